@@ -0,0 +1,249 @@
+// Throughput benchmarks for OASIS save/load and the AND engine on synthetic layouts.
+//
+// For every layout kind and size, a mask and an input layer are generated and
+// then timed phase by phase: save (OasisWriter), load (OasisReader through
+// load_layers_from_oasis), the single-threaded AND and the tiled AND. Each
+// phase runs --repeat times and the fastest run is reported, with polygons/s,
+// vertices/s, MB/s where files are involved, and the peak resident set of the
+// phase. Results are written as JSON so runs can be compared over time.
+
+#define DFM_CAPTURE_NO_MAIN
+#include "../dfm_pattern_capture.cpp"
+
+#include <cstdio>
+#include <fstream>
+#include <sys/stat.h>
+
+#include "dfm_layout_generator.h"
+
+namespace {
+
+// Peak resident set in kB since the last reset, from /proc/self/status (VmHWM)
+long peak_rss_kb() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) return std::atol(line.c_str() + 6);
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Reset the peak resident set to the current one (Linux 4.0 and later). Returns false if not supported.
+bool reset_peak_rss() {
+    std::FILE* file = std::fopen("/proc/self/clear_refs", "w");
+    if (!file) return false;
+    bool ok = std::fputs("5", file) >= 0;
+    if (std::fclose(file) != 0) ok = false;
+    return ok;
+}
+
+uint64_t file_size(const std::string& filename) {
+    struct stat info;
+    return stat(filename.c_str(), &info) == 0 ? (uint64_t)info.st_size : 0;
+}
+
+struct PhaseResult {
+    std::string layout;
+    std::size_t layout_polygons;  // Polygons per generated layer
+    std::string phase;
+    double seconds = 0.0;         // Fastest run
+    std::size_t polygons = 0;     // Polygons processed per run
+    std::size_t vertices = 0;
+    uint64_t bytes = 0;           // File bytes written or read per run (0 if none)
+    long peak_rss_kb = 0;         // Peak resident set during the phase
+    std::size_t result_polygons = 0;
+};
+
+// Run a phase `repeat` times with the engine's console output silenced and keep the fastest run
+template <typename Fn>
+double time_phase(unsigned repeat, long& peak_kb, Fn fn) {
+    double best = 0.0;
+    std::streambuf* console = std::cout.rdbuf(nullptr);
+    reset_peak_rss();
+    for (unsigned r = 0; r < std::max(1u, repeat); ++r) {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (r == 0 || seconds < best) best = seconds;
+    }
+    peak_kb = peak_rss_kb();
+    std::cout.rdbuf(console);
+    std::cout.clear();
+    return best;
+}
+
+void write_json(std::ostream& out, const std::vector<PhaseResult>& results, unsigned threads, unsigned repeat, bool rss_reset) {
+    auto rate = [](double count, double seconds) { return seconds > 0.0 ? count / seconds : 0.0; };
+    out << "{\n  \"benchmark\": \"dfm_bench\",\n  \"threads\": " << threads << ",\n  \"repeat\": " << repeat
+        << ",\n  \"per_phase_rss\": " << (rss_reset ? "true" : "false") << ",\n  \"results\": [\n";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const PhaseResult& r = results[i];
+        out << "    {\"layout\": \"" << r.layout << "\", \"layout_polygons\": " << r.layout_polygons << ", \"phase\": \"" << r.phase
+            << "\", \"seconds\": " << r.seconds << ", \"polygons\": " << r.polygons << ", \"vertices\": " << r.vertices
+            << ", \"bytes\": " << r.bytes << ", \"result_polygons\": " << r.result_polygons
+            << ", \"polygons_per_s\": " << rate((double)r.polygons, r.seconds) << ", \"vertices_per_s\": " << rate((double)r.vertices, r.seconds)
+            << ", \"mb_per_s\": " << rate(r.bytes / 1048576.0, r.seconds) << ", \"peak_rss_kb\": " << r.peak_rss_kb << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+std::vector<std::string> split_list(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+void print_bench_usage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]" << '\n';
+    std::cerr << "Options:" << '\n';
+    std::cerr << "  --layouts LIST   Layout kinds: grid,random,manhattan,allangle (default: all)" << '\n';
+    std::cerr << "  --sizes LIST     Polygons per layer, e.g. 1000,100000,10000000 (default: 1000,100000)" << '\n';
+    std::cerr << "  --threads N      Threads of the tiled AND (default: all cores)" << '\n';
+    std::cerr << "  --repeat R       Runs per phase; the fastest is reported (default: 3)" << '\n';
+    std::cerr << "  --dir DIR        Directory for the generated OASIS files (default: $TMPDIR or /tmp)" << '\n';
+    std::cerr << "  --json FILE      Write the results to FILE instead of stdout" << '\n';
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::vector<LayoutKind> kinds = {LayoutKind::Grid, LayoutKind::Random, LayoutKind::Manhattan, LayoutKind::AllAngle};
+    std::vector<std::size_t> sizes = {1000, 100000};
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    unsigned repeat = 3;
+    const char* tmpdir = std::getenv("TMPDIR");
+    std::string dir = tmpdir && *tmpdir ? tmpdir : "/tmp";
+    std::string json_file;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--layouts" && i + 1 < argc) {
+                kinds.clear();
+                for (const auto& name : split_list(argv[++i])) {
+                    LayoutKind kind;
+                    if (!parse_layout_kind(name, kind)) throw std::invalid_argument("unknown layout kind " + name);
+                    kinds.push_back(kind);
+                }
+            } else if (arg == "--sizes" && i + 1 < argc) {
+                sizes.clear();
+                for (const auto& size : split_list(argv[++i])) sizes.push_back((std::size_t)std::stoull(size));
+            } else if (arg == "--threads" && i + 1 < argc) {
+                threads = std::max(1u, (unsigned)std::stoul(argv[++i]));
+            } else if (arg == "--repeat" && i + 1 < argc) {
+                repeat = std::max(1u, (unsigned)std::stoul(argv[++i]));
+            } else if (arg == "--dir" && i + 1 < argc) {
+                dir = argv[++i];
+            } else if (arg == "--json" && i + 1 < argc) {
+                json_file = argv[++i];
+            } else {
+                print_bench_usage(argv[0]);
+                return 1;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: Invalid option value. " << e.what() << '\n';
+        return 1;
+    }
+
+    const bool rss_reset = reset_peak_rss();
+    if (!rss_reset) std::cerr << "Warning: Cannot reset the peak RSS; phase peaks are process peaks" << '\n';
+    const std::string mask_file = dir + "/dfm_bench_mask.oas";
+    const std::string input_file = dir + "/dfm_bench_input.oas";
+    const int mask_layer_num = 1, input_layer_num = 2;
+    LayoutUnits units;
+    TileOptions tile_options;
+    tile_options.threads = threads;
+    std::vector<PhaseResult> results;
+
+    try {
+        for (LayoutKind kind : kinds) {
+            for (std::size_t size : sizes) {
+                PhaseResult base;
+                base.layout = layout_kind_name(kind);
+                base.layout_polygons = size;
+                layer_type mask, input;
+
+                PhaseResult generate = base;
+                generate.phase = "generate";
+                generate.seconds = time_phase(1, generate.peak_rss_kb, [&] {
+                    mask = LayoutGenerator(1).generate(kind, size, 1000, 0.0);
+                    input = LayoutGenerator(2).generate(kind, size, 1000, 0.5);
+                });
+                generate.polygons = mask.size() + input.size();
+                generate.vertices = count_vertices(mask) + count_vertices(input);
+                results.push_back(generate);
+
+                PhaseResult save = base;
+                save.phase = "save";
+                save.seconds = time_phase(repeat, save.peak_rss_kb, [&] {
+                    save_layer_to_oasis(mask, mask_file, mask_layer_num, 0, units);
+                    save_layer_to_oasis(input, input_file, input_layer_num, 0, units);
+                });
+                save.polygons = generate.polygons;
+                save.vertices = generate.vertices;
+                save.bytes = file_size(mask_file) + file_size(input_file);
+                results.push_back(save);
+
+                PhaseResult load = base;
+                load.phase = "load";
+                std::size_t loaded = 0;
+                load.seconds = time_phase(repeat, load.peak_rss_kb, [&] {
+                    std::vector<layer_type> layers = load_layers_from_oasis({LayerRequest{mask_file, mask_layer_num, 0},
+                                                                             LayerRequest{input_file, input_layer_num, 0}});
+                    loaded = layers[0].size() + layers[1].size();
+                });
+                load.polygons = loaded;
+                load.vertices = generate.vertices;
+                load.bytes = save.bytes;
+                results.push_back(load);
+
+                PhaseResult and_single = base;
+                and_single.phase = "and";
+                and_single.seconds = time_phase(repeat, and_single.peak_rss_kb, [&] {
+                    and_single.result_polygons = layer_and(mask, input).size();
+                });
+                and_single.polygons = generate.polygons;
+                and_single.vertices = generate.vertices;
+                results.push_back(and_single);
+
+                PhaseResult and_tiled = base;
+                and_tiled.phase = "and_tiled";
+                and_tiled.seconds = time_phase(repeat, and_tiled.peak_rss_kb, [&] {
+                    and_tiled.result_polygons = layer_and_tiled(mask, input, tile_options).size();
+                });
+                and_tiled.polygons = generate.polygons;
+                and_tiled.vertices = generate.vertices;
+                results.push_back(and_tiled);
+
+                std::cerr << base.layout << " " << size << ": save " << save.seconds << " s, load " << load.seconds << " s, and "
+                          << and_single.seconds << " s, and_tiled " << and_tiled.seconds << " s (" << and_single.result_polygons
+                          << " result polygons)" << '\n';
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+    std::remove(mask_file.c_str());
+    std::remove(input_file.c_str());
+
+    if (json_file.empty()) {
+        write_json(std::cout, results, threads, repeat, rss_reset);
+    } else {
+        std::ofstream out(json_file);
+        write_json(out, results, threads, repeat, rss_reset);
+        if (!out) {
+            std::cerr << "Error: Cannot write " << json_file << '\n';
+            return 1;
+        }
+    }
+    return 0;
+}
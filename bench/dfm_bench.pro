@@ -0,0 +1,18 @@
+# Benchmarks for the OASIS reader/writer and the AND engine.
+# Build and run from the repository root:
+#   qmake -o bench/Makefile bench/dfm_bench.pro && make -C bench
+#   ./bench/dfm_bench --sizes 1000,100000,1000000 --json bench_output.json
+
+TEMPLATE = app
+TARGET = dfm_bench
+CONFIG += console c++14 release
+CONFIG -= qt app_bundle
+
+INCLUDEPATH += .. \
+               /usr/include # For zlib and Boost if system-installed
+
+HEADERS += dfm_layout_generator.h
+SOURCES += dfm_bench.cpp
+
+LIBS += -lz -pthread
+QMAKE_CXXFLAGS += -pthread
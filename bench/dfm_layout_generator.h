@@ -0,0 +1,149 @@
+#ifndef DFM_LAYOUT_GENERATOR_H
+#define DFM_LAYOUT_GENERATOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dfm_geometry.h"
+
+// Synthetic layouts for benchmarks.
+//
+// Every kind places about one polygon per pitch x pitch cell of a square
+// region, so density and overlap between two generated layers stay the same
+// from 1k to 10M polygons and run times scale with the polygon count alone.
+// The random kinds use their own splitmix64 generator, so a (kind, count,
+// seed) triple gives the same layout on every platform and standard library.
+enum class LayoutKind {
+    Grid,       // Equal rectangles on a regular grid (repetition-friendly)
+    Random,     // Rectangles of random size at random positions
+    Manhattan,  // Random rectilinear L, T and U shapes
+    AllAngle    // Random convex polygons with arbitrary edge angles
+};
+
+inline const char* layout_kind_name(LayoutKind kind) {
+    switch (kind) {
+    case LayoutKind::Grid: return "grid";
+    case LayoutKind::Random: return "random";
+    case LayoutKind::Manhattan: return "manhattan";
+    case LayoutKind::AllAngle: return "allangle";
+    }
+    return "unknown";
+}
+
+inline bool parse_layout_kind(const std::string& name, LayoutKind& kind) {
+    for (LayoutKind candidate : {LayoutKind::Grid, LayoutKind::Random, LayoutKind::Manhattan, LayoutKind::AllAngle}) {
+        if (name == layout_kind_name(candidate)) {
+            kind = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+class LayoutGenerator {
+public:
+    explicit LayoutGenerator(uint64_t seed) : m_state(seed) {}
+
+    // A layer of `polygons` polygons of one kind, in database units. phase (0..1)
+    // shifts the grid kind by a fraction of the pitch, so two layers generated
+    // with different phases overlap partially instead of coinciding.
+    layer_type generate(LayoutKind kind, std::size_t polygons, coord_type pitch = 1000, double phase = 0.0) {
+        layer_type layer;
+        layer.reserve(polygons);
+        const std::size_t columns = std::max<std::size_t>(1, (std::size_t)std::ceil(std::sqrt((double)polygons)));
+        const coord_type extent = (coord_type)columns * pitch;
+        for (std::size_t i = 0; i < polygons; ++i) {
+            switch (kind) {
+            case LayoutKind::Grid: {
+                const coord_type offset = (coord_type)std::llround(phase * pitch);
+                const coord_type x = (coord_type)(i % columns) * pitch + offset;
+                const coord_type y = (coord_type)(i / columns) * pitch + offset;
+                layer.push_back(rectangle(x, y, x + pitch * 7 / 10, y + pitch * 7 / 10));
+                break;
+            }
+            case LayoutKind::Random: {
+                const coord_type x = uniform(0, extent), y = uniform(0, extent);
+                layer.push_back(rectangle(x, y, x + uniform(pitch / 10, pitch * 3 / 2), y + uniform(pitch / 10, pitch * 3 / 2)));
+                break;
+            }
+            case LayoutKind::Manhattan:
+                layer.push_back(manhattan(uniform(0, extent), uniform(0, extent), pitch));
+                break;
+            case LayoutKind::AllAngle:
+                layer.push_back(convex(uniform(0, extent), uniform(0, extent), pitch));
+                break;
+            }
+        }
+        return layer;
+    }
+
+private:
+    uint64_t m_state;
+
+    uint64_t next() {
+        uint64_t z = (m_state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform in [low, high)
+    coord_type uniform(coord_type low, coord_type high) {
+        return high <= low ? low : low + (coord_type)(next() % (uint64_t)(high - low));
+    }
+
+    static polygon_type ring(const std::vector<point_type>& points) {
+        polygon_type poly;
+        poly.outer().assign(points.begin(), points.end());
+        poly.outer().push_back(points.front());
+        bg::correct(poly);
+        return poly;
+    }
+
+    static polygon_type rectangle(coord_type x0, coord_type y0, coord_type x1, coord_type y1) {
+        return ring({point_type(x0, y0), point_type(x0, y1), point_type(x1, y1), point_type(x1, y0)});
+    }
+
+    // L, T or U shape inside a box of up to 1.2 x 1.2 pitches, with arms of at least a tenth of a pitch
+    polygon_type manhattan(coord_type x, coord_type y, coord_type pitch) {
+        const coord_type w = uniform(pitch / 2, pitch * 6 / 5), h = uniform(pitch / 2, pitch * 6 / 5);
+        const coord_type t = uniform(pitch / 10, pitch / 4); // Arm width
+        switch (next() % 3) {
+        case 0: // L
+            return ring({point_type(x, y), point_type(x + w, y), point_type(x + w, y + t), point_type(x + t, y + t),
+                         point_type(x + t, y + h), point_type(x, y + h)});
+        case 1: { // T
+            const coord_type stem = x + (w - t) / 2;
+            return ring({point_type(stem, y), point_type(stem + t, y), point_type(stem + t, y + h - t), point_type(x + w, y + h - t),
+                         point_type(x + w, y + h), point_type(x, y + h), point_type(x, y + h - t), point_type(stem, y + h - t)});
+        }
+        default: // U
+            return ring({point_type(x, y), point_type(x + w, y), point_type(x + w, y + h), point_type(x + w - t, y + h),
+                         point_type(x + w - t, y + t), point_type(x + t, y + t), point_type(x + t, y + h), point_type(x, y + h)});
+        }
+    }
+
+    // Convex polygon with 3 to 8 vertices at random angles around a center
+    polygon_type convex(coord_type x, coord_type y, coord_type pitch) {
+        const std::size_t count = 3 + (std::size_t)(next() % 6);
+        const double radius = (double)uniform(pitch / 4, pitch * 3 / 4);
+        std::vector<double> angles(count);
+        for (double& angle : angles) angle = (double)(next() % 3600000) * (2.0 * M_PI / 3600000.0);
+        std::sort(angles.begin(), angles.end());
+        std::vector<point_type> points;
+        for (double angle : angles) {
+            const point_type pt(x + (coord_type)std::llround(radius * std::cos(angle)), y + (coord_type)std::llround(radius * std::sin(angle)));
+            if (points.empty() || !bg::equals(points.back(), pt)) points.push_back(pt);
+        }
+        if (points.size() < 3 || bg::equals(points.front(), points.back())) {
+            return rectangle(x, y, x + pitch / 2, y + pitch / 3); // Degenerate draw
+        }
+        return ring(points);
+    }
+};
+
+#endif // DFM_LAYOUT_GENERATOR_H
@@ -0,0 +1,153 @@
+// Command-line client of the layout server (dfm_pattern_capture --serve).
+//
+// Sends one AND, clip or match request to a running server, prints the
+// result size and the round-trip time, and optionally writes the returned
+// polygons to an OASIS file.
+
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "dfm_layout_protocol.h"
+#include "dfm_oasis_writer.h"
+
+namespace {
+
+void print_client_usage(const char* program) {
+    std::cerr << "Usage: " << program << " <socket_path> and <mask_layer[/datatype]> <input_layer[/datatype]> [--window X0 Y0 X1 Y1] [--output FILE LAYER]" << '\n';
+    std::cerr << "       " << program << " <socket_path> clip <layer[/datatype]> X0 Y0 X1 Y1 [--output FILE LAYER]" << '\n';
+    std::cerr << "       " << program << " <socket_path> match <layer[/datatype]> X0 Y0 X1 Y1" << '\n';
+    std::cerr << "       " << program << " <socket_path> shutdown" << '\n';
+    std::cerr << "Coordinates are in database units of the served layout." << '\n';
+}
+
+// "layer" or "layer/datatype"
+bool parse_layer(const std::string& spec, uint32_t& layer, uint32_t& datatype) {
+    std::size_t slash = spec.find('/');
+    try {
+        std::size_t used = 0;
+        layer = (uint32_t)std::stoul(spec.substr(0, slash), &used);
+        if (used != (slash == std::string::npos ? spec.size() : slash)) return false;
+        datatype = 0;
+        if (slash != std::string::npos) {
+            datatype = (uint32_t)std::stoul(spec.substr(slash + 1), &used);
+            if (used != spec.size() - slash - 1) return false;
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+box_type parse_window(char* argv[], int first) {
+    return box_type(point_type(to_coord(std::stod(argv[first])), to_coord(std::stod(argv[first + 1]))),
+                    point_type(to_coord(std::stod(argv[first + 2])), to_coord(std::stod(argv[first + 3]))));
+}
+
+void save_polygons(const layer_type& polygons, const std::string& filename, uint32_t layer, double db_unit) {
+    OasisWriter writer(filename, db_unit);
+    writer.beginCell("RESULT_CELL");
+    std::vector<OasisPoint> ring;
+    std::size_t skipped = 0, dropped_holes = 0;
+    for (const auto& poly : polygons) {
+        const polygon_type::ring_type& outer = poly.outer();
+        ring.clear();
+        for (std::size_t k = 0; k + 1 < outer.size(); ++k) ring.push_back(OasisPoint{outer[k].x(), outer[k].y()});
+        if (ring.size() < 3) {
+            ++skipped;
+            continue;
+        }
+        dropped_holes += poly.inners().size();
+        writer.addPolygon(layer, 0, ring.data(), ring.size());
+    }
+    writer.close();
+    std::cout << "Wrote " << polygons.size() - skipped << " polygons to layer " << layer << " in " << filename << '\n';
+    if (skipped > 0) {
+        std::cerr << "Warning: Skipped " << skipped << " polygons with < 3 unique points for OASIS output." << '\n';
+    }
+    if (dropped_holes > 0) {
+        std::cerr << "Warning: OASIS polygons cannot hold holes; " << dropped_holes << " holes were not written." << '\n';
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        print_client_usage(argv[0]);
+        return 1;
+    }
+    const std::string socket_path = argv[1];
+    const std::string command = argv[2];
+
+    try {
+        const auto start = std::chrono::steady_clock::now();
+        auto elapsed_ms = [&start] {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        };
+        LayoutClient client(socket_path);
+
+        if (command == "shutdown" && argc == 3) {
+            client.shutdown();
+            std::cout << "Server is shutting down" << '\n';
+            return 0;
+        }
+
+        uint32_t layer, datatype;
+        if (argc < 4 || !parse_layer(argv[3], layer, datatype)) {
+            print_client_usage(argv[0]);
+            return 1;
+        }
+
+        if (command == "match" && argc == 8) {
+            const std::vector<std::pair<int64_t, int64_t>> offsets = client.match(layer, datatype, parse_window(argv, 4));
+            std::cout << offsets.size() << " occurrences in " << elapsed_ms() << " ms" << '\n';
+            for (const auto& offset : offsets) std::cout << "  dx " << offset.first << ", dy " << offset.second << '\n';
+            return 0;
+        }
+
+        layer_type polygons;
+        double db_unit = 0.0;
+        int next = 0;
+        if (command == "clip" && argc >= 8) {
+            polygons = client.clip(layer, datatype, parse_window(argv, 4), db_unit);
+            next = 8;
+        } else if (command == "and" && argc >= 5) {
+            uint32_t input_layer, input_datatype;
+            if (!parse_layer(argv[4], input_layer, input_datatype)) {
+                print_client_usage(argv[0]);
+                return 1;
+            }
+            next = 5;
+            box_type window;
+            bool windowed = false;
+            if (next + 4 < argc && std::string(argv[next]) == "--window") {
+                window = parse_window(argv, next + 1);
+                windowed = true;
+                next += 5;
+            }
+            polygons = client.layerAnd(layer, datatype, input_layer, input_datatype, windowed ? &window : nullptr, db_unit);
+        } else {
+            print_client_usage(argv[0]);
+            return 1;
+        }
+        std::cout << polygons.size() << " polygons in " << elapsed_ms() << " ms" << '\n';
+
+        if (next < argc) {
+            if (std::string(argv[next]) != "--output" || next + 3 != argc) {
+                print_client_usage(argv[0]);
+                return 1;
+            }
+            save_polygons(polygons, argv[next + 1], (uint32_t)std::stoul(argv[next + 2]), db_unit);
+        }
+    } catch (const std::invalid_argument&) {
+        std::cerr << "Error: Invalid number argument." << '\n';
+        return 1;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
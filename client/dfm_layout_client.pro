@@ -0,0 +1,17 @@
+# Command-line client of the layout server (dfm_pattern_capture --serve).
+# Build from the repository root:
+#   qmake -o client/Makefile client/dfm_layout_client.pro && make -C client
+#   ./client/dfm_layout_client /tmp/layout.sock and 1 2 --output result.oas 100
+
+TEMPLATE = app
+TARGET = dfm_layout_client
+CONFIG += console c++14 release
+CONFIG -= qt app_bundle
+
+INCLUDEPATH += .. \
+               /usr/include # For zlib and Boost if system-installed
+
+SOURCES += dfm_layout_client.cpp
+
+LIBS += -lz -pthread
+QMAKE_CXXFLAGS += -pthread
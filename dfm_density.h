@@ -0,0 +1,297 @@
+#ifndef DFM_DENSITY_H
+#define DFM_DENSITY_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "dfm_geometry.h"
+#include "dfm_manhattan.h"
+#include "dfm_thread_pool.h"
+#include "dfm_trace.h"
+
+// Exact polygon coverage on a grid of square cells, for window density checks.
+//
+// rasterize() computes, for every cell, the area of the layer inside it. The
+// area of a region between the horizontal lines y = b and y = b + h equals
+// the ring integral of clamp(y - b, 0, h) dx (positive for the clockwise
+// outer rings Boost uses, negative for holes), and the integral splits over
+// x, so every polygon edge adds the exact area under it to each cell of its
+// column that it crosses. Cells wholly below an edge get the full cell
+// height times its width; those contributions go into one marker per column
+// and row and are summed downwards once at the end, so an edge costs time
+// in proportion to the cells it crosses, not to the cells below it. The grid
+// is split into stripes of columns that are rasterized in parallel; each
+// stripe owns its cells, so no locking is needed.
+//
+// A summed-area table built after rasterizing answers the covered area of
+// any block of cells in O(1). Overlapping polygons are counted twice, so the
+// layer should be merged first.
+class CoverageGrid {
+public:
+    // columns x rows cells of cell_size database units; origin is the lower-left corner of cell (0, 0)
+    CoverageGrid(const point_type& origin, coord_type cell_size, std::size_t columns, std::size_t rows)
+        : m_origin(origin), m_cell(cell_size), m_columns(columns), m_rows(rows) {
+        if (cell_size <= 0 || columns == 0 || rows == 0) throw std::runtime_error("empty coverage grid");
+        if ((double)columns * (double)rows > 2e9) throw std::runtime_error("coverage grid too large, use larger cells");
+    }
+
+    std::size_t columns() const { return m_columns; }
+    std::size_t rows() const { return m_rows; }
+    coord_type cellSize() const { return m_cell; }
+    const point_type& origin() const { return m_origin; }
+
+    // Area of every cell covered by the layer, then the summed-area table
+    void rasterize(const layer_type& layer, ThreadPool& pool) {
+        m_coverage.assign(m_columns * m_rows, 0.0);
+
+        // Several stripes per worker so that dense stripes do not leave the others idle
+        const std::size_t stripe_columns = (m_columns + pool.size() * 8 - 1) / (pool.size() * 8);
+        const std::size_t stripes = (m_columns + stripe_columns - 1) / stripe_columns;
+        std::vector<std::vector<std::size_t>> stripe_polygons(stripes);
+        for (std::size_t i = 0; i < layer.size(); ++i) {
+            const box_type envelope = bg::return_envelope<box_type>(layer[i]);
+            const double x0 = (double)envelope.min_corner().x() - m_origin.x(), x1 = (double)envelope.max_corner().x() - m_origin.x();
+            if (x1 <= 0.0 || x0 >= (double)m_columns * m_cell) continue;
+            const std::size_t first = column(x0), last = column(x1);
+            for (std::size_t s = first / stripe_columns; s <= last / stripe_columns; ++s) stripe_polygons[s].push_back(i);
+        }
+
+        parallel_for(pool, stripes, [&](std::size_t s) {
+            TraceScope trace("density_stripe");
+            const std::size_t c0 = s * stripe_columns, c1 = std::min(m_columns, c0 + stripe_columns);
+            Stripe stripe{c0, c1, std::vector<double>((c1 - c0) * (m_rows + 1), 0.0)};
+            for (std::size_t i : stripe_polygons[s]) {
+                const polygon_type& poly = layer[i];
+                // Boost outer rings are clockwise; a counter-clockwise polygon has all its signs flipped
+                const double sign = ring_area2(poly.outer()) > 0 ? -1.0 : 1.0;
+                addRing(poly.outer(), sign, stripe);
+                for (const auto& inner : poly.inners()) addRing(inner, sign, stripe);
+            }
+            for (std::size_t c = c0; c < c1; ++c) {
+                const double* below = &stripe.below[(c - c0) * (m_rows + 1)];
+                double sum = 0.0;
+                for (std::size_t r = m_rows; r-- > 0;) {
+                    sum += below[r + 1];
+                    m_coverage[r * m_columns + c] += sum;
+                }
+            }
+        });
+
+        // table(r, c) = covered area of the cells below row r and left of column c
+        m_table.assign((m_columns + 1) * (m_rows + 1), 0.0);
+        for (std::size_t r = 0; r < m_rows; ++r) {
+            double row_sum = 0.0;
+            const double* cells = &m_coverage[r * m_columns];
+            const double* previous = &m_table[r * (m_columns + 1)];
+            double* current = &m_table[(r + 1) * (m_columns + 1)];
+            for (std::size_t c = 0; c < m_columns; ++c) {
+                row_sum += cells[c];
+                current[c + 1] = previous[c + 1] + row_sum;
+            }
+        }
+    }
+
+    // Covered area of one cell in square database units
+    double coverage(std::size_t column, std::size_t row) const { return m_coverage[row * m_columns + column]; }
+
+    // Covered area of the cells [c0, c1) x [r0, r1) in square database units, in O(1)
+    double coveredArea(std::size_t c0, std::size_t r0, std::size_t c1, std::size_t r1) const {
+        const std::size_t stride = m_columns + 1;
+        return m_table[r1 * stride + c1] - m_table[r0 * stride + c1] - m_table[r1 * stride + c0] + m_table[r0 * stride + c0];
+    }
+
+private:
+    // Cells and markers of the columns [first, end) being rasterized by one task
+    struct Stripe {
+        std::size_t first;
+        std::size_t end;
+        std::vector<double> below; // (column - first) * (rows + 1) + k: area added to each row below k
+    };
+
+    point_type m_origin;             // Lower-left corner of cell (0, 0)
+    coord_type m_cell;               // Cell edge length in database units
+    std::size_t m_columns;
+    std::size_t m_rows;
+    std::vector<double> m_coverage;  // Covered area per cell, row-major
+    std::vector<double> m_table;     // Summed-area table, (rows + 1) x (columns + 1), row-major
+
+    // Column of an x offset from the origin, clamped to the grid
+    std::size_t column(double x) const {
+        const double c = std::floor(x / m_cell);
+        return c <= 0.0 ? 0 : std::min(m_columns - 1, (std::size_t)c);
+    }
+
+    void addRing(const polygon_type::ring_type& ring, double sign, Stripe& stripe) {
+        const double ox = m_origin.x(), oy = m_origin.y();
+        for (std::size_t k = 0; k + 1 < ring.size(); ++k) {
+            addEdge(ring[k].x() - ox, ring[k].y() - oy, ring[k + 1].x() - ox, ring[k + 1].y() - oy, sign, stripe);
+        }
+        if (ring.size() > 2 && !bg::equals(ring.front(), ring.back())) { // Open ring
+            addEdge(ring.back().x() - ox, ring.back().y() - oy, ring.front().x() - ox, ring.front().y() - oy, sign, stripe);
+        }
+    }
+
+    // Edge (x0, y0) -> (x1, y1) relative to the origin; only its part inside the stripe counts
+    void addEdge(double x0, double y0, double x1, double y1, double sign, Stripe& stripe) {
+        if (x0 == x1) return; // Nothing lies under a vertical edge
+        const double direction = x1 > x0 ? sign : -sign;
+        const double slope = (y1 - y0) / (x1 - x0);
+        const double left = std::max(std::min(x0, x1), (double)stripe.first * m_cell);
+        const double right = std::min(std::max(x0, x1), (double)stripe.end * m_cell);
+        if (left >= right) return;
+        for (std::size_t c = std::max(stripe.first, column(left)); c < stripe.end && (double)c * m_cell < right; ++c) {
+            const double a = std::max(left, (double)c * m_cell), b = std::min(right, (double)(c + 1) * m_cell);
+            addPiece(c, stripe, direction * (b - a), y0 + (a - x0) * slope, y0 + (b - x0) * slope);
+        }
+    }
+
+    // Part of an edge inside one column: signed width, heights at its left and right end
+    void addPiece(std::size_t c, Stripe& stripe, double width, double ya, double yb) {
+        const double h = m_cell;
+        const double low = std::min(ya, yb), high = std::max(ya, yb);
+        const double first_row = std::floor(low / h), last_row = std::floor(high / h);
+        if (last_row < 0.0) return; // Below the grid
+        // Every row below the piece is covered over the full width
+        const std::size_t first = first_row <= 0.0 ? 0 : (std::size_t)std::min(first_row, (double)m_rows);
+        stripe.below[(c - stripe.first) * (m_rows + 1) + first] += width * h;
+        const std::size_t last = (std::size_t)std::min(last_row, (double)m_rows - 1);
+        for (std::size_t r = first; r <= last && r < m_rows; ++r) {
+            const double bottom = (double)r * h;
+            double mean; // Mean of clamp(y - bottom, 0, h) along the piece
+            if (ya == yb) {
+                mean = std::min(std::max(ya - bottom, 0.0), h);
+            } else {
+                mean = (rowIntegral(yb - bottom) - rowIntegral(ya - bottom)) / (yb - ya);
+            }
+            m_coverage[r * m_columns + c] += width * mean;
+        }
+    }
+
+    // Antiderivative of clamp(t, 0, h) over t
+    double rowIntegral(double t) const {
+        const double h = m_cell;
+        if (t <= 0.0) return 0.0;
+        if (t < h) return 0.5 * t * t;
+        return 0.5 * h * h + h * (t - h);
+    }
+};
+
+// Density of square windows stepped over a layout extent.
+//
+// Windows are window_cells cells wide and start every step_cells cells from
+// the lower-left corner of the grid. Where the extent is not a whole number
+// of steps, the last column and row of windows is shifted back to end at the
+// far edge of the extent, so no window reaches outside it (unless the extent
+// is smaller than one window). Every window is one O(1) lookup in the
+// summed-area table of the grid.
+class DensityMap {
+public:
+    // extent_columns x extent_rows: cells of the grid covered by the layout
+    DensityMap(const CoverageGrid& grid, std::size_t window_cells, std::size_t step_cells, std::size_t extent_columns, std::size_t extent_rows)
+        : m_grid(grid), m_window(window_cells), m_column_starts(windowStarts(extent_columns, window_cells, step_cells)),
+          m_row_starts(windowStarts(extent_rows, window_cells, step_cells)) {
+        if (window_cells == 0 || step_cells == 0) throw std::runtime_error("density window and step must be at least one cell");
+        for (std::size_t start : m_column_starts) {
+            if (start + window_cells > grid.columns()) throw std::runtime_error("density windows reach outside the coverage grid");
+        }
+        for (std::size_t start : m_row_starts) {
+            if (start + window_cells > grid.rows()) throw std::runtime_error("density windows reach outside the coverage grid");
+        }
+        const double window_area = (double)window_cells * window_cells * grid.cellSize() * grid.cellSize();
+        m_density.resize(m_column_starts.size() * m_row_starts.size());
+        for (std::size_t j = 0; j < m_row_starts.size(); ++j) {
+            for (std::size_t i = 0; i < m_column_starts.size(); ++i) {
+                const std::size_t c = m_column_starts[i], r = m_row_starts[j];
+                m_density[j * m_column_starts.size() + i] = grid.coveredArea(c, r, c + window_cells, r + window_cells) / window_area;
+            }
+        }
+    }
+
+    // Start cells of the windows along one axis of extent_cells cells
+    static std::vector<std::size_t> windowStarts(std::size_t extent_cells, std::size_t window_cells, std::size_t step_cells) {
+        std::vector<std::size_t> starts{0};
+        if (step_cells == 0) return starts;
+        while (starts.back() + window_cells < extent_cells) {
+            starts.push_back(std::min(starts.back() + step_cells, extent_cells - window_cells));
+        }
+        return starts;
+    }
+
+    std::size_t columns() const { return m_column_starts.size(); }
+    std::size_t rows() const { return m_row_starts.size(); }
+
+    // Covered fraction (0..1) of window (i, j), i along x and j along y
+    double density(std::size_t i, std::size_t j) const { return m_density[j * columns() + i]; }
+
+    // Window (i, j) in database units
+    box_type window(std::size_t i, std::size_t j) const {
+        const coord_type cell = m_grid.cellSize();
+        const coord_type x0 = m_grid.origin().x() + (coord_type)m_column_starts[i] * cell;
+        const coord_type y0 = m_grid.origin().y() + (coord_type)m_row_starts[j] * cell;
+        const coord_type size = (coord_type)m_window * cell;
+        return box_type(point_type(x0, y0), point_type(x0 + size, y0 + size));
+    }
+
+    // Index (j * columns() + i) of the least and of the most dense window; the first one wins ties
+    std::size_t minimum() const { return (std::size_t)(std::min_element(m_density.begin(), m_density.end()) - m_density.begin()); }
+    std::size_t maximum() const { return (std::size_t)(std::max_element(m_density.begin(), m_density.end()) - m_density.begin()); }
+
+    // One line per window: x0,y0,x1,y1 in microns and the density. Returns false if the file cannot be written.
+    bool writeCsv(const std::string& filename, double db_unit) const {
+        std::ofstream out(filename);
+        const double scale = db_unit / 1e-6;
+        char line[160];
+        out << "x0_um,y0_um,x1_um,y1_um,density\n";
+        for (std::size_t j = 0; j < rows(); ++j) {
+            for (std::size_t i = 0; i < columns(); ++i) {
+                const box_type box = window(i, j);
+                std::snprintf(line, sizeof(line), "%.6g,%.6g,%.6g,%.6g,%.6f\n", box.min_corner().x() * scale, box.min_corner().y() * scale,
+                              box.max_corner().x() * scale, box.max_corner().y() * scale, density(i, j));
+                out << line;
+            }
+        }
+        return (bool)out;
+    }
+
+    // Little-endian binary map: "DFMDENS1", u32 columns, u32 rows, f64 window size in microns,
+    // f64 x0 of every window column and y0 of every window row in microns, then f64 densities row by row.
+    // Returns false if the file cannot be written.
+    bool writeBinary(const std::string& filename, double db_unit) const {
+        std::ofstream out(filename, std::ios::binary);
+        const double scale = db_unit / 1e-6;
+        std::string bytes("DFMDENS1");
+        auto u32 = [&bytes](uint32_t value) {
+            for (int k = 0; k < 4; ++k) bytes.push_back((char)(value >> (8 * k)));
+        };
+        auto f64 = [&bytes](double value) {
+            uint64_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            for (int k = 0; k < 8; ++k) bytes.push_back((char)(bits >> (8 * k)));
+        };
+        u32((uint32_t)columns());
+        u32((uint32_t)rows());
+        f64((double)m_window * m_grid.cellSize() * scale);
+        for (std::size_t i = 0; i < columns(); ++i) f64(window(i, 0).min_corner().x() * scale);
+        for (std::size_t j = 0; j < rows(); ++j) f64(window(0, j).min_corner().y() * scale);
+        for (double value : m_density) f64(value);
+        out.write(bytes.data(), (std::streamsize)bytes.size());
+        return (bool)out;
+    }
+
+private:
+    const CoverageGrid& m_grid;
+    std::size_t m_window;                     // Window edge in cells
+    std::vector<std::size_t> m_column_starts; // First cell column of every window column
+    std::vector<std::size_t> m_row_starts;    // First cell row of every window row
+    std::vector<double> m_density;            // Row-major, columns() per row
+};
+
+#endif // DFM_DENSITY_H
@@ -0,0 +1,128 @@
+#ifndef DFM_GDSTK_ADAPTER_H
+#define DFM_GDSTK_ADAPTER_H
+
+#include <cstddef>
+#include <vector>
+
+#include <boost/geometry.hpp>
+#include <boost/geometry/geometries/register/point.hpp>
+#include <boost/range/iterator.hpp>
+
+#include <gdstk/gdstk.hpp>
+
+// Boost.Geometry traits for gdstk types, so Boost algorithms (envelope, area,
+// centroid, convert, ...) run directly on gdstk::Polygon::point_array without
+// copying vertices into a Boost polygon first.
+//
+//   gdstk::Vec2          point (double coordinates)
+//   gdstk::Array<Vec2>   ring, open (the first point is not repeated), clockwise
+//   gdstk::Polygon       polygon made of its point_array, without holes
+//
+// gdstk does not enforce an orientation; algorithms that depend on it (area
+// sign, set operations) need rings in the registered clockwise order.
+// Interior rings are read-only and always empty, so converting a Boost polygon
+// with holes into a gdstk::Polygon does not compile; convert its outer ring.
+//
+// Only the layout viewer holds gdstk polygons. The capture tool reads and
+// writes OASIS through OasisReader and OasisWriter and does not use this header.
+
+BOOST_GEOMETRY_REGISTER_POINT_2D(gdstk::Vec2, double, boost::geometry::cs::cartesian, x, y)
+
+// Boost.Range access to the contiguous items of a gdstk::Array<Vec2>
+namespace boost {
+template <>
+struct range_mutable_iterator<gdstk::Array<gdstk::Vec2>> {
+    typedef gdstk::Vec2* type;
+};
+template <>
+struct range_const_iterator<gdstk::Array<gdstk::Vec2>> {
+    typedef const gdstk::Vec2* type;
+};
+} // namespace boost
+
+namespace gdstk {
+inline Vec2* range_begin(Array<Vec2>& array) { return array.items; }
+inline Vec2* range_end(Array<Vec2>& array) { return array.items + array.count; }
+inline const Vec2* range_begin(const Array<Vec2>& array) { return array.items; }
+inline const Vec2* range_end(const Array<Vec2>& array) { return array.items + array.count; }
+} // namespace gdstk
+
+namespace boost { namespace geometry { namespace traits {
+
+template <>
+struct tag<gdstk::Array<gdstk::Vec2>> {
+    typedef ring_tag type;
+};
+
+template <>
+struct point_order<gdstk::Array<gdstk::Vec2>> {
+    static const order_selector value = clockwise;
+};
+
+template <>
+struct closure<gdstk::Array<gdstk::Vec2>> {
+    static const closure_selector value = open;
+};
+
+// Mutation through gdstk's own growth policy
+template <>
+struct clear<gdstk::Array<gdstk::Vec2>> {
+    static void apply(gdstk::Array<gdstk::Vec2>& array) { array.count = 0; }
+};
+
+template <>
+struct push_back<gdstk::Array<gdstk::Vec2>> {
+    static void apply(gdstk::Array<gdstk::Vec2>& array, const gdstk::Vec2& point) { array.append(point); }
+};
+
+template <>
+struct resize<gdstk::Array<gdstk::Vec2>> {
+    static void apply(gdstk::Array<gdstk::Vec2>& array, std::size_t new_size) {
+        if (new_size > array.count) array.ensure_slots(new_size - array.count);
+        array.count = new_size;
+    }
+};
+
+template <>
+struct tag<gdstk::Polygon> {
+    typedef polygon_tag type;
+};
+
+template <>
+struct ring_const_type<gdstk::Polygon> {
+    typedef const gdstk::Array<gdstk::Vec2>& type;
+};
+
+template <>
+struct ring_mutable_type<gdstk::Polygon> {
+    typedef gdstk::Array<gdstk::Vec2>& type;
+};
+
+// gdstk polygons have no holes: both interior types are the same empty, read-only range
+template <>
+struct interior_const_type<gdstk::Polygon> {
+    typedef const std::vector<gdstk::Array<gdstk::Vec2>>& type;
+};
+
+template <>
+struct interior_mutable_type<gdstk::Polygon> {
+    typedef const std::vector<gdstk::Array<gdstk::Vec2>>& type;
+};
+
+template <>
+struct exterior_ring<gdstk::Polygon> {
+    static gdstk::Array<gdstk::Vec2>& get(gdstk::Polygon& polygon) { return polygon.point_array; }
+    static const gdstk::Array<gdstk::Vec2>& get(const gdstk::Polygon& polygon) { return polygon.point_array; }
+};
+
+template <>
+struct interior_rings<gdstk::Polygon> {
+    static const std::vector<gdstk::Array<gdstk::Vec2>>& get(const gdstk::Polygon&) {
+        static const std::vector<gdstk::Array<gdstk::Vec2>> no_holes;
+        return no_holes;
+    }
+};
+
+}}} // namespace boost::geometry::traits
+
+#endif // DFM_GDSTK_ADAPTER_H
@@ -0,0 +1,63 @@
+#ifndef DFM_GEOMETRY_H
+#define DFM_GEOMETRY_H
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/geometry.hpp>
+#include <boost/geometry/geometries/point_xy.hpp>
+#include <boost/geometry/geometries/polygon.hpp>
+#include <boost/geometry/geometries/box.hpp>
+
+namespace bg = boost::geometry;
+
+// Geometry is kept in integer database units (DBU), exactly as OASIS stores it.
+// 32-bit coordinates cover +/-2.1 m at a 1 nm grid, halve the memory per
+// vertex compared to doubles, and let Boost.Geometry use exact integer side
+// predicates instead of its floating point rescaling/robustness fallbacks.
+typedef int32_t coord_type;
+typedef int64_t wide_coord_type; // For products and sums of coordinates (areas, cross products)
+
+typedef bg::model::d2::point_xy<coord_type> point_type;
+typedef bg::model::polygon<point_type> polygon_type;
+typedef bg::model::box<point_type> box_type;
+typedef std::vector<polygon_type> layer_type; // A layer is a vector of polygons
+
+// Units of a layout: the user unit and the database unit (grid step), both in meters
+struct LayoutUnits {
+    double user_unit = 1e-6; // 1 micron
+    double db_unit = 1e-9;   // 1 nanometer
+};
+
+// Round a value that is already expressed in database units to a coordinate.
+// Throws std::out_of_range if it does not fit coord_type.
+inline coord_type to_coord(double dbu_value) {
+    if (!(dbu_value >= (double)std::numeric_limits<coord_type>::min() - 0.5 &&
+          dbu_value < (double)std::numeric_limits<coord_type>::max() + 0.5)) {
+        throw std::out_of_range("Coordinate " + std::to_string(dbu_value) + " does not fit into 32-bit database units");
+    }
+    return (coord_type)std::llround(dbu_value);
+}
+
+// Bring a layer from one database unit to another (e.g. mask and input written with different grids).
+// Coordinates are snapped to the target grid.
+inline void rescale_layer(layer_type& layer, double from_db_unit, double to_db_unit) {
+    if (from_db_unit == to_db_unit) return;
+    const double factor = from_db_unit / to_db_unit;
+    auto rescale_ring = [factor](polygon_type::ring_type& ring) {
+        for (auto& pt : ring) {
+            pt.x(to_coord(pt.x() * factor));
+            pt.y(to_coord(pt.y() * factor));
+        }
+    };
+    for (auto& poly : layer) {
+        rescale_ring(poly.outer());
+        for (auto& inner : poly.inners()) rescale_ring(inner);
+    }
+}
+
+#endif // DFM_GEOMETRY_H
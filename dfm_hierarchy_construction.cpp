@@ -6,6 +6,8 @@
 #include <algorithm>
 #include <functional>
 
+#include "dfm_trace.h"
+
 // --- Polygon and Layout Definitions ---
 
 struct Point {
@@ -250,7 +252,10 @@ int main() {
     // Step 3: Run VF2 subgraph isomorphism to find all matches of pattern in flat graph
     VF2State vf2(pattern, flat);
     std::vector<std::unordered_map<int,int>> matches;
-    vf2.match(matches);
+    {
+        TraceScope trace("vf2_match");
+        vf2.match(matches);
+    }
 
     std::cout << "Found " << matches.size() << " instances of the pattern.\n";
 
@@ -258,6 +263,7 @@ int main() {
     Cell cell;
     cell.name = "L_CELL";
     {
+        TraceScope trace("extract_cell");
         std::unordered_set<int> node_ids;
         for (const auto& kv : matches[0]) node_ids.insert(kv.first);
         cell.graph = extractSubgraph(pattern, node_ids);
@@ -271,6 +277,7 @@ int main() {
 
     // Step 5: Remove matched nodes from flat graph to avoid duplication
     for (const auto& mapping : matches) {
+        TraceScope trace("remove_nodes");
         std::unordered_set<int> ids_to_remove;
         for (const auto& kv : mapping) ids_to_remove.insert(kv.second);
         removeNodes(flat, ids_to_remove);
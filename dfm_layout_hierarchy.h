@@ -0,0 +1,295 @@
+#ifndef DFM_LAYOUT_HIERARCHY_H
+#define DFM_LAYOUT_HIERARCHY_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "dfm_geometry.h"
+#include "dfm_oasis_reader.h"
+
+// Placement transform of a cell instance: mirror about the x axis (optional),
+// then magnify, rotate counterclockwise and translate. Transforms made of
+// quarter turns without magnification map the integer grid onto itself and are
+// applied exactly; anything else is evaluated in floating point and snapped.
+struct CellTransform {
+    int64_t dx = 0, dy = 0;
+    double angle = 0.0;          // Degrees, counterclockwise
+    double magnification = 1.0;
+    bool mirror = false;
+
+    // Number of quarter turns (0-3), or -1 if the angle is not a multiple of 90 degrees
+    int quarterTurns() const {
+        double turns = angle / 90.0;
+        double rounded = std::round(turns);
+        if (std::abs(turns - rounded) > 1e-9) return -1;
+        return (int)((((int64_t)rounded % 4) + 4) % 4);
+    }
+
+    // True if the transform maps integer coordinates to integer coordinates exactly
+    bool isManhattan() const { return magnification == 1.0 && quarterTurns() >= 0; }
+
+    point_type apply(const point_type& p) const {
+        const int64_t x = p.x();
+        const int64_t y = mirror ? -(int64_t)p.y() : (int64_t)p.y();
+        const int turns = quarterTurns();
+        if (magnification == 1.0 && turns >= 0) {
+            int64_t rx = x, ry = y;
+            switch (turns) {
+            case 1: rx = -y; ry = x; break;
+            case 2: rx = -x; ry = -y; break;
+            case 3: rx = y; ry = -x; break;
+            default: break;
+            }
+            return point_type(to_coord((double)(rx + dx)), to_coord((double)(ry + dy)));
+        }
+        const double radians = angle * M_PI / 180.0;
+        const double c = std::cos(radians) * magnification;
+        const double s = std::sin(radians) * magnification;
+        return point_type(to_coord(c * x - s * y + dx), to_coord(s * x + c * y + dy));
+    }
+
+    // Inverse transform; only exact for Manhattan transforms
+    CellTransform inverted() const {
+        CellTransform result;
+        result.mirror = mirror;
+        result.magnification = 1.0 / magnification;
+        result.angle = mirror ? angle : std::fmod(360.0 - angle, 360.0);
+        point_type origin = result.apply(point_type(to_coord((double)dx), to_coord((double)dy)));
+        result.dx = -(int64_t)origin.x();
+        result.dy = -(int64_t)origin.y();
+        return result;
+    }
+
+    // Transform of a child instance placed with child inside a cell placed with this transform
+    CellTransform combine(const CellTransform& child) const {
+        CellTransform result;
+        result.mirror = mirror != child.mirror;
+        result.angle = std::fmod(angle + (mirror ? -child.angle : child.angle), 360.0);
+        if (result.angle < 0.0) result.angle += 360.0;
+        result.magnification = magnification * child.magnification;
+        point_type origin = apply(point_type(to_coord((double)child.dx), to_coord((double)child.dy)));
+        result.dx = origin.x();
+        result.dy = origin.y();
+        return result;
+    }
+
+    // Transform a polygon; mirroring flips the ring orientation, which is restored here
+    polygon_type apply(const polygon_type& poly) const {
+        polygon_type out;
+        auto map_ring = [this](const polygon_type::ring_type& in, polygon_type::ring_type& ring) {
+            ring.reserve(in.size());
+            for (const auto& pt : in) ring.push_back(apply(pt));
+            if (mirror) std::reverse(ring.begin(), ring.end());
+        };
+        map_ring(poly.outer(), out.outer());
+        out.inners().resize(poly.inners().size());
+        for (std::size_t i = 0; i < poly.inners().size(); ++i) map_ring(poly.inners()[i], out.inners()[i]);
+        return out;
+    }
+};
+
+// Placement of one cell inside another
+struct CellInstance {
+    std::size_t cell;         // Index into LayoutHierarchy::cells
+    CellTransform transform;
+};
+
+struct LayoutCell {
+    std::string name;
+    std::vector<layer_type> layers;       // Own polygons per requested layer, in cell coordinates
+    std::vector<CellInstance> instances;  // Child placements (repetitions already expanded)
+};
+
+// Cell hierarchy of one OASIS file restricted to a set of layers
+struct LayoutHierarchy {
+    std::vector<LayoutCell> cells;
+    LayoutUnits units;
+
+    // Cells that are not placed by any other cell
+    std::vector<std::size_t> topCells() const {
+        std::vector<bool> placed(cells.size(), false);
+        for (const auto& cell : cells) {
+            for (const auto& instance : cell.instances) placed[instance.cell] = true;
+        }
+        std::vector<std::size_t> tops;
+        for (std::size_t i = 0; i < cells.size(); ++i) {
+            if (!placed[i]) tops.push_back(i);
+        }
+        return tops;
+    }
+
+    // Call fn(cell index, transform to top level) for every cell occurrence, depth first from the top cells.
+    // Throws std::runtime_error if the hierarchy is recursive.
+    template <typename Fn>
+    void forEachOccurrence(Fn fn) const {
+        struct Frame {
+            std::size_t cell;
+            CellTransform transform;
+            std::size_t depth;
+        };
+        std::vector<Frame> stack;
+        std::vector<std::size_t> tops = topCells();
+        if (tops.empty() && !cells.empty()) throw std::runtime_error("Cell hierarchy has no top cell (recursive placements)");
+        for (auto it = tops.rbegin(); it != tops.rend(); ++it) stack.push_back(Frame{*it, CellTransform(), 0});
+        while (!stack.empty()) {
+            Frame frame = stack.back();
+            stack.pop_back();
+            fn(frame.cell, frame.transform);
+            if (frame.depth > cells.size()) throw std::runtime_error("Recursive cell placement in cell " + cells[frame.cell].name);
+            const auto& instances = cells[frame.cell].instances;
+            for (auto it = instances.rbegin(); it != instances.rend(); ++it) {
+                stack.push_back(Frame{it->cell, frame.transform.combine(it->transform), frame.depth + 1});
+            }
+        }
+    }
+
+    // All polygons of one requested layer in top-level coordinates
+    layer_type flatten(std::size_t layer) const {
+        layer_type flat;
+        forEachOccurrence([&](std::size_t cell, const CellTransform& transform) {
+            for (const auto& poly : cells[cell].layers[layer]) flat.push_back(transform.apply(poly));
+        });
+        return flat;
+    }
+};
+
+// Sink that records the cells, placements and requested layers of an OASIS file
+class HierarchyBuilder : public OasisSink {
+public:
+    // layers: the (layer, datatype) pairs to keep, in the order of LayoutCell::layers.
+    // A pair may be requested more than once (e.g. mask and input on the same layer).
+    HierarchyBuilder(LayoutHierarchy& hierarchy, const std::vector<std::pair<uint32_t, uint32_t>>& layers)
+        : m_hierarchy(hierarchy), m_layer_count(layers.size()) {
+        for (std::size_t slot = 0; slot < layers.size(); ++slot) m_slots_by_tag[layers[slot]].push_back(slot);
+    }
+
+    void onStart(double db_unit) override { m_hierarchy.units.db_unit = db_unit; }
+
+    bool wantsLayer(uint32_t layer, uint32_t datatype) override {
+        return m_slots_by_tag.count(std::make_pair(layer, datatype)) != 0;
+    }
+
+    bool wantsHierarchy() const override { return true; }
+
+    void onCellName(uint64_t number, const std::string& name) override { m_cell_names[number] = name; }
+
+    void onCell(const OasisCellRef& cell) override { m_current = cellIndex(cell); }
+
+    void onPlacement(const OasisPlacement& placement) override {
+        if (m_current == npos) throw std::runtime_error("Malformed OASIS file: PLACEMENT outside of a cell");
+        CellInstance instance;
+        instance.cell = cellIndex(placement.cell);
+        instance.transform.dx = placement.x;
+        instance.transform.dy = placement.y;
+        instance.transform.angle = placement.angle;
+        instance.transform.magnification = placement.magnification;
+        instance.transform.mirror = placement.flip;
+        m_hierarchy.cells[m_current].instances.push_back(instance);
+    }
+
+    void onPolygon(uint32_t layer, uint32_t datatype, const OasisPoint* points, std::size_t count) override {
+        if (m_current == npos) throw std::runtime_error("Malformed OASIS file: geometry outside of a cell");
+        if (count < 3) return; // A polygon needs at least 3 points
+        auto slots = m_slots_by_tag.find(std::make_pair(layer, datatype));
+        if (slots == m_slots_by_tag.end()) return;
+
+        polygon_type poly;
+        poly.outer().reserve(count + 1);
+        for (std::size_t k = 0; k < count; ++k) {
+            poly.outer().push_back(point_type(to_coord((double)points[k].x), to_coord((double)points[k].y)));
+        }
+        poly.outer().push_back(poly.outer().front());
+        bg::correct(poly);
+        std::vector<layer_type>& layers = m_hierarchy.cells[m_current].layers;
+        for (std::size_t t = 1; t < slots->second.size(); ++t) layers[slots->second[t]].push_back(poly);
+        layers[slots->second[0]].push_back(std::move(poly));
+    }
+
+    // Merge cells that were referenced by number and by name once all CELLNAME records are known
+    void finish() {
+        std::vector<std::size_t> remap(m_hierarchy.cells.size());
+        std::map<std::string, std::size_t> by_name;
+        std::vector<LayoutCell> merged;
+        for (std::size_t i = 0; i < m_hierarchy.cells.size(); ++i) {
+            LayoutCell& cell = m_hierarchy.cells[i];
+            auto numbered = m_numbered_cells.find(i);
+            if (numbered != m_numbered_cells.end()) {
+                auto name = m_cell_names.find(numbered->second);
+                cell.name = name != m_cell_names.end() ? name->second : "#" + std::to_string(numbered->second);
+            }
+            auto existing = by_name.find(cell.name);
+            if (existing == by_name.end()) {
+                remap[i] = merged.size();
+                by_name[cell.name] = merged.size();
+                merged.push_back(std::move(cell));
+                continue;
+            }
+            // Same cell seen under both forms: one of them is a forward reference without contents
+            LayoutCell& target = merged[existing->second];
+            remap[i] = existing->second;
+            for (std::size_t l = 0; l < target.layers.size(); ++l) {
+                target.layers[l].insert(target.layers[l].end(), cell.layers[l].begin(), cell.layers[l].end());
+            }
+            target.instances.insert(target.instances.end(), cell.instances.begin(), cell.instances.end());
+        }
+        for (auto& cell : merged) {
+            for (auto& instance : cell.instances) instance.cell = remap[instance.cell];
+        }
+        m_hierarchy.cells = std::move(merged);
+    }
+
+private:
+    static const std::size_t npos = (std::size_t)-1;
+
+    LayoutHierarchy& m_hierarchy;
+    std::size_t m_layer_count;                                // Layers per cell
+    std::map<std::pair<uint32_t, uint32_t>, std::vector<std::size_t>> m_slots_by_tag; // Layer/datatype -> slots
+    std::size_t m_current = npos;                             // Cell receiving shapes and placements
+    std::unordered_map<uint64_t, std::size_t> m_cells_by_number;
+    std::map<std::string, std::size_t> m_cells_by_name;
+    std::map<std::size_t, uint64_t> m_numbered_cells;          // Cell index -> reference number
+    std::unordered_map<uint64_t, std::string> m_cell_names;    // CELLNAME table
+
+    std::size_t addCell(const std::string& name) {
+        m_hierarchy.cells.push_back(LayoutCell());
+        m_hierarchy.cells.back().name = name;
+        m_hierarchy.cells.back().layers.resize(m_layer_count);
+        return m_hierarchy.cells.size() - 1;
+    }
+
+    std::size_t cellIndex(const OasisCellRef& cell) {
+        if (cell.by_number) {
+            auto found = m_cells_by_number.find(cell.number);
+            if (found != m_cells_by_number.end()) return found->second;
+            std::size_t index = addCell(std::string());
+            m_cells_by_number[cell.number] = index;
+            m_numbered_cells[index] = cell.number;
+            return index;
+        }
+        auto found = m_cells_by_name.find(cell.name);
+        if (found != m_cells_by_name.end()) return found->second;
+        std::size_t index = addCell(cell.name);
+        m_cells_by_name[cell.name] = index;
+        return index;
+    }
+};
+
+// Load the cell hierarchy of an OASIS file with the given layers.
+// Throws std::runtime_error if the file cannot be read.
+inline LayoutHierarchy load_hierarchy_from_oasis(const std::string& filename, const std::vector<std::pair<uint32_t, uint32_t>>& layers) {
+    LayoutHierarchy hierarchy;
+    HierarchyBuilder builder(hierarchy, layers);
+    OasisReader reader(builder);
+    reader.readFile(filename);
+    builder.finish();
+    return hierarchy;
+}
+
+#endif // DFM_LAYOUT_HIERARCHY_H
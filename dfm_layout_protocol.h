@@ -0,0 +1,310 @@
+#ifndef DFM_LAYOUT_PROTOCOL_H
+#define DFM_LAYOUT_PROTOCOL_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "dfm_geometry.h"
+
+// Wire format of the layout server (dfm_pattern_capture --serve).
+//
+// Client and server exchange frames over a Unix domain stream socket: a
+// little-endian uint32 payload length followed by the payload. A request
+// payload starts with its LayoutOp; a response payload starts with a
+// LayoutStatus byte, followed by an error message (uint32 length + bytes) or
+// by the result. Integers are little-endian, coordinates int64 database units.
+//
+//   AND      u32 mask layer, u32 mask datatype, u32 input layer, u32 input datatype,
+//            u8 windowed, i64 x0 y0 x1 y1  ->  f64 db unit, polygons
+//   CLIP     u32 layer, u32 datatype, i64 x0 y0 x1 y1  ->  f64 db unit, polygons
+//   MATCH    u32 layer, u32 datatype, i64 x0 y0 x1 y1  ->  u32 count, i64 dx dy per occurrence
+//   SHUTDOWN (nothing)  ->  (nothing)
+//
+// Polygons are a u32 count, then per polygon a u32 ring count (outer ring
+// first) and per ring a u32 point count and the open ring's i64 x y pairs.
+// A connection may carry any number of requests, answered in order.
+enum class LayoutOp : uint8_t {
+    And = 1,      // AND of two layers, optionally only inside a window (results clipped to it)
+    Clip = 2,     // Polygons of a layer inside a window, clipped to it
+    Match = 3,    // Translations at which the window's clip of a layer occurs again, exactly
+    Shutdown = 4  // Stop the server once running requests have finished
+};
+
+enum class LayoutStatus : uint8_t {
+    Ok = 0,
+    Error = 1
+};
+
+// Frames larger than this are rejected as corrupt
+const uint32_t LAYOUT_MAX_FRAME = 1u << 30;
+
+// Appends little-endian fields to a payload
+class MessageWriter {
+public:
+    void u8(uint8_t value) { m_bytes.push_back((char)value); }
+    void u32(uint32_t value) { little(value, 4); }
+    void i64(int64_t value) { little((uint64_t)value, 8); }
+
+    void f64(double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        little(bits, 8);
+    }
+
+    void text(const std::string& value) {
+        u32((uint32_t)value.size());
+        m_bytes.append(value);
+    }
+
+    void box(const box_type& window) {
+        i64(window.min_corner().x());
+        i64(window.min_corner().y());
+        i64(window.max_corner().x());
+        i64(window.max_corner().y());
+    }
+
+    // Boost rings repeat their first point at the end; the wire carries open rings
+    void polygons(const layer_type& layer) {
+        u32((uint32_t)layer.size());
+        for (const auto& poly : layer) {
+            u32((uint32_t)(1 + poly.inners().size()));
+            ring(poly.outer());
+            for (const auto& inner : poly.inners()) ring(inner);
+        }
+    }
+
+    const std::string& bytes() const { return m_bytes; }
+
+private:
+    std::string m_bytes;
+
+    void little(uint64_t value, int size) {
+        for (int i = 0; i < size; ++i) m_bytes.push_back((char)(value >> (8 * i)));
+    }
+
+    void ring(const polygon_type::ring_type& points) {
+        std::size_t count = points.size();
+        if (count > 1 && bg::equals(points.front(), points.back())) --count;
+        u32((uint32_t)count);
+        for (std::size_t k = 0; k < count; ++k) {
+            i64(points[k].x());
+            i64(points[k].y());
+        }
+    }
+};
+
+// Reads the fields of a payload. Throws std::runtime_error when the payload is too short.
+class MessageReader {
+public:
+    explicit MessageReader(const std::string& bytes) : m_bytes(bytes) {}
+
+    uint8_t u8() { return (uint8_t)little(1); }
+    uint32_t u32() { return (uint32_t)little(4); }
+    int64_t i64() { return (int64_t)little(8); }
+
+    double f64() {
+        const uint64_t bits = little(8);
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    std::string text() {
+        const uint32_t size = u32();
+        need(size);
+        std::string value = m_bytes.substr(m_pos, size);
+        m_pos += size;
+        return value;
+    }
+
+    // Throws std::out_of_range if a corner does not fit coord_type
+    box_type box() {
+        const int64_t x0 = i64(), y0 = i64(), x1 = i64(), y1 = i64();
+        return box_type(point_type(to_coord((double)x0), to_coord((double)y0)), point_type(to_coord((double)x1), to_coord((double)y1)));
+    }
+
+    layer_type polygons() {
+        layer_type layer(u32());
+        for (auto& poly : layer) {
+            const uint32_t rings = u32();
+            if (rings == 0) throw std::runtime_error("polygon without rings");
+            ring(poly.outer());
+            poly.inners().resize(rings - 1);
+            for (auto& inner : poly.inners()) ring(inner);
+        }
+        return layer;
+    }
+
+private:
+    const std::string& m_bytes;
+    std::size_t m_pos = 0;
+
+    void need(std::size_t size) const {
+        if (m_bytes.size() - m_pos < size) throw std::runtime_error("truncated message");
+    }
+
+    uint64_t little(int size) {
+        need((std::size_t)size);
+        uint64_t value = 0;
+        for (int i = 0; i < size; ++i) value |= (uint64_t)(uint8_t)m_bytes[m_pos + i] << (8 * i);
+        m_pos += (std::size_t)size;
+        return value;
+    }
+
+    void ring(polygon_type::ring_type& points) {
+        const uint32_t count = u32();
+        need((std::size_t)count * 16);
+        points.reserve(count + 1);
+        for (uint32_t k = 0; k < count; ++k) {
+            const int64_t x = i64(), y = i64();
+            points.push_back(point_type((coord_type)x, (coord_type)y));
+        }
+        if (count > 0) points.push_back(points.front());
+    }
+};
+
+// Send one frame. Returns false if the peer is gone.
+inline bool send_frame(int fd, const std::string& payload) {
+    char header[4];
+    for (int i = 0; i < 4; ++i) header[i] = (char)((uint32_t)payload.size() >> (8 * i));
+    auto send_all = [fd](const char* data, std::size_t size) {
+        while (size > 0) {
+            const ssize_t sent = ::send(fd, data, size, MSG_NOSIGNAL); // A closed peer must not raise SIGPIPE
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent <= 0) return false;
+            data += sent;
+            size -= (std::size_t)sent;
+        }
+        return true;
+    };
+    return send_all(header, sizeof(header)) && send_all(payload.data(), payload.size());
+}
+
+// Receive one frame. Returns false at the end of the stream; throws std::runtime_error on a broken frame.
+inline bool receive_frame(int fd, std::string& payload) {
+    auto receive_all = [fd](char* data, std::size_t size) -> std::size_t {
+        std::size_t done = 0;
+        while (done < size) {
+            const ssize_t got = ::recv(fd, data + done, size - done, 0);
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) break;
+            done += (std::size_t)got;
+        }
+        return done;
+    };
+    unsigned char header[4];
+    const std::size_t got = receive_all((char*)header, sizeof(header));
+    if (got == 0) return false;
+    if (got < sizeof(header)) throw std::runtime_error("truncated frame header");
+    const uint32_t size = (uint32_t)header[0] | (uint32_t)header[1] << 8 | (uint32_t)header[2] << 16 | (uint32_t)header[3] << 24;
+    if (size > LAYOUT_MAX_FRAME) throw std::runtime_error("frame too large");
+    payload.resize(size);
+    if (receive_all(&payload[0], size) < size) throw std::runtime_error("truncated frame");
+    return true;
+}
+
+// Fill a Unix socket address. Throws std::runtime_error if the path is too long.
+inline sockaddr_un unix_socket_address(const std::string& path) {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) throw std::runtime_error("socket path too long: " + path);
+    std::memcpy(address.sun_path, path.c_str(), path.size());
+    return address;
+}
+
+// Blocking client of the layout server; one request at a time per connection.
+// Methods throw std::runtime_error on connection problems and on errors reported by the server.
+class LayoutClient {
+public:
+    explicit LayoutClient(const std::string& socket_path) {
+        m_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (m_fd < 0) throw std::runtime_error("cannot create a socket");
+        const sockaddr_un address = unix_socket_address(socket_path);
+        if (::connect(m_fd, (const sockaddr*)&address, sizeof(address)) != 0) {
+            ::close(m_fd);
+            throw std::runtime_error("cannot connect to " + socket_path + " (" + std::strerror(errno) + ")");
+        }
+    }
+
+    ~LayoutClient() { ::close(m_fd); }
+
+    LayoutClient(const LayoutClient&) = delete;
+    LayoutClient& operator=(const LayoutClient&) = delete;
+
+    // AND of two layers; with a window only inside it. Returns the database unit through db_unit.
+    layer_type layerAnd(uint32_t mask_layer, uint32_t mask_datatype, uint32_t input_layer, uint32_t input_datatype,
+                        const box_type* window, double& db_unit) {
+        MessageWriter request;
+        request.u8((uint8_t)LayoutOp::And);
+        request.u32(mask_layer);
+        request.u32(mask_datatype);
+        request.u32(input_layer);
+        request.u32(input_datatype);
+        request.u8(window ? 1 : 0);
+        request.box(window ? *window : box_type(point_type(0, 0), point_type(0, 0)));
+        std::string payload;
+        MessageReader response = call(request, payload);
+        db_unit = response.f64();
+        return response.polygons();
+    }
+
+    layer_type clip(uint32_t layer, uint32_t datatype, const box_type& window, double& db_unit) {
+        MessageWriter request;
+        request.u8((uint8_t)LayoutOp::Clip);
+        request.u32(layer);
+        request.u32(datatype);
+        request.box(window);
+        std::string payload;
+        MessageReader response = call(request, payload);
+        db_unit = response.f64();
+        return response.polygons();
+    }
+
+    // Translations (dx, dy) at which the window's content occurs, including (0, 0)
+    std::vector<std::pair<int64_t, int64_t>> match(uint32_t layer, uint32_t datatype, const box_type& window) {
+        MessageWriter request;
+        request.u8((uint8_t)LayoutOp::Match);
+        request.u32(layer);
+        request.u32(datatype);
+        request.box(window);
+        std::string payload;
+        MessageReader response = call(request, payload);
+        std::vector<std::pair<int64_t, int64_t>> offsets(response.u32());
+        for (auto& offset : offsets) {
+            offset.first = response.i64();
+            offset.second = response.i64();
+        }
+        return offsets;
+    }
+
+    void shutdown() {
+        MessageWriter request;
+        request.u8((uint8_t)LayoutOp::Shutdown);
+        std::string payload;
+        call(request, payload);
+    }
+
+private:
+    int m_fd = -1;
+
+    // Send a request and return a reader positioned after the status byte; payload keeps the bytes alive
+    MessageReader call(const MessageWriter& request, std::string& payload) {
+        if (!send_frame(m_fd, request.bytes())) throw std::runtime_error("the server closed the connection");
+        if (!receive_frame(m_fd, payload)) throw std::runtime_error("the server closed the connection");
+        MessageReader response(payload);
+        if (response.u8() != (uint8_t)LayoutStatus::Ok) throw std::runtime_error("server: " + response.text());
+        return response;
+    }
+};
+
+#endif // DFM_LAYOUT_PROTOCOL_H
@@ -0,0 +1,538 @@
+#ifndef DFM_MANHATTAN_H
+#define DFM_MANHATTAN_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "dfm_geometry.h"
+#include "dfm_polygon_arena.h"
+
+// Fast paths for axis-aligned geometry. Most mask and input shapes are
+// rectangles or rectilinear polygons; for those the boolean engine avoids
+// the general Boost.Geometry overlay and works on boxes or horizontal slabs.
+
+// Shape class of a polygon, used to pick the intersection kernel
+enum class ShapeKind : uint8_t {
+    Rectangle,   // Axis-aligned rectangle without holes
+    Rectilinear, // Every edge (outer and holes) is horizontal or vertical
+    General      // Anything else, handled by Boost.Geometry
+};
+
+inline const char* shape_kind_name(ShapeKind kind) {
+    switch (kind) {
+    case ShapeKind::Rectangle: return "rectangle";
+    case ShapeKind::Rectilinear: return "rectilinear";
+    default: return "general";
+    }
+}
+
+// Twice the signed area of a ring (positive for counter-clockwise), in wide integers
+template <typename Ring>
+wide_coord_type ring_area2(const Ring& ring) {
+    wide_coord_type sum = 0;
+    const std::size_t n = ring.size();
+    for (std::size_t i = 0; i < n; ++i) {
+        const auto& p = ring[i];
+        const auto& q = ring[(i + 1) % n];
+        sum += (wide_coord_type)p.x() * q.y() - (wide_coord_type)q.x() * p.y();
+    }
+    return sum;
+}
+
+inline bool ring_is_rectilinear(const polygon_type::ring_type& ring) {
+    for (std::size_t i = 0; i + 1 < ring.size(); ++i) {
+        if (ring[i].x() != ring[i + 1].x() && ring[i].y() != ring[i + 1].y()) return false;
+    }
+    // Closing edge, in case the ring is not explicitly closed
+    return ring.empty() || ring.front().x() == ring.back().x() || ring.front().y() == ring.back().y();
+}
+
+// Classify a polygon for the intersection dispatcher
+inline ShapeKind classify_polygon(const polygon_type& poly) {
+    if (!ring_is_rectilinear(poly.outer())) return ShapeKind::General;
+    for (const auto& inner : poly.inners()) {
+        if (!ring_is_rectilinear(inner)) return ShapeKind::General;
+    }
+    if (poly.inners().empty() && poly.outer().size() >= 4) {
+        // A rectilinear ring is its envelope exactly when the areas match
+        box_type envelope = bg::return_envelope<box_type>(poly);
+        wide_coord_type envelope_area2 = 2 * (wide_coord_type)(envelope.max_corner().x() - envelope.min_corner().x()) *
+                                         (wide_coord_type)(envelope.max_corner().y() - envelope.min_corner().y());
+        wide_coord_type area2 = ring_area2(poly.outer());
+        if (envelope_area2 > 0 && (area2 == envelope_area2 || area2 == -envelope_area2)) return ShapeKind::Rectangle;
+    }
+    return ShapeKind::Rectilinear;
+}
+
+// Rectangle x rectangle kernel: the overlap is just a min/max of the corners.
+// Returns false when the boxes do not overlap with a positive area.
+inline bool rect_and(const box_type& a, const box_type& b, box_type& out) {
+    const coord_type x0 = std::max(a.min_corner().x(), b.min_corner().x());
+    const coord_type y0 = std::max(a.min_corner().y(), b.min_corner().y());
+    const coord_type x1 = std::min(a.max_corner().x(), b.max_corner().x());
+    const coord_type y1 = std::min(a.max_corner().y(), b.max_corner().y());
+    out = box_type(point_type(x0, y0), point_type(x1, y1));
+    return (x0 < x1) & (y0 < y1);
+}
+
+// Closed, clockwise (Boost default orientation) polygon for a box
+inline polygon_type box_to_polygon(const box_type& box) {
+    polygon_type poly;
+    auto& ring = poly.outer();
+    ring.reserve(5);
+    ring.emplace_back(box.min_corner().x(), box.min_corner().y());
+    ring.emplace_back(box.min_corner().x(), box.max_corner().y());
+    ring.emplace_back(box.max_corner().x(), box.max_corner().y());
+    ring.emplace_back(box.max_corner().x(), box.min_corner().y());
+    ring.emplace_back(box.min_corner().x(), box.min_corner().y());
+    return poly;
+}
+
+// --- Rectilinear regions as horizontal slabs ---
+
+// Half-open covered x range [lo, hi)
+struct Interval {
+    coord_type lo, hi;
+};
+
+// Horizontal band [y0, y1) with its sorted, disjoint, non-touching covered x intervals
+struct Slab {
+    coord_type y0, y1;
+    std::vector<Interval> xs;
+};
+
+// A rectilinear region: slabs sorted by y, non-overlapping, none empty
+typedef std::vector<Slab> slab_region;
+
+// Sort intervals and merge the overlapping and touching ones
+inline void normalize_intervals(std::vector<Interval>& xs) {
+    std::sort(xs.begin(), xs.end(), [](const Interval& a, const Interval& b) { return a.lo < b.lo; });
+    std::size_t out = 0;
+    for (std::size_t i = 0; i < xs.size(); ++i) {
+        if (xs[i].lo >= xs[i].hi) continue;
+        if (out > 0 && xs[i].lo <= xs[out - 1].hi) {
+            xs[out - 1].hi = std::max(xs[out - 1].hi, xs[i].hi);
+        } else {
+            xs[out++] = xs[i];
+        }
+    }
+    xs.resize(out);
+}
+
+// Append a slab, merging it into the previous one when it continues it with identical intervals
+inline void push_slab(slab_region& region, Slab&& slab) {
+    if (slab.xs.empty() || slab.y0 >= slab.y1) return;
+    if (!region.empty()) {
+        Slab& last = region.back();
+        if (last.y1 == slab.y0 && last.xs.size() == slab.xs.size() &&
+            std::equal(last.xs.begin(), last.xs.end(), slab.xs.begin(),
+                       [](const Interval& a, const Interval& b) { return a.lo == b.lo && a.hi == b.hi; })) {
+            last.y1 = slab.y1;
+            return;
+        }
+    }
+    region.push_back(std::move(slab));
+}
+
+// Decompose a rectilinear polygon (holes included) into slabs with an even-odd scanline
+// over its vertical edges.
+inline slab_region polygon_to_slabs(const polygon_type& poly) {
+    struct VerticalEdge {
+        coord_type x, ylo, yhi;
+    };
+    std::vector<VerticalEdge> edges;
+    std::vector<coord_type> ys;
+    auto collect = [&](const polygon_type::ring_type& ring) {
+        const std::size_t n = ring.size();
+        for (std::size_t i = 0; i < n; ++i) {
+            const point_type& p = ring[i];
+            const point_type& q = ring[(i + 1) % n];
+            if (p.x() == q.x() && p.y() != q.y()) {
+                edges.push_back(VerticalEdge{p.x(), std::min(p.y(), q.y()), std::max(p.y(), q.y())});
+                ys.push_back(p.y());
+                ys.push_back(q.y());
+            }
+        }
+    };
+    collect(poly.outer());
+    for (const auto& inner : poly.inners()) collect(inner);
+
+    std::sort(ys.begin(), ys.end());
+    ys.erase(std::unique(ys.begin(), ys.end()), ys.end());
+    std::sort(edges.begin(), edges.end(), [](const VerticalEdge& a, const VerticalEdge& b) { return a.ylo < b.ylo; });
+
+    slab_region region;
+    std::vector<VerticalEdge> active;
+    std::vector<coord_type> crossings;
+    std::size_t next_edge = 0;
+    for (std::size_t band = 0; band + 1 < ys.size(); ++band) {
+        const coord_type y0 = ys[band];
+        const coord_type y1 = ys[band + 1];
+        active.erase(std::remove_if(active.begin(), active.end(),
+                                    [y0](const VerticalEdge& e) { return e.yhi <= y0; }),
+                     active.end());
+        while (next_edge < edges.size() && edges[next_edge].ylo <= y0) {
+            if (edges[next_edge].yhi > y0) active.push_back(edges[next_edge]);
+            ++next_edge;
+        }
+
+        crossings.clear();
+        for (const auto& e : active) crossings.push_back(e.x);
+        std::sort(crossings.begin(), crossings.end());
+        Slab slab{y0, y1, {}};
+        for (std::size_t i = 0; i + 1 < crossings.size(); i += 2) {
+            slab.xs.push_back(Interval{crossings[i], crossings[i + 1]});
+        }
+        normalize_intervals(slab.xs);
+        push_slab(region, std::move(slab));
+    }
+    return region;
+}
+
+inline slab_region box_to_slabs(const box_type& box) {
+    slab_region region;
+    push_slab(region, Slab{box.min_corner().y(), box.max_corner().y(),
+                           {Interval{box.min_corner().x(), box.max_corner().x()}}});
+    return region;
+}
+
+// box_to_slabs into an existing region, reusing its buffers
+inline void box_to_slabs(const box_type& box, slab_region& out) {
+    if (box.min_corner().y() >= box.max_corner().y() || box.min_corner().x() >= box.max_corner().x()) {
+        out.clear();
+        return;
+    }
+    out.resize(1);
+    out[0].y0 = box.min_corner().y();
+    out[0].y1 = box.max_corner().y();
+    out[0].xs.assign(1, Interval{box.min_corner().x(), box.max_corner().x()});
+}
+
+// Intersection of two sorted, disjoint interval lists
+inline void intersect_intervals(const std::vector<Interval>& a, const std::vector<Interval>& b, std::vector<Interval>& out) {
+    out.clear();
+    std::size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        const coord_type lo = std::max(a[i].lo, b[j].lo);
+        const coord_type hi = std::min(a[i].hi, b[j].hi);
+        if (lo < hi) out.push_back(Interval{lo, hi});
+        if (a[i].hi < b[j].hi) ++i; else ++j;
+    }
+}
+
+// Scanline AND of two slab regions into out. The slabs already in out are
+// overwritten, so a scratch region reused for many pairs keeps its buffers.
+inline void slabs_and(const slab_region& a, const slab_region& b, slab_region& out) {
+    std::size_t count = 0;
+    std::size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        const coord_type y0 = std::max(a[i].y0, b[j].y0);
+        const coord_type y1 = std::min(a[i].y1, b[j].y1);
+        if (y0 < y1) {
+            if (count == out.size()) out.emplace_back();
+            Slab& slab = out[count];
+            slab.y0 = y0;
+            slab.y1 = y1;
+            intersect_intervals(a[i].xs, b[j].xs, slab.xs);
+            if (!slab.xs.empty()) {
+                // Same merge as push_slab
+                Slab* last = count > 0 ? &out[count - 1] : nullptr;
+                if (last && last->y1 == y0 && last->xs.size() == slab.xs.size() &&
+                    std::equal(last->xs.begin(), last->xs.end(), slab.xs.begin(),
+                               [](const Interval& p, const Interval& q) { return p.lo == q.lo && p.hi == q.hi; })) {
+                    last->y1 = y1;
+                } else {
+                    ++count;
+                }
+            }
+        }
+        if (a[i].y1 < b[j].y1) ++i; else ++j;
+    }
+    out.resize(count);
+}
+
+// Scanline AND of two slab regions
+inline slab_region slabs_and(const slab_region& a, const slab_region& b) {
+    slab_region result;
+    slabs_and(a, b, result);
+    return result;
+}
+
+// Parts of sorted, disjoint interval list a not covered by b
+inline void subtract_intervals(const std::vector<Interval>& a, const std::vector<Interval>& b, std::vector<Interval>& out) {
+    std::size_t j = 0;
+    for (const auto& iv : a) {
+        coord_type lo = iv.lo;
+        while (j < b.size() && b[j].hi <= lo) ++j;
+        std::size_t k = j;
+        while (k < b.size() && b[k].lo < iv.hi) {
+            if (b[k].lo > lo) out.push_back(Interval{lo, b[k].lo});
+            lo = std::max(lo, b[k].hi);
+            ++k;
+        }
+        if (lo < iv.hi) out.push_back(Interval{lo, iv.hi});
+    }
+}
+
+// Scanline difference a - b of two slab regions
+inline slab_region slabs_not(const slab_region& a, const slab_region& b) {
+    slab_region result;
+    std::size_t j = 0;
+    for (const auto& slab : a) {
+        coord_type y = slab.y0;
+        while (y < slab.y1) {
+            while (j < b.size() && b[j].y1 <= y) ++j;
+            if (j < b.size() && b[j].y0 <= y) {
+                // Band covered by b[j]
+                Slab piece{y, std::min(slab.y1, b[j].y1), {}};
+                subtract_intervals(slab.xs, b[j].xs, piece.xs);
+                y = piece.y1;
+                push_slab(result, std::move(piece));
+            } else {
+                // Band up to the next slab of b (or the end of this slab) is untouched
+                Slab piece{y, j < b.size() ? std::min(slab.y1, b[j].y0) : slab.y1, slab.xs};
+                y = piece.y1;
+                push_slab(result, std::move(piece));
+            }
+        }
+    }
+    return result;
+}
+
+// Scanline union of any number of slab regions. Every band between consecutive
+// slab boundaries gets the merged intervals of all slabs active in it, so
+// overlapping and abutting pieces come out as one maximal region.
+inline slab_region slabs_union(const std::vector<slab_region>& regions) {
+    struct Piece {
+        coord_type y0, y1;
+        Interval xs;
+    };
+    std::vector<Piece> pieces;
+    std::vector<coord_type> ys;
+    for (const auto& region : regions) {
+        for (const auto& slab : region) {
+            for (const auto& iv : slab.xs) pieces.push_back(Piece{slab.y0, slab.y1, iv});
+            ys.push_back(slab.y0);
+            ys.push_back(slab.y1);
+        }
+    }
+    std::sort(ys.begin(), ys.end());
+    ys.erase(std::unique(ys.begin(), ys.end()), ys.end());
+    std::sort(pieces.begin(), pieces.end(), [](const Piece& a, const Piece& b) { return a.y0 < b.y0; });
+
+    slab_region result;
+    std::vector<Piece> active;
+    std::size_t next = 0;
+    for (std::size_t k = 0; k + 1 < ys.size(); ++k) {
+        const coord_type y = ys[k];
+        active.erase(std::remove_if(active.begin(), active.end(), [y](const Piece& p) { return p.y1 <= y; }), active.end());
+        while (next < pieces.size() && pieces[next].y0 == y) active.push_back(pieces[next++]);
+        Slab slab{y, ys[k + 1], {}};
+        slab.xs.reserve(active.size());
+        for (const auto& piece : active) slab.xs.push_back(piece.xs);
+        normalize_intervals(slab.xs);
+        push_slab(result, std::move(slab));
+    }
+    return result;
+}
+
+// Reusable buffers of slabs_to_polygons; with one per thread, tracing allocates
+// nothing once the buffers have grown to the largest region
+struct SlabTraceScratch {
+    struct Edge {
+        point_type from, to;
+        bool used;
+    };
+    std::vector<Edge> edges;
+    std::vector<std::pair<point_type, std::size_t>> outgoing; // Edges sorted by start vertex
+    std::vector<coord_type> xs;
+    std::vector<point_type> ring, simplified;  // Ring being traced
+    std::vector<point_type> ring_points;       // Traced rings, one after another
+    std::vector<std::size_t> ring_starts;      // First point of every ring, plus the end
+    std::vector<wide_coord_type> ring_area;    // Twice the signed area of every ring
+    std::vector<std::size_t> parent;           // Outer ring of every hole
+};
+
+// Trace the boundary of a slab region into polygons (outer rings with their holes).
+//
+// Boundary edges are generated with the region on their left (counter-clockwise
+// outers, clockwise holes): vertical edges from every interval end, horizontal
+// edges where the coverage above and below a slab boundary differs. Edges are
+// chained by always taking the leftmost turn, so shapes touching at a corner
+// come out as separate rings. Collinear vertices are dropped. The polygons are
+// appended to out in Boost orientation.
+inline void slabs_to_polygons(const slab_region& region, PolygonArena& out, SlabTraceScratch& scratch) {
+    typedef SlabTraceScratch::Edge Edge;
+    std::vector<Edge>& edges = scratch.edges;
+    edges.clear();
+    auto add_edge = [&edges](coord_type x0, coord_type y0, coord_type x1, coord_type y1) {
+        edges.push_back(Edge{point_type(x0, y0), point_type(x1, y1), false});
+    };
+
+    // Coverage difference at a horizontal boundary: bottom edges of "above" run left to right,
+    // top edges of "below" run right to left
+    const std::vector<Interval> empty;
+    std::vector<coord_type>& xs = scratch.xs;
+    auto add_boundary = [&](coord_type y, const std::vector<Interval>& below, const std::vector<Interval>& above) {
+        xs.clear();
+        for (const auto& iv : below) { xs.push_back(iv.lo); xs.push_back(iv.hi); }
+        for (const auto& iv : above) { xs.push_back(iv.lo); xs.push_back(iv.hi); }
+        std::sort(xs.begin(), xs.end());
+        xs.erase(std::unique(xs.begin(), xs.end()), xs.end());
+        std::size_t bi = 0, ai = 0;
+        for (std::size_t k = 0; k + 1 < xs.size(); ++k) {
+            const coord_type lo = xs[k], hi = xs[k + 1];
+            while (bi < below.size() && below[bi].hi <= lo) ++bi;
+            while (ai < above.size() && above[ai].hi <= lo) ++ai;
+            const bool in_below = bi < below.size() && below[bi].lo <= lo;
+            const bool in_above = ai < above.size() && above[ai].lo <= lo;
+            if (in_above && !in_below) add_edge(lo, y, hi, y);
+            else if (in_below && !in_above) add_edge(hi, y, lo, y);
+        }
+    };
+
+    for (std::size_t s = 0; s < region.size(); ++s) {
+        const Slab& slab = region[s];
+        for (const auto& iv : slab.xs) {
+            add_edge(iv.lo, slab.y1, iv.lo, slab.y0); // Left side runs down
+            add_edge(iv.hi, slab.y0, iv.hi, slab.y1); // Right side runs up
+        }
+        const bool continues_below = s > 0 && region[s - 1].y1 == slab.y0;
+        add_boundary(slab.y0, continues_below ? region[s - 1].xs : empty, slab.xs);
+        const bool continues_above = s + 1 < region.size() && region[s + 1].y0 == slab.y1;
+        if (!continues_above) add_boundary(slab.y1, slab.xs, empty);
+    }
+
+    // Outgoing edges per start vertex, in edge order for equal vertices
+    auto point_less = [](const point_type& a, const point_type& b) {
+        return a.x() != b.x() ? a.x() < b.x() : a.y() < b.y();
+    };
+    std::vector<std::pair<point_type, std::size_t>>& outgoing = scratch.outgoing;
+    outgoing.clear();
+    for (std::size_t i = 0; i < edges.size(); ++i) outgoing.emplace_back(edges[i].from, i);
+    std::sort(outgoing.begin(), outgoing.end(),
+              [&point_less](const std::pair<point_type, std::size_t>& a, const std::pair<point_type, std::size_t>& b) {
+                  if (point_less(a.first, b.first)) return true;
+                  if (point_less(b.first, a.first)) return false;
+                  return a.second < b.second;
+              });
+
+    std::vector<point_type>& ring = scratch.ring;
+    std::vector<point_type>& simplified = scratch.simplified;
+    std::vector<point_type>& ring_points = scratch.ring_points;
+    std::vector<std::size_t>& ring_starts = scratch.ring_starts;
+    std::vector<wide_coord_type>& ring_area = scratch.ring_area;
+    ring_points.clear();
+    ring_starts.assign(1, 0);
+    ring_area.clear();
+    for (std::size_t start = 0; start < edges.size(); ++start) {
+        if (edges[start].used) continue;
+        ring.clear();
+        std::size_t current = start;
+        while (!edges[current].used) {
+            edges[current].used = true;
+            ring.push_back(edges[current].from);
+            const point_type at = edges[current].to;
+            const wide_coord_type dx = (wide_coord_type)edges[current].to.x() - edges[current].from.x();
+            const wide_coord_type dy = (wide_coord_type)edges[current].to.y() - edges[current].from.y();
+            std::size_t next = current;
+            int best_score = -1;
+            auto it = std::lower_bound(outgoing.begin(), outgoing.end(), at,
+                                       [&point_less](const std::pair<point_type, std::size_t>& e, const point_type& p) {
+                                           return point_less(e.first, p);
+                                       });
+            for (; it != outgoing.end() && it->first.x() == at.x() && it->first.y() == at.y(); ++it) {
+                const Edge& candidate = edges[it->second];
+                if (candidate.used && it->second != start) continue;
+                const wide_coord_type cx = (wide_coord_type)candidate.to.x() - candidate.from.x();
+                const wide_coord_type cy = (wide_coord_type)candidate.to.y() - candidate.from.y();
+                const wide_coord_type cross = dx * cy - dy * cx;
+                const int score = cross > 0 ? 2 : (cross == 0 ? 1 : 0);
+                if (score > best_score) {
+                    best_score = score;
+                    next = it->second;
+                }
+            }
+            if (next == current) break; // Open chain; cannot happen for a valid region
+            current = next;
+        }
+
+        // Drop collinear vertices
+        simplified.clear();
+        const std::size_t n = ring.size();
+        for (std::size_t i = 0; i < n; ++i) {
+            const point_type& prev = ring[(i + n - 1) % n];
+            const point_type& cur = ring[i];
+            const point_type& next = ring[(i + 1) % n];
+            const bool collinear = (prev.x() == cur.x() && cur.x() == next.x()) ||
+                                   (prev.y() == cur.y() && cur.y() == next.y());
+            if (!collinear) simplified.push_back(cur);
+        }
+        if (simplified.size() < 4) continue;
+        ring_area.push_back(ring_area2(simplified)); // Positive for outers, negative for holes
+        ring_points.insert(ring_points.end(), simplified.begin(), simplified.end());
+        ring_starts.push_back(ring_points.size());
+    }
+    const std::size_t rings = ring_area.size();
+
+    // Strict point-in-ring test (crossing number) for points known not to lie on any boundary
+    auto contains = [&](std::size_t r, double px, double py) {
+        bool inside = false;
+        const std::size_t begin = ring_starts[r], n = ring_starts[r + 1] - begin;
+        for (std::size_t i = 0, j = n - 1; i < n; j = i++) {
+            const point_type& pi = ring_points[begin + i];
+            const point_type& pj = ring_points[begin + j];
+            const double xi = pi.x(), yi = pi.y(), xj = pj.x(), yj = pj.y();
+            if ((yi > py) != (yj > py) && px < (xj - xi) * (py - yi) / (yj - yi) + xi) inside = !inside;
+        }
+        return inside;
+    };
+
+    // Every hole belongs to the smallest outer ring containing it
+    bool any_hole = false;
+    std::vector<std::size_t>& parent = scratch.parent;
+    parent.assign(rings, rings);
+    for (std::size_t h = 0; h < rings; ++h) {
+        if (ring_area[h] > 0) continue;
+        any_hole = true;
+        // A point a quarter unit into the empty side of the hole's first edge (the region is on the left)
+        const point_type& p = ring_points[ring_starts[h]];
+        const point_type& q = ring_points[ring_starts[h] + 1];
+        const double len = std::abs((double)q.x() - p.x()) + std::abs((double)q.y() - p.y());
+        const double px = (p.x() + (double)q.x()) / 2 + 0.25 * ((double)q.y() - p.y()) / len;
+        const double py = (p.y() + (double)q.y()) / 2 - 0.25 * ((double)q.x() - p.x()) / len;
+        for (std::size_t o = 0; o < rings; ++o) {
+            if (ring_area[o] <= 0) continue;
+            if ((parent[h] == rings || ring_area[o] < ring_area[parent[h]]) && contains(o, px, py)) parent[h] = o;
+        }
+    }
+
+    // Boost orientation: the traced rings are reversed (clockwise outers, counter-clockwise holes)
+    auto emit_reversed = [&](std::size_t r) {
+        for (std::size_t k = ring_starts[r + 1]; k-- > ring_starts[r];) out.addVertex(ring_points[k].x(), ring_points[k].y());
+        out.endRing();
+    };
+    for (std::size_t o = 0; o < rings; ++o) {
+        if (ring_area[o] <= 0) continue;
+        emit_reversed(o);
+        if (any_hole) {
+            for (std::size_t h = 0; h < rings; ++h) {
+                if (parent[h] == o) emit_reversed(h);
+            }
+        }
+        out.endPolygon();
+    }
+}
+
+// slabs_to_polygons into Boost polygons
+inline void slabs_to_polygons(const slab_region& region, layer_type& out) {
+    PolygonArena arena;
+    SlabTraceScratch scratch;
+    slabs_to_polygons(region, arena, scratch);
+    arena.appendTo(out);
+}
+
+#endif // DFM_MANHATTAN_H
@@ -0,0 +1,83 @@
+#ifndef DFM_MAPPED_FILE_H
+#define DFM_MAPPED_FILE_H
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only memory mapping of a whole file.
+//
+// The decoders read straight from the page cache instead of copying the file
+// into their own buffers, and several processes or readers of the same file
+// share one cached copy. The mapping is advised as sequential, so the kernel
+// reads ahead aggressively and may drop pages behind the cursor.
+class MappedFile {
+public:
+    MappedFile() {}
+
+    // Map a file. Throws std::runtime_error if it cannot be opened or mapped.
+    explicit MappedFile(const std::string& filename) { open(filename); }
+
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Map a file, replacing the current mapping. Throws std::runtime_error on failure.
+    void open(const std::string& filename) {
+        close();
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Unable to open " + filename + ": " + std::strerror(errno));
+        struct stat info;
+        if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+            ::close(fd);
+            throw std::runtime_error("Unable to map " + filename + ": not a regular file");
+        }
+        m_size = (std::size_t)info.st_size;
+        if (m_size > 0) {
+            void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                int error = errno;
+                ::close(fd);
+                m_size = 0;
+                throw std::runtime_error("Unable to map " + filename + ": " + std::strerror(error));
+            }
+            m_data = (const uint8_t*)data;
+            madvise(data, m_size, MADV_SEQUENTIAL);
+        }
+        ::close(fd); // The mapping keeps the file referenced
+    }
+
+    void close() {
+        if (m_data) munmap((void*)m_data, m_size);
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+    const uint8_t* data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+
+    // Ask the kernel to drop the cached pages of a file, so the next read is a cold
+    // start. Dirty or mapped pages stay cached. Returns false if the file cannot be opened.
+    static bool evictFromPageCache(const std::string& filename) {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        bool ok = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+        ::close(fd);
+        return ok;
+    }
+
+private:
+    const uint8_t* m_data = nullptr;
+    std::size_t m_size = 0;
+};
+
+#endif // DFM_MAPPED_FILE_H
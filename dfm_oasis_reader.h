@@ -0,0 +1,1328 @@
+#ifndef DFM_OASIS_READER_H
+#define DFM_OASIS_READER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <zlib.h>
+
+#include "dfm_mapped_file.h"
+#include "dfm_thread_pool.h"
+#include "dfm_trace.h"
+
+// Streaming OASIS (SEMI P39) record decoder.
+//
+// Unlike gdstk::read_oas, which builds a complete Library with every cell and
+// layer, this reader decodes the file record by record from a fixed-size
+// buffer and hands polygons on the layers a sink asks for to that sink. Shapes
+// on other layers are parsed only as far as needed to advance the cursor and
+// keep the modal variables right; they are never expanded or stored. Peak
+// memory is therefore the input buffer, one inflated CBLOCK and whatever the
+// sink keeps, independent of the file size.
+//
+// By default the file is memory-mapped (MappedFile) and decoded in place, so
+// the only copy of the file is the shared page cache; CBLOCKs are inflated
+// straight from the mapping. The buffered mode reads a fixed-size window with
+// fread instead and is used as a fallback when a file cannot be mapped.
+//
+// With more than one thread (setThreads) a mapped file is decoded in parallel.
+// A prescan walks the top-level records, which does not need the modal
+// variables, and notes the CELL records and CBLOCK extents. CBLOCKs are then
+// inflated concurrently, in waves of bounded size, and scanned for the CELL
+// records they contain. Every CELL record resets the modal variables, so the
+// stream splits into cell segments that are decoded on separate threads into
+// OasisEventBuffer arenas and replayed into the sink in file order. The sink
+// therefore sees exactly the sequence of calls of a sequential read, from the
+// calling thread. A single large cell is still decoded on one thread; only
+// the inflation of its CBLOCKs is spread over the pool.
+//
+// Coordinates are reported as 64-bit integers in database units.
+
+struct OasisPoint {
+    int64_t x, y;
+};
+
+// Cell named in a CELL or PLACEMENT record, either by reference number or by name.
+// Reference numbers are resolved through the CELLNAME records (OasisSink::onCellName).
+struct OasisCellRef {
+    bool by_number = false;
+    uint64_t number = 0;
+    std::string name;
+};
+
+// One cell instance of a PLACEMENT record (repetitions are expanded into separate placements).
+// The placed cell is mirrored about the x axis first, then scaled, rotated and moved.
+struct OasisPlacement {
+    OasisCellRef cell;
+    int64_t x = 0, y = 0;
+    double angle = 0.0;         // Counterclockwise, in degrees
+    double magnification = 1.0;
+    bool flip = false;
+};
+
+// Receives decoded geometry from OasisReader
+class OasisSink {
+public:
+    virtual ~OasisSink() {}
+    // Called once after the START record with the database unit in meters
+    virtual void onStart(double db_unit) { (void)db_unit; }
+    // Shapes on layers for which this returns false are skipped without being expanded
+    virtual bool wantsLayer(uint32_t layer, uint32_t datatype) = 0;
+    // One polygon instance: open ring in database units, repetitions already expanded
+    virtual void onPolygon(uint32_t layer, uint32_t datatype, const OasisPoint* points, std::size_t count) = 0;
+
+    // Hierarchy events are only decoded in full when this returns true
+    virtual bool wantsHierarchy() const { return false; }
+    // CELLNAME record binding a reference number to a name (may come after the references)
+    virtual void onCellName(uint64_t number, const std::string& name) { (void)number; (void)name; }
+    // Start of a cell; the following shapes and placements belong to it
+    virtual void onCell(const OasisCellRef& cell) { (void)cell; }
+    virtual void onPlacement(const OasisPlacement& placement) { (void)placement; }
+};
+
+// Sink that records the calls for one stream segment, so that segments decoded on
+// different threads can be replayed into the real sink in file order. Layer
+// queries go to the target sink under a shared mutex and are cached per buffer.
+// OasisReader hands it each shape once with its repetition offsets (onShape);
+// the instances are only expanded during the replay.
+class OasisEventBuffer : public OasisSink {
+public:
+    OasisEventBuffer(OasisSink& target, std::mutex& target_mutex, bool hierarchy)
+        : m_target(target), m_target_mutex(target_mutex), m_hierarchy(hierarchy), m_last(m_wanted.end()) {}
+
+    void onStart(double db_unit) override { push(Start, m_doubles.size()); m_doubles.push_back(db_unit); }
+
+    bool wantsLayer(uint32_t layer, uint32_t datatype) override {
+        const std::pair<uint32_t, uint32_t> tag(layer, datatype);
+        if (m_last != m_wanted.end() && m_last->first == tag) return m_last->second;
+        m_last = m_wanted.find(tag);
+        if (m_last == m_wanted.end()) {
+            std::lock_guard<std::mutex> lock(m_target_mutex);
+            m_last = m_wanted.insert(std::make_pair(tag, m_target.wantsLayer(layer, datatype))).first;
+        }
+        return m_last->second;
+    }
+
+    void onPolygon(uint32_t layer, uint32_t datatype, const OasisPoint* points, std::size_t count) override {
+        const OasisPoint origin{0, 0};
+        onShape(layer, datatype, points, count, origin, &origin, 1);
+    }
+
+    // A shape relative to position, placed once at position + offsets[i] for every offset
+    void onShape(uint32_t layer, uint32_t datatype, const OasisPoint* points, std::size_t count,
+                 OasisPoint position, const OasisPoint* offsets, std::size_t offset_count) {
+        push(Polygon, m_polygons.size());
+        m_polygons.push_back(PolygonRecord{layer, datatype, position, m_points.size(), count, m_offsets.size(), offset_count});
+        m_points.insert(m_points.end(), points, points + count);
+        m_offsets.insert(m_offsets.end(), offsets, offsets + offset_count);
+    }
+
+    bool wantsHierarchy() const override { return m_hierarchy; }
+
+    void onCellName(uint64_t number, const std::string& name) override {
+        push(CellName, m_cell_names.size());
+        m_cell_names.push_back(std::make_pair(number, name));
+    }
+
+    void onCell(const OasisCellRef& cell) override { push(Cell, m_cells.size()); m_cells.push_back(cell); }
+
+    void onPlacement(const OasisPlacement& placement) override {
+        push(Placement, m_placements.size());
+        m_placements.push_back(placement);
+    }
+
+    // Repeat the recorded calls on a sink
+    void replay(OasisSink& sink) const {
+        std::vector<OasisPoint> instance;
+        for (const Event& event : m_events) {
+            switch (event.kind) {
+            case Start: sink.onStart(m_doubles[event.index]); break;
+            case Polygon: {
+                const PolygonRecord& poly = m_polygons[event.index];
+                const OasisPoint* points = m_points.data() + poly.first;
+                instance.resize(poly.count);
+                for (std::size_t o = 0; o < poly.offset_count; ++o) {
+                    const OasisPoint& offset = m_offsets[poly.first_offset + o];
+                    const int64_t x = poly.position.x + offset.x;
+                    const int64_t y = poly.position.y + offset.y;
+                    for (std::size_t i = 0; i < poly.count; ++i) instance[i] = OasisPoint{points[i].x + x, points[i].y + y};
+                    sink.onPolygon(poly.layer, poly.datatype, instance.data(), instance.size());
+                }
+                break;
+            }
+            case CellName: sink.onCellName(m_cell_names[event.index].first, m_cell_names[event.index].second); break;
+            case Cell: sink.onCell(m_cells[event.index]); break;
+            case Placement: sink.onPlacement(m_placements[event.index]); break;
+            }
+        }
+    }
+
+    // Drop the recorded calls (the layer cache is kept)
+    void clear() {
+        m_events.clear();
+        m_doubles.clear();
+        m_polygons.clear();
+        m_points.clear();
+        m_offsets.clear();
+        m_cell_names.clear();
+        m_cells.clear();
+        m_placements.clear();
+    }
+
+private:
+    enum Kind : uint8_t { Start, Polygon, CellName, Cell, Placement };
+
+    struct Event {
+        Kind kind;
+        std::size_t index; // Into the vector of that kind
+    };
+
+    struct PolygonRecord {
+        uint32_t layer, datatype;
+        OasisPoint position;
+        std::size_t first, count;               // Range in m_points
+        std::size_t first_offset, offset_count; // Range in m_offsets
+    };
+
+    OasisSink& m_target;
+    std::mutex& m_target_mutex;                         // Serializes wantsLayer calls on the target
+    bool m_hierarchy;                                   // Cached target.wantsHierarchy()
+    std::map<std::pair<uint32_t, uint32_t>, bool> m_wanted; // Cached wantsLayer answers
+    std::map<std::pair<uint32_t, uint32_t>, bool>::iterator m_last; // Answer of the last query
+    std::vector<Event> m_events;                        // Calls in order
+    std::vector<double> m_doubles;
+    std::vector<PolygonRecord> m_polygons;
+    std::vector<OasisPoint> m_points;                   // Points of all recorded shapes
+    std::vector<OasisPoint> m_offsets;                  // Repetition offsets of all recorded shapes
+    std::vector<std::pair<uint64_t, std::string>> m_cell_names;
+    std::vector<OasisCellRef> m_cells;
+    std::vector<OasisPlacement> m_placements;
+
+    void push(Kind kind, std::size_t index) { m_events.push_back(Event{kind, index}); }
+};
+
+// Counters of one OasisReader run
+struct OasisReadStats {
+    uint64_t bytes_read = 0;       // Bytes read from the file (compressed size for CBLOCKs)
+    uint64_t records = 0;          // Records decoded, including those inside CBLOCKs
+    uint64_t cblocks = 0;          // Compressed blocks inflated
+    uint64_t polygons_emitted = 0; // Polygon instances handed to the sink
+    uint64_t shapes_skipped = 0;   // Shape records on layers the sink did not want
+    uint64_t paths_skipped = 0;    // PATH records on wanted layers (not converted to polygons)
+    bool memory_mapped = false;    // The file was decoded from a memory mapping
+    uint64_t segments = 0;         // Cell segments decoded independently (parallel decode only)
+};
+
+enum class OasisInputMode {
+    MemoryMapped, // Decode in place from a read-only mapping of the file
+    Buffered      // Copy the file through a 1 MiB fread window
+};
+
+class OasisReader {
+public:
+    explicit OasisReader(OasisSink& sink) : m_sink(sink), m_input_mode(defaultInputMode()), m_threads(defaultThreads()) {}
+
+    OasisReader(const OasisReader&) = delete;
+    OasisReader& operator=(const OasisReader&) = delete;
+
+    ~OasisReader() {
+        if (m_file) fclose(m_file);
+    }
+
+    // Input mode of readers constructed afterwards (memory-mapped unless changed)
+    static void setDefaultInputMode(OasisInputMode mode) { defaultInputMode() = mode; }
+
+    void setInputMode(OasisInputMode mode) { m_input_mode = mode; }
+
+    // Decode threads of readers constructed afterwards (1 unless changed)
+    static void setDefaultThreads(unsigned threads) { defaultThreads() = threads == 0 ? 1 : threads; }
+
+    // Decode with up to this many threads (1 decodes sequentially).
+    // Parallel decoding needs a memory mapping; buffered reads are always sequential.
+    void setThreads(unsigned threads) { m_threads = threads == 0 ? 1 : threads; }
+
+    // Decode a whole file. Throws std::runtime_error on unreadable or malformed input.
+    void readFile(const std::string& filename) {
+        TraceScope trace("read_oasis");
+        m_cur = m_end = nullptr;
+        m_in_cblock = false;
+        m_next_cellname = 0;
+        m_stats = OasisReadStats();
+
+        if (m_input_mode == OasisInputMode::MemoryMapped) {
+            try {
+                m_mapping.open(filename);
+                m_cur = m_mapping.data();
+                m_end = m_cur + m_mapping.size();
+                m_stats.bytes_read = m_mapping.size();
+                m_stats.memory_mapped = true;
+            } catch (const std::runtime_error&) {
+                // Not mappable (special file, address space exhausted, ...): fall back to buffered reads
+            }
+        }
+        if (!m_stats.memory_mapped) {
+            m_file = fopen(filename.c_str(), "rb");
+            if (!m_file) throw std::runtime_error("Unable to open OASIS file " + filename);
+            m_file_buffer.resize(1 << 20);
+        }
+
+        try {
+            if (m_stats.memory_mapped && m_threads > 1) {
+                decodeParallel();
+            } else {
+                decode();
+            }
+        } catch (...) {
+            closeInput();
+            throw;
+        }
+        closeInput();
+    }
+
+    const OasisReadStats& stats() const { return m_stats; }
+    // Database unit in meters from the START record
+    double dbUnit() const { return m_db_unit; }
+
+private:
+    // Repetition in either lattice form (types 1-3, 8, 9) or as an explicit offset list
+    struct Repetition {
+        bool lattice = true;
+        uint64_t n_count = 1, m_count = 1;
+        OasisPoint n_step{0, 0}, m_step{0, 0};
+        std::vector<OasisPoint> offsets;
+    };
+
+    // Modal variables (SEMI P39 section 10); reset at every CELL record
+    struct Modal {
+        bool has_repetition = false;
+        Repetition repetition;
+        int64_t placement_x = 0, placement_y = 0;
+        int64_t geometry_x = 0, geometry_y = 0;
+        int64_t text_x = 0, text_y = 0;
+        bool xy_relative = false;
+        uint32_t layer = 0, datatype = 0;
+        uint64_t geometry_w = 0, geometry_h = 0;
+        std::vector<OasisPoint> polygon_points;
+        std::vector<OasisPoint> path_points;
+        uint64_t ctrapezoid_type = 0;
+        uint64_t circle_radius = 0;
+        OasisCellRef placement_cell;
+    };
+
+    // Contiguous run of whole records, in the mapping or in an inflated CBLOCK
+    struct StreamPiece {
+        const uint8_t* data = nullptr;
+        std::size_t size = 0;
+        bool starts_cell = false;   // Begins with a CELL record
+        uint64_t cellnames = 0;     // CELLNAME records with an implicit reference number
+        std::shared_ptr<std::vector<uint8_t>> block; // Keeps an inflated CBLOCK alive
+    };
+
+    // Top-level item found by the prescan: plain records, or a CBLOCK still to be inflated
+    struct TopLevelItem {
+        bool cblock = false;
+        StreamPiece piece;                    // Plain records
+        const uint8_t* compressed = nullptr;  // CBLOCK payload in the mapping
+        uint64_t compressed_size = 0;
+        uint64_t uncompressed_size = 0;
+    };
+
+    // Pieces found by scan() in one buffer
+    struct ScanState {
+        bool top_level = false;               // Scanning the file rather than an inflated CBLOCK
+        std::vector<TopLevelItem> items;
+        const uint8_t* piece_start = nullptr; // Start of the piece being scanned
+        bool piece_starts_cell = false;
+        uint64_t cellnames = 0;
+    };
+
+    // Sink of the scans: no layer is wanted, so no shape is expanded
+    class NullSink : public OasisSink {
+    public:
+        bool wantsLayer(uint32_t, uint32_t) override { return false; }
+        void onPolygon(uint32_t, uint32_t, const OasisPoint*, std::size_t) override {}
+    };
+
+    OasisSink& m_sink;
+    OasisInputMode m_input_mode;
+    unsigned m_threads;                     // Decode threads; more than one needs a mapping
+    MappedFile m_mapping;                   // Whole file in memory-mapped mode
+    FILE* m_file = nullptr;                 // Buffered mode
+    std::vector<uint8_t> m_file_buffer;     // Fixed-size window into the file
+    std::vector<uint8_t> m_compressed;      // Compressed bytes of the current CBLOCK
+    std::vector<uint8_t> m_cblock;          // Inflated bytes of the current CBLOCK
+    const uint8_t* m_cur = nullptr;         // Read cursor in the active buffer
+    const uint8_t* m_end = nullptr;         // End of the active buffer
+    const uint8_t* m_file_cur = nullptr;    // File window saved while a CBLOCK is decoded
+    const uint8_t* m_file_end = nullptr;
+    bool m_in_cblock = false;
+    bool m_table_offsets_at_end = false;
+    uint64_t m_next_cellname = 0;           // Implicit reference number of the next CELLNAME record
+    double m_db_unit = 1e-9;
+    Modal m_modal;
+    std::vector<OasisPoint> m_shape;        // Scratch: absolute points of the current shape
+    std::vector<OasisPoint> m_instance;     // Scratch: one repetition instance of m_shape
+    std::vector<OasisPoint> m_offsets;      // Scratch: expanded repetition offsets
+    OasisReadStats m_stats;
+    ScanState* m_scan = nullptr;            // Set while scanning for the parallel decoder
+    const StreamPiece* m_pieces = nullptr;  // Pieces of the segment being decoded
+    OasisEventBuffer* m_events = nullptr;   // The sink, when it records a segment for replay
+    std::size_t m_piece_count = 0;
+    std::size_t m_next_piece = 0;
+
+    // --- Byte level ---
+
+    static OasisInputMode& defaultInputMode() {
+        static OasisInputMode mode = OasisInputMode::MemoryMapped;
+        return mode;
+    }
+
+    static unsigned& defaultThreads() {
+        static unsigned threads = 1;
+        return threads;
+    }
+
+    void closeInput() {
+        if (m_file) fclose(m_file);
+        m_file = nullptr;
+        m_mapping.close();
+    }
+
+    [[noreturn]] static void fail(const std::string& message) {
+        throw std::runtime_error("Malformed OASIS file: " + message);
+    }
+
+    bool refill() {
+        if (m_in_cblock) {
+            // End of the inflated block: continue in the file where the CBLOCK record ended
+            m_in_cblock = false;
+            m_cur = m_file_cur;
+            m_end = m_file_end;
+            if (m_cur < m_end) return true;
+        }
+        while (m_next_piece < m_piece_count) {
+            // Continue with the next piece of the segment
+            m_cur = m_pieces[m_next_piece].data;
+            m_end = m_cur + m_pieces[m_next_piece].size;
+            ++m_next_piece;
+            if (m_cur < m_end) return true;
+        }
+        if (!m_file) return false;
+        std::size_t n = fread(m_file_buffer.data(), 1, m_file_buffer.size(), m_file);
+        m_stats.bytes_read += n;
+        m_cur = m_file_buffer.data();
+        m_end = m_cur + n;
+        return n > 0;
+    }
+
+    uint8_t readByte() {
+        if (m_cur == m_end && !refill()) fail("unexpected end of file");
+        return *m_cur++;
+    }
+
+    void readBytes(uint8_t* out, uint64_t count) {
+        while (count > 0) {
+            if (m_cur == m_end && !refill()) fail("unexpected end of file");
+            std::size_t chunk = (std::size_t)std::min<uint64_t>(count, (uint64_t)(m_end - m_cur));
+            if (out) {
+                std::memcpy(out, m_cur, chunk);
+                out += chunk;
+            }
+            m_cur += chunk;
+            count -= chunk;
+        }
+    }
+
+    void skipBytes(uint64_t count) { readBytes(nullptr, count); }
+
+    uint64_t readUInt() {
+        uint64_t value = 0;
+        unsigned shift = 0;
+        for (;;) {
+            uint8_t byte = readByte();
+            if (shift < 64) value |= (uint64_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) return value;
+            shift += 7;
+            if (shift > 70) fail("unsigned integer too long");
+        }
+    }
+
+    int64_t readSInt() {
+        uint64_t value = readUInt();
+        int64_t magnitude = (int64_t)(value >> 1);
+        return (value & 1) ? -magnitude : magnitude;
+    }
+
+    double readReal() {
+        switch (readUInt()) {
+        case 0: return (double)readUInt();
+        case 1: return -(double)readUInt();
+        case 2: return 1.0 / (double)readUInt();
+        case 3: return -1.0 / (double)readUInt();
+        case 4: { double num = (double)readUInt(); return num / (double)readUInt(); }
+        case 5: { double num = (double)readUInt(); return -num / (double)readUInt(); }
+        case 6: {
+            uint8_t bytes[4];
+            readBytes(bytes, 4);
+            uint32_t bits = (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+            float value;
+            std::memcpy(&value, &bits, 4);
+            return value;
+        }
+        case 7: {
+            uint8_t bytes[8];
+            readBytes(bytes, 8);
+            uint64_t bits = 0;
+            for (int i = 7; i >= 0; --i) bits = bits << 8 | bytes[i];
+            double value;
+            std::memcpy(&value, &bits, 8);
+            return value;
+        }
+        default: fail("invalid real number type");
+        }
+    }
+
+    void skipString() { skipBytes(readUInt()); }
+
+    std::string readString() {
+        std::string value((std::size_t)readUInt(), '\0');
+        if (!value.empty()) readBytes((uint8_t*)&value[0], value.size());
+        return value;
+    }
+
+    // Octangular direction codes shared by 3-deltas and the first g-delta form
+    static OasisPoint octangular(uint64_t direction, int64_t magnitude) {
+        switch (direction) {
+        case 0: return OasisPoint{magnitude, 0};
+        case 1: return OasisPoint{0, magnitude};
+        case 2: return OasisPoint{-magnitude, 0};
+        case 3: return OasisPoint{0, -magnitude};
+        case 4: return OasisPoint{magnitude, magnitude};
+        case 5: return OasisPoint{-magnitude, magnitude};
+        case 6: return OasisPoint{-magnitude, -magnitude};
+        default: return OasisPoint{magnitude, -magnitude};
+        }
+    }
+
+    OasisPoint read2Delta() {
+        uint64_t value = readUInt();
+        return octangular(value & 3, (int64_t)(value >> 2));
+    }
+
+    OasisPoint read3Delta() {
+        uint64_t value = readUInt();
+        return octangular(value & 7, (int64_t)(value >> 3));
+    }
+
+    OasisPoint readGDelta() {
+        uint64_t value = readUInt();
+        if (!(value & 1)) return octangular((value >> 1) & 7, (int64_t)(value >> 4));
+        int64_t dx = (int64_t)(value >> 2);
+        if (value & 2) dx = -dx;
+        return OasisPoint{dx, readSInt()};
+    }
+
+    // --- Structured fields ---
+
+    // Point list relative to the shape position; the first point (0, 0) is included.
+    // Manhattan lists (types 0 and 1) of polygons get their implicit closing vertex.
+    void readPointList(std::vector<OasisPoint>& points, bool polygon) {
+        uint64_t type = readUInt();
+        uint64_t count = readUInt();
+        points.clear();
+        OasisPoint cur{0, 0};
+        points.push_back(cur);
+        switch (type) {
+        case 0:
+        case 1: {
+            bool horizontal = type == 0;
+            for (uint64_t i = 0; i < count; ++i) {
+                int64_t delta = readSInt();
+                if (horizontal) cur.x += delta; else cur.y += delta;
+                horizontal = !horizontal;
+                points.push_back(cur);
+            }
+            if (polygon) points.push_back(horizontal ? OasisPoint{0, cur.y} : OasisPoint{cur.x, 0});
+            break;
+        }
+        case 2:
+        case 3:
+        case 4:
+            for (uint64_t i = 0; i < count; ++i) {
+                OasisPoint d = type == 2 ? read2Delta() : (type == 3 ? read3Delta() : readGDelta());
+                cur.x += d.x;
+                cur.y += d.y;
+                points.push_back(cur);
+            }
+            break;
+        case 5: {
+            OasisPoint step{0, 0};
+            for (uint64_t i = 0; i < count; ++i) {
+                OasisPoint d = readGDelta();
+                step.x += d.x;
+                step.y += d.y;
+                cur.x += step.x;
+                cur.y += step.y;
+                points.push_back(cur);
+            }
+            break;
+        }
+        default:
+            fail("invalid point list type");
+        }
+    }
+
+    // Repetition field (SEMI P39 section 7.6). Type 0 keeps the modal repetition.
+    void readRepetition() {
+        uint64_t type = readUInt();
+        if (type == 0) {
+            if (!m_modal.has_repetition && !m_scan) fail("repetition reuse without a previous repetition");
+            return;
+        }
+        Repetition& rep = m_modal.repetition;
+        m_modal.has_repetition = true;
+        rep.lattice = true;
+        rep.n_count = rep.m_count = 1;
+        rep.n_step = rep.m_step = OasisPoint{0, 0};
+        rep.offsets.clear();
+
+        auto explicit_list = [&](uint64_t dimension, bool along_x, uint64_t grid) {
+            rep.lattice = false;
+            int64_t position = 0;
+            rep.offsets.push_back(OasisPoint{0, 0});
+            for (uint64_t i = 0; i <= dimension; ++i) {
+                position += (int64_t)(readUInt() * grid);
+                rep.offsets.push_back(along_x ? OasisPoint{position, 0} : OasisPoint{0, position});
+            }
+        };
+
+        switch (type) {
+        case 1:
+            rep.n_count = readUInt() + 2;
+            rep.m_count = readUInt() + 2;
+            rep.n_step = OasisPoint{(int64_t)readUInt(), 0};
+            rep.m_step = OasisPoint{0, (int64_t)readUInt()};
+            break;
+        case 2:
+            rep.n_count = readUInt() + 2;
+            rep.n_step = OasisPoint{(int64_t)readUInt(), 0};
+            break;
+        case 3:
+            rep.m_count = readUInt() + 2;
+            rep.m_step = OasisPoint{0, (int64_t)readUInt()};
+            break;
+        case 4: { uint64_t d = readUInt(); explicit_list(d, true, 1); break; }
+        case 5: { uint64_t d = readUInt(); uint64_t g = readUInt(); explicit_list(d, true, g); break; }
+        case 6: { uint64_t d = readUInt(); explicit_list(d, false, 1); break; }
+        case 7: { uint64_t d = readUInt(); uint64_t g = readUInt(); explicit_list(d, false, g); break; }
+        case 8:
+            rep.n_count = readUInt() + 2;
+            rep.m_count = readUInt() + 2;
+            rep.n_step = readGDelta();
+            rep.m_step = readGDelta();
+            break;
+        case 9:
+            rep.n_count = readUInt() + 2;
+            rep.n_step = readGDelta();
+            break;
+        case 10:
+        case 11: {
+            uint64_t dimension = readUInt();
+            int64_t grid = type == 11 ? (int64_t)readUInt() : 1;
+            rep.lattice = false;
+            OasisPoint position{0, 0};
+            rep.offsets.push_back(position);
+            for (uint64_t i = 0; i <= dimension; ++i) {
+                OasisPoint d = readGDelta();
+                position.x += d.x * grid;
+                position.y += d.y * grid;
+                rep.offsets.push_back(position);
+            }
+            break;
+        }
+        default:
+            fail("invalid repetition type");
+        }
+    }
+
+    void expandRepetition(std::vector<OasisPoint>& offsets) const {
+        const Repetition& rep = m_modal.repetition;
+        offsets.clear();
+        if (!rep.lattice) {
+            offsets = rep.offsets;
+            return;
+        }
+        offsets.reserve(rep.n_count * rep.m_count);
+        for (uint64_t j = 0; j < rep.m_count; ++j) {
+            for (uint64_t i = 0; i < rep.n_count; ++i) {
+                offsets.push_back(OasisPoint{(int64_t)i * rep.n_step.x + (int64_t)j * rep.m_step.x,
+                                             (int64_t)i * rep.n_step.y + (int64_t)j * rep.m_step.y});
+            }
+        }
+    }
+
+    // x/y fields honour the modal xy-mode: absolute values or deltas to the modal position
+    void readXY(uint8_t info, uint8_t x_bit, uint8_t y_bit, int64_t& x, int64_t& y) {
+        if (info & x_bit) x = m_modal.xy_relative ? x + readSInt() : readSInt();
+        if (info & y_bit) y = m_modal.xy_relative ? y + readSInt() : readSInt();
+    }
+
+    void readLayerDatatype(uint8_t info) {
+        if (info & 0x01) m_modal.layer = (uint32_t)readUInt();
+        if (info & 0x02) m_modal.datatype = (uint32_t)readUInt();
+    }
+
+    // Hand m_shape (relative to the shape position) to the sink, once per repetition instance
+    void emitShape(bool has_repetition) {
+        const int64_t x = m_modal.geometry_x;
+        const int64_t y = m_modal.geometry_y;
+        if (has_repetition) {
+            expandRepetition(m_offsets);
+        } else {
+            m_offsets.assign(1, OasisPoint{0, 0});
+        }
+        if (m_events) {
+            // Expanded when the segment is replayed
+            m_events->onShape(m_modal.layer, m_modal.datatype, m_shape.data(), m_shape.size(), OasisPoint{x, y}, m_offsets.data(), m_offsets.size());
+            m_stats.polygons_emitted += m_offsets.size();
+            return;
+        }
+        m_instance.resize(m_shape.size());
+        for (const OasisPoint& offset : m_offsets) {
+            for (std::size_t i = 0; i < m_shape.size(); ++i) {
+                m_instance[i] = OasisPoint{m_shape[i].x + x + offset.x, m_shape[i].y + y + offset.y};
+            }
+            m_sink.onPolygon(m_modal.layer, m_modal.datatype, m_instance.data(), m_instance.size());
+            ++m_stats.polygons_emitted;
+        }
+    }
+
+    void setBox(int64_t x0, int64_t y0, int64_t x1, int64_t y1) {
+        m_shape.clear();
+        m_shape.push_back(OasisPoint{x0, y0});
+        m_shape.push_back(OasisPoint{x1, y0});
+        m_shape.push_back(OasisPoint{x1, y1});
+        m_shape.push_back(OasisPoint{x0, y1});
+    }
+
+    // --- Records ---
+
+    void readRectangle() {
+        uint8_t info = readByte();
+        readLayerDatatype(info);
+        if (info & 0x40) m_modal.geometry_w = readUInt();
+        if (info & 0x80) {
+            m_modal.geometry_h = m_modal.geometry_w; // Square
+        } else if (info & 0x20) {
+            m_modal.geometry_h = readUInt();
+        }
+        readXY(info, 0x10, 0x08, m_modal.geometry_x, m_modal.geometry_y);
+        if (info & 0x04) readRepetition();
+
+        if (!m_sink.wantsLayer(m_modal.layer, m_modal.datatype)) {
+            ++m_stats.shapes_skipped;
+            return;
+        }
+        setBox(0, 0, (int64_t)m_modal.geometry_w, (int64_t)m_modal.geometry_h);
+        emitShape(info & 0x04);
+    }
+
+    void readPolygon() {
+        uint8_t info = readByte();
+        readLayerDatatype(info);
+        if (info & 0x20) readPointList(m_modal.polygon_points, true);
+        readXY(info, 0x10, 0x08, m_modal.geometry_x, m_modal.geometry_y);
+        if (info & 0x04) readRepetition();
+
+        if (!m_sink.wantsLayer(m_modal.layer, m_modal.datatype)) {
+            ++m_stats.shapes_skipped;
+            return;
+        }
+        m_shape = m_modal.polygon_points;
+        emitShape(info & 0x04);
+    }
+
+    void readPath() {
+        uint8_t info = readByte();
+        readLayerDatatype(info);
+        if (info & 0x40) readUInt(); // Half-width
+        if (info & 0x80) {
+            uint64_t scheme = readUInt();
+            if ((scheme & 0x0C) == 0x0C) readSInt(); // Start extension
+            if ((scheme & 0x03) == 0x03) readSInt(); // End extension
+        }
+        if (info & 0x20) readPointList(m_modal.path_points, false);
+        readXY(info, 0x10, 0x08, m_modal.geometry_x, m_modal.geometry_y);
+        if (info & 0x04) readRepetition();
+
+        // Paths are not converted to polygons, matching the gdstk based loader (which only reads polygon_array)
+        if (m_sink.wantsLayer(m_modal.layer, m_modal.datatype)) {
+            ++m_stats.paths_skipped;
+        } else {
+            ++m_stats.shapes_skipped;
+        }
+    }
+
+    // TRAPEZOID records 23 (both deltas), 24 (delta-a only) and 25 (delta-b only).
+    // delta-a/delta-b are the offsets of the first/second slanted side between its two ends.
+    void readTrapezoid(uint64_t record) {
+        uint8_t info = readByte();
+        readLayerDatatype(info);
+        if (info & 0x40) m_modal.geometry_w = readUInt();
+        if (info & 0x20) m_modal.geometry_h = readUInt();
+        int64_t delta_a = record != 25 ? readSInt() : 0;
+        int64_t delta_b = record != 24 ? readSInt() : 0;
+        readXY(info, 0x10, 0x08, m_modal.geometry_x, m_modal.geometry_y);
+        if (info & 0x04) readRepetition();
+
+        if (!m_sink.wantsLayer(m_modal.layer, m_modal.datatype)) {
+            ++m_stats.shapes_skipped;
+            return;
+        }
+        const int64_t w = (int64_t)m_modal.geometry_w;
+        const int64_t h = (int64_t)m_modal.geometry_h;
+        m_shape.clear();
+        if (info & 0x80) {
+            // Vertical: left side x = 0 and right side x = w are the parallel sides
+            m_shape.push_back(OasisPoint{0, std::max<int64_t>(0, -delta_a)});
+            m_shape.push_back(OasisPoint{w, std::max<int64_t>(0, delta_a)});
+            m_shape.push_back(OasisPoint{w, h + std::min<int64_t>(0, delta_b)});
+            m_shape.push_back(OasisPoint{0, h - std::max<int64_t>(0, delta_b)});
+        } else {
+            // Horizontal: bottom y = 0 and top y = h are the parallel sides
+            m_shape.push_back(OasisPoint{std::max<int64_t>(0, -delta_a), 0});
+            m_shape.push_back(OasisPoint{w - std::max<int64_t>(0, delta_b), 0});
+            m_shape.push_back(OasisPoint{w + std::min<int64_t>(0, delta_b), h});
+            m_shape.push_back(OasisPoint{std::max<int64_t>(0, delta_a), h});
+        }
+        emitShape(info & 0x04);
+    }
+
+    void readCTrapezoid() {
+        uint8_t info = readByte();
+        readLayerDatatype(info);
+        if (info & 0x80) m_modal.ctrapezoid_type = readUInt();
+        if (info & 0x40) m_modal.geometry_w = readUInt();
+        if (info & 0x20) m_modal.geometry_h = readUInt();
+        readXY(info, 0x10, 0x08, m_modal.geometry_x, m_modal.geometry_y);
+        if (info & 0x04) readRepetition();
+
+        if (!m_sink.wantsLayer(m_modal.layer, m_modal.datatype)) {
+            ++m_stats.shapes_skipped;
+            return;
+        }
+        const uint64_t type = m_modal.ctrapezoid_type;
+        int64_t w = (int64_t)m_modal.geometry_w;
+        int64_t h = (int64_t)m_modal.geometry_h;
+        // Types with an implied dimension (SEMI P39 table 7)
+        if ((type >= 16 && type <= 19) || type == 25) h = w;
+        if (type == 20 || type == 21) w = 2 * h;
+        if (type == 22 || type == 23) h = 2 * w;
+
+        m_shape.clear();
+        auto add = [this](int64_t x, int64_t y) { m_shape.push_back(OasisPoint{x, y}); };
+        switch (type) {
+        case 0: add(0, 0); add(w, 0); add(w - h, h); add(0, h); break;
+        case 1: add(0, 0); add(w - h, 0); add(w, h); add(0, h); break;
+        case 2: add(0, 0); add(w, 0); add(w, h); add(h, h); break;
+        case 3: add(h, 0); add(w, 0); add(w, h); add(0, h); break;
+        case 4: add(0, 0); add(w, 0); add(w - h, h); add(h, h); break;
+        case 5: add(h, 0); add(w - h, 0); add(w, h); add(0, h); break;
+        case 6: add(0, 0); add(w - h, 0); add(w, h); add(h, h); break;
+        case 7: add(h, 0); add(w, 0); add(w - h, h); add(0, h); break;
+        case 8: add(0, 0); add(w, 0); add(w, h - w); add(0, h); break;
+        case 9: add(0, 0); add(w, 0); add(w, h); add(0, h - w); break;
+        case 10: add(0, 0); add(w, w); add(w, h); add(0, h); break;
+        case 11: add(0, w); add(w, 0); add(w, h); add(0, h); break;
+        case 12: add(0, 0); add(w, w); add(w, h - w); add(0, h); break;
+        case 13: add(0, w); add(w, 0); add(w, h); add(0, h - w); break;
+        case 14: add(0, 0); add(w, w); add(w, h); add(0, h - w); break;
+        case 15: add(0, w); add(w, 0); add(w, h - w); add(0, h); break;
+        case 16: add(0, 0); add(w, 0); add(0, w); break;
+        case 17: add(0, 0); add(w, w); add(0, w); break;
+        case 18: add(0, 0); add(w, 0); add(w, w); break;
+        case 19: add(w, 0); add(w, w); add(0, w); break;
+        case 20: add(0, 0); add(2 * h, 0); add(h, h); break;
+        case 21: add(h, 0); add(2 * h, h); add(0, h); break;
+        case 22: add(0, 0); add(w, w); add(0, 2 * w); break;
+        case 23: add(w, 0); add(w, 2 * w); add(0, w); break;
+        case 24:
+        case 25: add(0, 0); add(w, 0); add(w, h); add(0, h); break;
+        default: fail("invalid ctrapezoid type");
+        }
+        emitShape(info & 0x04);
+    }
+
+    void readCircle() {
+        uint8_t info = readByte();
+        readLayerDatatype(info);
+        if (info & 0x20) m_modal.circle_radius = readUInt();
+        readXY(info, 0x10, 0x08, m_modal.geometry_x, m_modal.geometry_y);
+        if (info & 0x04) readRepetition();
+
+        if (!m_sink.wantsLayer(m_modal.layer, m_modal.datatype)) {
+            ++m_stats.shapes_skipped;
+            return;
+        }
+        // Polygonize with a chord error of at most one database unit
+        const double r = (double)m_modal.circle_radius;
+        std::size_t n = 8;
+        if (r > 1.0) n = std::max<std::size_t>(n, (std::size_t)std::ceil(M_PI / std::acos(1.0 - 1.0 / r)));
+        m_shape.clear();
+        for (std::size_t i = 0; i < n; ++i) {
+            double angle = 2.0 * M_PI * (double)i / (double)n;
+            m_shape.push_back(OasisPoint{std::llround(r * std::cos(angle)), std::llround(r * std::sin(angle))});
+        }
+        emitShape(info & 0x04);
+    }
+
+    void readPlacement(uint64_t record) {
+        const bool hierarchy = m_sink.wantsHierarchy();
+        uint8_t info = readByte();
+        if (info & 0x80) {
+            OasisCellRef& cell = m_modal.placement_cell;
+            cell.by_number = (info & 0x40) != 0;
+            if (cell.by_number) {
+                cell.number = readUInt();
+                cell.name.clear();
+            } else if (hierarchy) {
+                cell.name = readString();
+            } else {
+                skipString();
+            }
+        }
+        OasisPlacement placement;
+        if (record == 18) {
+            if (info & 0x04) placement.magnification = readReal();
+            if (info & 0x02) placement.angle = readReal();
+        } else {
+            placement.angle = 90.0 * ((info >> 1) & 3);
+        }
+        placement.flip = (info & 0x01) != 0;
+        readXY(info, 0x20, 0x10, m_modal.placement_x, m_modal.placement_y);
+        if (info & 0x08) readRepetition();
+        if (!hierarchy) return;
+
+        placement.cell = m_modal.placement_cell;
+        if (info & 0x08) {
+            expandRepetition(m_offsets);
+        } else {
+            m_offsets.assign(1, OasisPoint{0, 0});
+        }
+        for (const OasisPoint& offset : m_offsets) {
+            placement.x = m_modal.placement_x + offset.x;
+            placement.y = m_modal.placement_y + offset.y;
+            m_sink.onPlacement(placement);
+        }
+    }
+
+    void readText() {
+        uint8_t info = readByte();
+        if (info & 0x40) {
+            if (info & 0x20) readUInt(); else skipString();
+        }
+        if (info & 0x01) readUInt(); // Text layer
+        if (info & 0x02) readUInt(); // Text type
+        readXY(info, 0x10, 0x08, m_modal.text_x, m_modal.text_y);
+        if (info & 0x04) readRepetition();
+    }
+
+    void readProperty() {
+        uint8_t info = readByte();
+        if (info & 0x04) {
+            if (info & 0x02) readUInt(); else skipString(); // Property name reference or string
+        }
+        if (info & 0x08) return; // Reuse the last value list
+        uint64_t count = info >> 4;
+        if (count == 15) count = readUInt();
+        for (uint64_t i = 0; i < count; ++i) {
+            uint64_t type = readUInt();
+            if (type <= 7) {
+                // Types 0-7 are reals and the value type doubles as the real number format
+                switch (type) {
+                case 0: case 1: case 2: case 3: readUInt(); break;
+                case 4: case 5: readUInt(); readUInt(); break;
+                case 6: skipBytes(4); break;
+                default: skipBytes(8); break;
+                }
+            } else if (type == 8) {
+                readUInt();
+            } else if (type == 9) {
+                readSInt();
+            } else if (type <= 12) {
+                skipString();
+            } else if (type <= 15) {
+                readUInt();
+            } else {
+                fail("invalid property value type");
+            }
+        }
+    }
+
+    void readXGeometry() {
+        uint8_t info = readByte();
+        readLayerDatatype(info);
+        readUInt();   // Attribute
+        skipString(); // Payload
+        readXY(info, 0x10, 0x08, m_modal.geometry_x, m_modal.geometry_y);
+        if (info & 0x04) readRepetition();
+        ++m_stats.shapes_skipped;
+    }
+
+    // Read a CBLOCK and continue decoding from its inflated contents
+    void readCBlock() {
+        if (m_in_cblock) fail("nested CBLOCK");
+        uint64_t method = readUInt();
+        uint64_t uncompressed_size = readUInt();
+        uint64_t compressed_size = readUInt();
+        if (method != 0) fail("unsupported CBLOCK compression method");
+
+        // Inflate in place when the compressed bytes are contiguous (always with a mapping)
+        const uint8_t* compressed;
+        if ((uint64_t)(m_end - m_cur) >= compressed_size) {
+            compressed = m_cur;
+            m_cur += compressed_size;
+        } else {
+            m_compressed.resize((std::size_t)compressed_size);
+            readBytes(m_compressed.data(), compressed_size);
+            compressed = m_compressed.data();
+        }
+        m_cblock.resize((std::size_t)uncompressed_size);
+        inflateBlock(compressed, compressed_size, m_cblock.data(), uncompressed_size);
+
+        ++m_stats.cblocks;
+        m_file_cur = m_cur;
+        m_file_end = m_end;
+        m_cur = m_cblock.data();
+        m_end = m_cur + m_cblock.size();
+        m_in_cblock = true;
+    }
+
+    // Inflate the raw deflate payload of a CBLOCK into out[0, size)
+    static void inflateBlock(const uint8_t* compressed, uint64_t compressed_size, uint8_t* out, uint64_t size) {
+        z_stream stream;
+        std::memset(&stream, 0, sizeof(stream));
+        if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) fail("unable to initialize zlib");
+        stream.next_in = (Bytef*)compressed;
+        stream.avail_in = (uInt)compressed_size;
+        stream.next_out = out;
+        stream.avail_out = (uInt)size;
+        int status = inflate(&stream, Z_FINISH);
+        inflateEnd(&stream);
+        if (status != Z_STREAM_END || stream.total_out != size) fail("corrupt CBLOCK");
+    }
+
+    void readStart() {
+        std::string version = readString();
+        if (version != "1.0") fail("unsupported OASIS version " + version);
+        double grid_per_micron = readReal();
+        if (!(grid_per_micron > 0.0)) fail("invalid unit in START record");
+        m_db_unit = 1e-6 / grid_per_micron;
+        m_table_offsets_at_end = readUInt() != 0;
+        if (!m_table_offsets_at_end) {
+            for (int i = 0; i < 12; ++i) readUInt();
+        }
+        m_sink.onStart(m_db_unit);
+    }
+
+    void readMagic() {
+        static const char magic[] = "%SEMI-OASIS\r\n";
+        uint8_t header[13];
+        readBytes(header, 13);
+        if (std::memcmp(header, magic, 13) != 0) fail("missing OASIS magic bytes");
+    }
+
+    // Decode one record after its type. Returns false at the END record.
+    bool decodeRecord(uint64_t record) {
+        switch (record) {
+        case 0: break; // PAD
+        case 1: readStart(); break;
+        case 2: return false; // END; table offsets, padding and validation are not needed
+        case 3:
+        case 4: {
+            std::string name = readString();
+            uint64_t number = record == 3 ? m_next_cellname++ : readUInt();
+            m_sink.onCellName(number, name);
+            break;
+        }
+        case 5: case 7: case 9: skipString(); break; // Name with implicit reference number
+        case 6: case 8: case 10: skipString(); readUInt(); break;
+        case 11:
+        case 12: {
+            skipString();
+            for (int interval = 0; interval < 2; ++interval) {
+                uint64_t type = readUInt();
+                if (type >= 1 && type <= 3) readUInt();
+                else if (type == 4) { readUInt(); readUInt(); }
+                else if (type > 4) fail("invalid interval type");
+            }
+            break;
+        }
+        case 13:
+        case 14: {
+            OasisCellRef cell;
+            cell.by_number = record == 13;
+            if (cell.by_number) cell.number = readUInt(); else cell.name = readString();
+            m_modal = Modal();
+            m_sink.onCell(cell);
+            break;
+        }
+        case 15: m_modal.xy_relative = false; break;
+        case 16: m_modal.xy_relative = true; break;
+        case 17: case 18: readPlacement(record); break;
+        case 19: readText(); break;
+        case 20: readRectangle(); break;
+        case 21: readPolygon(); break;
+        case 22: readPath(); break;
+        case 23: case 24: case 25: readTrapezoid(record); break;
+        case 26: readCTrapezoid(); break;
+        case 27: readCircle(); break;
+        case 28: readProperty(); break;
+        case 29: break; // PROPERTY repeating the last one
+        case 30: readUInt(); skipString(); break;
+        case 31: readUInt(); skipString(); readUInt(); break;
+        case 32: readUInt(); skipString(); break;
+        case 33: readXGeometry(); break;
+        case 34: readCBlock(); break;
+        default: fail("unknown record type " + std::to_string(record));
+        }
+        return true;
+    }
+
+    void decode() {
+        readMagic();
+        bool started = false;
+        for (;;) {
+            uint64_t record = readUInt();
+            ++m_stats.records;
+            if (!started && record != 0 && record != 1) fail("first record is not START");
+            if (record == 1) started = true;
+            if (!decodeRecord(record)) return;
+        }
+    }
+
+    // --- Parallel decoding ---
+
+    // End the current piece of a scan at `at` and start the next one there
+    void cutPiece(const uint8_t* at, bool starts_cell) {
+        ScanState& state = *m_scan;
+        if (at > state.piece_start) {
+            TopLevelItem item;
+            item.piece.data = state.piece_start;
+            item.piece.size = (std::size_t)(at - state.piece_start);
+            item.piece.starts_cell = state.piece_starts_cell;
+            item.piece.cellnames = state.cellnames;
+            state.items.push_back(std::move(item));
+            state.cellnames = 0;
+        }
+        state.piece_start = at;
+        state.piece_starts_cell = starts_cell;
+    }
+
+    // Walk the records of [data, data + size) without expanding shapes and cut them into
+    // pieces at every CELL record (and every few MiB, at record boundaries). Record lengths
+    // do not depend on the modal variables, so any buffer of whole records can be scanned.
+    // At the top level CBLOCKs are noted instead of inflated and the walk stops at END.
+    void scan(const uint8_t* data, std::size_t size, ScanState& state) {
+        const std::size_t piece_bytes = 4u << 20;
+        m_cur = data;
+        m_end = data + size;
+        m_scan = &state;
+        state.piece_start = data;
+        bool started = !state.top_level;
+        for (;;) {
+            if (m_cur == m_end) {
+                if (state.top_level) fail("unexpected end of file");
+                cutPiece(m_end, false);
+                break;
+            }
+            const uint8_t* record_start = m_cur;
+            uint64_t record = readUInt();
+            if (!started && record != 0 && record != 1) fail("first record is not START");
+            if (record == 1) started = true;
+
+            if (record == 13 || record == 14) {
+                cutPiece(record_start, true);
+            } else if ((std::size_t)(record_start - state.piece_start) >= piece_bytes) {
+                cutPiece(record_start, false);
+            }
+            if (record == 3) ++state.cellnames;
+            if (record == 34) {
+                if (!state.top_level) fail("nested CBLOCK");
+                cutPiece(record_start, false);
+                TopLevelItem item;
+                item.cblock = true;
+                if (readUInt() != 0) fail("unsupported CBLOCK compression method");
+                item.uncompressed_size = readUInt();
+                item.compressed_size = readUInt();
+                if ((uint64_t)(m_end - m_cur) < item.compressed_size) fail("unexpected end of file");
+                item.compressed = m_cur;
+                m_cur += item.compressed_size;
+                state.items.push_back(std::move(item));
+                state.piece_start = m_cur;
+                continue;
+            }
+            if (!decodeRecord(record)) {
+                cutPiece(record_start, false); // END
+                break;
+            }
+        }
+        m_scan = nullptr;
+    }
+
+    // Decode the records of pieces[0, count). Called again with the pieces that follow,
+    // the reader continues the same cell with its modal variables.
+    void decodePieces(const StreamPiece* pieces, std::size_t count) {
+        m_pieces = pieces;
+        m_piece_count = count;
+        m_next_piece = 0;
+        m_cur = m_end = nullptr;
+        while (m_cur != m_end || refill()) {
+            uint64_t record = readUInt();
+            ++m_stats.records;
+            if (!decodeRecord(record)) break;
+        }
+        m_pieces = nullptr;
+        m_piece_count = m_next_piece = 0;
+    }
+
+    void addStats(const OasisReadStats& stats) {
+        m_stats.records += stats.records;
+        m_stats.cblocks += stats.cblocks;
+        m_stats.polygons_emitted += stats.polygons_emitted;
+        m_stats.shapes_skipped += stats.shapes_skipped;
+        m_stats.paths_skipped += stats.paths_skipped;
+    }
+
+    // Parallel decode of the mapped file, see the comment at the top of this file
+    void decodeParallel() {
+        readMagic();
+        ScanState top;
+        top.top_level = true;
+        {
+            NullSink null_sink;
+            OasisReader scanner(null_sink);
+            scanner.scan(m_cur, (std::size_t)(m_end - m_cur), top);
+            m_db_unit = scanner.m_db_unit;
+        }
+        std::size_t cells = 0;
+        bool compressed = false;
+        for (const TopLevelItem& item : top.items) {
+            if (item.cblock) compressed = true;
+            else if (item.piece.starts_cell) ++cells;
+        }
+        if (!compressed && cells < 2) {
+            // Nothing to inflate and at most one cell: decode the mapping in place
+            m_cur = m_mapping.data();
+            m_end = m_cur + m_mapping.size();
+            decode();
+            return;
+        }
+
+        // One decoder per segment; the last one of a wave is carried over while its cell continues
+        struct SegmentDecoder {
+            std::unique_ptr<OasisEventBuffer> buffer;
+            std::unique_ptr<OasisReader> reader;
+        };
+
+        ThreadPool pool(m_threads);
+        std::mutex sink_mutex;
+        const bool hierarchy = m_sink.wantsHierarchy();
+        const uint64_t wave_bytes = (uint64_t)m_threads << 25; // 32 MiB of records per thread
+        SegmentDecoder carried;
+        uint64_t cellnames = 0; // Implicit CELLNAME numbers used before the current wave
+        std::size_t next = 0;
+        while (next < top.items.size()) {
+            std::size_t wave_end = next;
+            uint64_t bytes = 0;
+            while (wave_end < top.items.size() && (wave_end == next || bytes < wave_bytes)) {
+                const TopLevelItem& item = top.items[wave_end++];
+                bytes += item.cblock ? item.uncompressed_size : item.piece.size;
+                if (item.cblock) {
+                    ++m_stats.cblocks;
+                    ++m_stats.records;
+                }
+            }
+
+            // Inflate the CBLOCKs of the wave and cut them at their CELL records
+            std::vector<std::vector<StreamPiece>> expanded(wave_end - next);
+            parallel_for(pool, expanded.size(), [&](std::size_t i) {
+                TraceScope trace("inflate_cblock");
+                const TopLevelItem& item = top.items[next + i];
+                if (!item.cblock) {
+                    expanded[i].push_back(item.piece);
+                    return;
+                }
+                std::shared_ptr<std::vector<uint8_t>> block = std::make_shared<std::vector<uint8_t>>((std::size_t)item.uncompressed_size);
+                inflateBlock(item.compressed, item.compressed_size, block->data(), item.uncompressed_size);
+                NullSink null_sink;
+                OasisReader scanner(null_sink);
+                ScanState state;
+                scanner.scan(block->data(), block->size(), state);
+                for (TopLevelItem& part : state.items) {
+                    part.piece.block = block;
+                    expanded[i].push_back(std::move(part.piece));
+                }
+            });
+            next = wave_end;
+
+            std::vector<StreamPiece> pieces;
+            for (auto& part : expanded) {
+                for (auto& piece : part) pieces.push_back(std::move(piece));
+            }
+            expanded.clear();
+            if (pieces.empty()) continue;
+
+            // Segments start at CELL records; the first one may continue the carried cell
+            std::vector<std::size_t> starts;
+            std::vector<uint64_t> first_cellname;
+            for (std::size_t k = 0; k < pieces.size(); ++k) {
+                if (k == 0 || pieces[k].starts_cell) {
+                    starts.push_back(k);
+                    first_cellname.push_back(cellnames);
+                }
+                cellnames += pieces[k].cellnames;
+            }
+            std::vector<SegmentDecoder> decoders(starts.size());
+            const bool continued = carried.reader && !pieces[0].starts_cell;
+            if (continued) decoders[0] = std::move(carried);
+            carried = SegmentDecoder();
+
+            parallel_for(pool, decoders.size(), [&](std::size_t s) {
+                TraceScope trace("decode_segment");
+                SegmentDecoder& decoder = decoders[s];
+                if (!decoder.reader) {
+                    decoder.buffer.reset(new OasisEventBuffer(m_sink, sink_mutex, hierarchy));
+                    decoder.reader.reset(new OasisReader(*decoder.buffer));
+                    decoder.reader->m_events = decoder.buffer.get();
+                    decoder.reader->m_next_cellname = first_cellname[s];
+                }
+                const std::size_t end = s + 1 < starts.size() ? starts[s + 1] : pieces.size();
+                decoder.reader->decodePieces(&pieces[starts[s]], end - starts[s]);
+            });
+
+            // Replay in file order on the calling thread
+            for (SegmentDecoder& decoder : decoders) {
+                decoder.buffer->replay(m_sink);
+                decoder.buffer->clear();
+                addStats(decoder.reader->m_stats);
+                decoder.reader->m_stats = OasisReadStats();
+            }
+            m_stats.segments += decoders.size() - (continued ? 1 : 0);
+            if (next < top.items.size()) carried = std::move(decoders.back());
+        }
+        ++m_stats.records; // END
+    }
+};
+
+#endif // DFM_OASIS_READER_H
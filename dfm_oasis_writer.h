@@ -0,0 +1,576 @@
+#ifndef DFM_OASIS_WRITER_H
+#define DFM_OASIS_WRITER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <zlib.h>
+
+#include "dfm_oasis_reader.h"
+#include "dfm_thread_pool.h"
+#include "dfm_trace.h"
+
+// Streaming OASIS (SEMI P39) writer.
+//
+// Shapes are appended one at a time and written as soon as a window of them
+// has been collected; the window is the only geometry the writer holds. Within
+// a window, shapes with identical geometry on the same layer are grouped and
+// their positions searched for regular pitches, which are written as OASIS
+// repetitions (matrices, rows and columns) instead of one record per shape.
+// Records reuse the modal layer, datatype, geometry and repetition whenever
+// possible. With compression enabled, the record stream is cut into blocks
+// that are deflated in parallel and written as CBLOCK records in order, so
+// peak memory stays at a few blocks per thread.
+
+struct OasisWriterOptions {
+    bool compress = false;                  // Wrap the records in deflate-compressed CBLOCKs
+    unsigned threads = 1;                   // Compression threads (0 = hardware concurrency)
+    std::size_t window_shapes = 1 << 16;    // Shapes buffered for repetition detection
+    std::size_t block_bytes = 1 << 20;      // Uncompressed bytes per CBLOCK
+};
+
+struct OasisWriteStats {
+    uint64_t shapes = 0;             // Shapes passed to addPolygon
+    uint64_t shape_records = 0;      // RECTANGLE and POLYGON records written
+    uint64_t repetitions = 0;        // Records that carry a repetition
+    uint64_t placements = 0;         // PLACEMENT records
+    uint64_t cblocks = 0;            // Compressed blocks written
+    uint64_t bytes_written = 0;      // File size
+};
+
+class OasisWriter {
+public:
+    // Create the file and write the header. db_unit is the database unit in meters.
+    // Throws std::runtime_error if the file cannot be created.
+    OasisWriter(const std::string& filename, double db_unit, const OasisWriterOptions& options = OasisWriterOptions())
+        : m_filename(filename), m_options(options) {
+        if (m_options.block_bytes == 0) m_options.block_bytes = 1 << 20;
+        if (m_options.window_shapes == 0) m_options.window_shapes = 1;
+        m_file = std::fopen(filename.c_str(), "wb");
+        if (!m_file) throw std::runtime_error("cannot create " + filename);
+        if (m_options.compress) {
+            unsigned threads = m_options.threads != 0 ? m_options.threads : std::max(1u, std::thread::hardware_concurrency());
+            if (threads > 1) m_pool.reset(new ThreadPool(threads));
+        }
+
+        static const char magic[] = "%SEMI-OASIS\r\n";
+        std::string start(magic, 13);
+        putUInt(start, 1);
+        putString(start, "1.0");
+        putReal(start, gridPerMicron(db_unit));
+        putUInt(start, 0);              // Table offsets follow in START; no name tables are written
+        for (int i = 0; i < 12; ++i) putUInt(start, 0);
+        writeFile(start);
+    }
+
+    ~OasisWriter() {
+        if (!m_file) return;
+        try {
+            close();
+        } catch (const std::exception&) {
+            // Destructors must not throw; call close() to see write errors
+        }
+    }
+
+    OasisWriter(const OasisWriter&) = delete;
+    OasisWriter& operator=(const OasisWriter&) = delete;
+
+    // Start a new cell; the following shapes belong to it
+    void beginCell(const std::string& name) {
+        flushWindow();
+        putUInt(m_records, 14);
+        putString(m_records, name);
+        m_modal = Modal();
+        m_in_cell = true;
+        flushRecords(false);
+    }
+
+    // Append a polygon given by its open ring (the first point is not repeated).
+    // Rings with fewer than 3 distinct points are ignored.
+    void addPolygon(uint32_t layer, uint32_t datatype, const OasisPoint* points, std::size_t count) {
+        if (!m_in_cell) throw std::runtime_error("OASIS geometry written before beginCell()");
+        if (!canonicalize(points, count)) return;
+        ++m_stats.shapes;
+
+        // Geometry key: layer, datatype and the encoded shape without its position
+        m_key.clear();
+        putUInt(m_key, layer);
+        putUInt(m_key, datatype);
+        m_key.push_back((char)m_shape_kind);
+        m_key += m_template;
+        auto found = m_group_index.find(m_key);
+        std::size_t group;
+        if (found == m_group_index.end()) {
+            group = m_groups.size();
+            m_group_index.emplace(m_key, group);
+            m_groups.push_back(Group{layer, datatype, m_shape_kind, m_template, {}});
+        } else {
+            group = found->second;
+        }
+        m_groups[group].positions.push_back(m_position);
+        if (++m_window_size >= m_options.window_shapes) {
+            flushWindow();
+            flushRecords(false);
+        }
+    }
+
+    // Place a cell by name at (x, y), unrotated and unmirrored. The placed cell
+    // may be defined before or after the current one.
+    void addPlacement(const std::string& cell_name, int64_t x, int64_t y) {
+        if (!m_in_cell) throw std::runtime_error("OASIS placement written before beginCell()");
+        putUInt(m_records, 17);
+        m_records.push_back((char)0xb0); // CNXYRAAF: explicit cell name, x and y; no repetition
+        putString(m_records, cell_name);
+        putSInt(m_records, x);
+        putSInt(m_records, y);
+        ++m_stats.placements;
+        if (m_records.size() >= m_options.block_bytes) flushRecords(false);
+    }
+
+    // Write all buffered shapes and the END record, then close the file.
+    // Throws std::runtime_error on write errors.
+    void close() {
+        if (!m_file) return;
+        flushWindow();
+        flushRecords(true);
+
+        // END: record id, padding string and validation scheme, 256 bytes in total
+        std::string end;
+        putUInt(end, 2);
+        putString(end, std::string(252, '\0'));
+        putUInt(end, 0); // No validation
+        writeFile(end);
+
+        bool failed = std::fclose(m_file) != 0;
+        m_file = nullptr;
+        if (failed) throw std::runtime_error("error writing " + m_filename);
+    }
+
+    const OasisWriteStats& stats() const { return m_stats; }
+
+private:
+    enum ShapeKind : char { Rectangle, ManhattanH, ManhattanV, General };
+
+    // Shapes with identical geometry on one layer, collected in the current window
+    struct Group {
+        uint32_t layer, datatype;
+        ShapeKind kind;
+        std::string geometry;               // Encoded width/height or point list
+        std::vector<OasisPoint> positions;
+    };
+
+    // Modal variables as a reader sees them after the records written so far
+    struct Modal {
+        bool has_layer = false;
+        uint32_t layer = 0, datatype = 0;
+        int64_t x = 0, y = 0;
+        bool has_rectangle = false;
+        std::string rectangle;              // Encoded width/height of the last RECTANGLE
+        bool has_points = false;
+        std::string points;                 // Encoded point list of the last POLYGON
+        bool has_repetition = false;
+        std::string repetition;             // Encoded last repetition
+    };
+
+    std::string m_filename;
+    OasisWriterOptions m_options;
+    std::FILE* m_file = nullptr;
+    std::unique_ptr<ThreadPool> m_pool;     // Compression workers (compress with more than one thread)
+    bool m_in_cell = false;
+    Modal m_modal;
+    OasisWriteStats m_stats;
+
+    std::vector<Group> m_groups;                             // Current window, in first-appearance order
+    std::unordered_map<std::string, std::size_t> m_group_index;
+    std::size_t m_window_size = 0;                           // Shapes in the current window
+
+    std::string m_records;                  // Encoded records not yet written
+    std::vector<std::string> m_blocks;      // Full blocks waiting for parallel compression
+
+    // Scratch for the shape being added
+    std::vector<OasisPoint> m_ring;
+    OasisPoint m_position{0, 0};
+    ShapeKind m_shape_kind = General;
+    std::string m_template;
+    std::string m_key;
+
+    // --- Primitive encodings ---
+
+    static void putUInt(std::string& out, uint64_t value) {
+        do {
+            uint8_t byte = value & 0x7f;
+            value >>= 7;
+            if (value) byte |= 0x80;
+            out.push_back((char)byte);
+        } while (value);
+    }
+
+    static void putSInt(std::string& out, int64_t value) {
+        uint64_t magnitude = value < 0 ? (uint64_t)0 - (uint64_t)value : (uint64_t)value;
+        putUInt(out, magnitude << 1 | (value < 0 ? 1 : 0));
+    }
+
+    static void putString(std::string& out, const std::string& value) {
+        putUInt(out, value.size());
+        out += value;
+    }
+
+    // Grid steps per micron of a database unit in meters. The division is not exact
+    // for the usual units (1 nm gives 999.9999999999999), so a value within a tiny
+    // relative distance of a whole number is written as that whole number.
+    static double gridPerMicron(double db_unit) {
+        const double grid = 1e-6 / db_unit;
+        const double whole = std::round(grid);
+        return whole > 0.0 && std::abs(grid - whole) <= 1e-9 * whole ? whole : grid;
+    }
+
+    static void putReal(std::string& out, double value) {
+        double whole = std::round(value);
+        if (value > 0.0 && whole == value && whole < 9.0e15) {
+            putUInt(out, 0); // Positive whole number
+            putUInt(out, (uint64_t)whole);
+            return;
+        }
+        putUInt(out, 7); // IEEE double, little endian
+        uint64_t bits;
+        std::memcpy(&bits, &value, 8);
+        for (int i = 0; i < 8; ++i) out.push_back((char)(bits >> (8 * i) & 0xff));
+    }
+
+    // Displacement in the shortest g-delta form
+    static void putGDelta(std::string& out, int64_t dx, int64_t dy) {
+        int direction = -1;
+        int64_t magnitude = std::max(std::abs(dx), std::abs(dy));
+        if (dy == 0) direction = dx >= 0 ? 0 : 2;
+        else if (dx == 0) direction = dy > 0 ? 1 : 3;
+        else if (dx == dy) direction = dx > 0 ? 4 : 6;
+        else if (dx == -dy) direction = dx < 0 ? 5 : 7;
+        if (direction >= 0) {
+            putUInt(out, (uint64_t)magnitude << 4 | (uint64_t)direction << 1);
+            return;
+        }
+        uint64_t x_magnitude = dx < 0 ? (uint64_t)0 - (uint64_t)dx : (uint64_t)dx;
+        putUInt(out, x_magnitude << 2 | (dx < 0 ? 2 : 0) | 1);
+        putSInt(out, dy);
+    }
+
+    // --- Shapes ---
+
+    // Bring a ring into the canonical form used to find identical shapes: duplicate
+    // and collinear vertices removed, starting at the lowest-leftmost vertex.
+    // Sets m_position, m_shape_kind and m_template; false for degenerate rings.
+    bool canonicalize(const OasisPoint* points, std::size_t count) {
+        m_ring.clear();
+        for (std::size_t k = 0; k < count; ++k) {
+            if (m_ring.empty() || points[k].x != m_ring.back().x || points[k].y != m_ring.back().y) m_ring.push_back(points[k]);
+        }
+        while (m_ring.size() > 1 && m_ring.front().x == m_ring.back().x && m_ring.front().y == m_ring.back().y) m_ring.pop_back();
+
+        // Drop vertices in the middle of a straight edge (repeat until stable, the ring is cyclic)
+        bool removed = true;
+        while (removed && m_ring.size() >= 3) {
+            removed = false;
+            for (std::size_t k = 0; k < m_ring.size() && m_ring.size() >= 3;) {
+                const OasisPoint& prev = m_ring[(k + m_ring.size() - 1) % m_ring.size()];
+                const OasisPoint& cur = m_ring[k];
+                const OasisPoint& next = m_ring[(k + 1) % m_ring.size()];
+                double cross = (double)(cur.x - prev.x) * (double)(next.y - cur.y) - (double)(cur.y - prev.y) * (double)(next.x - cur.x);
+                if (cross == 0.0) {
+                    m_ring.erase(m_ring.begin() + k);
+                    removed = true;
+                } else {
+                    ++k;
+                }
+            }
+        }
+        if (m_ring.size() < 3) return false;
+
+        std::size_t first = 0;
+        for (std::size_t k = 1; k < m_ring.size(); ++k) {
+            if (m_ring[k].x < m_ring[first].x || (m_ring[k].x == m_ring[first].x && m_ring[k].y < m_ring[first].y)) first = k;
+        }
+        std::rotate(m_ring.begin(), m_ring.begin() + first, m_ring.end());
+        m_position = m_ring[0];
+
+        bool manhattan = m_ring.size() % 2 == 0;
+        for (std::size_t k = 0; manhattan && k < m_ring.size(); ++k) {
+            const OasisPoint& a = m_ring[k];
+            const OasisPoint& b = m_ring[(k + 1) % m_ring.size()];
+            manhattan = a.x == b.x || a.y == b.y;
+        }
+
+        m_template.clear();
+        if (manhattan && m_ring.size() == 4) {
+            // The lowest-leftmost vertex of a rectangle is its lower-left corner
+            int64_t width = 0, height = 0;
+            for (const auto& p : m_ring) {
+                width = std::max(width, p.x - m_position.x);
+                height = std::max(height, p.y - m_position.y);
+            }
+            m_shape_kind = Rectangle;
+            putUInt(m_template, (uint64_t)width);
+            putUInt(m_template, (uint64_t)height);
+        } else if (manhattan) {
+            // Edges alternate; the last two are implied by the start point
+            bool horizontal = m_ring[1].y == m_ring[0].y;
+            m_shape_kind = horizontal ? ManhattanH : ManhattanV;
+            putUInt(m_template, horizontal ? 0 : 1);
+            putUInt(m_template, m_ring.size() - 2);
+            for (std::size_t k = 1; k + 1 < m_ring.size(); ++k) {
+                putSInt(m_template, horizontal ? m_ring[k].x - m_ring[k - 1].x : m_ring[k].y - m_ring[k - 1].y);
+                horizontal = !horizontal;
+            }
+        } else {
+            // The closing edge is implied
+            m_shape_kind = General;
+            putUInt(m_template, 4);
+            putUInt(m_template, m_ring.size() - 1);
+            for (std::size_t k = 1; k < m_ring.size(); ++k) {
+                putGDelta(m_template, m_ring[k].x - m_ring[k - 1].x, m_ring[k].y - m_ring[k - 1].y);
+            }
+        }
+        return true;
+    }
+
+    // One shape record at (x, y), optionally with an encoded repetition
+    void writeShape(const Group& group, int64_t x, int64_t y, const std::string& repetition) {
+        const bool rectangle = group.kind == Rectangle;
+        uint8_t info = 0;
+        std::string body;
+        if (!m_modal.has_layer || m_modal.layer != group.layer) {
+            info |= 0x01;
+            putUInt(body, group.layer);
+        }
+        if (!m_modal.has_layer || m_modal.datatype != group.datatype) {
+            info |= 0x02;
+            putUInt(body, group.datatype);
+        }
+        m_modal.has_layer = true;
+        m_modal.layer = group.layer;
+        m_modal.datatype = group.datatype;
+
+        if (rectangle) {
+            if (!m_modal.has_rectangle || m_modal.rectangle != group.geometry) {
+                info |= 0x60; // Width and height
+                body += group.geometry;
+                m_modal.has_rectangle = true;
+                m_modal.rectangle = group.geometry;
+            }
+        } else if (!m_modal.has_points || m_modal.points != group.geometry) {
+            info |= 0x20; // Point list
+            body += group.geometry;
+            m_modal.has_points = true;
+            m_modal.points = group.geometry;
+        }
+
+        if (x != m_modal.x) {
+            info |= 0x10;
+            putSInt(body, x);
+            m_modal.x = x;
+        }
+        if (y != m_modal.y) {
+            info |= 0x08;
+            putSInt(body, y);
+            m_modal.y = y;
+        }
+        if (!repetition.empty()) {
+            info |= 0x04;
+            ++m_stats.repetitions;
+            if (m_modal.has_repetition && m_modal.repetition == repetition) {
+                putUInt(body, 0); // Reuse the modal repetition
+            } else {
+                body += repetition;
+                m_modal.has_repetition = true;
+                m_modal.repetition = repetition;
+            }
+        }
+
+        putUInt(m_records, rectangle ? 20 : 21);
+        m_records.push_back((char)info);
+        m_records += body;
+        ++m_stats.shape_records;
+        if (m_records.size() >= m_options.block_bytes) flushRecords(false);
+    }
+
+    // Arithmetic run of a sorted coordinate list starting at begin: returns its end and pitch
+    template <typename Get>
+    static std::size_t arithmeticRun(std::size_t begin, std::size_t end, Get get, int64_t& pitch) {
+        pitch = 0;
+        if (begin + 1 >= end || get(begin + 1) == get(begin)) return begin + 1;
+        pitch = get(begin + 1) - get(begin);
+        std::size_t k = begin + 2;
+        while (k < end && get(k) - get(k - 1) == pitch) ++k;
+        return k;
+    }
+
+    // Write one group: matrices of identical rows, then rows, then columns, then single shapes
+    void writeGroup(Group& group) {
+        std::vector<OasisPoint>& positions = group.positions;
+        std::sort(positions.begin(), positions.end(), [](const OasisPoint& a, const OasisPoint& b) {
+            return a.y != b.y ? a.y < b.y : a.x < b.x;
+        });
+
+        struct Row {
+            int64_t x, y, pitch;
+            std::size_t count;
+        };
+        std::vector<Row> rows;
+        std::vector<OasisPoint> singles;
+        for (std::size_t row_begin = 0; row_begin < positions.size();) {
+            std::size_t row_end = row_begin;
+            while (row_end < positions.size() && positions[row_end].y == positions[row_begin].y) ++row_end;
+            for (std::size_t k = row_begin; k < row_end;) {
+                int64_t pitch;
+                std::size_t run_end = arithmeticRun(k, row_end, [&](std::size_t i) { return positions[i].x; }, pitch);
+                if (run_end - k >= 2) rows.push_back(Row{positions[k].x, positions[k].y, pitch, run_end - k});
+                else singles.push_back(positions[k]);
+                k = run_end;
+            }
+            row_begin = row_end;
+        }
+
+        // Stack rows with the same start, pitch and length into matrices
+        std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+            if (a.x != b.x) return a.x < b.x;
+            if (a.pitch != b.pitch) return a.pitch < b.pitch;
+            if (a.count != b.count) return a.count < b.count;
+            return a.y < b.y;
+        });
+        std::string repetition;
+        for (std::size_t stack_begin = 0; stack_begin < rows.size();) {
+            std::size_t stack_end = stack_begin;
+            while (stack_end < rows.size() && rows[stack_end].x == rows[stack_begin].x && rows[stack_end].pitch == rows[stack_begin].pitch &&
+                   rows[stack_end].count == rows[stack_begin].count) {
+                ++stack_end;
+            }
+            for (std::size_t k = stack_begin; k < stack_end;) {
+                int64_t y_pitch;
+                std::size_t run_end = arithmeticRun(k, stack_end, [&](std::size_t i) { return rows[i].y; }, y_pitch);
+                const Row& row = rows[k];
+                repetition.clear();
+                if (run_end - k >= 2) {
+                    putUInt(repetition, 1);
+                    putUInt(repetition, row.count - 2);
+                    putUInt(repetition, run_end - k - 2);
+                    putUInt(repetition, (uint64_t)row.pitch);
+                    putUInt(repetition, (uint64_t)y_pitch);
+                } else {
+                    putUInt(repetition, 2);
+                    putUInt(repetition, row.count - 2);
+                    putUInt(repetition, (uint64_t)row.pitch);
+                }
+                writeShape(group, row.x, row.y, repetition);
+                k = run_end;
+            }
+            stack_begin = stack_end;
+        }
+
+        // Shapes that are alone in their row may still line up vertically
+        std::sort(singles.begin(), singles.end(), [](const OasisPoint& a, const OasisPoint& b) {
+            return a.x != b.x ? a.x < b.x : a.y < b.y;
+        });
+        for (std::size_t column_begin = 0; column_begin < singles.size();) {
+            std::size_t column_end = column_begin;
+            while (column_end < singles.size() && singles[column_end].x == singles[column_begin].x) ++column_end;
+            for (std::size_t k = column_begin; k < column_end;) {
+                int64_t pitch;
+                std::size_t run_end = arithmeticRun(k, column_end, [&](std::size_t i) { return singles[i].y; }, pitch);
+                repetition.clear();
+                if (run_end - k >= 2) {
+                    putUInt(repetition, 3);
+                    putUInt(repetition, run_end - k - 2);
+                    putUInt(repetition, (uint64_t)pitch);
+                }
+                writeShape(group, singles[k].x, singles[k].y, repetition);
+                k = run_end;
+            }
+            column_begin = column_end;
+        }
+    }
+
+    // Encode every shape of the window and start a new one
+    void flushWindow() {
+        for (auto& group : m_groups) writeGroup(group);
+        m_groups.clear();
+        m_group_index.clear();
+        m_window_size = 0;
+    }
+
+    // --- Output ---
+
+    void writeFile(const std::string& bytes) {
+        if (bytes.empty()) return;
+        if (std::fwrite(bytes.data(), 1, bytes.size(), m_file) != bytes.size()) throw std::runtime_error("error writing " + m_filename);
+        m_stats.bytes_written += bytes.size();
+    }
+
+    // Hand encoded records to the file. Uncompressed output goes out once a block
+    // is full; compressed output is collected into blocks and deflated in batches
+    // of two blocks per thread. Blocks end on record boundaries, as CBLOCKs must
+    // hold complete records. final writes whatever is left.
+    void flushRecords(bool final) {
+        if (!m_options.compress) {
+            if (final || m_records.size() >= m_options.block_bytes) {
+                writeFile(m_records);
+                m_records.clear();
+            }
+            return;
+        }
+        if (!m_records.empty() && (final || m_records.size() >= m_options.block_bytes)) {
+            m_blocks.push_back(std::move(m_records));
+            m_records.clear();
+        }
+        std::size_t batch = 2 * (m_pool ? m_pool->size() : 1);
+        if (m_blocks.empty() || (!final && m_blocks.size() < batch)) return;
+
+        std::vector<std::string> compressed(m_blocks.size());
+        auto deflate_block = [&](std::size_t i) {
+            TraceScope trace("deflate_cblock");
+            compressed[i] = deflateBlock(m_blocks[i]);
+        };
+        if (m_pool) parallel_for(*m_pool, m_blocks.size(), deflate_block);
+        else for (std::size_t i = 0; i < m_blocks.size(); ++i) deflate_block(i);
+        for (std::size_t i = 0; i < m_blocks.size(); ++i) {
+            std::string header;
+            putUInt(header, 34);
+            putUInt(header, 0); // Deflate
+            putUInt(header, m_blocks[i].size());
+            putUInt(header, compressed[i].size());
+            writeFile(header);
+            writeFile(compressed[i]);
+            ++m_stats.cblocks;
+        }
+        m_blocks.clear();
+    }
+
+    // Raw deflate stream of one block, as CBLOCK expects
+    static std::string deflateBlock(const std::string& block) {
+        z_stream stream;
+        std::memset(&stream, 0, sizeof(stream));
+        if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            throw std::runtime_error("unable to initialize zlib");
+        }
+        std::string out(deflateBound(&stream, block.size()), '\0');
+        stream.next_in = (Bytef*)block.data();
+        stream.avail_in = (uInt)block.size();
+        stream.next_out = (Bytef*)&out[0];
+        stream.avail_out = (uInt)out.size();
+        int status = deflate(&stream, Z_FINISH);
+        out.resize(stream.total_out);
+        deflateEnd(&stream);
+        if (status != Z_STREAM_END) throw std::runtime_error("deflate failed");
+        return out;
+    }
+};
+
+#endif // DFM_OASIS_WRITER_H
@@ -2,232 +2,3529 @@
 #include <vector>
 #include <string>
 #include <fstream>
+#include <algorithm>
+#include <iterator>
+#include <utility>
 #include <stdexcept> // For std::stoi, std::runtime_error
+#include <cmath>
+#include <map>
+#include <thread>
+#include <unordered_map>
+#include <sstream>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <chrono>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <set>
+#include <future>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include <boost/geometry.hpp>
-#include <boost/geometry/geometries/point_xy.hpp>
-#include <boost/geometry/geometries/polygon.hpp>
 #include <boost/geometry/io/io.hpp>
+#include <boost/geometry/index/rtree.hpp>
+
+#include "dfm_density.h"
+#include "dfm_geometry.h"
+#include "dfm_layout_hierarchy.h"
+#include "dfm_layout_protocol.h"
+#include "dfm_manhattan.h"
+#include "dfm_oasis_reader.h"
+#include "dfm_oasis_writer.h"
+#include "dfm_polygon_arena.h"
+#include "dfm_result_cache.h"
+#include "dfm_stats.h"
+#include "dfm_thread_pool.h"
+#include "dfm_tile_spill.h"
+#include "dfm_trace.h"
+#include "dfm_width_spacing.h"
+
+namespace bgi = boost::geometry::index;
+
+typedef std::pair<box_type, std::size_t> indexed_box; // Envelope + index of the polygon in its layer
+
+// One layer to load: source file plus layer/datatype numbers
+struct LayerRequest {
+    std::string filename;
+    int layer_number;
+    int datatype_number;
+};
+
+// Vertical stripe [min_x, max_x) of the layout; a shard worker only loads polygons that reach into it
+struct LoadWindow {
+    int64_t min_x;
+    int64_t max_x;
+};
+
+// Sink collecting the requested layers of one file as Boost polygons in database units
+class LayerCollector : public OasisSink {
+public:
+    LayerCollector(std::vector<layer_type>& layers, const std::map<std::pair<uint32_t, uint32_t>, std::vector<std::size_t>>& requests_by_tag,
+                   const LoadWindow* window = nullptr)
+        : m_layers(layers), m_requests_by_tag(requests_by_tag), m_last(requests_by_tag.end()), m_window(window) {}
+
+    bool wantsLayer(uint32_t layer, uint32_t datatype) override {
+        // Consecutive shapes are almost always on the same layer, so remember the last lookup
+        if (m_last == m_requests_by_tag.end() || m_last->first.first != layer || m_last->first.second != datatype) {
+            m_last = m_requests_by_tag.find(std::make_pair(layer, datatype));
+        }
+        return m_last != m_requests_by_tag.end();
+    }
+
+    void onPolygon(uint32_t layer, uint32_t datatype, const OasisPoint* points, std::size_t count) override {
+        if (!wantsLayer(layer, datatype)) return;
+        if (count < 3) { // A polygon needs at least 3 points
+            ++m_degenerate;
+            return;
+        }
+        if (m_window) {
+            int64_t min_x = points[0].x, max_x = points[0].x;
+            for (std::size_t k = 1; k < count; ++k) {
+                min_x = std::min(min_x, points[k].x);
+                max_x = std::max(max_x, points[k].x);
+            }
+            if (max_x < m_window->min_x || min_x >= m_window->max_x) return;
+        }
+
+        polygon_type boost_poly;
+        boost_poly.outer().reserve(count + 1);
+        for (std::size_t k = 0; k < count; ++k) {
+            bg::append(boost_poly.outer(), point_type(to_coord((double)points[k].x), to_coord((double)points[k].y)));
+        }
+        bg::append(boost_poly.outer(), boost_poly.outer().front()); // Boost.Geometry expects closed rings
+        bg::correct(boost_poly); // Correct winding order if necessary for Boost.Geometry
+
+        const std::vector<std::size_t>& targets = m_last->second;
+        for (std::size_t t = 1; t < targets.size(); ++t) m_layers[targets[t]].push_back(boost_poly);
+        m_layers[targets[0]].push_back(std::move(boost_poly));
+    }
+
+    std::size_t degenerateCount() const { return m_degenerate; }
+
+private:
+    typedef std::map<std::pair<uint32_t, uint32_t>, std::vector<std::size_t>> tag_map;
+    std::vector<layer_type>& m_layers;     // Output layers, indexed like the requests
+    const tag_map& m_requests_by_tag;      // Requests per layer/datatype
+    tag_map::const_iterator m_last;        // Cached result of the last lookup
+    std::size_t m_degenerate = 0;          // Polygons skipped for having fewer than 3 points
+    const LoadWindow* m_window;            // Only keep polygons reaching into this stripe (null = all)
+};
+
+// Print how long decoding a file took, whether it was read through a memory mapping
+// and how many cell segments were decoded in parallel, and count its bytes in the run statistics
+void print_read_time(const std::string& filename, const OasisReader& reader, double seconds) {
+    const OasisReadStats& stats = reader.stats();
+    RunStats::instance().add("bytes_read", stats.bytes_read);
+    std::cout << "Read " << filename << ": " << stats.bytes_read / 1048576.0 << " MB in " << seconds << " s ("
+              << (stats.memory_mapped ? "memory-mapped" : "buffered");
+    if (stats.segments > 0) std::cout << ", " << stats.segments << " segments decoded in parallel";
+    std::cout << ")" << '\n';
+}
+
+// Function to load several layers from OASIS files in a single pass per file.
+// Requests are grouped by file and every distinct file is streamed once through
+// OasisReader: only shapes on requested layers are expanded, so memory follows
+// the selected layers rather than the whole library. Coordinates stay in integer
+// database units; each request's file units are returned through units. With a
+// window, only polygons whose envelope reaches into the stripe are kept.
+std::vector<layer_type> load_layers_from_oasis(const std::vector<LayerRequest>& requests, std::vector<LayoutUnits>* units = nullptr,
+                                               const LoadWindow* window = nullptr) {
+    ScopedTimer timer("load");
+    std::vector<layer_type> loaded_layers(requests.size());
+    if (units) units->assign(requests.size(), LayoutUnits());
+
+    std::map<std::string, std::vector<std::size_t>> requests_by_file;
+    for (std::size_t r = 0; r < requests.size(); ++r) {
+        requests_by_file[requests[r].filename].push_back(r);
+    }
+
+    for (const auto& file_requests : requests_by_file) {
+        const std::string& filename = file_requests.first;
+        // Requests per tag; the same layer may be requested more than once
+        std::map<std::pair<uint32_t, uint32_t>, std::vector<std::size_t>> requests_by_tag;
+        for (std::size_t r : file_requests.second) {
+            std::cout << "Loading layer " << requests[r].layer_number << ":" << requests[r].datatype_number << " from " << filename << '\n';
+            requests_by_tag[std::make_pair((uint32_t)requests[r].layer_number, (uint32_t)requests[r].datatype_number)].push_back(r);
+        }
+
+        LayerCollector collector(loaded_layers, requests_by_tag, window);
+        OasisReader reader(collector);
+        const auto read_start = std::chrono::steady_clock::now();
+        try {
+            reader.readFile(filename);
+        } catch (const std::out_of_range& e) {
+            // A coordinate beyond 32-bit database units cannot be loaded at all
+            throw std::runtime_error(filename + ": " + e.what());
+        } catch (const std::runtime_error& e) {
+            std::cerr << "Error reading OASIS file: " << filename << " (" << e.what() << ")" << '\n';
+            for (std::size_t r : file_requests.second) loaded_layers[r].clear();
+            continue; // Requested layers from this file stay empty
+        }
+        print_read_time(filename, reader, std::chrono::duration<double>(std::chrono::steady_clock::now() - read_start).count());
+
+        if (units) {
+            for (std::size_t r : file_requests.second) {
+                (*units)[r].db_unit = reader.dbUnit(); // OASIS user units are always microns
+            }
+        }
+        if (collector.degenerateCount() > 0) {
+            std::cerr << "Warning: Skipped " << collector.degenerateCount() << " polygons with < 3 points in " << filename << '\n';
+        }
+        if (reader.stats().paths_skipped > 0) {
+            std::cerr << "Warning: Ignored " << reader.stats().paths_skipped << " PATH records on requested layers in " << filename << '\n';
+        }
+    }
+
+    for (std::size_t r = 0; r < requests.size(); ++r) {
+        RunStats::instance().add("polygons_loaded", loaded_layers[r].size());
+        if (loaded_layers[r].empty()) {
+            std::cerr << "Warning: No polygons loaded from " << requests[r].filename << " for layer "
+                      << requests[r].layer_number << ":" << requests[r].datatype_number << '\n';
+        }
+    }
+    return loaded_layers;
+}
+
+// Function to load a single layer from an OASIS file
+layer_type load_layer_from_oasis(const std::string& filename, int layer_number, int datatype_number = 0, LayoutUnits* units = nullptr) {
+    std::vector<LayoutUnits> request_units;
+    std::vector<layer_type> layers = load_layers_from_oasis({LayerRequest{filename, layer_number, datatype_number}}, &request_units);
+    if (units) *units = request_units[0];
+    return std::move(layers[0]);
+}
+
+// Polygons an OASIS output could not take as they are
+struct WriteWarnings {
+    std::size_t skipped = 0;       // Fewer than 3 unique points
+    std::size_t dropped_holes = 0; // OASIS polygons have no holes
+};
+
+// Append polygons in database units to an open writer
+void write_polygons(OasisWriter& writer, const layer_type& polygons, int layer_number, int datatype_number, WriteWarnings& warnings) {
+    std::vector<OasisPoint> ring;
+    for (const auto& boost_poly : polygons) {
+        const polygon_type::ring_type& outer = boost_poly.outer();
+        // Boost rings repeat the first point at the end; OASIS rings are open
+        std::size_t unique_points = outer.size();
+        if (unique_points > 1 && bg::equals(outer.front(), outer.back())) --unique_points;
+        if (unique_points < 3) {
+            ++warnings.skipped;
+            continue;
+        }
+        warnings.dropped_holes += boost_poly.inners().size();
+
+        ring.clear();
+        for (std::size_t k = 0; k < unique_points; ++k) ring.push_back(OasisPoint{outer[k].x(), outer[k].y()});
+        writer.addPolygon((uint32_t)layer_number, (uint32_t)datatype_number, ring.data(), ring.size());
+    }
+}
+
+// Append the polygons of an arena (open rings) to an open writer
+void write_polygons(OasisWriter& writer, const PolygonArena& polygons, int layer_number, int datatype_number, WriteWarnings& warnings) {
+    std::vector<OasisPoint> ring;
+    for (std::size_t p = 0; p < polygons.size(); ++p) {
+        const std::size_t outer = polygons.ringBegin(p);
+        const std::size_t begin = polygons.vertexBegin(outer);
+        const std::size_t end = polygons.vertexEnd(outer);
+        if (end - begin < 3) {
+            ++warnings.skipped;
+            continue;
+        }
+        warnings.dropped_holes += polygons.ringEnd(p) - outer - 1;
+
+        ring.clear();
+        for (std::size_t v = begin; v < end; ++v) ring.push_back(OasisPoint{polygons.x(v), polygons.y(v)});
+        writer.addPolygon((uint32_t)layer_number, (uint32_t)datatype_number, ring.data(), ring.size());
+    }
+}
+
+// Print what a closed writer produced and what it had to drop, and count it in the run statistics
+void report_write(const OasisWriter& writer, const WriteWarnings& warnings) {
+    const OasisWriteStats& stats = writer.stats();
+    RunStats::instance().add("bytes_written", stats.bytes_written);
+    RunStats::instance().add("polygons_written", stats.shapes);
+    std::cout << "Wrote " << stats.shape_records << " shape records (" << stats.repetitions << " with repetitions";
+    if (stats.cblocks > 0) std::cout << ", " << stats.cblocks << " compressed blocks";
+    std::cout << "), " << stats.bytes_written << " bytes" << '\n';
+    if (warnings.skipped > 0) {
+        std::cerr << "Warning: Skipped " << warnings.skipped << " polygons with < 3 unique points for OASIS output." << '\n';
+    }
+    if (warnings.dropped_holes > 0) {
+        std::cerr << "Warning: OASIS polygons cannot hold holes; " << warnings.dropped_holes << " holes were not written." << '\n';
+    }
+}
+
+// Function to save a layer to an OASIS file.
+// Polygons are streamed through OasisWriter in integer database units: identical
+// shapes at regular pitches become OASIS repetitions, and with options.compress
+// the records are wrapped in CBLOCKs deflated in parallel.
+void save_layer_to_oasis(const layer_type& layer_to_save, const std::string& filename, int layer_number, int datatype_number = 0,
+                         const LayoutUnits& units = LayoutUnits(), const OasisWriterOptions& options = OasisWriterOptions()) {
+    ScopedTimer timer("write");
+    std::cout << "Saving " << layer_to_save.size() << " polygons to layer " << layer_number << ":" << datatype_number << " in " << filename << '\n';
+
+    try {
+        OasisWriter writer(filename, units.db_unit, options);
+        writer.beginCell("RESULT_CELL");
+        WriteWarnings warnings;
+        write_polygons(writer, layer_to_save, layer_number, datatype_number, warnings);
+        writer.close();
+        report_write(writer, warnings);
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Error writing OASIS file: " << filename << " (" << e.what() << ")" << '\n';
+    }
+}
+
+// Counters collected by layer_and for the spatial candidate filtering stage
+// and for the kernel that handled each candidate pair
+struct AndStats {
+    std::size_t total_pairs = 0;       // Pairs an all-pairs scan would have intersected
+    std::size_t candidate_pairs = 0;   // Pairs whose envelopes overlap and were actually intersected
+    std::size_t rectangle_pairs = 0;   // Rectangle x rectangle, min/max kernel
+    std::size_t rectilinear_pairs = 0; // Both rectilinear (at least one not a rectangle), slab scanline
+    std::size_t general_pairs = 0;     // At least one general polygon, Boost.Geometry
+
+    void add(const AndStats& other) {
+        total_pairs += other.total_pairs;
+        candidate_pairs += other.candidate_pairs;
+        rectangle_pairs += other.rectangle_pairs;
+        rectilinear_pairs += other.rectilinear_pairs;
+        general_pairs += other.general_pairs;
+    }
+};
+
+typedef bgi::rtree<indexed_box, bgi::rstar<16>> layer_index_type;
+
+// Per-polygon data the AND engine derives once per layer
+struct PreparedLayer {
+    const layer_type* polygons = nullptr;
+    std::vector<indexed_box> boxes;  // Envelope and index of every polygon, in layer order
+    std::vector<ShapeKind> kinds;    // Shape class of every polygon
+    std::vector<slab_region> slabs;  // Slab decomposition, only filled for rectilinear non-rectangles
+};
+
+PreparedLayer prepare_layer(const layer_type& layer) {
+    PreparedLayer prepared;
+    prepared.polygons = &layer;
+    prepared.boxes.reserve(layer.size());
+    prepared.kinds.reserve(layer.size());
+    prepared.slabs.resize(layer.size());
+    for (std::size_t i = 0; i < layer.size(); ++i) {
+        prepared.boxes.emplace_back(bg::return_envelope<box_type>(layer[i]), i);
+        prepared.kinds.push_back(classify_polygon(layer[i]));
+        if (prepared.kinds.back() == ShapeKind::Rectilinear) prepared.slabs[i] = polygon_to_slabs(layer[i]);
+    }
+    return prepared;
+}
+
+// Slab form of a rectilinear polygon; rectangles are converted on the fly into scratch
+const slab_region& polygon_slabs(const PreparedLayer& layer, std::size_t idx, slab_region& scratch) {
+    if (layer.kinds[idx] != ShapeKind::Rectangle) return layer.slabs[idx];
+    box_to_slabs(layer.boxes[idx].first, scratch);
+    return scratch;
+}
+
+// Per-thread buffers of the intersection kernels. Fragments are appended to an
+// arena that the caller resets once per tile or chunk; the slab and trace
+// buffers are overwritten by every pair. After the first few tiles the
+// rectangle and rectilinear kernels no longer allocate at all.
+struct IntersectScratch {
+    PolygonArena fragments;
+    slab_region mask_slabs, input_slabs, overlap;
+    SlabTraceScratch trace;
+    layer_type general; // Boost.Geometry output
+};
+
+// Scratch of the calling thread
+IntersectScratch& thread_scratch() {
+    static thread_local IntersectScratch scratch;
+    return scratch;
+}
+
+// Intersect one mask/input pair and append the fragments to scratch.fragments.
+// Rectangle pairs use the min/max kernel, rectilinear pairs the slab scanline,
+// and only pairs involving a general polygon go through Boost.Geometry.
+void intersect_pair(const PreparedLayer& mask, std::size_t mask_idx, const PreparedLayer& input, std::size_t input_idx,
+                    IntersectScratch& scratch, AndStats& stats) {
+    const ShapeKind mask_kind = mask.kinds[mask_idx];
+    const ShapeKind input_kind = input.kinds[input_idx];
+
+    if (mask_kind == ShapeKind::Rectangle && input_kind == ShapeKind::Rectangle) {
+        ++stats.rectangle_pairs;
+        box_type overlap;
+        if (rect_and(mask.boxes[mask_idx].first, input.boxes[input_idx].first, overlap)) {
+            scratch.fragments.addBox(overlap);
+        }
+        return;
+    }
+
+    if (mask_kind != ShapeKind::General && input_kind != ShapeKind::General) {
+        ++stats.rectilinear_pairs;
+        slabs_and(polygon_slabs(mask, mask_idx, scratch.mask_slabs),
+                  polygon_slabs(input, input_idx, scratch.input_slabs), scratch.overlap);
+        slabs_to_polygons(scratch.overlap, scratch.fragments, scratch.trace);
+        return;
+    }
+
+    ++stats.general_pairs;
+    scratch.general.clear(); // intersection can produce multiple polygons
+    try {
+        bg::intersection((*mask.polygons)[mask_idx], (*input.polygons)[input_idx], scratch.general);
+        for (const auto& poly : scratch.general) scratch.fragments.addPolygon(poly);
+    } catch (const bg::exception& e) {
+        std::cerr << "Boost.Geometry intersection error: " << e.what() << '\n';
+        RunStats::instance().add("boost_exceptions");
+        // Potentially log problematic polygons or skip them
+    }
+}
+
+// Function to perform AND operation between mask and input layers.
+// The input layer is bulk-loaded into an R-tree so each mask polygon is only
+// intersected with input polygons whose envelopes overlap its own.
+layer_type layer_and(const layer_type& mask_layer, const layer_type& input_layer, AndStats* stats = nullptr) {
+    layer_type result;
+    AndStats local_stats;
+
+    ScopedTimer convert_timer("convert");
+    PreparedLayer mask = prepare_layer(mask_layer);
+    PreparedLayer input = prepare_layer(input_layer);
+    convert_timer.stop();
+    ScopedTimer index_timer("index");
+    // The range constructor uses the packing (STR) algorithm, which is much faster than inserting one by one
+    layer_index_type input_index(input.boxes.begin(), input.boxes.end());
+    index_timer.stop();
+
+    ScopedTimer intersect_timer("intersect");
+    IntersectScratch& scratch = thread_scratch();
+    scratch.fragments.clear();
+    std::vector<indexed_box> candidates;
+    for (const auto& mask_box : mask.boxes) {
+        candidates.clear();
+        input_index.query(bgi::intersects(mask_box.first), std::back_inserter(candidates));
+        // Visit candidates in input order so the result matches the all-pairs scan
+        std::sort(candidates.begin(), candidates.end(),
+                  [](const indexed_box& a, const indexed_box& b) { return a.second < b.second; });
+        local_stats.candidate_pairs += candidates.size();
+
+        for (const auto& candidate : candidates) {
+            intersect_pair(mask, mask_box.second, input, candidate.second, scratch, local_stats);
+        }
+    }
+    scratch.fragments.appendTo(result);
+    intersect_timer.stop();
+
+    if (stats) {
+        local_stats.total_pairs = mask_layer.size() * input_layer.size();
+        *stats = local_stats;
+    }
+    return result;
+}
+
+// Function to perform NOT (difference) operation: the parts of a_layer not covered by b_layer.
+// Each polygon of a_layer is only cut by the b_layer polygons whose envelopes overlap it;
+// rectilinear cases use the slab scanline, the rest Boost.Geometry difference.
+layer_type layer_not(const layer_type& a_layer, const layer_type& b_layer) {
+    layer_type result;
+    PreparedLayer a = prepare_layer(a_layer);
+    PreparedLayer b = prepare_layer(b_layer);
+    layer_index_type b_index(b.boxes.begin(), b.boxes.end());
+
+    std::vector<indexed_box> candidates;
+    std::vector<slab_region> cover;
+    for (const auto& a_box : a.boxes) {
+        const std::size_t a_idx = a_box.second;
+        candidates.clear();
+        b_index.query(bgi::intersects(a_box.first), std::back_inserter(candidates));
+        if (candidates.empty()) {
+            result.push_back(a_layer[a_idx]);
+            continue;
+        }
+        std::sort(candidates.begin(), candidates.end(),
+                  [](const indexed_box& x, const indexed_box& y) { return x.second < y.second; });
+
+        bool rectilinear = a.kinds[a_idx] != ShapeKind::General;
+        for (const auto& candidate : candidates) rectilinear = rectilinear && b.kinds[candidate.second] != ShapeKind::General;
+        if (rectilinear) {
+            cover.clear();
+            slab_region scratch;
+            for (const auto& candidate : candidates) cover.push_back(polygon_slabs(b, candidate.second, scratch));
+            slabs_to_polygons(slabs_not(polygon_slabs(a, a_idx, scratch), slabs_union(cover)), result);
+            continue;
+        }
+
+        // Cut one candidate at a time so the remaining pieces always form a valid multi-polygon
+        bg::model::multi_polygon<polygon_type> pieces, step;
+        pieces.push_back(a_layer[a_idx]);
+        try {
+            for (const auto& candidate : candidates) {
+                step.clear();
+                bg::difference(pieces, b_layer[candidate.second], step);
+                pieces.swap(step);
+            }
+        } catch (const bg::exception& e) {
+            std::cerr << "Boost.Geometry difference error: " << e.what() << '\n';
+            RunStats::instance().add("boost_exceptions");
+        }
+        result.insert(result.end(), pieces.begin(), pieces.end());
+    }
+    return result;
+}
+
+// Settings for the tiled, multi-threaded AND
+struct TileOptions {
+    unsigned threads = 1;    // Worker threads (0 = hardware concurrency)
+    double tile_size = 0.0;  // Tile edge length in database units (0 = derive from extent and thread count)
+    std::size_t memory_limit = 0; // Bytes; non-zero selects the out-of-core AND
+    std::string spill_dir;        // Parent directory of the out-of-core tile buckets
+};
+
+// Tiled, multi-threaded AND operation.
+//
+// The combined extent of both layers is cut into square tiles which are
+// processed as independent tasks on a work-stealing pool. A mask/input pair is
+// owned by exactly one tile: the one containing the lower-left corner of the
+// overlap of the two envelopes. Each pair is therefore intersected whole,
+// exactly once, so nothing is clipped or duplicated at tile borders. Results
+// are tagged with their (mask, input) indices and sorted afterwards, which
+// reproduces the output order of layer_and() exactly.
+layer_type layer_and_tiled(const layer_type& mask_layer, const layer_type& input_layer,
+                           const TileOptions& options, AndStats* stats = nullptr) {
+    layer_type result;
+    if (stats) *stats = AndStats();
+    if (mask_layer.empty() || input_layer.empty()) return result;
+
+    ScopedTimer convert_timer("convert");
+    PreparedLayer mask = prepare_layer(mask_layer);
+    PreparedLayer input = prepare_layer(input_layer);
+    convert_timer.stop();
+
+    box_type extent;
+    bg::assign_inverse(extent);
+    for (const auto& b : mask.boxes) bg::expand(extent, b.first);
+    for (const auto& b : input.boxes) bg::expand(extent, b.first);
+
+    unsigned threads = options.threads != 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    double width = (double)extent.max_corner().x() - extent.min_corner().x();
+    double height = (double)extent.max_corner().y() - extent.min_corner().y();
+    double tile_size = options.tile_size;
+    if (tile_size <= 0.0) {
+        // Aim for roughly eight tiles per thread so stealing can even out dense regions
+        tile_size = std::sqrt(std::max(width * height, 1.0) / (8.0 * threads));
+    }
+    std::size_t tiles_x = std::max<std::size_t>(1, (std::size_t)std::ceil(width / tile_size));
+    std::size_t tiles_y = std::max<std::size_t>(1, (std::size_t)std::ceil(height / tile_size));
+    std::cout << "Tiling extent into " << tiles_x << " x " << tiles_y << " tiles of size " << tile_size
+              << " on " << threads << " thread(s)" << '\n';
+
+    const double origin_x = extent.min_corner().x();
+    const double origin_y = extent.min_corner().y();
+    // Tile boxes are widened to whole database units; ownership below still uses the exact tile grid
+    auto tile_corner = [](double value, bool upper) {
+        return to_coord(upper ? std::ceil(value) : std::floor(value));
+    };
+    auto tile_column = [&](double x) {
+        double column = std::floor((x - origin_x) / tile_size);
+        return (std::size_t)std::min(std::max(column, 0.0), (double)(tiles_x - 1));
+    };
+    auto tile_row = [&](double y) {
+        double row = std::floor((y - origin_y) / tile_size);
+        return (std::size_t)std::min(std::max(row, 0.0), (double)(tiles_y - 1));
+    };
+
+    // Both indices are only queried once built, which is safe from several threads
+    ScopedTimer index_timer("index");
+    layer_index_type mask_index(mask.boxes.begin(), mask.boxes.end());
+    layer_index_type input_index(input.boxes.begin(), input.boxes.end());
+    index_timer.stop();
+
+    // Fragments of one pair, kept with the pair's indices for the final ordering
+    struct PairResult {
+        std::size_t mask_idx;
+        std::size_t input_idx;
+        std::size_t tile;
+        std::size_t first, last; // Polygons in the tile's fragments
+    };
+    struct TileResult {
+        PolygonArena fragments;
+        std::vector<PairResult> pairs;
+        AndStats stats;
+    };
+    std::vector<TileResult> tile_results(tiles_x * tiles_y);
+
+    ScopedTimer intersect_timer("intersect");
+    ThreadPool pool(threads);
+    parallel_for(pool, tile_results.size(), [&](std::size_t tile) {
+        TraceScope trace("and_tile");
+        const std::size_t column = tile % tiles_x;
+        const std::size_t row = tile / tiles_x;
+        box_type tile_box(point_type(tile_corner(origin_x + column * tile_size, false),
+                                     tile_corner(origin_y + row * tile_size, false)),
+                          point_type(tile_corner(origin_x + (column + 1) * tile_size, true),
+                                     tile_corner(origin_y + (row + 1) * tile_size, true)));
+        TileResult& out = tile_results[tile];
+        IntersectScratch& scratch = thread_scratch();
+        scratch.fragments.clear(); // Reset once per tile, not per pair
+
+        std::vector<indexed_box> tile_masks;
+        mask_index.query(bgi::intersects(tile_box), std::back_inserter(tile_masks));
+        std::vector<indexed_box> candidates;
+        for (const auto& mask_box : tile_masks) {
+            candidates.clear();
+            input_index.query(bgi::intersects(mask_box.first), std::back_inserter(candidates));
+            for (const auto& input_box : candidates) {
+                // Lower-left corner of the envelope overlap decides which tile owns the pair
+                coord_type ref_x = std::max(mask_box.first.min_corner().x(), input_box.first.min_corner().x());
+                coord_type ref_y = std::max(mask_box.first.min_corner().y(), input_box.first.min_corner().y());
+                if (tile_column(ref_x) != column || tile_row(ref_y) != row) continue;
+
+                ++out.stats.candidate_pairs;
+                const std::size_t first = scratch.fragments.size();
+                intersect_pair(mask, mask_box.second, input, input_box.second, scratch, out.stats);
+                if (scratch.fragments.size() > first) {
+                    out.pairs.push_back(PairResult{mask_box.second, input_box.second, tile, first, scratch.fragments.size()});
+                }
+            }
+        }
+        out.fragments = scratch.fragments; // Exact-size copy; the scratch keeps its capacity for the next tile
+    });
+
+    std::vector<const PairResult*> ordered;
+    AndStats local_stats;
+    std::size_t fragment_count = 0;
+    for (const auto& tile : tile_results) {
+        local_stats.add(tile.stats);
+        fragment_count += tile.fragments.size();
+        for (const auto& pair : tile.pairs) ordered.push_back(&pair);
+    }
+    std::sort(ordered.begin(), ordered.end(), [](const PairResult* a, const PairResult* b) {
+        return a->mask_idx != b->mask_idx ? a->mask_idx < b->mask_idx : a->input_idx < b->input_idx;
+    });
+    result.reserve(fragment_count);
+    for (const PairResult* pair : ordered) {
+        tile_results[pair->tile].fragments.appendTo(result, pair->first, pair->last);
+    }
+
+    if (stats) {
+        local_stats.total_pairs = mask_layer.size() * input_layer.size();
+        *stats = local_stats;
+    }
+    return result;
+}
+
+// LayerCollector that hands one of its layers downstream in chunks while the file is still being read
+class ChunkedLayerCollector : public LayerCollector {
+public:
+    ChunkedLayerCollector(std::vector<layer_type>& layers, const std::map<std::pair<uint32_t, uint32_t>, std::vector<std::size_t>>& requests_by_tag,
+                          std::size_t streamed_layer, std::size_t chunk_polygons,
+                          std::function<void(double)> on_start, std::function<void(layer_type&)> on_chunk)
+        : LayerCollector(layers, requests_by_tag), m_layers(layers), m_streamed_layer(streamed_layer),
+          m_chunk_polygons(std::max<std::size_t>(1, chunk_polygons)), m_on_start(on_start), m_on_chunk(on_chunk) {}
+
+    void onStart(double db_unit) override { m_on_start(db_unit); }
+
+    void onPolygon(uint32_t layer, uint32_t datatype, const OasisPoint* points, std::size_t count) override {
+        LayerCollector::onPolygon(layer, datatype, points, count);
+        if (m_layers[m_streamed_layer].size() >= m_chunk_polygons) flush();
+    }
+
+    // Hand over the polygons collected since the last chunk
+    void flush() {
+        if (m_layers[m_streamed_layer].empty()) return;
+        m_on_chunk(m_layers[m_streamed_layer]);
+        m_layers[m_streamed_layer].clear();
+    }
+
+private:
+    std::vector<layer_type>& m_layers;
+    std::size_t m_streamed_layer;                 // Layer handed over in chunks instead of being kept
+    std::size_t m_chunk_polygons;                 // Polygons per chunk
+    std::function<void(double)> m_on_start;       // Called with the database unit from START
+    std::function<void(layer_type&)> m_on_chunk;  // Takes the polygons of one chunk
+};
+
+// Busy and idle time of one pipeline stage, in seconds
+struct StageTimes {
+    double busy = 0.0;
+    double idle = 0.0; // Waiting for another stage
+};
+
+struct PipelineStats {
+    StageTimes load_mask;       // Reading, then indexing the mask (shares load_input when both come from one file)
+    StageTimes load_input;      // Reading the input in chunks
+    StageTimes compute;         // AND of the chunks, summed over the workers
+    StageTimes store;           // Writing finished chunks
+    bool shared_file = false;   // Mask and input were read in one pass
+    double wall_time = 0.0;
+    std::size_t chunks = 0;
+    std::size_t mask_polygons = 0;
+    std::size_t input_polygons = 0;
+    std::size_t result_polygons = 0;
+    LayoutUnits units;          // Units of the input and the result
+};
+
+// Flat AND as a load/compute/store pipeline, writing the result straight to output_file.
+//
+// Mask and input are read on their own threads. The mask is kept whole and
+// indexed once it is loaded; the input is cut into chunks of chunk_polygons
+// polygons in file order, and every chunk is intersected with the mask on the
+// thread pool as soon as both exist. The calling thread writes finished chunks
+// in chunk order while later chunks are still being read and computed, so the
+// result never has to be held in full. Results come out in input order (mask
+// order within each input polygon) instead of layer_and()'s mask order.
+// The input reader stalls once 4 chunks per worker are waiting to be written.
+// When mask and input share a file the mask is only complete once the whole
+// file has been read, so nothing overlaps and every input chunk is buffered
+// until then; run_capture() uses the whole-layer path for that case.
+void layer_and_pipelined(const LayerRequest& mask_request, const LayerRequest& input_request, const std::string& output_file,
+                         int output_layer, int output_datatype, const TileOptions& options, const OasisWriterOptions& output_options,
+                         AndStats* stats = nullptr, PipelineStats* pipeline_stats = nullptr, std::size_t chunk_polygons = 4096) {
+    typedef std::chrono::steady_clock clock;
+    auto seconds_since = [](clock::time_point start) { return std::chrono::duration<double>(clock::now() - start).count(); };
+    const clock::time_point pipeline_start = clock::now();
+
+    const bool shared_file = mask_request.filename == input_request.filename;
+    const unsigned threads = options.threads != 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    const std::size_t max_in_flight = 4 * (std::size_t)threads;
+    ThreadPool pool(threads);
+
+    // Everything below is guarded by state_mutex
+    std::mutex state_mutex;
+    std::condition_variable changed;
+    PipelineStats local;
+    local.shared_file = shared_file;
+    AndStats and_stats;
+    bool units_known = false;       // START of the input has been read
+    bool mask_ready = false;        // mask and mask_index may be used; stays false if the mask failed to load
+    bool input_done = false;        // No more chunks will be added
+    std::size_t chunks_read = 0;
+    std::size_t in_flight = 0;      // Chunks submitted for computing but not written yet
+    std::vector<std::pair<std::size_t, std::shared_ptr<layer_type>>> waiting; // Chunks read before the mask was ready
+    // Once error is set no more chunks are computed: new and waiting chunks are dropped
+    std::map<std::size_t, PolygonArena> finished;                             // Computed chunks not written yet
+    std::exception_ptr error;
+
+    layer_type mask_layer;
+    PreparedLayer mask;
+    std::unique_ptr<layer_index_type> mask_index;
+    LayoutUnits mask_units;
+
+    auto compute_chunk = [&](std::size_t chunk_id, std::shared_ptr<layer_type> chunk) {
+        TraceScope trace("and_chunk");
+        const clock::time_point start = clock::now();
+        PolygonArena result;
+        AndStats chunk_stats;
+        std::exception_ptr chunk_error;
+        try {
+            IntersectScratch& scratch = thread_scratch();
+            scratch.fragments.clear(); // Reset once per chunk
+            PreparedLayer input = prepare_layer(*chunk);
+            std::vector<indexed_box> candidates;
+            for (const auto& input_box : input.boxes) {
+                candidates.clear();
+                mask_index->query(bgi::intersects(input_box.first), std::back_inserter(candidates));
+                std::sort(candidates.begin(), candidates.end(),
+                          [](const indexed_box& a, const indexed_box& b) { return a.second < b.second; });
+                chunk_stats.candidate_pairs += candidates.size();
+                for (const auto& candidate : candidates) {
+                    intersect_pair(mask, candidate.second, input, input_box.second, scratch, chunk_stats);
+                }
+            }
+            result = scratch.fragments;
+        } catch (...) {
+            chunk_error = std::current_exception();
+        }
+        const double busy = seconds_since(start);
+        std::lock_guard<std::mutex> lock(state_mutex);
+        if (chunk_error && !error) error = chunk_error;
+        and_stats.add(chunk_stats);
+        local.compute.busy += busy;
+        finished[chunk_id] = std::move(result);
+        changed.notify_all();
+    };
+    // Called with state_mutex held, and only once the mask is ready
+    auto submit_chunk = [&](std::size_t chunk_id, std::shared_ptr<layer_type> chunk) {
+        if (!mask_index) throw std::logic_error("pipeline chunk submitted before the mask index");
+        ++in_flight;
+        pool.submit([&compute_chunk, chunk_id, chunk] { compute_chunk(chunk_id, chunk); });
+    };
+    // Index the mask and release the chunks that waited for it
+    auto finish_mask = [&](double input_db_unit) {
+        ScopedTimer timer("index");
+        if (mask_units.db_unit != input_db_unit) {
+            std::cerr << "Warning: Mask database unit (" << mask_units.db_unit << " m) differs from input database unit ("
+                      << input_db_unit << " m). Snapping mask to the input grid." << '\n';
+            rescale_layer(mask_layer, mask_units.db_unit, input_db_unit);
+        }
+        mask = prepare_layer(mask_layer);
+        mask_index.reset(new layer_index_type(mask.boxes.begin(), mask.boxes.end()));
+        std::lock_guard<std::mutex> lock(state_mutex);
+        local.mask_polygons = mask_layer.size();
+        mask_ready = true;
+        if (!error) {
+            for (auto& chunk : waiting) submit_chunk(chunk.first, chunk.second);
+        }
+        waiting.clear();
+        changed.notify_all();
+    };
+
+    std::thread mask_thread;
+    if (!shared_file) {
+        mask_thread = std::thread([&] {
+            if (Tracer::enabled()) Tracer::instance().setThreadName("mask loader");
+            try {
+                clock::time_point start = clock::now();
+                std::vector<LayoutUnits> units;
+                mask_layer = std::move(load_layers_from_oasis({mask_request}, &units)[0]);
+                mask_units = units[0];
+                local.load_mask.busy += seconds_since(start);
+
+                start = clock::now();
+                double input_db_unit;
+                {
+                    std::unique_lock<std::mutex> lock(state_mutex);
+                    changed.wait(lock, [&] { return units_known || input_done; });
+                    input_db_unit = local.units.db_unit;
+                }
+                local.load_mask.idle += seconds_since(start);
+
+                start = clock::now();
+                finish_mask(input_db_unit);
+                local.load_mask.busy += seconds_since(start);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(state_mutex);
+                if (!error) error = std::current_exception();
+                waiting.clear();
+                changed.notify_all();
+            }
+        });
+    }
+
+    std::thread input_thread([&] {
+        if (Tracer::enabled()) Tracer::instance().setThreadName("input loader");
+        const clock::time_point start = clock::now();
+        double idle = 0.0;
+        try {
+            std::cout << "Loading layer " << input_request.layer_number << ":" << input_request.datatype_number << " from "
+                      << input_request.filename << (shared_file ? " (with the mask layer)" : " in chunks") << '\n';
+            std::vector<layer_type> layers(2); // 0: mask (one file only), 1: input chunk
+            std::map<std::pair<uint32_t, uint32_t>, std::vector<std::size_t>> requests_by_tag;
+            requests_by_tag[std::make_pair((uint32_t)input_request.layer_number, (uint32_t)input_request.datatype_number)].push_back(1);
+            if (shared_file) {
+                requests_by_tag[std::make_pair((uint32_t)mask_request.layer_number, (uint32_t)mask_request.datatype_number)].push_back(0);
+            }
+
+            ChunkedLayerCollector collector(layers, requests_by_tag, 1, chunk_polygons,
+                [&](double db_unit) {
+                    std::lock_guard<std::mutex> lock(state_mutex);
+                    local.units.db_unit = db_unit;
+                    units_known = true;
+                    changed.notify_all();
+                },
+                [&](layer_type& polygons) {
+                    std::shared_ptr<layer_type> chunk = std::make_shared<layer_type>();
+                    chunk->swap(polygons);
+                    const clock::time_point wait_start = clock::now();
+                    std::unique_lock<std::mutex> lock(state_mutex);
+                    // Back-pressure: do not read further ahead than the writer can follow
+                    changed.wait(lock, [&] { return !mask_ready || in_flight < max_in_flight || error; });
+                    idle += seconds_since(wait_start);
+                    if (error) return; // The run has failed; nothing will be written
+                    local.input_polygons += chunk->size();
+                    const std::size_t chunk_id = chunks_read++;
+                    if (mask_ready) submit_chunk(chunk_id, chunk);
+                    else waiting.push_back(std::make_pair(chunk_id, chunk));
+                });
+            OasisReader reader(collector);
+            try {
+                reader.readFile(input_request.filename);
+            } catch (const std::runtime_error& e) {
+                std::cerr << "Error reading OASIS file: " << input_request.filename << " (" << e.what() << ")" << '\n';
+            }
+            collector.flush();
+            if (collector.degenerateCount() > 0) {
+                std::cerr << "Warning: Skipped " << collector.degenerateCount() << " polygons with < 3 points in " << input_request.filename << '\n';
+            }
+            if (reader.stats().paths_skipped > 0) {
+                std::cerr << "Warning: Ignored " << reader.stats().paths_skipped << " PATH records on requested layers in "
+                          << input_request.filename << '\n';
+            }
+            if (shared_file) {
+                mask_layer = std::move(layers[0]);
+                mask_units.db_unit = reader.dbUnit();
+                finish_mask(reader.dbUnit());
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            if (!error) error = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(state_mutex);
+        input_done = true;
+        local.load_input.busy = seconds_since(start) - idle;
+        local.load_input.idle = idle;
+        changed.notify_all();
+    });
+
+    // Store stage on the calling thread: write chunks in order as they finish
+    std::exception_ptr store_error;
+    try {
+        clock::time_point wait_start = clock::now();
+        {
+            std::unique_lock<std::mutex> lock(state_mutex);
+            changed.wait(lock, [&] { return units_known || input_done; });
+        }
+        local.store.idle += seconds_since(wait_start);
+
+        OasisWriter writer(output_file, local.units.db_unit, output_options);
+        writer.beginCell("RESULT_CELL");
+        WriteWarnings warnings;
+        for (std::size_t next = 0;; ++next) {
+            PolygonArena chunk_result;
+            wait_start = clock::now();
+            {
+                std::unique_lock<std::mutex> lock(state_mutex);
+                changed.wait(lock, [&] { return finished.count(next) || (input_done && mask_ready && next == chunks_read) || error; });
+                if (error) break;
+                if (!finished.count(next)) break; // All chunks written
+                chunk_result = std::move(finished[next]);
+                finished.erase(next);
+            }
+            local.store.idle += seconds_since(wait_start);
+
+            const clock::time_point start = clock::now();
+            write_polygons(writer, chunk_result, output_layer, output_datatype, warnings);
+            local.result_polygons += chunk_result.size();
+            local.store.busy += seconds_since(start);
+
+            std::lock_guard<std::mutex> lock(state_mutex);
+            --in_flight;
+            changed.notify_all();
+        }
+        const clock::time_point start = clock::now();
+        writer.close();
+        local.store.busy += seconds_since(start);
+        std::cout << "Saving " << local.result_polygons << " polygons to layer " << output_layer << ":" << output_datatype
+                  << " in " << output_file << '\n';
+        report_write(writer, warnings);
+    } catch (...) {
+        store_error = std::current_exception();
+        std::lock_guard<std::mutex> lock(state_mutex);
+        if (!error) error = store_error;
+        changed.notify_all();
+    }
+
+    input_thread.join();
+    if (mask_thread.joinable()) mask_thread.join();
+    pool.waitIdle();
+    if (error) std::rethrow_exception(error);
+
+    local.wall_time = seconds_since(pipeline_start);
+    local.compute.idle = std::max(0.0, threads * local.wall_time - local.compute.busy);
+    local.chunks = chunks_read;
+    // The stages overlap, so their times add up to more than the wall time. A mask in its
+    // own file is loaded and indexed through load_layers_from_oasis and finish_mask, which time themselves.
+    RunStats& run_stats = RunStats::instance();
+    run_stats.addTime("load", local.load_input.busy);
+    run_stats.addTime("intersect", local.compute.busy);
+    run_stats.addTime("write", local.store.busy);
+    if (stats) {
+        and_stats.total_pairs = local.mask_polygons * local.input_polygons;
+        *stats = and_stats;
+    }
+    if (pipeline_stats) *pipeline_stats = local;
+}
+
+// Sink that buckets the requested layers into the spatial tiles of a TileSpillStore.
+// A polygon goes into every tile its envelope touches.
+class TileBucketSink : public OasisSink {
+public:
+    // slots: store layers per (layer, datatype), more than one if mask and input share a layer;
+    // target_db_unit: grid all coordinates are snapped to (0 = the unit of the file);
+    // tile_size: tile edge in target database units (0 = 100 microns)
+    TileBucketSink(TileSpillStore& store, const std::map<std::pair<uint32_t, uint32_t>, std::vector<std::size_t>>& slots,
+                   double& target_db_unit, double& tile_size)
+        : m_store(store), m_slots(slots), m_target_db_unit(target_db_unit), m_tile_size(tile_size) {}
+
+    void onStart(double db_unit) override {
+        if (m_target_db_unit == 0.0) m_target_db_unit = db_unit;
+        if (m_tile_size <= 0.0) m_tile_size = std::max(1.0, std::round(100e-6 / m_target_db_unit));
+        m_scale = db_unit / m_target_db_unit;
+        if (m_scale != 1.0) {
+            std::cerr << "Warning: Snapping a database unit of " << db_unit << " m to " << m_target_db_unit << " m" << '\n';
+        }
+    }
+
+    bool wantsLayer(uint32_t layer, uint32_t datatype) override {
+        return m_slots.count(std::make_pair(layer, datatype)) != 0;
+    }
+
+    void onPolygon(uint32_t layer, uint32_t datatype, const OasisPoint* points, std::size_t count) override {
+        auto slots = m_slots.find(std::make_pair(layer, datatype));
+        if (slots == m_slots.end()) return;
+        if (count < 3) { // A polygon needs at least 3 points
+            ++m_degenerate;
+            return;
+        }
+
+        m_poly.clear();
+        for (std::size_t k = 0; k < count; ++k) {
+            bg::append(m_poly.outer(), point_type(to_coord(points[k].x * m_scale), to_coord(points[k].y * m_scale)));
+        }
+        bg::append(m_poly.outer(), m_poly.outer().front());
+        bg::correct(m_poly);
+        box_type envelope = bg::return_envelope<box_type>(m_poly);
+
+        const int64_t first_column = (int64_t)std::floor(envelope.min_corner().x() / m_tile_size);
+        const int64_t last_column = (int64_t)std::floor(envelope.max_corner().x() / m_tile_size);
+        const int64_t first_row = (int64_t)std::floor(envelope.min_corner().y() / m_tile_size);
+        const int64_t last_row = (int64_t)std::floor(envelope.max_corner().y() / m_tile_size);
+        for (int64_t row = first_row; row <= last_row; ++row) {
+            for (int64_t column = first_column; column <= last_column; ++column) {
+                for (std::size_t slot : slots->second) {
+                    m_store.add(slot, TileSpillStore::tileKey(column, row), m_poly.outer().data(), m_poly.outer().size() - 1);
+                    ++m_copies;
+                }
+            }
+        }
+        for (std::size_t slot : slots->second) ++m_polygons[slot];
+    }
+
+    std::size_t degenerateCount() const { return m_degenerate; }
+    // Polygons read per store layer
+    std::size_t polygonCount(std::size_t slot) const {
+        auto found = m_polygons.find(slot);
+        return found == m_polygons.end() ? 0 : found->second;
+    }
+    // Tile copies written; more than the polygon count when polygons cross tile borders
+    std::size_t copyCount() const { return m_copies; }
+
+private:
+    TileSpillStore& m_store;
+    const std::map<std::pair<uint32_t, uint32_t>, std::vector<std::size_t>>& m_slots;
+    double& m_target_db_unit;
+    double& m_tile_size;
+    double m_scale = 1.0;                          // File database unit / target database unit
+    polygon_type m_poly;                           // Scratch
+    std::map<std::size_t, std::size_t> m_polygons;
+    std::size_t m_copies = 0;
+    std::size_t m_degenerate = 0;
+};
+
+struct OutOfCoreStats {
+    std::size_t mask_polygons = 0;
+    std::size_t input_polygons = 0;
+    std::size_t tile_copies = 0;     // Polygons stored, counting each tile a polygon touches
+    std::size_t tiles = 0;
+    std::size_t working_sets = 0;    // Batches of tiles processed together
+    std::size_t result_polygons = 0;
+    uint64_t spilled_bytes = 0;      // Written to the spill directory
+    double tile_size = 0.0;
+    LayoutUnits units;               // Units of the input and the result
+};
+
+// Memory a tile bucket takes once loaded and prepared: its vertices plus the
+// per-polygon overhead of polygon_type, envelope, shape class and R-tree entry
+std::size_t working_set_bytes(uint64_t serialized_bytes, uint64_t polygons) {
+    return (std::size_t)(serialized_bytes + polygons * (sizeof(polygon_type) + 2 * sizeof(indexed_box) + sizeof(slab_region) + 16));
+}
+
+// Byte count for messages: KB below one MB, MB with one decimal from there on
+std::string format_size(uint64_t bytes) {
+    char text[32];
+    if (bytes < (1 << 20)) {
+        std::snprintf(text, sizeof(text), "%.0f KB", bytes / 1024.0);
+    } else {
+        std::snprintf(text, sizeof(text), "%.1f MB", bytes / (double)(1 << 20));
+    }
+    return text;
+}
+
+// Out-of-core AND for layers that do not fit in memory, writing the result straight to output_file.
+//
+// While the files are read, every polygon is appended to the buckets of the
+// tiles it touches (TileSpillStore); buffered buckets spill to disk at a
+// quarter of options.memory_limit. Tiles are then processed in working sets
+// that fit into half of the limit: the buckets of a set are read back and the
+// tiles are ANDed in parallel, each pair only in the tile that owns the lower-
+// left corner of its envelope overlap (as in layer_and_tiled), so tile copies
+// never produce duplicates. Results are written tile by tile and freed.
+//
+// If the largest tile alone exceeds the working set limit, the files are
+// bucketed again with smaller tiles until it fits. Only polygons too large to
+// be split further by smaller tiles can still push a tile over the limit.
+void layer_and_out_of_core(const LayerRequest& mask_request, const LayerRequest& input_request, const std::string& output_file,
+                           int output_layer, int output_datatype, const TileOptions& options, const OasisWriterOptions& output_options,
+                           AndStats* stats = nullptr, OutOfCoreStats* ooc_stats = nullptr) {
+    enum { MaskSlot = 0, InputSlot = 1 };
+    OutOfCoreStats local;
+    AndStats and_stats;
+    std::unique_ptr<TileSpillStore> store;
+
+    // The input file is read first: it defines the grid, so the mask can be snapped while it is bucketed
+    double db_unit = 0.0;
+    double tile_size = options.tile_size;
+    std::map<std::string, std::map<std::pair<uint32_t, uint32_t>, std::vector<std::size_t>>> slots_by_file;
+    slots_by_file[input_request.filename][std::make_pair((uint32_t)input_request.layer_number, (uint32_t)input_request.datatype_number)].push_back(InputSlot);
+    slots_by_file[mask_request.filename][std::make_pair((uint32_t)mask_request.layer_number, (uint32_t)mask_request.datatype_number)].push_back(MaskSlot);
+    std::vector<std::string> files = {input_request.filename};
+    if (mask_request.filename != input_request.filename) files.push_back(mask_request.filename);
+    auto bucket_files = [&] {
+        store.reset();
+        store.reset(new TileSpillStore(options.spill_dir, options.memory_limit / 4));
+        std::cout << "Spilling tile buckets to " << store->directory() << '\n';
+        local.mask_polygons = local.input_polygons = local.tile_copies = 0;
+        for (const auto& filename : files) {
+            ScopedTimer timer("load");
+            std::cout << "Bucketing " << filename << '\n';
+            TileBucketSink sink(*store, slots_by_file[filename], db_unit, tile_size);
+            OasisReader reader(sink);
+            const auto read_start = std::chrono::steady_clock::now();
+            try {
+                reader.readFile(filename);
+                print_read_time(filename, reader, std::chrono::duration<double>(std::chrono::steady_clock::now() - read_start).count());
+            } catch (const std::runtime_error& e) {
+                std::cerr << "Error reading OASIS file: " << filename << " (" << e.what() << ")" << '\n';
+            }
+            if (sink.degenerateCount() > 0) {
+                std::cerr << "Warning: Skipped " << sink.degenerateCount() << " polygons with < 3 points in " << filename << '\n';
+            }
+            if (reader.stats().paths_skipped > 0) {
+                std::cerr << "Warning: Ignored " << reader.stats().paths_skipped << " PATH records on requested layers in " << filename << '\n';
+            }
+            local.mask_polygons += sink.polygonCount(MaskSlot);
+            local.input_polygons += sink.polygonCount(InputSlot);
+            local.tile_copies += sink.copyCount();
+        }
+    };
+    auto tile_bytes = [&store](uint64_t tile) {
+        return working_set_bytes(store->bytes(MaskSlot, tile), store->polygons(MaskSlot, tile)) +
+               working_set_bytes(store->bytes(InputSlot, tile), store->polygons(InputSlot, tile));
+    };
+
+    const std::size_t working_set_limit = options.memory_limit / 2;
+    std::vector<uint64_t> tiles;
+    std::size_t previous_largest = std::numeric_limits<std::size_t>::max();
+    for (;;) {
+        bucket_files();
+        tiles = store->tiles();
+        std::size_t largest = 0;
+        for (uint64_t tile : tiles) largest = std::max(largest, tile_bytes(tile));
+        // Stop once it fits, or when smaller tiles no longer help (single polygons over the limit)
+        if (largest <= working_set_limit || tile_size <= 1.0 || largest >= previous_largest) break;
+        // The bytes of a tile follow its area, so shrink the edge by the square root of the excess
+        const double shrink = std::max(2.0, std::ceil(std::sqrt((double)largest / working_set_limit)));
+        local.spilled_bytes += store->spilledBytes();
+        previous_largest = largest;
+        tile_size = std::max(1.0, std::floor(tile_size / shrink));
+        std::cout << "Largest tile needs about " << format_size(largest) << ", more than the working set limit of "
+                  << format_size(working_set_limit) << "; bucketing again with tiles of size " << tile_size << '\n';
+    }
+    if (db_unit == 0.0) db_unit = LayoutUnits().db_unit; // Nothing could be read
+    local.units.db_unit = db_unit;
+    local.tile_size = tile_size;
+    local.tiles = tiles.size();
+    std::cout << "Bucketed " << local.mask_polygons << " mask and " << local.input_polygons << " input polygons into "
+              << tiles.size() << " tiles of size " << tile_size << " (" << local.tile_copies << " tile copies)" << '\n';
+
+    OasisWriter writer(output_file, db_unit, output_options);
+    writer.beginCell("RESULT_CELL");
+    WriteWarnings warnings;
+
+    const unsigned threads = options.threads != 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    ThreadPool pool(threads);
+    struct TileWork {
+        uint64_t key;
+        layer_type mask;
+        layer_type input;
+        PolygonArena result;
+        AndStats stats;
+    };
+
+    for (std::size_t begin = 0; begin < tiles.size();) {
+        // Gather tiles until the working set is full; a tile that is too large on its own still runs alone
+        std::size_t end = begin;
+        std::size_t working_set = 0;
+        while (end < tiles.size()) {
+            const std::size_t bytes = tile_bytes(tiles[end]);
+            if (end > begin && working_set + bytes > working_set_limit) break;
+            if (end == begin && bytes > working_set_limit) {
+                std::cerr << "Warning: Tile " << end << " needs about " << format_size(bytes) << ", more than the working set limit"
+                          << " of " << format_size(working_set_limit) << ", even with tiles of size " << tile_size << '\n';
+            }
+            working_set += bytes;
+            ++end;
+        }
+
+        ScopedTimer load_timer("load");
+        std::vector<TileWork> work(end - begin);
+        for (std::size_t t = 0; t < work.size(); ++t) {
+            work[t].key = tiles[begin + t];
+            work[t].mask = store->take(MaskSlot, work[t].key);
+            work[t].input = store->take(InputSlot, work[t].key);
+        }
+        load_timer.stop();
+        ScopedTimer intersect_timer("intersect");
+        parallel_for(pool, work.size(), [&](std::size_t t) {
+            TraceScope trace("and_tile");
+            TileWork& tile = work[t];
+            if (tile.mask.empty() || tile.input.empty()) return;
+            int64_t column, row;
+            TileSpillStore::tilePosition(tile.key, column, row);
+            PreparedLayer mask = prepare_layer(tile.mask);
+            PreparedLayer input = prepare_layer(tile.input);
+            layer_index_type input_index(input.boxes.begin(), input.boxes.end());
+            IntersectScratch& scratch = thread_scratch();
+            scratch.fragments.clear(); // Reset once per tile
+            std::vector<indexed_box> candidates;
+            for (const auto& mask_box : mask.boxes) {
+                candidates.clear();
+                input_index.query(bgi::intersects(mask_box.first), std::back_inserter(candidates));
+                std::sort(candidates.begin(), candidates.end(),
+                          [](const indexed_box& a, const indexed_box& b) { return a.second < b.second; });
+                for (const auto& input_box : candidates) {
+                    // Lower-left corner of the envelope overlap decides which tile owns the pair
+                    coord_type ref_x = std::max(mask_box.first.min_corner().x(), input_box.first.min_corner().x());
+                    coord_type ref_y = std::max(mask_box.first.min_corner().y(), input_box.first.min_corner().y());
+                    if ((int64_t)std::floor(ref_x / tile_size) != column || (int64_t)std::floor(ref_y / tile_size) != row) continue;
+                    ++tile.stats.candidate_pairs;
+                    intersect_pair(mask, mask_box.second, input, input_box.second, scratch, tile.stats);
+                }
+            }
+            tile.result = scratch.fragments;
+            layer_type().swap(tile.mask);
+            layer_type().swap(tile.input);
+        });
+        intersect_timer.stop();
+        ScopedTimer write_timer("write");
+        for (auto& tile : work) {
+            and_stats.add(tile.stats);
+            write_polygons(writer, tile.result, output_layer, output_datatype, warnings);
+            local.result_polygons += tile.result.size();
+        }
+        ++local.working_sets;
+        begin = end;
+    }
+
+    writer.close();
+    std::cout << "Saving " << local.result_polygons << " polygons to layer " << output_layer << ":" << output_datatype
+              << " in " << output_file << '\n';
+    report_write(writer, warnings);
+
+    local.spilled_bytes += store->spilledBytes();
+    if (stats) {
+        and_stats.total_pairs = local.mask_polygons * local.input_polygons;
+        *stats = and_stats;
+    }
+    if (ooc_stats) *ooc_stats = local;
+}
+
+// Counters of the incremental AND
+struct IncrementalStats {
+    std::size_t mask_polygons = 0;
+    std::size_t input_polygons = 0;
+    std::size_t tiles = 0;             // Tiles holding both mask and input polygons
+    std::size_t reused_tiles = 0;      // Unchanged tiles copied from the previous result
+    std::size_t recomputed_tiles = 0;  // New or changed tiles
+    std::size_t removed_tiles = 0;     // Tiles of the previous result that no longer exist
+    std::size_t result_polygons = 0;
+    std::size_t reused_polygons = 0;
+    bool previous_result = false;      // A matching sidecar and result were found
+    double tile_size = 0.0;
+    LayoutUnits units;                 // Units of the input and the result
+};
+
+// Content hash of one polygon, independent of its position in the layer
+uint64_t hash_polygon(const polygon_type& poly) {
+    uint64_t hash = 1469598103934665603ULL; // FNV-1a
+    auto mix = [&hash](uint64_t value) {
+        hash ^= value;
+        hash *= 1099511628211ULL;
+    };
+    mix(poly.outer().size());
+    for (const auto& pt : poly.outer()) mix((uint64_t)(uint32_t)pt.x() << 32 | (uint32_t)pt.y());
+    for (const auto& inner : poly.inners()) {
+        mix(inner.size());
+        for (const auto& pt : inner) mix((uint64_t)(uint32_t)pt.x() << 32 | (uint32_t)pt.y());
+    }
+    return hash;
+}
+
+// Name of the output cell holding the result of one tile
+std::string incremental_tile_cell(uint64_t tile) {
+    int64_t column, row;
+    TileSpillStore::tilePosition(tile, column, row);
+    return "TILE_" + std::to_string(column) + "_" + std::to_string(row);
+}
+
+// Sink that collects the polygons of selected tile cells of a previous incremental result
+class TileCellCollector : public OasisSink {
+public:
+    TileCellCollector(uint32_t layer, uint32_t datatype, std::map<std::string, PolygonArena>& cells)
+        : m_layer(layer), m_datatype(datatype), m_cells(cells) {}
+
+    bool wantsHierarchy() const override { return true; }
+
+    // Our writer names cells inline; cells referenced by number are not ours and are skipped
+    void onCell(const OasisCellRef& cell) override {
+        auto found = cell.by_number ? m_cells.end() : m_cells.find(cell.name);
+        m_current = found == m_cells.end() ? nullptr : &found->second;
+    }
+
+    bool wantsLayer(uint32_t layer, uint32_t datatype) override {
+        return m_current && layer == m_layer && datatype == m_datatype;
+    }
+
+    void onPolygon(uint32_t layer, uint32_t datatype, const OasisPoint* points, std::size_t count) override {
+        if (!wantsLayer(layer, datatype)) return;
+        for (std::size_t k = 0; k < count; ++k) m_current->addVertex((coord_type)points[k].x, (coord_type)points[k].y);
+        m_current->endRing();
+        m_current->endPolygon();
+    }
+
+private:
+    uint32_t m_layer, m_datatype;
+    std::map<std::string, PolygonArena>& m_cells;
+    PolygonArena* m_current = nullptr; // Tile being read, or null for cells that are not needed
+};
+
+// Incremental AND that recomputes only the tiles whose geometry changed since the last run.
+//
+// Both layers are loaded and every polygon is assigned to the tiles its
+// envelope touches on a grid anchored at the origin (as in the out-of-core
+// AND), so an edit does not shift the tiles elsewhere. A tile's hash covers
+// the content hashes of all of its mask and input polygons, sorted so that
+// reordering the files changes nothing. The result is written with one cell
+// per tile (TILE_<column>_<row>) placed at the origin by RESULT_CELL, and the
+// tile hashes go into a sidecar, <output>.tiles. On the next run, tiles whose
+// hash and polygon count match the sidecar are copied from the previous
+// result; only new and changed tiles are computed, on the thread pool. Pairs
+// are owned by the tile of their envelope overlap's lower-left corner, so
+// every tile's result depends on its own polygons only.
+void layer_and_incremental(const LayerRequest& mask_request, const LayerRequest& input_request, const std::string& output_file,
+                           int output_layer, int output_datatype, const TileOptions& options,
+                           const OasisWriterOptions& output_options, AndStats* stats = nullptr, IncrementalStats* inc_stats = nullptr) {
+    IncrementalStats local;
+    AndStats and_stats;
+
+    std::vector<LayoutUnits> units;
+    std::vector<layer_type> layers = load_layers_from_oasis({mask_request, input_request}, &units);
+    layer_type& mask_layer = layers[0];
+    layer_type& input_layer = layers[1];
+    if (units[0].db_unit != units[1].db_unit) {
+        std::cerr << "Warning: Mask database unit (" << units[0].db_unit << " m) differs from input database unit ("
+                  << units[1].db_unit << " m). Snapping mask to the input grid." << '\n';
+        rescale_layer(mask_layer, units[0].db_unit, units[1].db_unit);
+    }
+    local.units = units[1];
+    local.mask_polygons = mask_layer.size();
+    local.input_polygons = input_layer.size();
+    const double tile_size = options.tile_size > 0.0 ? options.tile_size : std::max(1.0, std::round(100e-6 / local.units.db_unit));
+    local.tile_size = tile_size;
+
+    // Everything besides the geometry that the tile results depend on
+    ContentHash128 settings_hash;
+    settings_hash.update(std::string("dfm incremental AND 1"));
+    settings_hash.updateValue((uint64_t)(int64_t)output_layer);
+    settings_hash.updateValue((uint64_t)(int64_t)output_datatype);
+    settings_hash.update(&local.units.db_unit, sizeof(double));
+    settings_hash.update(&tile_size, sizeof(double));
+    const std::string settings = settings_hash.hex();
+
+    // Polygons per tile, as (content hash, index) so the order within a tile is canonical
+    struct TileInputs {
+        std::vector<std::pair<uint64_t, std::size_t>> mask, input;
+    };
+    std::map<uint64_t, TileInputs> tile_inputs;
+    auto bucket = [&](const layer_type& layer, bool is_mask) {
+        for (std::size_t i = 0; i < layer.size(); ++i) {
+            const uint64_t hash = hash_polygon(layer[i]);
+            const box_type envelope = bg::return_envelope<box_type>(layer[i]);
+            const int64_t first_column = (int64_t)std::floor(envelope.min_corner().x() / tile_size);
+            const int64_t last_column = (int64_t)std::floor(envelope.max_corner().x() / tile_size);
+            const int64_t first_row = (int64_t)std::floor(envelope.min_corner().y() / tile_size);
+            const int64_t last_row = (int64_t)std::floor(envelope.max_corner().y() / tile_size);
+            for (int64_t row = first_row; row <= last_row; ++row) {
+                for (int64_t column = first_column; column <= last_column; ++column) {
+                    TileInputs& tile = tile_inputs[TileSpillStore::tileKey(column, row)];
+                    (is_mask ? tile.mask : tile.input).push_back(std::make_pair(hash, i));
+                }
+            }
+        }
+    };
+    bucket(mask_layer, true);
+    bucket(input_layer, false);
+
+    struct TileState {
+        uint64_t key = 0;
+        std::string hash;
+        const TileInputs* inputs = nullptr;
+        bool reuse = false;
+        std::size_t written = 0; // Shapes written to the tile's cell
+        PolygonArena result;
+        AndStats stats;
+    };
+    std::vector<TileState> tiles;
+    for (auto& entry : tile_inputs) {
+        TileInputs& inputs = entry.second;
+        if (inputs.mask.empty() || inputs.input.empty()) continue; // No pairs, no result
+        std::sort(inputs.mask.begin(), inputs.mask.end());
+        std::sort(inputs.input.begin(), inputs.input.end());
+        ContentHash128 hash;
+        hash.updateValue(entry.first);
+        hash.updateValue(inputs.mask.size());
+        for (const auto& poly : inputs.mask) hash.updateValue(poly.first);
+        hash.updateValue(inputs.input.size());
+        for (const auto& poly : inputs.input) hash.updateValue(poly.first);
+        tiles.emplace_back();
+        tiles.back().key = entry.first;
+        tiles.back().hash = hash.hex();
+        tiles.back().inputs = &inputs;
+    }
+    local.tiles = tiles.size();
+
+    // Sidecar of the previous run: settings, then one line per tile with its hash and shape count
+    const std::string sidecar = output_file + ".tiles";
+    std::map<uint64_t, std::pair<std::string, std::size_t>> previous;
+    {
+        std::ifstream in(sidecar);
+        std::string magic, previous_settings;
+        if (in >> magic >> previous_settings && magic == "dfm_incremental_tiles" && previous_settings == settings) {
+            unsigned long long key, count;
+            std::string hash;
+            while (in >> std::hex >> key >> hash >> std::dec >> count) previous[key] = std::make_pair(hash, (std::size_t)count);
+        }
+    }
+    std::map<std::string, PolygonArena> reused_cells;
+    for (auto& tile : tiles) {
+        auto found = previous.find(tile.key);
+        if (found == previous.end() || found->second.first != tile.hash) continue;
+        tile.reuse = true;
+        if (found->second.second > 0) reused_cells[incremental_tile_cell(tile.key)];
+    }
+    for (const auto& entry : previous) {
+        if (!tile_inputs.count(entry.first)) ++local.removed_tiles;
+    }
+    local.previous_result = !previous.empty();
+    if (!reused_cells.empty()) {
+        TileCellCollector collector((uint32_t)output_layer, (uint32_t)output_datatype, reused_cells);
+        OasisReader reader(collector);
+        try {
+            reader.readFile(output_file);
+        } catch (const std::runtime_error& e) {
+            std::cerr << "Warning: Cannot read the previous result " << output_file << " (" << e.what() << "); recomputing all tiles" << '\n';
+            for (auto& cell : reused_cells) cell.second.clear();
+        }
+    }
+    // A tile is only reused if the previous result still holds exactly the shapes the sidecar lists
+    for (auto& tile : tiles) {
+        if (!tile.reuse) continue;
+        const std::size_t expected = previous[tile.key].second;
+        if (expected == 0) continue;
+        PolygonArena& cell = reused_cells[incremental_tile_cell(tile.key)];
+        if (cell.size() != expected) {
+            tile.reuse = false;
+            continue;
+        }
+        tile.result.append(cell);
+        cell.clear();
+    }
+
+    std::vector<std::size_t> changed;
+    for (std::size_t t = 0; t < tiles.size(); ++t) {
+        if (tiles[t].reuse) ++local.reused_tiles; else changed.push_back(t);
+    }
+    local.recomputed_tiles = changed.size();
+    std::cout << "Tiles: " << tiles.size() << " of size " << tile_size << ", " << local.reused_tiles << " unchanged, "
+              << changed.size() << " to compute" << '\n';
+
+    const unsigned threads = options.threads != 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    ScopedTimer intersect_timer("intersect");
+    ThreadPool pool(threads);
+    parallel_for(pool, changed.size(), [&](std::size_t c) {
+        TraceScope trace("and_tile");
+        TileState& tile = tiles[changed[c]];
+        int64_t column, row;
+        TileSpillStore::tilePosition(tile.key, column, row);
+        layer_type tile_mask, tile_input;
+        tile_mask.reserve(tile.inputs->mask.size());
+        tile_input.reserve(tile.inputs->input.size());
+        for (const auto& poly : tile.inputs->mask) tile_mask.push_back(mask_layer[poly.second]);
+        for (const auto& poly : tile.inputs->input) tile_input.push_back(input_layer[poly.second]);
+        PreparedLayer mask = prepare_layer(tile_mask);
+        PreparedLayer input = prepare_layer(tile_input);
+        layer_index_type input_index(input.boxes.begin(), input.boxes.end());
+        IntersectScratch& scratch = thread_scratch();
+        scratch.fragments.clear(); // Reset once per tile
+        std::vector<indexed_box> candidates;
+        for (const auto& mask_box : mask.boxes) {
+            candidates.clear();
+            input_index.query(bgi::intersects(mask_box.first), std::back_inserter(candidates));
+            std::sort(candidates.begin(), candidates.end(),
+                      [](const indexed_box& a, const indexed_box& b) { return a.second < b.second; });
+            for (const auto& input_box : candidates) {
+                // Lower-left corner of the envelope overlap decides which tile owns the pair
+                coord_type ref_x = std::max(mask_box.first.min_corner().x(), input_box.first.min_corner().x());
+                coord_type ref_y = std::max(mask_box.first.min_corner().y(), input_box.first.min_corner().y());
+                if ((int64_t)std::floor(ref_x / tile_size) != column || (int64_t)std::floor(ref_y / tile_size) != row) continue;
+                ++tile.stats.candidate_pairs;
+                intersect_pair(mask, mask_box.second, input, input_box.second, scratch, tile.stats);
+            }
+        }
+        tile.result = scratch.fragments;
+    });
+    intersect_timer.stop();
+
+    // The previous result has been read, so the new one can be written; both files are replaced by rename
+    const std::string output_part = output_file + ".part";
+    {
+        ScopedTimer timer("write");
+        OasisWriter writer(output_part, local.units.db_unit, output_options);
+        WriteWarnings warnings;
+        std::vector<std::string> tile_cells;
+        for (auto& tile : tiles) {
+            and_stats.add(tile.stats);
+            if (tile.result.empty()) continue;
+            tile_cells.push_back(incremental_tile_cell(tile.key));
+            writer.beginCell(tile_cells.back());
+            const uint64_t before = writer.stats().shapes;
+            write_polygons(writer, tile.result, output_layer, output_datatype, warnings);
+            tile.written = (std::size_t)(writer.stats().shapes - before);
+            local.result_polygons += tile.result.size();
+            if (tile.reuse) local.reused_polygons += tile.result.size();
+            tile.result = PolygonArena(); // Written; free it
+        }
+        writer.beginCell("RESULT_CELL");
+        for (const auto& cell : tile_cells) writer.addPlacement(cell, 0, 0);
+        writer.close();
+        std::cout << "Saving " << local.result_polygons << " polygons (" << local.reused_polygons << " reused) to layer "
+                  << output_layer << ":" << output_datatype << " in " << output_file << '\n';
+        report_write(writer, warnings);
+    }
+    if (std::rename(output_part.c_str(), output_file.c_str()) != 0) {
+        std::remove(output_part.c_str());
+        throw std::runtime_error("cannot replace " + output_file);
+    }
+
+    const std::string sidecar_part = sidecar + ".part";
+    {
+        std::ofstream out(sidecar_part);
+        out << "dfm_incremental_tiles " << settings << "\n";
+        for (const auto& tile : tiles) out << std::hex << tile.key << " " << tile.hash << " " << std::dec << tile.written << "\n";
+        if (!out) std::cerr << "Warning: Could not write the tile hashes to " << sidecar << '\n';
+    }
+    if (std::rename(sidecar_part.c_str(), sidecar.c_str()) != 0) std::remove(sidecar_part.c_str());
+
+    if (stats) {
+        and_stats.total_pairs = local.mask_polygons * local.input_polygons;
+        *stats = and_stats;
+    }
+    if (inc_stats) *inc_stats = local;
+}
+
+// Sink that records the x extent of the requested layers without keeping any geometry
+class ExtentSink : public OasisSink {
+public:
+    explicit ExtentSink(const std::set<std::pair<uint32_t, uint32_t>>& tags) : m_tags(tags) {}
+
+    void onStart(double db_unit) override { m_db_unit = db_unit; }
+
+    bool wantsLayer(uint32_t layer, uint32_t datatype) override {
+        return m_tags.count(std::make_pair(layer, datatype)) != 0;
+    }
+
+    void onPolygon(uint32_t layer, uint32_t datatype, const OasisPoint* points, std::size_t count) override {
+        if (count < 3 || !wantsLayer(layer, datatype)) return;
+        ++m_counts[std::make_pair(layer, datatype)];
+        int64_t min_x = points[0].x;
+        for (std::size_t k = 0; k < count; ++k) {
+            min_x = std::min(min_x, points[k].x);
+            m_max_x = std::max(m_max_x, points[k].x);
+        }
+        m_min_x = std::min(m_min_x, min_x);
+        m_left_edges.push_back(min_x);
+    }
+
+    double dbUnit() const { return m_db_unit; }
+    int64_t minX() const { return m_min_x; }
+    int64_t maxX() const { return m_max_x; }
+    std::size_t polygonCount(const std::pair<uint32_t, uint32_t>& tag) const {
+        auto found = m_counts.find(tag);
+        return found == m_counts.end() ? 0 : found->second;
+    }
+    // Left edge of every polygon read, used to balance the shards
+    std::vector<int64_t>& leftEdges() { return m_left_edges; }
+
+private:
+    const std::set<std::pair<uint32_t, uint32_t>>& m_tags;
+    double m_db_unit = 0.0;
+    int64_t m_min_x = std::numeric_limits<int64_t>::max();
+    int64_t m_max_x = std::numeric_limits<int64_t>::min();
+    std::vector<int64_t> m_left_edges;
+    std::map<std::pair<uint32_t, uint32_t>, std::size_t> m_counts; // Polygons per requested layer
+};
+
+// Sink that copies the polygons of one layer into an open writer
+class CopyToWriterSink : public OasisSink {
+public:
+    CopyToWriterSink(OasisWriter& writer, uint32_t layer, uint32_t datatype) : m_writer(writer), m_layer(layer), m_datatype(datatype) {}
+
+    bool wantsLayer(uint32_t layer, uint32_t datatype) override { return layer == m_layer && datatype == m_datatype; }
+
+    void onPolygon(uint32_t layer, uint32_t datatype, const OasisPoint* points, std::size_t count) override {
+        if (!wantsLayer(layer, datatype)) return;
+        m_writer.addPolygon(layer, datatype, points, count);
+        ++m_polygons;
+    }
+
+    std::size_t polygonCount() const { return m_polygons; }
+
+private:
+    OasisWriter& m_writer;
+    uint32_t m_layer, m_datatype;
+    std::size_t m_polygons = 0;
+};
+
+// What a shard worker reports to the coordinator
+struct ShardResult {
+    std::size_t mask_polygons = 0;   // Polygons loaded into the shard's window
+    std::size_t input_polygons = 0;
+    std::size_t result_polygons = 0;
+    AndStats stats;
+};
+
+// Last line a shard worker prints on stdout; everything before it is log output
+const char* const SHARD_RESULT_TAG = "SHARD_RESULT";
+
+// Shard worker: AND of the pairs owned by the stripe [window.min_x, window.max_x), written to shard_file.
+//
+// Only polygons whose envelope reaches into the stripe are loaded, so the
+// worker's memory follows the size of its shard. A pair is owned by the
+// stripe that contains the x of the lower-left corner of its envelope
+// overlap; both polygons of such a pair reach into that stripe, so every pair
+// is computed by exactly one worker. The result goes to stdout as one
+// SHARD_RESULT line after the log output.
+void run_shard_worker(const LayerRequest& mask_request, const LayerRequest& input_request, const LoadWindow& window,
+                      const std::string& shard_file, int output_layer, int output_datatype) {
+    std::vector<LayoutUnits> units;
+    std::vector<layer_type> layers = load_layers_from_oasis({mask_request, input_request}, &units, &window);
+    ShardResult result;
+    result.mask_polygons = layers[0].size();
+    result.input_polygons = layers[1].size();
+
+    PreparedLayer mask = prepare_layer(layers[0]);
+    PreparedLayer input = prepare_layer(layers[1]);
+    layer_index_type input_index(input.boxes.begin(), input.boxes.end());
+    IntersectScratch& scratch = thread_scratch();
+    scratch.fragments.clear();
+    std::vector<indexed_box> candidates;
+    for (const auto& mask_box : mask.boxes) {
+        candidates.clear();
+        input_index.query(bgi::intersects(mask_box.first), std::back_inserter(candidates));
+        std::sort(candidates.begin(), candidates.end(),
+                  [](const indexed_box& a, const indexed_box& b) { return a.second < b.second; });
+        for (const auto& input_box : candidates) {
+            const coord_type ref_x = std::max(mask_box.first.min_corner().x(), input_box.first.min_corner().x());
+            if (ref_x < window.min_x || ref_x >= window.max_x) continue; // Owned by another stripe
+            ++result.stats.candidate_pairs;
+            intersect_pair(mask, mask_box.second, input, input_box.second, scratch, result.stats);
+        }
+    }
+    result.result_polygons = scratch.fragments.size();
+
+    OasisWriter writer(shard_file, units[1].db_unit);
+    writer.beginCell("RESULT_CELL");
+    WriteWarnings warnings;
+    write_polygons(writer, scratch.fragments, output_layer, output_datatype, warnings);
+    writer.close();
+
+    std::cout << SHARD_RESULT_TAG << " " << result.mask_polygons << " " << result.input_polygons << " " << result.result_polygons << " "
+              << result.stats.candidate_pairs << " " << result.stats.rectangle_pairs << " " << result.stats.rectilinear_pairs << " "
+              << result.stats.general_pairs << '\n';
+}
+
+// Counters of the sharded AND
+struct ShardStats {
+    std::size_t shards = 0;
+    std::size_t retries = 0;          // Workers that were started again after a failure
+    std::size_t mask_polygons = 0;    // Polygons in the layers, counted once
+    std::size_t input_polygons = 0;
+    std::size_t loaded_polygons = 0;  // Polygons loaded by all workers together (border polygons count per shard)
+    std::size_t result_polygons = 0;
+    long max_worker_rss_kb = 0;       // Largest peak resident set of a worker
+    LayoutUnits units;
+};
+
+// Multi-process AND: a coordinator partitions the layout into vertical stripes
+// and runs one worker process per stripe, then merges the shard outputs.
+//
+// The coordinator reads only the extent of both layers and places the stripe
+// borders at quantiles of the polygons' left edges, so shards hold similar
+// amounts of geometry. Each worker is this program started again (fork and
+// exec of /proc/self/exe) with a self-contained command line: the two input
+// files, its stripe and the path of its shard output. It reports its counters
+// through a pipe connected to its stdout. A worker that dies or fails is
+// started again up to two more times. Because workers share nothing but files,
+// a remote launcher could run the same command lines on other machines and
+// only the launch step would change. Shard outputs are streamed into the final
+// file in stripe order and deleted.
+void layer_and_sharded(const LayerRequest& mask_request, const LayerRequest& input_request, const std::string& output_file,
+                       int output_layer, int output_datatype, std::size_t shards, const TileOptions& options,
+                       const OasisWriterOptions& output_options, AndStats* stats = nullptr, ShardStats* shard_stats = nullptr) {
+    ShardStats local;
+    AndStats and_stats;
+
+    // Extent and left edges of both layers, one pass per distinct file
+    const std::pair<uint32_t, uint32_t> mask_tag((uint32_t)mask_request.layer_number, (uint32_t)mask_request.datatype_number);
+    const std::pair<uint32_t, uint32_t> input_tag((uint32_t)input_request.layer_number, (uint32_t)input_request.datatype_number);
+    std::map<std::string, std::set<std::pair<uint32_t, uint32_t>>> tags_by_file;
+    tags_by_file[mask_request.filename].insert(mask_tag);
+    tags_by_file[input_request.filename].insert(input_tag);
+    int64_t min_x = std::numeric_limits<int64_t>::max();
+    int64_t max_x = std::numeric_limits<int64_t>::min();
+    std::vector<int64_t> left_edges;
+    std::map<std::string, double> db_units;
+    ScopedTimer scan_timer("scan");
+    for (const auto& file_tags : tags_by_file) {
+        ExtentSink sink(file_tags.second);
+        OasisReader reader(sink);
+        reader.readFile(file_tags.first);
+        RunStats::instance().add("bytes_read", reader.stats().bytes_read);
+        db_units[file_tags.first] = sink.dbUnit();
+        if (file_tags.first == mask_request.filename) local.mask_polygons = sink.polygonCount(mask_tag);
+        if (file_tags.first == input_request.filename) local.input_polygons = sink.polygonCount(input_tag);
+        min_x = std::min(min_x, sink.minX());
+        max_x = std::max(max_x, sink.maxX());
+        left_edges.insert(left_edges.end(), sink.leftEdges().begin(), sink.leftEdges().end());
+        std::vector<int64_t>().swap(sink.leftEdges());
+    }
+    scan_timer.stop();
+    if (db_units[mask_request.filename] != db_units[input_request.filename]) {
+        throw std::runtime_error("--shards needs mask and input files with the same database unit");
+    }
+    local.units.db_unit = db_units[input_request.filename];
+
+    // Stripe borders at quantiles of the left edges; duplicate borders merge shards
+    std::vector<int64_t> borders;
+    if (!left_edges.empty()) {
+        std::sort(left_edges.begin(), left_edges.end());
+        borders.push_back(min_x);
+        for (std::size_t s = 1; s < shards; ++s) {
+            const int64_t border = left_edges[left_edges.size() * s / shards];
+            if (border > borders.back()) borders.push_back(border);
+        }
+        borders.push_back(max_x + 1);
+    }
+    std::vector<int64_t>().swap(left_edges);
+    local.shards = borders.empty() ? 0 : borders.size() - 1;
+
+    std::string parent = options.spill_dir.empty() ? std::string("/tmp") : options.spill_dir;
+    std::string pattern = parent + "/dfm_shards_XXXXXX";
+    std::vector<char> directory(pattern.begin(), pattern.end());
+    directory.push_back('\0');
+    if (!mkdtemp(directory.data())) throw std::runtime_error("cannot create a shard directory in " + parent);
+    const std::string shard_dir = directory.data();
+    std::cout << "Running " << local.shards << " shard workers; shard outputs in " << shard_dir << '\n';
+
+    std::vector<std::string> shard_files(local.shards);
+    std::vector<ShardResult> results(local.shards);
+    std::vector<char> done(local.shards, 0); // Not vector<bool>: launcher threads set their own entries
+    std::mutex log_mutex;
+    auto run_shard = [&](std::size_t s) {
+        shard_files[s] = shard_dir + "/shard_" + std::to_string(s) + ".oas";
+        std::vector<std::string> args = {"dfm_pattern_capture", "--shard-window", std::to_string(borders[s]), std::to_string(borders[s + 1]),
+                                         input_request.filename, std::to_string(input_request.layer_number),
+                                         mask_request.filename, std::to_string(mask_request.layer_number),
+                                         shard_files[s], std::to_string(output_layer)};
+        std::vector<char*> argv;
+        for (auto& arg : args) argv.push_back(&arg[0]);
+        argv.push_back(nullptr);
+        // Workers inherit the environment, except that a traced run gives every shard its own trace file
+        std::vector<std::string> env;
+        for (char** entry = environ; *entry; ++entry) {
+            if (std::strncmp(*entry, "DFM_TRACE=", 10) != 0) env.push_back(*entry);
+        }
+        if (Tracer::enabled()) env.push_back("DFM_TRACE=" + Tracer::path() + ".shard" + std::to_string(s));
+        std::vector<char*> envp;
+        for (auto& entry : env) envp.push_back(&entry[0]);
+        envp.push_back(nullptr);
+
+        for (int attempt = 1; attempt <= 3 && !done[s]; ++attempt) {
+            int fds[2];
+            if (pipe2(fds, O_CLOEXEC) != 0) break; // Close-on-exec, so other workers do not inherit it
+            const pid_t pid = fork();
+            if (pid == 0) {
+                dup2(fds[1], STDOUT_FILENO);
+                ::close(fds[0]);
+                ::close(fds[1]);
+                execve("/proc/self/exe", argv.data(), envp.data());
+                _exit(127);
+            }
+            ::close(fds[1]);
+            std::string report;
+            char buffer[4096];
+            ssize_t got;
+            while ((got = read(fds[0], buffer, sizeof(buffer))) > 0 || (got < 0 && errno == EINTR)) {
+                if (got > 0) report.append(buffer, (std::size_t)got);
+            }
+            ::close(fds[0]);
+            if (pid < 0) break;
+
+            int status = 0;
+            struct rusage usage;
+            while (wait4(pid, &status, 0, &usage) < 0 && errno == EINTR) {}
+            const std::size_t tag = report.rfind(SHARD_RESULT_TAG);
+            ShardResult result;
+            bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 && tag != std::string::npos;
+            if (ok) {
+                std::istringstream line(report.substr(tag + std::strlen(SHARD_RESULT_TAG)));
+                ok = (bool)(line >> result.mask_polygons >> result.input_polygons >> result.result_polygons >> result.stats.candidate_pairs >>
+                            result.stats.rectangle_pairs >> result.stats.rectilinear_pairs >> result.stats.general_pairs);
+            }
+            std::lock_guard<std::mutex> lock(log_mutex);
+            if (ok) {
+                results[s] = result;
+                done[s] = 1;
+                local.max_worker_rss_kb = std::max(local.max_worker_rss_kb, (long)usage.ru_maxrss);
+            } else {
+                std::cerr << "Warning: Shard " << s << " worker " << pid << " failed (attempt " << attempt << ", ";
+                if (WIFSIGNALED(status)) std::cerr << "signal " << WTERMSIG(status); else std::cerr << "exit " << WEXITSTATUS(status);
+                std::cerr << ")" << (attempt < 3 ? "; retrying" : "") << '\n';
+                if (attempt < 3) ++local.retries;
+            }
+        }
+    };
+    ScopedTimer workers_timer("workers");
+    std::vector<std::thread> launchers;
+    for (std::size_t s = 0; s < local.shards; ++s) launchers.emplace_back(run_shard, s);
+    for (auto& launcher : launchers) launcher.join();
+    workers_timer.stop();
+    RunStats::instance().max("worker_peak_rss_kb", (uint64_t)local.max_worker_rss_kb);
+
+    auto remove_shards = [&]() {
+        for (const auto& file : shard_files) {
+            if (!file.empty()) std::remove(file.c_str());
+        }
+        rmdir(shard_dir.c_str());
+    };
+    for (std::size_t s = 0; s < local.shards; ++s) {
+        if (!done[s]) {
+            remove_shards();
+            throw std::runtime_error("shard " + std::to_string(s) + " failed after 3 attempts");
+        }
+    }
+
+    // Merge the shard outputs in stripe order
+    ScopedTimer write_timer("write");
+    OasisWriter writer(output_file, local.units.db_unit, output_options);
+    writer.beginCell("RESULT_CELL");
+    for (std::size_t s = 0; s < local.shards; ++s) {
+        CopyToWriterSink sink(writer, (uint32_t)output_layer, (uint32_t)output_datatype);
+        OasisReader reader(sink);
+        reader.readFile(shard_files[s]);
+        RunStats::instance().add("bytes_read", reader.stats().bytes_read);
+        std::remove(shard_files[s].c_str());
+        local.loaded_polygons += results[s].mask_polygons + results[s].input_polygons;
+        local.result_polygons += sink.polygonCount();
+        and_stats.add(results[s].stats);
+    }
+    writer.close();
+    remove_shards();
+    std::cout << "Saving " << local.result_polygons << " polygons to layer " << output_layer << ":" << output_datatype
+              << " in " << output_file << '\n';
+    report_write(writer, WriteWarnings());
+
+    if (stats) {
+        and_stats.total_pairs = local.mask_polygons * local.input_polygons;
+        *stats = and_stats;
+    }
+    if (shard_stats) *shard_stats = local;
+}
+
+// Counters of the hierarchical AND
+struct HierarchyStats {
+    std::size_t occurrences = 0;     // Cell occurrences with own input polygons
+    std::size_t unique_contexts = 0; // Distinct (cell, local mask context) pairs that were computed
+};
+
+// Total order on polygons by their vertex sequences (outer ring first, then holes)
+int compare_polygons(const polygon_type& a, const polygon_type& b) {
+    auto compare_rings = [](const polygon_type::ring_type& ra, const polygon_type::ring_type& rb) {
+        if (ra.size() != rb.size()) return ra.size() < rb.size() ? -1 : 1;
+        for (std::size_t i = 0; i < ra.size(); ++i) {
+            if (ra[i].x() != rb[i].x()) return ra[i].x() < rb[i].x() ? -1 : 1;
+            if (ra[i].y() != rb[i].y()) return ra[i].y() < rb[i].y() ? -1 : 1;
+        }
+        return 0;
+    };
+    int order = compare_rings(a.outer(), b.outer());
+    if (order != 0) return order;
+    if (a.inners().size() != b.inners().size()) return a.inners().size() < b.inners().size() ? -1 : 1;
+    for (std::size_t i = 0; i < a.inners().size(); ++i) {
+        order = compare_rings(a.inners()[i], b.inners()[i]);
+        if (order != 0) return order;
+    }
+    return 0;
+}
+
+// Bring a mask context into a canonical form: every closed ring starts at its
+// smallest vertex and the polygons are sorted, so equal contexts compare equal
+// no matter how the instance was oriented or in which order the index returned them
+void canonicalize_context(layer_type& context) {
+    auto canonical_ring = [](polygon_type::ring_type& ring) {
+        if (ring.size() < 2) return;
+        ring.pop_back(); // Drop the closing point, rotate, close again
+        auto smallest = std::min_element(ring.begin(), ring.end(), [](const point_type& a, const point_type& b) {
+            return a.x() != b.x() ? a.x() < b.x() : a.y() < b.y();
+        });
+        std::rotate(ring.begin(), smallest, ring.end());
+        ring.push_back(ring.front());
+    };
+    for (auto& poly : context) {
+        canonical_ring(poly.outer());
+        for (auto& inner : poly.inners()) canonical_ring(inner);
+    }
+    std::sort(context.begin(), context.end(),
+              [](const polygon_type& a, const polygon_type& b) { return compare_polygons(a, b) < 0; });
+}
 
-#include "gdstk/gdstk.hpp" // GDSTK header
-
-namespace bg = boost::geometry;
-
-// Define types for Boost.Geometry
-typedef bg::model::d2::point_xy<double> point_type;
-typedef bg::model::polygon<point_type> polygon_type;
-typedef std::vector<polygon_type> layer_type; // A layer is a vector of polygons
-
-// Function to load a layer from an OASIS file
-// Function to load a layer from an OASIS file
-layer_type load_layer_from_oasis(const std::string& filename, int layer_number, int datatype_number = 0) {
-    std::cout << "Loading layer " << layer_number << ":" << datatype_number << " from " << filename << std::endl;
-    layer_type loaded_layer;
-    gdstk::Library lib; // Will be populated by the return value of gdstk::read_oas
-    gdstk::ErrorCode local_error_code_val;
-    // Use 0.0 for unit and precision for gdstk to read them from the OASIS file itself.
-    lib = gdstk::read_oas(filename.c_str(), 0.0, 0.0, &local_error_code_val);
-
-    if (local_error_code_val != gdstk::ErrorCode::NoError) {
-        std::cerr << "Error reading OASIS file: " << filename << " (Error code: " << (int)local_error_code_val << ")" << std::endl;
-        lib.clear(); // Even if read_oas failed and returned an empty/default lib, clear it.
-        return loaded_layer; // Return empty layer on error
-    }
-
-    // Iterate through all cells in the library
-    for (uint64_t i = 0; i < lib.cell_array.count; ++i) {
-        gdstk::Cell* cell = lib.cell_array[i];
-        if (cell) {
-            // Iterate through polygons in the current cell
-            for (uint64_t j = 0; j < cell->polygon_array.count; ++j) {
-                gdstk::Polygon* gdstk_poly = cell->polygon_array[j];
-                if (gdstk_poly && gdstk::get_layer(gdstk_poly->tag) == (uint32_t)layer_number && gdstk::get_type(gdstk_poly->tag) == (uint32_t)datatype_number) {
-                    polygon_type boost_poly; // Create a Boost polygon
-                    gdstk::Array<gdstk::Vec2>& points = gdstk_poly->point_array;
-                    
-                    if (points.count < 3) { // A polygon needs at least 3 points
-                        std::cerr << "Warning: Skipping polygon with < 3 points in cell '" << (cell->name ? cell->name : "Unnamed") << "'." << std::endl;
-                        continue;
-                    }
-
-                    for (uint64_t k = 0; k < points.count; ++k) {
-                        bg::append(boost_poly.outer(), point_type(points[k].x, points[k].y));
-                    }
-                    
-                    // Ensure the polygon is closed for Boost.Geometry by adding the first point at the end
-                    // if it's not already closed. GDSTK polygons are typically closed by definition.
-                    // However, Boost.Geometry's intersection might behave better with explicitly closed polygons.
-                    if (points.count > 0 && (points[0].x != points[points.count - 1].x || points[0].y != points[points.count - 1].y)) {
-                         bg::append(boost_poly.outer(), point_type(points[0].x, points[0].y));
-                    }
-                    bg::correct(boost_poly); // Correct winding order if necessary for Boost.Geometry
-                    loaded_layer.push_back(boost_poly);
-                }
+uint64_t hash_context(std::size_t cell, const layer_type& context) {
+    uint64_t hash = 1469598103934665603ULL; // FNV-1a
+    auto mix = [&hash](uint64_t value) {
+        hash ^= value;
+        hash *= 1099511628211ULL;
+    };
+    mix(cell);
+    for (const auto& poly : context) {
+        mix(poly.outer().size());
+        for (const auto& pt : poly.outer()) mix((uint64_t)(uint32_t)pt.x() << 32 | (uint32_t)pt.y());
+        for (const auto& inner : poly.inners()) {
+            mix(inner.size());
+            for (const auto& pt : inner) mix((uint64_t)(uint32_t)pt.x() << 32 | (uint32_t)pt.y());
+        }
+    }
+    return hash;
+}
+
+// Hierarchical AND of a flat mask with one layer of a cell hierarchy.
+//
+// Every occurrence of a cell only needs the part of the mask that overlaps the
+// envelope of the cell's own polygons. That part is clipped, moved into the
+// cell's coordinate system and canonicalized; occurrences with the same cell
+// and the same local mask context share one AND computation, and the result is
+// placed through the occurrence transforms. Work therefore scales with the
+// unique (cell, context) pairs instead of the flattened chip. Occurrences with
+// a non-Manhattan transform are computed in top-level coordinates without reuse.
+layer_type layer_and_hierarchical(const layer_type& mask_layer, const LayoutHierarchy& input, std::size_t input_layer,
+                                  const TileOptions& options, AndStats* stats = nullptr, HierarchyStats* hierarchy_stats = nullptr) {
+    PreparedLayer mask = prepare_layer(mask_layer);
+    layer_index_type mask_index(mask.boxes.begin(), mask.boxes.end());
+
+    std::vector<box_type> own_boxes(input.cells.size());
+    for (std::size_t c = 0; c < input.cells.size(); ++c) {
+        bg::assign_inverse(own_boxes[c]);
+        for (const auto& poly : input.cells[c].layers[input_layer]) bg::expand(own_boxes[c], bg::return_envelope<box_type>(poly));
+    }
+
+    // One AND to compute: the cell's polygons against a mask context
+    struct UniqueAnd {
+        std::size_t cell;
+        layer_type context;      // Clipped mask, in cell coordinates (top-level for non-Manhattan occurrences)
+        layer_type placed_input; // Input already in top-level coordinates, only for non-Manhattan occurrences
+        layer_type result;
+        AndStats stats;
+    };
+    struct Occurrence {
+        std::size_t unique;
+        CellTransform transform; // Cell to top level; identity for non-Manhattan occurrences
+    };
+    std::vector<UniqueAnd> uniques;
+    std::vector<Occurrence> occurrences;
+    std::unordered_map<uint64_t, std::vector<std::size_t>> uniques_by_hash;
+    std::size_t total_pairs = 0;
+    std::size_t occurrence_count = 0;
+
+    std::vector<indexed_box> candidates;
+    input.forEachOccurrence([&](std::size_t cell, const CellTransform& transform) {
+        const layer_type& own = input.cells[cell].layers[input_layer];
+        if (own.empty()) return;
+        ++occurrence_count;
+        total_pairs += own.size() * mask_layer.size();
+
+        // Envelope of the cell's own polygons in top-level coordinates
+        const box_type& local_box = own_boxes[cell];
+        box_type world_box;
+        bg::assign_inverse(world_box);
+        bg::expand(world_box, transform.apply(local_box.min_corner()));
+        bg::expand(world_box, transform.apply(local_box.max_corner()));
+        bg::expand(world_box, transform.apply(point_type(local_box.min_corner().x(), local_box.max_corner().y())));
+        bg::expand(world_box, transform.apply(point_type(local_box.max_corner().x(), local_box.min_corner().y())));
+
+        candidates.clear();
+        mask_index.query(bgi::intersects(world_box), std::back_inserter(candidates));
+        if (candidates.empty()) return;
+        std::sort(candidates.begin(), candidates.end(),
+                  [](const indexed_box& a, const indexed_box& b) { return a.second < b.second; });
+
+        // The cell's polygons lie inside world_box, so clipping the mask to it does not change the AND
+        layer_type context;
+        for (const auto& candidate : candidates) {
+            if (mask.kinds[candidate.second] == ShapeKind::Rectangle) {
+                box_type overlap;
+                if (rect_and(candidate.first, world_box, overlap)) context.push_back(box_to_polygon(overlap));
+                continue;
+            }
+            try {
+                bg::intersection(mask_layer[candidate.second], world_box, context);
+            } catch (const bg::exception& e) {
+                std::cerr << "Boost.Geometry intersection error: " << e.what() << '\n';
+                RunStats::instance().add("boost_exceptions");
+            }
+        }
+        if (context.empty()) return;
+
+        if (!transform.isManhattan()) {
+            UniqueAnd unique{cell, std::move(context), layer_type(), layer_type(), AndStats()};
+            for (const auto& poly : own) unique.placed_input.push_back(transform.apply(poly));
+            occurrences.push_back(Occurrence{uniques.size(), CellTransform()});
+            uniques.push_back(std::move(unique));
+            return;
+        }
+
+        const CellTransform to_cell = transform.inverted();
+        for (auto& poly : context) poly = to_cell.apply(poly);
+        canonicalize_context(context);
+        std::vector<std::size_t>& bucket = uniques_by_hash[hash_context(cell, context)];
+        for (std::size_t u : bucket) {
+            const UniqueAnd& existing = uniques[u];
+            if (existing.cell != cell || existing.context.size() != context.size()) continue;
+            bool same = true;
+            for (std::size_t i = 0; i < context.size() && same; ++i) same = compare_polygons(existing.context[i], context[i]) == 0;
+            if (same) {
+                occurrences.push_back(Occurrence{u, transform});
+                return;
             }
         }
+        bucket.push_back(uniques.size());
+        occurrences.push_back(Occurrence{uniques.size(), transform});
+        uniques.push_back(UniqueAnd{cell, std::move(context), layer_type(), layer_type(), AndStats()});
+    });
+
+    unsigned threads = options.threads != 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    ThreadPool pool(threads);
+    parallel_for(pool, uniques.size(), [&](std::size_t u) {
+        TraceScope trace("and_cell");
+        UniqueAnd& unique = uniques[u];
+        const layer_type& cell_input = unique.placed_input.empty() ? input.cells[unique.cell].layers[input_layer] : unique.placed_input;
+        unique.result = layer_and(unique.context, cell_input, &unique.stats);
+    });
+
+    layer_type result;
+    AndStats local_stats;
+    for (const auto& unique : uniques) local_stats.add(unique.stats);
+    for (const auto& occurrence : occurrences) {
+        for (const auto& poly : uniques[occurrence.unique].result) result.push_back(occurrence.transform.apply(poly));
+    }
+
+    if (stats) {
+        local_stats.total_pairs = total_pairs;
+        *stats = local_stats;
+    }
+    if (hierarchy_stats) {
+        hierarchy_stats->occurrences = occurrence_count;
+        hierarchy_stats->unique_contexts = uniques.size();
+    }
+    return result;
+}
+
+// Polygon and vertex counts around the merge stage
+struct MergeStats {
+    std::size_t polygons_before = 0;
+    std::size_t vertices_before = 0;
+    std::size_t polygons_after = 0;
+    std::size_t vertices_after = 0;
+};
+
+std::size_t count_vertices(const layer_type& layer) {
+    std::size_t vertices = 0;
+    for (const auto& poly : layer) vertices += bg::num_points(poly);
+    return vertices;
+}
+
+// Merge overlapping and abutting polygons into maximal, non-overlapping ones.
+//
+// Polygons whose envelopes overlap or touch are grouped into connected
+// components (R-tree queries plus union-find); components are independent and
+// merged in parallel. Within a component, rectangles and rectilinear polygons
+// are united by a slab scanline and traced back into polygons; general
+// polygons are then folded in with Boost.Geometry union. Components are
+// emitted in the order of their first polygon, so the output is deterministic.
+layer_type merge_layer(const layer_type& layer, const TileOptions& options, MergeStats* stats = nullptr) {
+    ScopedTimer timer("merge");
+    PreparedLayer prepared = prepare_layer(layer);
+    layer_index_type index(prepared.boxes.begin(), prepared.boxes.end());
+
+    std::vector<std::size_t> parent(layer.size());
+    for (std::size_t i = 0; i < parent.size(); ++i) parent[i] = i;
+    auto find = [&parent](std::size_t i) {
+        while (parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    };
+    std::vector<indexed_box> touching;
+    for (const auto& entry : prepared.boxes) {
+        touching.clear();
+        index.query(bgi::intersects(entry.first), std::back_inserter(touching));
+        for (const auto& other : touching) {
+            std::size_t a = find(entry.second), b = find(other.second);
+            if (a != b) parent[std::max(a, b)] = std::min(a, b); // Roots stay the smallest member
+        }
     }
 
-    if (loaded_layer.empty()) {
-        std::cerr << "Warning: No polygons loaded from " << filename << " for layer " << layer_number << ":" << datatype_number << std::endl;
+    std::vector<std::vector<std::size_t>> components;
+    std::vector<std::size_t> component_of_root(layer.size(), (std::size_t)-1);
+    for (std::size_t i = 0; i < layer.size(); ++i) {
+        std::size_t root = find(i);
+        if (component_of_root[root] == (std::size_t)-1) {
+            component_of_root[root] = components.size();
+            components.emplace_back();
+        }
+        components[component_of_root[root]].push_back(i);
+    }
+
+    std::vector<layer_type> merged(components.size());
+    unsigned threads = options.threads != 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    ThreadPool pool(threads);
+    parallel_for(pool, components.size(), [&](std::size_t c) {
+        TraceScope trace("merge_component");
+        const std::vector<std::size_t>& members = components[c];
+        layer_type& out = merged[c];
+        if (members.size() == 1) {
+            out.push_back(layer[members[0]]);
+            return;
+        }
+
+        std::vector<slab_region> regions;
+        std::vector<std::size_t> general;
+        for (std::size_t idx : members) {
+            switch (prepared.kinds[idx]) {
+            case ShapeKind::Rectangle: regions.push_back(box_to_slabs(prepared.boxes[idx].first)); break;
+            case ShapeKind::Rectilinear: regions.push_back(prepared.slabs[idx]); break;
+            default: general.push_back(idx); break;
+            }
+        }
+        if (!regions.empty()) slabs_to_polygons(slabs_union(regions), out);
+        if (general.empty()) return;
+
+        bg::model::multi_polygon<polygon_type> accumulated, step;
+        accumulated.assign(out.begin(), out.end());
+        for (std::size_t idx : general) {
+            step.clear();
+            try {
+                bg::union_(accumulated, layer[idx], step);
+                accumulated.swap(step);
+            } catch (const bg::exception& e) {
+                std::cerr << "Boost.Geometry union error: " << e.what() << '\n';
+                RunStats::instance().add("boost_exceptions");
+                accumulated.push_back(layer[idx]); // Keep the polygon unmerged rather than losing it
+            }
+        }
+        out.assign(accumulated.begin(), accumulated.end());
+    });
+
+    layer_type result;
+    for (auto& component : merged) {
+        for (auto& poly : component) result.push_back(std::move(poly));
     }
+    if (stats) {
+        stats->polygons_before = layer.size();
+        stats->vertices_before = count_vertices(layer);
+        stats->polygons_after = result.size();
+        stats->vertices_after = count_vertices(result);
+    }
+    return result;
+}
+
+// OR of two layers: both layers merged into maximal polygons
+layer_type layer_or(const layer_type& a_layer, const layer_type& b_layer) {
+    layer_type both;
+    both.reserve(a_layer.size() + b_layer.size());
+    both.insert(both.end(), a_layer.begin(), a_layer.end());
+    both.insert(both.end(), b_layer.begin(), b_layer.end());
+    return merge_layer(both, TileOptions());
+}
+
+// One node of a rule deck: a source layer, a boolean operation or an output
+struct DeckNode {
+    enum Kind { Source, Operation, Output };
+    Kind kind;
+    std::string name;                    // Result name (operations), layer name (sources) or written result (outputs)
+    int line = 0;                        // Deck line that defined the node
+    std::string op;                      // AND, NOT or OR
+    std::vector<std::size_t> inputs;     // Operand nodes
+    LayerRequest source;                 // Layer to load (sources)
+    std::string output_file;             // Target file (outputs)
+    int output_layer = 0;
+    int output_datatype = 0;
 
-    lib.clear(); // Free memory allocated by GDSTK for the library contents
-    return loaded_layer;
+    layer_type layer;                    // Computed or loaded polygons
+    std::vector<std::size_t> dependents; // Nodes that consume this one
+    std::size_t consumers_left = 0;      // Consumers that have not finished; the layer is freed at zero
+    std::size_t inputs_left = 0;         // Operands that are not available yet
+};
+
+// Parse "<layer>" or "<layer>/<datatype>"
+bool parse_layer_spec(const std::string& spec, int& layer, int& datatype) {
+    std::size_t slash = spec.find('/');
+    try {
+        std::size_t used = 0;
+        layer = std::stoi(spec.substr(0, slash), &used);
+        if (used != (slash == std::string::npos ? spec.size() : slash)) return false;
+        datatype = 0;
+        if (slash != std::string::npos) {
+            datatype = std::stoi(spec.substr(slash + 1), &used);
+            if (used != spec.size() - slash - 1) return false;
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+    return layer >= 0 && datatype >= 0;
 }
 
-// Function to save a layer to an OASIS file
-// Function to save a layer to an OASIS file
-void save_layer_to_oasis(const layer_type& layer_to_save, const std::string& filename, int layer_number, int datatype_number = 0) {
-    std::cout << "Saving " << layer_to_save.size() << " polygons to layer " << layer_number << ":" << datatype_number << " in " << filename << std::endl;
+// Parse a rule deck into DAG nodes. Statements, one per line ('#' starts a comment):
+//   input <file>                          Layout for the L<layer>[/<datatype>] operands
+//   layer <name> = <file> <layer>[/<dt>]  Named layer from any file
+//   <name> = <a> AND|NOT|OR <b>           Boolean operation on layers or earlier results
+//   output <name> <file> <layer>[/<dt>]   Write a result
+// Names must be defined before they are used, so the graph cannot have cycles.
+// Throws std::runtime_error on syntax errors.
+std::vector<DeckNode> parse_deck(const std::string& deck_file) {
+    std::ifstream in(deck_file);
+    if (!in) throw std::runtime_error("Unable to open deck file " + deck_file);
 
-    gdstk::Library lib = {};
-    lib.unit = 1e-6;      // Default unit (1 micron)
-    lib.precision = 1e-9; // Default precision (1 nanometer)
-    // lib.name = gdstk::copy_string("DEFAULT_LIB", NULL); // Optional: name the library
+    std::vector<DeckNode> nodes;
+    std::map<std::string, std::size_t> names;
+    std::string default_input;
+    std::string text;
+    int line_number = 0;
 
-    gdstk::Cell* cell = (gdstk::Cell*)gdstk::allocate_clear(sizeof(gdstk::Cell));
-    cell->name = gdstk::copy_string("RESULT_CELL", NULL); // It's good practice to name cells
+    auto fail = [&](const std::string& message) {
+        throw std::runtime_error(deck_file + ":" + std::to_string(line_number) + ": " + message);
+    };
+    auto add_source = [&](const std::string& name, const std::string& file, int layer, int datatype) {
+        DeckNode node;
+        node.kind = DeckNode::Source;
+        node.name = name;
+        node.line = line_number;
+        node.source = LayerRequest{file, layer, datatype};
+        names[name] = nodes.size();
+        nodes.push_back(std::move(node));
+        return nodes.size() - 1;
+    };
+    auto operand = [&](const std::string& token) -> std::size_t {
+        auto found = names.find(token);
+        if (found != names.end()) return found->second;
+        int layer, datatype;
+        if (token.size() > 1 && token[0] == 'L' && parse_layer_spec(token.substr(1), layer, datatype)) {
+            if (default_input.empty()) fail("layer " + token + " used before an 'input' statement");
+            // Canonical key, so L5 and L5/0 share one load
+            std::string key = "L" + std::to_string(layer) + "/" + std::to_string(datatype);
+            found = names.find(key);
+            if (found != names.end()) {
+                names[token] = found->second;
+                return found->second;
+            }
+            std::size_t index = add_source(key, default_input, layer, datatype);
+            names[token] = index;
+            return index;
+        }
+        fail("unknown layer or result '" + token + "'");
+        return 0;
+    };
 
-    for (const auto& boost_poly : layer_to_save) {
-        if (boost_poly.outer().empty()) {
-            std::cerr << "Warning: Skipping an empty polygon during save." << std::endl;
-            continue;
+    while (std::getline(in, text)) {
+        ++line_number;
+        std::size_t comment = text.find('#');
+        if (comment != std::string::npos) text.erase(comment);
+        std::istringstream line(text);
+        std::vector<std::string> tokens((std::istream_iterator<std::string>(line)), std::istream_iterator<std::string>());
+        if (tokens.empty()) continue;
+
+        int layer, datatype;
+        if (tokens[0] == "input") {
+            if (tokens.size() != 2) fail("expected 'input <file>'");
+            default_input = tokens[1];
+        } else if (tokens[0] == "layer") {
+            if (tokens.size() != 5 || tokens[2] != "=" || !parse_layer_spec(tokens[4], layer, datatype)) {
+                fail("expected 'layer <name> = <file> <layer>[/<datatype>]'");
+            }
+            if (names.count(tokens[1])) fail("'" + tokens[1] + "' is already defined");
+            add_source(tokens[1], tokens[3], layer, datatype);
+        } else if (tokens[0] == "output") {
+            if (tokens.size() != 4 || !parse_layer_spec(tokens[3], layer, datatype)) {
+                fail("expected 'output <name> <file> <layer>[/<datatype>]'");
+            }
+            DeckNode node;
+            node.kind = DeckNode::Output;
+            node.name = tokens[1];
+            node.line = line_number;
+            node.inputs.push_back(operand(tokens[1]));
+            node.output_file = tokens[2];
+            node.output_layer = layer;
+            node.output_datatype = datatype;
+            nodes.push_back(std::move(node));
+        } else if (tokens.size() == 5 && tokens[1] == "=") {
+            std::string op = tokens[3];
+            std::transform(op.begin(), op.end(), op.begin(), ::toupper);
+            if (op != "AND" && op != "NOT" && op != "OR") fail("unknown operation '" + tokens[3] + "' (expected AND, NOT or OR)");
+            if (names.count(tokens[0])) fail("'" + tokens[0] + "' is already defined");
+            DeckNode node;
+            node.kind = DeckNode::Operation;
+            node.name = tokens[0];
+            node.line = line_number;
+            node.op = op;
+            node.inputs.push_back(operand(tokens[2]));
+            node.inputs.push_back(operand(tokens[4]));
+            names[tokens[0]] = nodes.size();
+            nodes.push_back(std::move(node));
+        } else {
+            fail("cannot parse '" + text + "'");
+        }
+    }
+    return nodes;
+}
+
+// Run a rule deck: every referenced layer is loaded once (one parse per file),
+// then the operations run as a dependency DAG on the thread pool. An
+// operation is submitted as soon as its operands exist, so independent
+// operations run concurrently, and every layer is freed as soon as its last
+// consumer has finished.
+void run_deck(const std::string& deck_file, const TileOptions& options, const OasisWriterOptions& output_options = OasisWriterOptions()) {
+    std::vector<DeckNode> nodes = parse_deck(deck_file);
+
+    std::vector<LayerRequest> requests;
+    std::vector<std::size_t> source_nodes;
+    for (std::size_t n = 0; n < nodes.size(); ++n) {
+        for (std::size_t input : nodes[n].inputs) {
+            nodes[input].dependents.push_back(n);
+            ++nodes[input].consumers_left;
+        }
+        if (nodes[n].kind == DeckNode::Source) {
+            requests.push_back(nodes[n].source);
+            source_nodes.push_back(n);
         }
+    }
+    for (const auto& node : nodes) {
+        if (node.kind == DeckNode::Operation && node.dependents.empty()) {
+            std::cerr << "Warning: Result '" << node.name << "' (line " << node.line << ") is never used or written" << '\n';
+        }
+    }
+
+    std::cout << "\n--- Loading Layers ---" << '\n';
+    std::vector<LayoutUnits> units;
+    std::vector<layer_type> layers = load_layers_from_oasis(requests, &units);
+    // Everything is computed on the grid of the first loaded layer
+    const LayoutUnits deck_units = units.empty() ? LayoutUnits() : units[0];
+    for (std::size_t r = 0; r < requests.size(); ++r) {
+        DeckNode& node = nodes[source_nodes[r]];
+        node.layer = std::move(layers[r]);
+        if (units[r].db_unit != deck_units.db_unit) {
+            std::cerr << "Warning: Snapping " << node.name << " from a database unit of " << units[r].db_unit << " m to "
+                      << deck_units.db_unit << " m" << '\n';
+            rescale_layer(node.layer, units[r].db_unit, deck_units.db_unit);
+        }
+        std::cout << node.name << ": " << node.layer.size() << " polygons" << '\n';
+    }
 
-        gdstk::Array<gdstk::Vec2> gdstk_points = {}; // Temporary array for points of one polygon
-        // Reserve memory if a typical number of points is known, e.g., gdstk_points.ensure_slots(boost_poly.outer().size());
-        
-        for (const auto& pt : boost_poly.outer()) {
-            gdstk_points.append({pt.x(), pt.y()});
+    for (auto& node : nodes) {
+        for (std::size_t input : node.inputs) {
+            if (nodes[input].kind != DeckNode::Source) ++node.inputs_left;
         }
+    }
 
-        // GDSTK expects polygons to not have the last point same as the first (it implies closure).
-        // Boost polygons often do. If gdstk_points has this, remove the last point.
-        if (gdstk_points.count > 1 && 
-            gdstk_points[0].x == gdstk_points[gdstk_points.count - 1].x && 
-            gdstk_points[0].y == gdstk_points[gdstk_points.count - 1].y) {
-            gdstk_points.count--; // Effectively remove the last point if it closes the loop
+    std::cout << "\n--- Running Deck ---" << '\n';
+    unsigned threads = options.threads != 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    ThreadPool pool(threads);
+    std::mutex state_mutex; // Guards the counters, the layer release and the console
+    std::function<void(std::size_t)> execute = [&](std::size_t n) {
+        DeckNode& node = nodes[n];
+        auto start = std::chrono::steady_clock::now();
+        if (node.kind == DeckNode::Operation) {
+            const layer_type& a = nodes[node.inputs[0]].layer;
+            const layer_type& b = nodes[node.inputs[1]].layer;
+            if (node.op == "AND") node.layer = layer_and(a, b);
+            else if (node.op == "NOT") node.layer = layer_not(a, b);
+            else node.layer = layer_or(a, b);
+        } else {
+            save_layer_to_oasis(nodes[node.inputs[0]].layer, node.output_file, node.output_layer, node.output_datatype, deck_units,
+                                output_options);
         }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-        if (gdstk_points.count < 3) {
-             std::cerr << "Warning: Skipping polygon with < 3 unique points for OASIS output." << std::endl;
-             gdstk_points.clear(); // free the points array
-             continue;
+        std::vector<std::size_t> ready;
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            if (node.kind == DeckNode::Operation) {
+                std::cout << node.name << " = " << nodes[node.inputs[0]].name << " " << node.op << " " << nodes[node.inputs[1]].name
+                          << ": " << node.layer.size() << " polygons (" << seconds << " s)" << '\n';
+            }
+            for (std::size_t input : node.inputs) {
+                if (--nodes[input].consumers_left == 0) layer_type().swap(nodes[input].layer);
+            }
+            if (node.consumers_left == 0) layer_type().swap(node.layer);
+            for (std::size_t dependent : node.dependents) {
+                if (--nodes[dependent].inputs_left == 0) ready.push_back(dependent);
+            }
         }
+        for (std::size_t dependent : ready) pool.submit([&execute, dependent] { execute(dependent); });
+    };
 
-        gdstk::Polygon* gdstk_poly = (gdstk::Polygon*)gdstk::allocate_clear(sizeof(gdstk::Polygon));
-        gdstk_poly->tag = gdstk::make_tag(layer_number, datatype_number);
-        // gdstk_poly->point_array.copy_from(gdstk_points); // This copies the data
-        // Or, if we want to transfer ownership of gdstk_points internal buffer (more advanced, ensure gdstk_points is not cleared later):
-        gdstk_poly->point_array = gdstk_points; // This should assign the array structure, potentially sharing data or copying
-                                              // For safety and clarity with gdstk_allocate_clear, a copy is safer if ownership is murky.
-                                              // Let's re-verify gdstk behavior. A common pattern is to fill poly->point_array directly or ensure it takes ownership.
-                                              // Given typical C library patterns, assigning the struct and then ensuring `gdstk_points` is not cleared (or only its container, not data) would work if point_array becomes owner.
-                                              // However, `gdstk.h` shows `Array<T>` has its own `items` pointer. So `gdstk_poly->point_array.extend(gdstk_points)` or `copy_from` is better.
-        
-        // Let's use copy_from for safety, ensuring gdstk_poly has its own copy of the points.
-        gdstk_poly->point_array.ensure_slots(gdstk_points.count); // Ensure capacity
-        for(size_t i=0; i < gdstk_points.count; ++i) {
-            gdstk_poly->point_array.append(gdstk_points[i]);
+    // Collect the initial ready set first: running tasks already decrement inputs_left
+    std::vector<std::size_t> ready;
+    for (std::size_t n = 0; n < nodes.size(); ++n) {
+        if (nodes[n].kind == DeckNode::Source) {
+            if (nodes[n].consumers_left == 0) layer_type().swap(nodes[n].layer);
+        } else if (nodes[n].inputs_left == 0) {
+            ready.push_back(n);
         }
-        // After points are copied to gdstk_poly->point_array, the temporary gdstk_points can be cleared.
-        gdstk_points.clear(); 
+    }
+    for (std::size_t n : ready) pool.submit([&execute, n] { execute(n); });
+    pool.waitIdle();
+}
+
+// A layer of the served layout, loaded on first use and kept in memory with its index
+struct ResidentLayer {
+    layer_type polygons;
+    PreparedLayer prepared;  // Points into polygons
+    layer_index_type index;
+    double db_unit = LayoutUnits().db_unit;
+    std::once_flag shapes_once;                                      // Builds by_shape on the first MATCH
+    std::unordered_map<uint64_t, std::vector<std::size_t>> by_shape; // Polygons by translation-invariant shape hash
+};
+
+// Append the part of poly (with envelope and shape class) inside window to out
+void clip_to_window(const polygon_type& poly, const box_type& envelope, ShapeKind kind, const box_type& window, layer_type& out) {
+    if (kind == ShapeKind::Rectangle) {
+        box_type overlap;
+        if (rect_and(envelope, window, overlap)) out.push_back(box_to_polygon(overlap));
+        return;
+    }
+    if (bg::covered_by(envelope, window)) {
+        out.push_back(poly);
+        return;
+    }
+    try {
+        bg::intersection(poly, window, out);
+    } catch (const bg::exception& e) {
+        std::cerr << "Boost.Geometry intersection error: " << e.what() << '\n';
+        RunStats::instance().add("boost_exceptions");
+    }
+}
 
-        cell->polygon_array.append(gdstk_poly); // Add the new polygon to the cell
+// Polygons of a resident layer reaching into window, clipped to it, in layer order
+layer_type clip_resident(const ResidentLayer& layer, const box_type& window) {
+    std::vector<indexed_box> hits;
+    layer.index.query(bgi::intersects(window), std::back_inserter(hits));
+    std::sort(hits.begin(), hits.end(), [](const indexed_box& a, const indexed_box& b) { return a.second < b.second; });
+    layer_type clipped;
+    for (const auto& hit : hits) {
+        clip_to_window(layer.polygons[hit.second], hit.first, layer.prepared.kinds[hit.second], window, clipped);
     }
+    return clipped;
+}
 
-    lib.cell_array.append(cell);
+// AND of two resident layers in layer_and()'s order; with a window, only the parts inside it
+layer_type and_resident(const ResidentLayer& mask, const ResidentLayer& input, const box_type* window, AndStats& stats) {
+    std::vector<indexed_box> window_masks;
+    if (window) {
+        mask.index.query(bgi::intersects(*window), std::back_inserter(window_masks));
+        std::sort(window_masks.begin(), window_masks.end(), [](const indexed_box& a, const indexed_box& b) { return a.second < b.second; });
+    }
+    const std::vector<indexed_box>& mask_boxes = window ? window_masks : mask.prepared.boxes;
 
-    gdstk::ErrorCode error_code = lib.write_oas(filename.c_str(), 0, 0, 0);
-    if (error_code != gdstk::ErrorCode::NoError) {
-        std::cerr << "Error writing OASIS file: " << filename << " (Error code: " << (int)error_code << ")" << std::endl;
-        // gdstk::print_error() could be useful here if available
+    IntersectScratch& scratch = thread_scratch();
+    scratch.fragments.clear();
+    std::vector<indexed_box> candidates;
+    for (const auto& mask_box : mask_boxes) {
+        candidates.clear();
+        input.index.query(bgi::intersects(mask_box.first), std::back_inserter(candidates));
+        std::sort(candidates.begin(), candidates.end(), [](const indexed_box& a, const indexed_box& b) { return a.second < b.second; });
+        for (const auto& candidate : candidates) {
+            if (window && !bg::intersects(candidate.first, *window)) continue;
+            ++stats.candidate_pairs;
+            intersect_pair(mask.prepared, mask_box.second, input.prepared, candidate.second, scratch, stats);
+        }
     }
+    layer_type fragments;
+    scratch.fragments.appendTo(fragments);
+    if (!window) return fragments;
 
-    // lib.clear() will free the cell, its name, polygons, and their point arrays.
-    // It will also free the library name if it was set.
-    lib.clear(); 
+    layer_type clipped;
+    for (const auto& fragment : fragments) {
+        const box_type envelope = bg::return_envelope<box_type>(fragment);
+        clip_to_window(fragment, envelope, classify_polygon(fragment), *window, clipped);
+    }
+    return clipped;
 }
 
-// Function to perform AND operation between mask and input layers (unchanged)
-layer_type layer_and(const layer_type& mask_layer, const layer_type& input_layer) {
-    layer_type result;
-    for (const auto& mask_poly : mask_layer) {
-        for (const auto& input_poly : input_layer) {
-            std::vector<polygon_type> output; // intersection can produce multiple polygons
+// Hash of a polygon's vertices relative to its smallest vertex, equal for translated copies
+uint64_t shape_hash(const polygon_type& poly) {
+    layer_type canonical(1, poly);
+    canonicalize_context(canonical);
+    const point_type origin = canonical[0].outer().front();
+    uint64_t hash = 1469598103934665603ULL; // FNV-1a
+    auto mix = [&hash](uint64_t value) {
+        hash ^= value;
+        hash *= 1099511628211ULL;
+    };
+    auto mix_ring = [&](const polygon_type::ring_type& ring) {
+        mix(ring.size());
+        for (const auto& pt : ring) mix((uint64_t)(uint32_t)(pt.x() - origin.x()) << 32 | (uint32_t)(pt.y() - origin.y()));
+    };
+    mix_ring(canonical[0].outer());
+    for (const auto& inner : canonical[0].inners()) mix_ring(inner);
+    return hash;
+}
+
+// Translations (dx, dy) at which the clip of window occurs again in the layer, exactly, including (0, 0).
+//
+// The pattern is the window's clip, canonicalized relative to the window corner.
+// A polygon lying wholly inside the window anchors the search: only places
+// where a translated copy of it sits are candidates, and at each of them the
+// translated window is clipped and compared with the pattern. The anchor with
+// the fewest copies is used, so common shapes do not flood the comparison.
+std::vector<std::pair<int64_t, int64_t>> match_resident(ResidentLayer& layer, const box_type& window) {
+    std::call_once(layer.shapes_once, [&layer] {
+        for (std::size_t p = 0; p < layer.polygons.size(); ++p) layer.by_shape[shape_hash(layer.polygons[p])].push_back(p);
+    });
+    auto shifted = [&window](int64_t dx, int64_t dy) {
+        return box_type(point_type(to_coord((double)(window.min_corner().x() + dx)), to_coord((double)(window.min_corner().y() + dy))),
+                        point_type(to_coord((double)(window.max_corner().x() + dx)), to_coord((double)(window.max_corner().y() + dy))));
+    };
+    auto normalized_clip = [&layer](const box_type& at) {
+        layer_type clip = clip_resident(layer, at);
+        for (auto& poly : clip) {
+            bg::for_each_point(poly, [&at](point_type& pt) {
+                pt.x(pt.x() - at.min_corner().x());
+                pt.y(pt.y() - at.min_corner().y());
+            });
+        }
+        canonicalize_context(clip);
+        return clip;
+    };
+    auto same = [](const layer_type& a, const layer_type& b) {
+        if (a.size() != b.size()) return false;
+        for (std::size_t i = 0; i < a.size(); ++i) {
+            if (compare_polygons(a[i], b[i]) != 0) return false;
+        }
+        return true;
+    };
+
+    const layer_type pattern = normalized_clip(window);
+    if (pattern.empty()) throw std::runtime_error("the pattern window is empty");
+    std::vector<indexed_box> inside;
+    layer.index.query(bgi::covered_by(window), std::back_inserter(inside));
+    const std::vector<std::size_t>* twins = nullptr;
+    std::size_t anchor = 0;
+    for (const auto& candidate : inside) {
+        // at(), not operator[]: concurrent requests share the map and must not insert
+        const std::vector<std::size_t>& copies = layer.by_shape.at(shape_hash(layer.polygons[candidate.second]));
+        if (!twins || copies.size() < twins->size()) {
+            twins = &copies;
+            anchor = candidate.second;
+        }
+    }
+    if (!twins) throw std::runtime_error("the pattern window must contain at least one whole polygon");
+
+    const point_type anchor_corner = layer.prepared.boxes[anchor].first.min_corner();
+    std::vector<std::pair<int64_t, int64_t>> offsets;
+    for (std::size_t twin : *twins) {
+        const point_type twin_corner = layer.prepared.boxes[twin].first.min_corner();
+        const int64_t dx = (int64_t)twin_corner.x() - anchor_corner.x();
+        const int64_t dy = (int64_t)twin_corner.y() - anchor_corner.y();
+        box_type at;
+        try {
+            at = shifted(dx, dy);
+        } catch (const std::out_of_range&) {
+            continue; // The window would leave the coordinate range
+        }
+        if (same(normalized_clip(at), pattern)) offsets.push_back(std::make_pair(dx, dy));
+    }
+    std::sort(offsets.begin(), offsets.end());
+    offsets.erase(std::unique(offsets.begin(), offsets.end()), offsets.end());
+    return offsets;
+}
+
+// Daemon that keeps the layers of one layout in memory and answers LayoutClient requests.
+//
+// Layers are loaded, prepared and indexed on first use and then stay resident;
+// concurrent first requests for the same layer wait for one load. A load that
+// fails is reported to the waiting requests and retried by the next one. Every
+// connection is served by its own thread, and requests only read the resident
+// layers, so they run concurrently without locks. The protocol is described
+// in dfm_layout_protocol.h.
+class LayoutServer {
+public:
+    explicit LayoutServer(const std::string& layout_file) : m_layout_file(layout_file) {}
+
+    // Serve on socket_path until a SHUTDOWN request. Throws std::runtime_error if the socket cannot be set up.
+    void serve(const std::string& socket_path) {
+        if (!std::ifstream(m_layout_file)) throw std::runtime_error("cannot read " + m_layout_file);
+        const sockaddr_un address = unix_socket_address(socket_path);
+        struct stat info;
+        if (lstat(socket_path.c_str(), &info) == 0) {
+            if (!S_ISSOCK(info.st_mode)) throw std::runtime_error(socket_path + " exists and is not a socket");
+            bool listening = true;
             try {
-                bg::intersection(mask_poly, input_poly, output);
-                result.insert(result.end(), output.begin(), output.end());
-            } catch (const bg::exception& e) {
-                std::cerr << "Boost.Geometry intersection error: " << e.what() << std::endl;
-                // Potentially log problematic polygons or skip them
+                LayoutClient probe(socket_path);
+            } catch (const std::runtime_error&) {
+                listening = false;
+            }
+            if (listening) throw std::runtime_error("a server is already listening on " + socket_path);
+            unlink(socket_path.c_str()); // Left behind by a server that did not shut down
+        }
+
+        m_listen_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (m_listen_fd < 0) throw std::runtime_error("cannot create a socket");
+        if (::bind(m_listen_fd, (const sockaddr*)&address, sizeof(address)) != 0 || ::listen(m_listen_fd, SOMAXCONN) != 0) {
+            ::close(m_listen_fd);
+            throw std::runtime_error("cannot listen on " + socket_path + " (" + std::strerror(errno) + ")");
+        }
+        std::cout << "Serving " << m_layout_file << " on " << socket_path << '\n' << std::flush;
+
+        for (;;) {
+            const int fd = accept4(m_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_stop) {
+                if (fd >= 0) ::close(fd);
+                break;
+            }
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                std::cerr << "Error: accept failed (" << std::strerror(errno) << ")" << '\n';
+                break;
             }
+            m_connections.insert(fd);
+            std::thread([this, fd] { handleConnection(fd); }).detach();
         }
+
+        // Stop reading further requests; the ones already running still get their responses
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_stop = true;
+        for (int fd : m_connections) ::shutdown(fd, SHUT_RD);
+        m_idle.wait(lock, [this] { return m_connections.empty(); });
+        ::close(m_listen_fd);
+        unlink(socket_path.c_str());
     }
-    return result;
+
+private:
+    std::string m_layout_file;
+    int m_listen_fd = -1;
+    std::mutex m_mutex;               // Guards the members below
+    std::condition_variable m_idle;   // Signalled when a connection closes
+    std::set<int> m_connections;      // Open client sockets
+    bool m_stop = false;              // Set by a SHUTDOWN request
+    std::map<std::pair<uint32_t, uint32_t>, std::shared_future<std::shared_ptr<ResidentLayer>>> m_layers;
+
+    std::shared_ptr<ResidentLayer> layer(uint32_t number, uint32_t datatype) {
+        const std::pair<uint32_t, uint32_t> key(number, datatype);
+        std::promise<std::shared_ptr<ResidentLayer>> promise;
+        std::shared_future<std::shared_ptr<ResidentLayer>> future;
+        bool load = false;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto found = m_layers.find(key);
+            if (found == m_layers.end()) {
+                future = promise.get_future().share();
+                m_layers[key] = future;
+                load = true;
+            } else {
+                future = found->second;
+            }
+        }
+        if (load) {
+            try {
+                std::shared_ptr<ResidentLayer> resident = std::make_shared<ResidentLayer>();
+                // Read directly rather than through load_layers_from_oasis, which keeps going with an
+                // empty layer: a file that cannot be read must fail the request and not be cached
+                ScopedTimer timer("load");
+                std::vector<layer_type> layers(1);
+                const std::map<std::pair<uint32_t, uint32_t>, std::vector<std::size_t>> requests_by_tag = {{key, {0}}};
+                LayerCollector collector(layers, requests_by_tag);
+                OasisReader reader(collector);
+                reader.readFile(m_layout_file);
+                timer.stop();
+                resident->polygons = std::move(layers[0]);
+                resident->db_unit = reader.dbUnit();
+                resident->prepared = prepare_layer(resident->polygons);
+                resident->index = layer_index_type(resident->prepared.boxes.begin(), resident->prepared.boxes.end());
+                promise.set_value(resident);
+            } catch (...) {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_layers.erase(key); // A later request tries again
+                }
+                promise.set_exception(std::current_exception());
+            }
+        }
+        return future.get();
+    }
+
+    void handleConnection(int fd) {
+        std::string request;
+        try {
+            while (receive_frame(fd, request)) {
+                bool shutdown = false;
+                if (!send_frame(fd, handleRequest(request, shutdown))) break;
+                if (shutdown) {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_stop = true;
+                    ::shutdown(m_listen_fd, SHUT_RDWR); // Wakes the accept loop
+                    break;
+                }
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Warning: Dropping a client (" << e.what() << ")" << '\n';
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_connections.erase(fd);
+            m_idle.notify_all();
+        }
+        ::close(fd);
+    }
+
+    // Response payload for one request payload
+    std::string handleRequest(const std::string& payload, bool& shutdown) {
+        TraceScope trace("request");
+        const auto start = std::chrono::steady_clock::now();
+        MessageWriter response;
+        std::ostringstream log;
+        try {
+            MessageReader request(payload);
+            const LayoutOp op = (LayoutOp)request.u8();
+            if (op == LayoutOp::And) {
+                const uint32_t mask_layer = request.u32(), mask_datatype = request.u32();
+                const uint32_t input_layer = request.u32(), input_datatype = request.u32();
+                const bool windowed = request.u8() != 0;
+                const box_type window = request.box();
+                std::shared_ptr<ResidentLayer> mask = layer(mask_layer, mask_datatype);
+                std::shared_ptr<ResidentLayer> input = layer(input_layer, input_datatype);
+                AndStats stats;
+                const layer_type result = and_resident(*mask, *input, windowed ? &window : nullptr, stats);
+                response.u8((uint8_t)LayoutStatus::Ok);
+                response.f64(input->db_unit);
+                response.polygons(result);
+                log << "AND " << mask_layer << ":" << mask_datatype << " x " << input_layer << ":" << input_datatype
+                    << (windowed ? " in window" : "") << " -> " << result.size() << " polygons (" << stats.candidate_pairs << " pairs)";
+            } else if (op == LayoutOp::Clip) {
+                const uint32_t number = request.u32(), datatype = request.u32();
+                const box_type window = request.box();
+                std::shared_ptr<ResidentLayer> resident = layer(number, datatype);
+                const layer_type clip = clip_resident(*resident, window);
+                response.u8((uint8_t)LayoutStatus::Ok);
+                response.f64(resident->db_unit);
+                response.polygons(clip);
+                log << "CLIP " << number << ":" << datatype << " -> " << clip.size() << " polygons";
+            } else if (op == LayoutOp::Match) {
+                const uint32_t number = request.u32(), datatype = request.u32();
+                const box_type window = request.box();
+                const std::vector<std::pair<int64_t, int64_t>> offsets = match_resident(*layer(number, datatype), window);
+                response.u8((uint8_t)LayoutStatus::Ok);
+                response.u32((uint32_t)offsets.size());
+                for (const auto& offset : offsets) {
+                    response.i64(offset.first);
+                    response.i64(offset.second);
+                }
+                log << "MATCH " << number << ":" << datatype << " -> " << offsets.size() << " occurrences";
+            } else if (op == LayoutOp::Shutdown) {
+                shutdown = true;
+                response.u8((uint8_t)LayoutStatus::Ok);
+                log << "SHUTDOWN";
+            } else {
+                throw std::runtime_error("unknown request " + std::to_string((int)op));
+            }
+        } catch (const std::exception& e) {
+            response = MessageWriter();
+            response.u8((uint8_t)LayoutStatus::Error);
+            response.text(e.what());
+            log.str("");
+            log << "Request failed: " << e.what();
+        }
+        RunStats::instance().add("requests");
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::cout << log.str() << " in " << ms << " ms" << '\n' << std::flush;
+        return response.bytes();
+    }
+};
+
+// Options of a window density run (--density); lengths in microns
+struct DensityOptions {
+    double window = 0.0; // Window edge length
+    double step = 0.0;   // Distance between window origins
+    double cell = 0.0;   // Coverage grid cell (0 = the largest cell that divides window and step)
+};
+
+// Density map of one layer: coverage per cell, then every window from the summed-area table.
+// A .csv output file gets one line per window, any other name the binary map of DensityMap::writeBinary.
+void run_density(const LayerRequest& request, const DensityOptions& density, const std::string& output_file, const TileOptions& options) {
+    LayoutUnits units;
+    layer_type layer = load_layer_from_oasis(request.filename, request.layer_number, request.datatype_number, &units);
+    if (layer.empty()) throw std::runtime_error("no polygons on the density layer");
+    std::cout << "Layer loaded with " << layer.size() << " polygons." << '\n';
+
+    const double dbu_per_micron = 1e-6 / units.db_unit;
+    auto to_dbu = [dbu_per_micron](double microns, const char* what) {
+        const double dbu = std::round(microns * dbu_per_micron);
+        if (!(dbu >= 1.0 && dbu <= 1e9)) throw std::runtime_error(std::string("invalid density ") + what);
+        return (int64_t)dbu;
+    };
+    const int64_t window = to_dbu(density.window, "window");
+    const int64_t step = to_dbu(density.step, "step");
+    int64_t cell = 0;
+    if (density.cell > 0.0) {
+        cell = to_dbu(density.cell, "grid");
+    } else {
+        cell = window;
+        for (int64_t rest = step; rest != 0;) { // Greatest common divisor
+            const int64_t next = cell % rest;
+            cell = rest;
+            rest = next;
+        }
+    }
+    if (window % cell != 0 || step % cell != 0) throw std::runtime_error("the density window and step must be multiples of the grid cell");
+
+    // Overlapping shapes would otherwise be counted twice
+    layer = merge_layer(layer, options);
+
+    box_type extent = bg::return_envelope<box_type>(layer.front());
+    for (const auto& poly : layer) bg::expand(extent, bg::return_envelope<box_type>(poly));
+    auto floor_to_cell = [cell](coord_type value) { return (coord_type)(((int64_t)value - (((int64_t)value % cell) + cell) % cell)); };
+    const point_type origin(floor_to_cell(extent.min_corner().x()), floor_to_cell(extent.min_corner().y()));
+    const std::size_t extent_columns = (std::size_t)(((int64_t)extent.max_corner().x() - origin.x() + cell - 1) / cell);
+    const std::size_t extent_rows = (std::size_t)(((int64_t)extent.max_corner().y() - origin.y() + cell - 1) / cell);
+    const std::size_t window_cells = (std::size_t)(window / cell), step_cells = (std::size_t)(step / cell);
+    CoverageGrid grid(origin, (coord_type)cell, std::max(extent_columns, window_cells), std::max(extent_rows, window_cells));
+
+    const unsigned threads = options.threads != 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    {
+        ScopedTimer timer("rasterize");
+        ThreadPool pool(threads);
+        grid.rasterize(layer, pool);
+    }
+    ScopedTimer density_timer("density");
+    DensityMap map(grid, window_cells, step_cells, extent_columns, extent_rows);
+    density_timer.stop();
+    RunStats::instance().add("density_cells", (uint64_t)grid.columns() * grid.rows());
+    RunStats::instance().add("density_windows", (uint64_t)map.columns() * map.rows());
+
+    const double microns_per_dbu = units.db_unit / 1e-6;
+    std::cout << "Grid: " << grid.columns() << " x " << grid.rows() << " cells of " << cell * microns_per_dbu << " um" << '\n';
+    std::cout << "Windows: " << map.columns() << " x " << map.rows() << " of " << window * microns_per_dbu << " um, step "
+              << step * microns_per_dbu << " um" << '\n';
+    auto print_window = [&](const char* label, std::size_t index) {
+        const std::size_t i = index % map.columns(), j = index / map.columns();
+        const box_type box = map.window(i, j);
+        std::cout << label << map.density(i, j) * 100.0 << "% in (" << box.min_corner().x() * microns_per_dbu << ", "
+                  << box.min_corner().y() * microns_per_dbu << ") - (" << box.max_corner().x() * microns_per_dbu << ", "
+                  << box.max_corner().y() * microns_per_dbu << ") um" << '\n';
+    };
+    print_window("Minimum density: ", map.minimum());
+    print_window("Maximum density: ", map.maximum());
+
+    ScopedTimer write_timer("write");
+    const bool csv = output_file.size() >= 4 && output_file.compare(output_file.size() - 4, 4, ".csv") == 0;
+    if (!(csv ? map.writeCsv(output_file, units.db_unit) : map.writeBinary(output_file, units.db_unit))) {
+        throw std::runtime_error("cannot write " + output_file);
+    }
+    std::cout << "Density map saved to " << output_file << (csv ? " (CSV)" : " (binary)") << '\n';
 }
 
-int main(int argc, char* argv[]) {
-    if (argc != 7) {
-        std::cerr << "Usage: " << argv[0] << " <mask_oasis_file> <mask_layer_num> <input_oasis_file> <input_layer_num> <output_oasis_file> <output_layer_num>" << std::endl;
+// Rules of a width/spacing run (--width, --spacing, --spacing-run); lengths in microns
+struct EdgeCheckOptions {
+    double width = 0.0;                               // Minimum width, 0 = not checked
+    std::vector<std::pair<double, double>> spacing;   // (parallel run length, spacing) rows
+};
+
+// Width and spacing markers of one layer. Width markers go to datatype 0 of the output layer, spacing markers to datatype 1.
+void run_width_spacing(const LayerRequest& request, const EdgeCheckOptions& checks, const std::string& output_file, int output_layer_num,
+                       const TileOptions& options, const OasisWriterOptions& output_options) {
+    LayoutUnits units;
+    layer_type layer = load_layer_from_oasis(request.filename, request.layer_number, request.datatype_number, &units);
+    std::cout << "Layer loaded with " << layer.size() << " polygons." << '\n';
+
+    const double dbu_per_micron = 1e-6 / units.db_unit;
+    auto to_dbu = [dbu_per_micron](double microns, const char* what) {
+        const double dbu = std::round(microns * dbu_per_micron);
+        if (!(dbu >= 0.0 && dbu <= 1e9)) throw std::runtime_error(std::string("invalid ") + what);
+        return (coord_type)dbu;
+    };
+    EdgeCheckRules rules;
+    rules.min_width = to_dbu(checks.width, "width");
+    for (const auto& row : checks.spacing) rules.addSpacing(to_dbu(row.first, "run length"), to_dbu(row.second, "spacing"));
+
+    // Edges shared by abutting or overlapping shapes are not real boundaries
+    layer = merge_layer(layer, options);
+
+    const unsigned threads = options.threads != 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    EdgeCheckStats stats;
+    std::vector<EdgeMarker> markers;
+    {
+        ScopedTimer timer("edge_check");
+        ThreadPool pool(threads);
+        markers = WidthSpacingChecker(rules).check(layer, pool, &stats);
+    }
+    RunStats::instance().add("edges", stats.edges);
+    RunStats::instance().add("halo_edges", stats.halo_edges);
+    RunStats::instance().add("edge_pairs_tested", stats.candidate_pairs);
+
+    layer_type width_markers, spacing_markers;
+    double narrowest = -1.0, closest = -1.0;
+    for (const EdgeMarker& marker : markers) {
+        if (marker.check == EdgeCheck::Width) {
+            width_markers.push_back(marker.shape);
+            if (narrowest < 0.0 || marker.distance < narrowest) narrowest = marker.distance;
+        } else {
+            spacing_markers.push_back(marker.shape);
+            if (closest < 0.0 || marker.distance < closest) closest = marker.distance;
+        }
+    }
+    RunStats::instance().add("width_markers", width_markers.size());
+    RunStats::instance().add("spacing_markers", spacing_markers.size());
+
+    const double microns_per_dbu = units.db_unit / 1e-6;
+    std::cout << "Edges: " << stats.edges << " in " << stats.stripes << " stripes (" << stats.halo_edges << " halo copies), "
+              << stats.candidate_pairs << " pairs measured" << '\n';
+    if (rules.min_width > 0) {
+        std::cout << "Width < " << rules.min_width * microns_per_dbu << " um: " << width_markers.size() << " markers";
+        if (narrowest >= 0.0) std::cout << ", narrowest " << narrowest * microns_per_dbu << " um";
+        std::cout << '\n';
+    }
+    if (!rules.spacing.empty()) {
+        std::cout << "Spacing: " << spacing_markers.size() << " markers";
+        if (closest >= 0.0) std::cout << ", closest " << closest * microns_per_dbu << " um";
+        std::cout << '\n';
+    }
+
+    ScopedTimer timer("write");
+    OasisWriter writer(output_file, units.db_unit, output_options);
+    writer.beginCell("RESULT_CELL");
+    WriteWarnings warnings;
+    write_polygons(writer, width_markers, output_layer_num, 0, warnings);
+    write_polygons(writer, spacing_markers, output_layer_num, 1, warnings);
+    writer.close();
+    report_write(writer, warnings);
+    std::cout << "Markers saved to layer " << output_layer_num << " (0: width, 1: spacing) in " << output_file << '\n';
+}
+
+// Print the candidate filtering and kernel counters of an AND run and add them to the run statistics
+void print_and_stats(const AndStats& and_stats, std::size_t result_polygons, bool kernels) {
+    RunStats& run_stats = RunStats::instance();
+    run_stats.add("pairs_tested", and_stats.candidate_pairs);
+    run_stats.add("pairs_rectangle", and_stats.rectangle_pairs);
+    run_stats.add("pairs_rectilinear", and_stats.rectilinear_pairs);
+    run_stats.add("pairs_general", and_stats.general_pairs);
+    run_stats.add("intersections_produced", result_polygons);
+    double pruned_percent = and_stats.total_pairs == 0 ? 0.0 :
+        100.0 * (1.0 - (double)and_stats.candidate_pairs / (double)and_stats.total_pairs);
+    std::cout << "Candidate pairs: " << and_stats.candidate_pairs << " of " << and_stats.total_pairs
+              << " (" << pruned_percent << "% pruned by the spatial index)" << '\n';
+    std::cout << "AND operation resulted in " << result_polygons << " polygons." << '\n';
+    if (kernels) {
+        std::cout << "Intersection kernels:" << '\n';
+        std::cout << "  rectangle x rectangle (min/max): " << and_stats.rectangle_pairs << " pairs" << '\n';
+        std::cout << "  rectilinear (slab scanline):     " << and_stats.rectilinear_pairs << " pairs" << '\n';
+        std::cout << "  general (Boost.Geometry):        " << and_stats.general_pairs << " pairs" << '\n';
+    }
+}
+
+// Print busy and idle time per pipeline stage and the stage that bounds the run
+void print_pipeline_stats(const PipelineStats& stats) {
+    struct Row {
+        const char* name;
+        const StageTimes* times;
+    };
+    std::vector<Row> rows;
+    if (!stats.shared_file) rows.push_back(Row{"load mask", &stats.load_mask});
+    rows.push_back(Row{stats.shared_file ? "load mask+input" : "load input", &stats.load_input});
+    rows.push_back(Row{"compute", &stats.compute});
+    rows.push_back(Row{"store", &stats.store});
+
+    std::cout << "Pipeline: " << stats.chunks << " chunks in " << stats.wall_time << " s" << '\n';
+    const Row* bound = &rows[0];
+    for (const auto& row : rows) {
+        std::cout << "  " << row.name << ": busy " << row.times->busy << " s, idle " << row.times->idle << " s" << '\n';
+        if (row.times->busy > bound->times->busy) bound = &row;
+    }
+    std::cout << "Bounded by: " << bound->name << '\n';
+}
+
+// Version of the capture output in result cache keys. Bump it whenever the same
+// inputs and options can produce a different output file.
+const char* const CAPTURE_CACHE_VERSION = "dfm_pattern_capture 3";
+
+// Settings that determine the bytes of a capture output
+struct CaptureCacheInputs {
+    std::string mask_file;
+    int mask_layer;
+    std::string input_file;
+    int input_layer;
+    int datatype;
+    int output_layer;
+    bool hierarchical;
+    bool merge;
+    bool compress;
+    std::size_t shards;  // Sharded runs write the shards one after the other
+    std::string mode;    // AND execution path: "pipelined", "whole_layer", "out_of_core" or "sharded"
+    double tile_size;    // Database units; only the out-of-core path writes in tile order
+};
+
+// Cache key of a capture run: a 128-bit hash of both file contents, the layer
+// numbers, the operation, the execution path and the tool version. The paths
+// write the same polygons in different orders: the pipeline in input order,
+// the whole-layer AND (flat or tiled, any thread count and tile size) in mask
+// order, the out-of-core AND in tile order and a sharded run shard by shard.
+// So the path is part of the key, with the tile size of an out-of-core run and
+// the shard count. The thread count and the memory limit do not change the output.
+std::string capture_cache_key(const CaptureCacheInputs& run) {
+    ContentHash128 hash;
+    hash.update(std::string(CAPTURE_CACHE_VERSION));
+    hash.update(std::string("AND"));
+    hash.updateFile(run.mask_file);
+    if (run.input_file == run.mask_file) {
+        hash.updateValue(0); // Same file, not hashed twice
+    } else {
+        hash.updateValue(1);
+        hash.updateFile(run.input_file);
+    }
+    hash.updateValue((uint64_t)(int64_t)run.mask_layer);
+    hash.updateValue((uint64_t)(int64_t)run.input_layer);
+    hash.updateValue((uint64_t)(int64_t)run.datatype);
+    hash.updateValue((uint64_t)(int64_t)run.output_layer);
+    hash.updateValue((run.hierarchical ? 1 : 0) | (run.merge ? 2 : 0) | (run.compress ? 4 : 0));
+    hash.updateValue(run.shards);
+    hash.update(run.mode);
+    hash.updateValue((uint64_t)(run.mode == "out_of_core" ? std::llround(run.tile_size) : 0));
+    return hash.hex();
+}
+
+// Print the result cache counters of this run and of all runs sharing the cache directory
+void print_cache_stats(const ResultCache& cache) {
+    const ResultCacheStats& run = cache.stats();
+    const ResultCacheStats total = cache.totalStats();
+    std::cout << "Result cache: " << (run.hits > 0 ? "hit" : "miss") << ", " << run.bytes_saved << " bytes served";
+    if (run.evictions > 0) std::cout << ", " << run.evictions << " entries evicted";
+    std::cout << '\n';
+    std::cout << "Result cache totals (" << cache.directory() << "): " << total.hits << " hits, " << total.misses << " misses, "
+              << total.bytes_saved / 1048576.0 << " MB saved, " << total.evictions << " evictions" << '\n';
+}
+
+void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " [options] <mask_oasis_file> <mask_layer_num> <input_oasis_file> <input_layer_num> <output_oasis_file> <output_layer_num>" << '\n';
+    std::cerr << "       " << program << " [--threads N] --deck <rule_deck_file>" << '\n';
+    std::cerr << "       " << program << " --serve <socket_path> <oasis_file>" << '\n';
+    std::cerr << "       " << program << " [--threads N] --density <window_um> <step_um> <oasis_file> <layer[/datatype]> <output_file>" << '\n';
+    std::cerr << "       " << program << " [--threads N] [--width W] [--spacing S] [--spacing-run L S]... <oasis_file> <layer[/datatype]> <output_oasis_file> <output_layer_num>" << '\n';
+    std::cerr << "Options:" << '\n';
+    std::cerr << "  --threads N      Run the AND and the OASIS decoding on N worker threads (0 = all cores)" << '\n';
+    std::cerr << "  --tile-size S    Load both layers first and run the tiled AND with tiles of S database units" << '\n';
+    std::cerr << "  --stats          Print how many pairs each intersection kernel handled" << '\n';
+    std::cerr << "  --stats=FILE     Write phase times, counters and the peak RSS of the run to FILE as JSON" << '\n';
+    std::cerr << "  --hierarchical   Resolve cell placements and compute the AND once per unique cell and mask context" << '\n';
+    std::cerr << "  --merge          Merge overlapping and abutting result fragments into maximal polygons" << '\n';
+    std::cerr << "  --deck FILE      Run the AND/NOT/OR operations of a rule deck on layers loaded once" << '\n';
+    std::cerr << "  --memory-limit M Out-of-core AND: bucket both layers into tiles on disk and keep about M MB in memory" << '\n';
+    std::cerr << "  --spill-dir DIR  Directory for the out-of-core tile buckets (default: $TMPDIR or /tmp)" << '\n';
+    std::cerr << "  --no-mmap        Read OASIS files through a buffered window instead of a memory mapping" << '\n';
+    std::cerr << "  --cold           Drop the input files from the page cache first, to time a cold start" << '\n';
+    std::cerr << "  --compress       Write the output as compressed CBLOCKs (deflated on --threads threads)" << '\n';
+    std::cerr << "  --incremental    Recompute only tiles (of --tile-size, default 100 um) whose geometry changed since the last run" << '\n';
+    std::cerr << "  --shards N       Split the layout into N stripes computed by separate worker processes, then merge" << '\n';
+    std::cerr << "  --cache-dir DIR  Reuse outputs of earlier runs with identical inputs and options from a cache in DIR" << '\n';
+    std::cerr << "  --cache-size M   Evict the least recently used cache entries above M MB (default: 1024)" << '\n';
+    std::cerr << "  --serve SOCKET   Keep the layers of the layout resident and answer AND/clip/match queries on a Unix socket" << '\n';
+    std::cerr << "  --density W S    Map the coverage of W x W um windows every S um; a .csv output gets one line per window, others a binary map" << '\n';
+    std::cerr << "  --density-grid G Coverage grid cell of the density map in um (default: the largest that divides W and S)" << '\n';
+    std::cerr << "  --width W        Mark interior edge pairs closer than W um (markers on datatype 0 of the output layer)" << '\n';
+    std::cerr << "  --spacing S      Mark exterior edge pairs closer than S um (markers on datatype 1)" << '\n';
+    std::cerr << "  --spacing-run L S  Require S um between parallel edges facing each other over at least L um; repeat for a table" << '\n';
+    std::cerr << "Environment:" << '\n';
+    std::cerr << "  DFM_TRACE=FILE   Write a Chrome trace-event timeline of the run to FILE on exit" << '\n';
+}
+
+// Benchmarks and other tools include this file for the AND engine and define
+// DFM_CAPTURE_NO_MAIN to bring their own main()
+#ifndef DFM_CAPTURE_NO_MAIN
+int run_capture(int argc, char* argv[]) {
+    std::vector<std::string> positional;
+    TileOptions tile_options;
+    bool tiled = false;
+    bool print_stats = false;
+    bool hierarchical = false;
+    bool merge = false;
+    std::string deck_file;
+    OasisWriterOptions output_options;
+    bool cold_start = false;
+    bool incremental = false;
+    std::size_t shards = 0;
+    bool shard_worker = false;
+    LoadWindow shard_window{0, 0};
+    std::string cache_dir;
+    uint64_t cache_size = (uint64_t)1024 << 20;
+    std::string serve_socket;
+    DensityOptions density;
+    EdgeCheckOptions edge_checks;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--threads" && i + 1 < argc) {
+                tile_options.threads = (unsigned)std::stoul(argv[++i]);
+                output_options.threads = tile_options.threads;
+                OasisReader::setDefaultThreads(tile_options.threads != 0 ? tile_options.threads : std::max(1u, std::thread::hardware_concurrency()));
+                tiled = true;
+            } else if (arg == "--tile-size" && i + 1 < argc) {
+                tile_options.tile_size = std::stod(argv[++i]);
+                tiled = true;
+            } else if (arg == "--stats") {
+                print_stats = true;
+            } else if (arg == "--serve" && i + 1 < argc) {
+                serve_socket = argv[++i];
+            } else if (arg == "--density" && i + 2 < argc) {
+                density.window = std::stod(argv[++i]);
+                density.step = std::stod(argv[++i]);
+            } else if (arg == "--width" && i + 1 < argc) {
+                edge_checks.width = std::stod(argv[++i]);
+            } else if (arg == "--spacing" && i + 1 < argc) {
+                edge_checks.spacing.push_back(std::make_pair(0.0, std::stod(argv[++i])));
+            } else if (arg == "--spacing-run" && i + 2 < argc) {
+                const double run_length = std::stod(argv[++i]);
+                edge_checks.spacing.push_back(std::make_pair(run_length, std::stod(argv[++i])));
+            } else if (arg == "--density-grid" && i + 1 < argc) {
+                density.cell = std::stod(argv[++i]);
+            } else if (arg.compare(0, 8, "--stats=") == 0) {
+                // The report is written by main() once the run has finished
+            } else if (arg == "--hierarchical") {
+                hierarchical = true;
+            } else if (arg == "--merge") {
+                merge = true;
+            } else if (arg == "--deck" && i + 1 < argc) {
+                deck_file = argv[++i];
+            } else if (arg == "--memory-limit" && i + 1 < argc) {
+                tile_options.memory_limit = (std::size_t)(std::stod(argv[++i]) * (1 << 20));
+            } else if (arg == "--spill-dir" && i + 1 < argc) {
+                tile_options.spill_dir = argv[++i];
+            } else if (arg == "--no-mmap") {
+                OasisReader::setDefaultInputMode(OasisInputMode::Buffered);
+            } else if (arg == "--cold") {
+                cold_start = true;
+            } else if (arg == "--compress") {
+                output_options.compress = true;
+            } else if (arg == "--incremental") {
+                incremental = true;
+            } else if (arg == "--shards" && i + 1 < argc) {
+                shards = (std::size_t)std::stoul(argv[++i]);
+            } else if (arg == "--shard-window" && i + 2 < argc) { // Internal: run as a shard worker
+                shard_worker = true;
+                shard_window.min_x = std::stoll(argv[++i]);
+                shard_window.max_x = std::stoll(argv[++i]);
+            } else if (arg == "--cache-dir" && i + 1 < argc) {
+                cache_dir = argv[++i];
+            } else if (arg == "--cache-size" && i + 1 < argc) {
+                cache_size = (uint64_t)(std::stod(argv[++i]) * (1 << 20));
+            } else if (arg.compare(0, 2, "--") == 0) {
+                std::cerr << "Error: Unknown or incomplete option " << arg << '\n';
+                print_usage(argv[0]);
+                return 1;
+            } else {
+                positional.push_back(arg);
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: Invalid option value. " << e.what() << '\n';
+        return 1;
+    }
+
+    if (!deck_file.empty()) {
+        if (!positional.empty()) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        if (!cache_dir.empty()) std::cerr << "Warning: --cache-dir is ignored with --deck" << '\n';
+        RunStats::instance().setMode("deck");
+        try {
+            run_deck(deck_file, tile_options, output_options);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << '\n';
+            return 1;
+        }
+        std::cout << "\nProcessing finished." << '\n';
+        return 0;
+    }
+
+    if (!serve_socket.empty()) {
+        if (positional.size() != 1) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        RunStats::instance().setMode("serve");
+        try {
+            LayoutServer(positional[0]).serve(serve_socket);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << '\n';
+            return 1;
+        }
+        std::cout << "\nServer stopped." << '\n';
+        return 0;
+    }
+
+    if (density.window > 0.0) {
+        int layer_number, datatype_number;
+        if (positional.size() != 3 || !parse_layer_spec(positional[1], layer_number, datatype_number)) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        RunStats::instance().setMode("density");
+        try {
+            run_density(LayerRequest{positional[0], layer_number, datatype_number}, density, positional[2], tile_options);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << '\n';
+            return 1;
+        }
+        std::cout << "\nProcessing finished." << '\n';
+        return 0;
+    }
+
+    if (edge_checks.width > 0.0 || !edge_checks.spacing.empty()) {
+        int layer_number, datatype_number;
+        if (positional.size() != 4 || !parse_layer_spec(positional[1], layer_number, datatype_number)) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        RunStats::instance().setMode("width_spacing");
+        try {
+            run_width_spacing(LayerRequest{positional[0], layer_number, datatype_number}, edge_checks, positional[2], std::stoi(positional[3]),
+                              tile_options, output_options);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << '\n';
+            return 1;
+        }
+        std::cout << "\nProcessing finished." << '\n';
+        return 0;
+    }
+
+    if (positional.size() != 6) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // Layer numbers are parsed on their own so that a std::out_of_range raised
+    // later (e.g. by to_coord while loading) is not reported as a bad argument.
+    int input_layer_num, mask_layer_num, output_layer_num;
+    try {
+        input_layer_num = std::stoi(positional[1]);
+        mask_layer_num = std::stoi(positional[3]);
+        output_layer_num = std::stoi(positional[5]);
+    } catch (const std::invalid_argument& e) {
+        std::cerr << "Error: Invalid layer number argument. Please provide integers." << '\n';
+        return 1;
+    } catch (const std::out_of_range& e) {
+        std::cerr << "Error: Layer number argument out of range." << '\n';
         return 1;
     }
 
     try {
-        std::string input_file = argv[1];
-        int input_layer_num = std::stoi(argv[2]);
-        std::string mask_file = argv[3];
-        int mask_layer_num = std::stoi(argv[4]);
-        std::string output_file = argv[5];
-        int output_layer_num = std::stoi(argv[6]);
+        std::string input_file = positional[0];
+        std::string mask_file = positional[2];
+        std::string output_file = positional[4];
 
         // For now, datatype is hardcoded to 0 as per our generated files
         int default_datatype = 0;
 
-        std::cout << "--- Configuration ---" << std::endl;
-        std::cout << "Mask File: " << mask_file << ", Layer: " << mask_layer_num << std::endl;
-        std::cout << "Input File: " << input_file << ", Layer: " << input_layer_num << std::endl;
-        std::cout << "Output File: " << output_file << ", Layer: " << output_layer_num << std::endl;
-        std::cout << "Datatype (fixed): " << default_datatype << std::endl;
-        std::cout << "---------------------" << std::endl;
+        std::cout << "--- Configuration ---" << '\n';
+        std::cout << "Mask File: " << mask_file << ", Layer: " << mask_layer_num << '\n';
+        std::cout << "Input File: " << input_file << ", Layer: " << input_layer_num << '\n';
+        std::cout << "Output File: " << output_file << ", Layer: " << output_layer_num << '\n';
+        std::cout << "Datatype (fixed): " << default_datatype << '\n';
+        std::cout << "---------------------" << '\n';
+
+        // Without post-processing of the whole result, loading, the AND and saving overlap. A mask in the
+        // input's file is only complete after the whole file is read, so that case loads both layers in one pass.
+        const bool pipelined = !hierarchical && !merge && tile_options.tile_size == 0.0 && mask_file != input_file;
+        const std::string and_mode = shards > 0 ? "sharded" : tile_options.memory_limit > 0 ? "out_of_core" : pipelined ? "pipelined" : "whole_layer";
+
+        // The cache key hashes both files; a hit skips loading, the AND and writing altogether
+        std::unique_ptr<ResultCache> cache;
+        std::string cache_key;
+        if (!cache_dir.empty() && incremental) {
+            std::cerr << "Warning: --cache-dir is ignored with --incremental, which keeps its own per-tile state" << '\n';
+        } else if (!cache_dir.empty()) {
+            cache.reset(new ResultCache(cache_dir, cache_size));
+            cache_key = capture_cache_key(CaptureCacheInputs{mask_file, mask_layer_num, input_file, input_layer_num, default_datatype,
+                                                             output_layer_num, hierarchical, merge, output_options.compress, shards,
+                                                             and_mode, tile_options.tile_size});
+            if (cache->fetch(cache_key, output_file)) {
+                RunStats::instance().setMode("cache_hit");
+                std::cout << "\n--- Result Cache Hit ---" << '\n';
+                print_cache_stats(*cache);
+                std::cout << "Result layer copied to " << output_file << '\n';
+                std::cout << "\nProcessing finished." << '\n';
+                return 0;
+            }
+        }
+        auto store_in_cache = [&cache, &cache_key, &output_file]() {
+            if (!cache) return;
+            if (!cache->store(cache_key, output_file)) std::cerr << "Warning: Could not store the result in the cache " << cache->directory() << '\n';
+            print_cache_stats(*cache);
+        };
+
+        if (cold_start) {
+            for (const std::string& file : {mask_file, input_file}) {
+                if (!MappedFile::evictFromPageCache(file)) std::cerr << "Warning: Could not drop " << file << " from the page cache" << '\n';
+            }
+        }
+
+        if (shard_worker) {
+            RunStats::instance().setMode("shard_worker");
+            run_shard_worker(LayerRequest{mask_file, mask_layer_num, default_datatype}, LayerRequest{input_file, input_layer_num, default_datatype},
+                             shard_window, output_file, output_layer_num, default_datatype);
+            return 0;
+        }
+
+        if (incremental) {
+            if (hierarchical || merge || tile_options.memory_limit > 0) {
+                std::cerr << "Error: --incremental cannot be combined with --hierarchical, --merge or --memory-limit." << '\n';
+                return 1;
+            }
+            std::cout << "\n--- Running Incremental AND ---" << '\n';
+            RunStats::instance().setMode("incremental");
+            AndStats and_stats;
+            IncrementalStats inc_stats;
+            layer_and_incremental(LayerRequest{mask_file, mask_layer_num, default_datatype}, LayerRequest{input_file, input_layer_num, default_datatype},
+                                  output_file, output_layer_num, default_datatype, tile_options, output_options, &and_stats, &inc_stats);
+            std::cout << "Mask layer loaded with " << inc_stats.mask_polygons << " polygons." << '\n';
+            std::cout << "Input layer loaded with " << inc_stats.input_polygons << " polygons." << '\n';
+            if (inc_stats.mask_polygons == 0 || inc_stats.input_polygons == 0) {
+                std::cerr << "Error: One or both input layers are empty. Cannot perform AND operation." << '\n';
+                std::cout << "Saved an empty result file." << '\n';
+                return 1;
+            }
+            print_and_stats(and_stats, inc_stats.result_polygons, print_stats);
+            if (!inc_stats.previous_result) std::cout << "No previous result with matching settings; all tiles were computed" << '\n';
+            std::cout << "Tiles: " << inc_stats.reused_tiles << " reused, " << inc_stats.recomputed_tiles << " recomputed, "
+                      << inc_stats.removed_tiles << " removed" << '\n';
+            std::cout << "Result layer saved to " << output_file << " (tile hashes in " << output_file << ".tiles)" << '\n';
+            std::cout << "\nProcessing finished." << '\n';
+            return 0;
+        }
+
+        if (shards > 0) {
+            if (hierarchical || merge || incremental || tile_options.memory_limit > 0) {
+                std::cerr << "Error: --shards cannot be combined with --hierarchical, --merge, --incremental or --memory-limit." << '\n';
+                return 1;
+            }
+            if (tile_options.spill_dir.empty()) {
+                const char* tmpdir = std::getenv("TMPDIR");
+                tile_options.spill_dir = tmpdir && *tmpdir ? tmpdir : "/tmp";
+            }
+            std::cout << "\n--- Running Sharded AND (" << shards << " worker processes) ---" << '\n';
+            RunStats::instance().setMode("sharded");
+            AndStats and_stats;
+            ShardStats shard_stats;
+            layer_and_sharded(LayerRequest{mask_file, mask_layer_num, default_datatype}, LayerRequest{input_file, input_layer_num, default_datatype},
+                              output_file, output_layer_num, default_datatype, shards, tile_options, output_options, &and_stats, &shard_stats);
+            std::cout << "Mask layer has " << shard_stats.mask_polygons << " polygons." << '\n';
+            std::cout << "Input layer has " << shard_stats.input_polygons << " polygons." << '\n';
+            if (shard_stats.mask_polygons == 0 || shard_stats.input_polygons == 0) {
+                std::cerr << "Error: One or both input layers are empty. Cannot perform AND operation." << '\n';
+                std::cout << "Saved an empty result file." << '\n';
+                return 1;
+            }
+            print_and_stats(and_stats, shard_stats.result_polygons, print_stats);
+            std::cout << "Shards: " << shard_stats.shards << ", " << shard_stats.retries << " retried, " << shard_stats.loaded_polygons
+                      << " polygons loaded by workers, largest worker peak RSS " << shard_stats.max_worker_rss_kb / 1024 << " MB" << '\n';
+            std::cout << "Result layer saved to " << output_file << '\n';
+            store_in_cache();
+            std::cout << "\nProcessing finished." << '\n';
+            return 0;
+        }
+
+        if (tile_options.memory_limit > 0) {
+            if (hierarchical || merge) {
+                std::cerr << "Error: --memory-limit cannot be combined with --hierarchical or --merge, which need whole layers in memory." << '\n';
+                return 1;
+            }
+            if (tile_options.spill_dir.empty()) {
+                const char* tmpdir = std::getenv("TMPDIR");
+                tile_options.spill_dir = tmpdir && *tmpdir ? tmpdir : "/tmp";
+            }
+            std::cout << "\n--- Running Out-of-Core AND (memory limit " << format_size(tile_options.memory_limit) << ") ---" << '\n';
+            RunStats::instance().setMode("out_of_core");
+            AndStats and_stats;
+            OutOfCoreStats ooc_stats;
+            layer_and_out_of_core(LayerRequest{mask_file, mask_layer_num, default_datatype}, LayerRequest{input_file, input_layer_num, default_datatype},
+                                  output_file, output_layer_num, default_datatype, tile_options, output_options, &and_stats, &ooc_stats);
+            if (ooc_stats.mask_polygons == 0 || ooc_stats.input_polygons == 0) {
+                std::cerr << "Error: One or both input layers are empty. Cannot perform AND operation." << '\n';
+                std::cout << "Saved an empty result file." << '\n';
+                return 1;
+            }
+            print_and_stats(and_stats, ooc_stats.result_polygons, print_stats);
+            std::cout << "Tiles: " << ooc_stats.tiles << " in " << ooc_stats.working_sets << " working sets, "
+                      << format_size(ooc_stats.spilled_bytes) << " spilled to disk" << '\n';
+            std::cout << "Result layer saved to " << output_file << '\n';
+            store_in_cache();
+            std::cout << "\nProcessing finished." << '\n';
+            return 0;
+        }
+
+        if (pipelined) {
+            std::cout << "\n--- Running Load/AND/Store Pipeline ---" << '\n';
+            RunStats::instance().setMode("pipelined");
+            AndStats and_stats;
+            PipelineStats pipeline_stats;
+            layer_and_pipelined(LayerRequest{mask_file, mask_layer_num, default_datatype}, LayerRequest{input_file, input_layer_num, default_datatype},
+                                output_file, output_layer_num, default_datatype, tile_options, output_options, &and_stats, &pipeline_stats);
+            std::cout << "Mask layer loaded with " << pipeline_stats.mask_polygons << " polygons." << '\n';
+            std::cout << "Input layer loaded with " << pipeline_stats.input_polygons << " polygons." << '\n';
+            if (pipeline_stats.mask_polygons == 0 || pipeline_stats.input_polygons == 0) {
+                std::cerr << "Error: One or both input layers are empty. Cannot perform AND operation." << '\n';
+                std::cout << "Saved an empty result file." << '\n';
+                return 1;
+            }
+            print_and_stats(and_stats, pipeline_stats.result_polygons, print_stats);
+            print_pipeline_stats(pipeline_stats);
+            std::cout << "Result layer saved to " << output_file << '\n';
+            store_in_cache();
+            std::cout << "\nProcessing finished." << '\n';
+            return 0;
+        }
 
         // Load layers from OASIS files
-        std::cout << "\n--- Loading Layers ---" << std::endl;
-        layer_type mask_layer = load_layer_from_oasis(mask_file, mask_layer_num, default_datatype);
-        layer_type input_layer = load_layer_from_oasis(input_file, input_layer_num, default_datatype);
-        std::cout << "Mask layer loaded with " << mask_layer.size() << " polygons." << std::endl;
-        std::cout << "Input layer loaded with " << input_layer.size() << " polygons." << std::endl;
-
-        if (mask_layer.empty() || input_layer.empty()) {
-            std::cerr << "Error: One or both input layers are empty. Cannot perform AND operation." << std::endl;
+        std::cout << "\n--- Loading Layers ---" << '\n';
+        RunStats::instance().setMode(hierarchical ? "hierarchical" : tiled ? "tiled" : "flat");
+        layer_type mask_layer;
+        layer_type input_layer;
+        LayoutUnits mask_units;
+        LayoutUnits input_units;
+        LayoutHierarchy input_hierarchy; // Only used with --hierarchical
+        std::size_t input_polygons = 0;
+        if (hierarchical) {
+            ScopedTimer timer("load");
+            // The mask is flattened; the input keeps its cells so repeated content is computed once
+            const std::pair<uint32_t, uint32_t> mask_tag((uint32_t)mask_layer_num, (uint32_t)default_datatype);
+            const std::pair<uint32_t, uint32_t> input_tag((uint32_t)input_layer_num, (uint32_t)default_datatype);
+            if (mask_file == input_file) {
+                input_hierarchy = load_hierarchy_from_oasis(input_file, {input_tag, mask_tag});
+                mask_layer = input_hierarchy.flatten(1);
+                mask_units = input_hierarchy.units;
+            } else {
+                LayoutHierarchy mask_hierarchy = load_hierarchy_from_oasis(mask_file, {mask_tag});
+                mask_layer = mask_hierarchy.flatten(0);
+                mask_units = mask_hierarchy.units;
+                input_hierarchy = load_hierarchy_from_oasis(input_file, {input_tag});
+            }
+            input_units = input_hierarchy.units;
+            for (const auto& cell : input_hierarchy.cells) input_polygons += cell.layers[0].size();
+        } else {
+            // Both layers come from one pass over each distinct file (a single parse when mask and input share a file)
+            std::vector<LayoutUnits> layer_units;
+            std::vector<layer_type> layers = load_layers_from_oasis({LayerRequest{mask_file, mask_layer_num, default_datatype},
+                                                                     LayerRequest{input_file, input_layer_num, default_datatype}},
+                                                                    &layer_units);
+            mask_layer = std::move(layers[0]);
+            input_layer = std::move(layers[1]);
+            mask_units = layer_units[0];
+            input_units = layer_units[1];
+            input_polygons = input_layer.size();
+        }
+        if (mask_units.db_unit != input_units.db_unit) {
+            std::cerr << "Warning: Mask database unit (" << mask_units.db_unit << " m) differs from input database unit ("
+                      << input_units.db_unit << " m). Snapping mask to the input grid." << '\n';
+            rescale_layer(mask_layer, mask_units.db_unit, input_units.db_unit);
+        }
+        std::cout << "Mask layer loaded with " << mask_layer.size() << " polygons." << '\n';
+        if (hierarchical) {
+            std::cout << "Input layer loaded with " << input_polygons << " polygons in " << input_hierarchy.cells.size() << " cells." << '\n';
+        } else {
+            std::cout << "Input layer loaded with " << input_polygons << " polygons." << '\n';
+        }
+
+        if (mask_layer.empty() || input_polygons == 0) {
+            std::cerr << "Error: One or both input layers are empty. Cannot perform AND operation." << '\n';
             // Save an empty output file or handle as an error
             layer_type empty_result;
-            save_layer_to_oasis(empty_result, output_file, output_layer_num, default_datatype);
-            std::cout << "Saved an empty result file." << std::endl;
+            save_layer_to_oasis(empty_result, output_file, output_layer_num, default_datatype, input_units, output_options);
+            std::cout << "Saved an empty result file." << '\n';
             return 1; // Indicate an error or abnormal termination
         }
 
         // Perform AND operation
-        std::cout << "\n--- Performing AND Operation ---" << std::endl;
-        layer_type result_layer = layer_and(mask_layer, input_layer);
-        std::cout << "AND operation resulted in " << result_layer.size() << " polygons." << std::endl;
+        std::cout << "\n--- Performing AND Operation ---" << '\n';
+        AndStats and_stats;
+        layer_type result_layer;
+        if (hierarchical) {
+            HierarchyStats hierarchy_stats;
+            result_layer = layer_and_hierarchical(mask_layer, input_hierarchy, 0, tile_options, &and_stats, &hierarchy_stats);
+            std::cout << "Cell occurrences: " << hierarchy_stats.occurrences << ", unique (cell, mask context) pairs computed: "
+                      << hierarchy_stats.unique_contexts << '\n';
+        } else if (tiled) {
+            result_layer = layer_and_tiled(mask_layer, input_layer, tile_options, &and_stats);
+        } else {
+            result_layer = layer_and(mask_layer, input_layer, &and_stats);
+        }
+        print_and_stats(and_stats, result_layer.size(), print_stats);
+
+        if (merge) {
+            std::cout << "\n--- Merging Result Fragments ---" << '\n';
+            MergeStats merge_stats;
+            result_layer = merge_layer(result_layer, tile_options, &merge_stats);
+            std::cout << "Polygons: " << merge_stats.polygons_before << " -> " << merge_stats.polygons_after << '\n';
+            std::cout << "Vertices: " << merge_stats.vertices_before << " -> " << merge_stats.vertices_after << '\n';
+        }
 
         // Save the result layer to an OASIS file
-        std::cout << "\n--- Saving Result Layer ---" << std::endl;
-        save_layer_to_oasis(result_layer, output_file, output_layer_num, default_datatype);
-        std::cout << "Result layer saved to " << output_file << std::endl;
+        std::cout << "\n--- Saving Result Layer ---" << '\n';
+        save_layer_to_oasis(result_layer, output_file, output_layer_num, default_datatype, input_units, output_options);
+        std::cout << "Result layer saved to " << output_file << '\n';
+        store_in_cache();
 
-    } catch (const std::invalid_argument& e) {
-        std::cerr << "Error: Invalid layer number argument. Please provide integers." << std::endl;
-        return 1;
-    } catch (const std::out_of_range& e) {
-        std::cerr << "Error: Layer number argument out of range." << std::endl;
-        return 1;
     } catch (const std::exception& e) {
-        std::cerr << "An unexpected error occurred: " << e.what() << std::endl;
+        std::cerr << "An unexpected error occurred: " << e.what() << '\n';
         return 1;
     }
 
-    std::cout << "\nProcessing finished." << std::endl;
+    std::cout << "\nProcessing finished." << '\n';
     return 0;
 }
+
+int main(int argc, char* argv[]) {
+    std::string stats_file;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strncmp(argv[i], "--stats=", 8) == 0) stats_file = argv[i] + 8;
+    }
+    if (Tracer::enabled()) Tracer::instance().setThreadName("main");
+    int exit_code;
+    {
+        TraceScope trace("dfm_pattern_capture");
+        exit_code = run_capture(argc, argv);
+    }
+    std::cout.flush();
+    if (!stats_file.empty() && !RunStats::instance().writeJson(stats_file, "dfm_pattern_capture", exit_code)) {
+        std::cerr << "Warning: Could not write the run statistics to " << stats_file << '\n';
+    }
+    return exit_code;
+}
+#endif // DFM_CAPTURE_NO_MAIN
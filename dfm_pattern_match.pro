@@ -36,6 +36,22 @@ LIBS += /home/amrmuhammad/dev/gdstk/build/src/libgdstk.a \
 
 # Input
 HEADERS += layoutwidget.h \
+           dfm_density.h \
+           dfm_gdstk_adapter.h \
+           dfm_geometry.h \
+           dfm_layout_hierarchy.h \
+           dfm_layout_protocol.h \
+           dfm_manhattan.h \
+           dfm_mapped_file.h \
+           dfm_oasis_reader.h \
+           dfm_oasis_writer.h \
+           dfm_polygon_arena.h \
+           dfm_result_cache.h \
+           dfm_stats.h \
+           dfm_thread_pool.h \
+           dfm_tile_spill.h \
+           dfm_trace.h \
+           dfm_width_spacing.h \
            gBolt/include/common.h \
            gBolt/include/config.h \
            gBolt/include/database.h \
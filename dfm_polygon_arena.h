@@ -0,0 +1,134 @@
+#ifndef DFM_POLYGON_ARENA_H
+#define DFM_POLYGON_ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+#include "dfm_geometry.h"
+
+// Polygons stored as a struct of arrays in one contiguous vertex arena.
+//
+// Every polygon_type owns a heap-allocated ring (plus a vector for its holes),
+// so producing millions of small AND fragments spends much of its time in the
+// allocator. PolygonArena keeps the x and y coordinates of all rings in two
+// arrays and describes the polygons with offset tables: polygon p owns rings
+// [ringBegin(p), ringEnd(p)), the first of which is the outer ring, and ring r
+// owns vertices [vertexBegin(r), vertexEnd(r)). Rings are stored open (the
+// first vertex is not repeated) in Boost orientation: clockwise outers,
+// counter-clockwise holes. clear() keeps the capacity, so a scratch arena that
+// is reused for every tile stops allocating once it has grown to the largest one.
+class PolygonArena {
+public:
+    PolygonArena() { clear(); }
+
+    std::size_t size() const { return m_polygon_rings.size() - 1; }
+    bool empty() const { return size() == 0; }
+    std::size_t ringCount() const { return m_ring_vertices.size() - 1; }
+    std::size_t vertexCount() const { return m_x.size(); }
+
+    std::size_t ringBegin(std::size_t polygon) const { return m_polygon_rings[polygon]; }
+    std::size_t ringEnd(std::size_t polygon) const { return m_polygon_rings[polygon + 1]; }
+    std::size_t vertexBegin(std::size_t ring) const { return m_ring_vertices[ring]; }
+    std::size_t vertexEnd(std::size_t ring) const { return m_ring_vertices[ring + 1]; }
+
+    coord_type x(std::size_t vertex) const { return m_x[vertex]; }
+    coord_type y(std::size_t vertex) const { return m_y[vertex]; }
+
+    // Drop all polygons but keep the allocated capacity
+    void clear() {
+        m_x.clear();
+        m_y.clear();
+        m_ring_vertices.assign(1, 0);
+        m_polygon_rings.assign(1, 0);
+    }
+
+    void reserve(std::size_t polygons, std::size_t vertices) {
+        m_x.reserve(vertices);
+        m_y.reserve(vertices);
+        m_ring_vertices.reserve(polygons + 1);
+        m_polygon_rings.reserve(polygons + 1);
+    }
+
+    // Building: vertices of the current ring, then endRing(); rings of the current polygon, then endPolygon()
+    void addVertex(coord_type x, coord_type y) {
+        m_x.push_back(x);
+        m_y.push_back(y);
+    }
+    void endRing() { m_ring_vertices.push_back(m_x.size()); }
+    void endPolygon() { m_polygon_rings.push_back(ringCount()); }
+
+    // Clockwise rectangle, like box_to_polygon
+    void addBox(const box_type& box) {
+        addVertex(box.min_corner().x(), box.min_corner().y());
+        addVertex(box.min_corner().x(), box.max_corner().y());
+        addVertex(box.max_corner().x(), box.max_corner().y());
+        addVertex(box.max_corner().x(), box.min_corner().y());
+        endRing();
+        endPolygon();
+    }
+
+    // Copy a Boost polygon (closing vertices are dropped)
+    void addPolygon(const polygon_type& poly) {
+        addRing(poly.outer());
+        for (const auto& inner : poly.inners()) addRing(inner);
+        endPolygon();
+    }
+
+    void append(const PolygonArena& other) {
+        const std::size_t vertex_base = m_x.size();
+        const std::size_t ring_base = ringCount();
+        m_x.insert(m_x.end(), other.m_x.begin(), other.m_x.end());
+        m_y.insert(m_y.end(), other.m_y.begin(), other.m_y.end());
+        for (std::size_t r = 1; r < other.m_ring_vertices.size(); ++r) m_ring_vertices.push_back(vertex_base + other.m_ring_vertices[r]);
+        for (std::size_t p = 1; p < other.m_polygon_rings.size(); ++p) m_polygon_rings.push_back(ring_base + other.m_polygon_rings[p]);
+    }
+
+    // Boost form of one polygon, with closed rings
+    polygon_type polygon(std::size_t index) const {
+        polygon_type poly;
+        const std::size_t first = ringBegin(index);
+        copyRing(first, poly.outer());
+        const std::size_t last = ringEnd(index);
+        if (last > first + 1) {
+            poly.inners().resize(last - first - 1);
+            for (std::size_t r = first + 1; r < last; ++r) copyRing(r, poly.inners()[r - first - 1]);
+        }
+        return poly;
+    }
+
+    // Append polygons [first, last) to a layer in Boost form
+    void appendTo(layer_type& layer, std::size_t first, std::size_t last) const {
+        layer.reserve(layer.size() + (last - first));
+        for (std::size_t p = first; p < last; ++p) layer.push_back(polygon(p));
+    }
+    void appendTo(layer_type& layer) const { appendTo(layer, 0, size()); }
+
+    // Allocated bytes
+    std::size_t bytes() const {
+        return (m_x.capacity() + m_y.capacity()) * sizeof(coord_type) +
+               (m_ring_vertices.capacity() + m_polygon_rings.capacity()) * sizeof(std::size_t);
+    }
+
+private:
+    std::vector<coord_type> m_x;              // x of every vertex, ring after ring
+    std::vector<coord_type> m_y;              // y of every vertex
+    std::vector<std::size_t> m_ring_vertices; // First vertex of every ring, plus the end
+    std::vector<std::size_t> m_polygon_rings; // First ring of every polygon, plus the end
+
+    template <typename Ring>
+    void addRing(const Ring& ring) {
+        std::size_t count = ring.size();
+        if (count > 1 && bg::equals(ring.front(), ring.back())) --count; // Boost rings are closed
+        for (std::size_t k = 0; k < count; ++k) addVertex(ring[k].x(), ring[k].y());
+        endRing();
+    }
+
+    void copyRing(std::size_t ring, polygon_type::ring_type& out) const {
+        const std::size_t begin = vertexBegin(ring), end = vertexEnd(ring);
+        out.reserve(end - begin + 1);
+        for (std::size_t v = begin; v < end; ++v) out.push_back(point_type(m_x[v], m_y[v]));
+        if (end > begin) out.push_back(point_type(m_x[begin], m_y[begin]));
+    }
+};
+
+#endif // DFM_POLYGON_ARENA_H
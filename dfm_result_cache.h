@@ -0,0 +1,324 @@
+#ifndef DFM_RESULT_CACHE_H
+#define DFM_RESULT_CACHE_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dfm_mapped_file.h"
+
+// Streaming 128-bit content hash (MurmurHash3 x64_128).
+//
+// Not cryptographic, but 128 bits make accidental collisions between cache
+// keys practically impossible, and it hashes at memory bandwidth.
+class ContentHash128 {
+public:
+    void update(const void* data, std::size_t size) {
+        const uint8_t* bytes = (const uint8_t*)data;
+        m_length += size;
+        if (m_tail_size > 0) {
+            const std::size_t take = std::min(size, (std::size_t)16 - m_tail_size);
+            std::memcpy(m_tail + m_tail_size, bytes, take);
+            m_tail_size += take;
+            bytes += take;
+            size -= take;
+            if (m_tail_size < 16) return;
+            block(m_tail);
+            m_tail_size = 0;
+        }
+        for (; size >= 16; bytes += 16, size -= 16) block(bytes);
+        std::memcpy(m_tail, bytes, size);
+        m_tail_size = size;
+    }
+
+    void update(const std::string& value) {
+        updateValue((uint64_t)value.size());
+        update(value.data(), value.size());
+    }
+
+    void updateValue(uint64_t value) {
+        uint8_t bytes[8];
+        for (int i = 0; i < 8; ++i) bytes[i] = (uint8_t)(value >> (8 * i));
+        update(bytes, 8);
+    }
+
+    // Hash the size and content of a file. Throws std::runtime_error if it cannot be mapped.
+    void updateFile(const std::string& filename) {
+        MappedFile file(filename);
+        updateValue(file.size());
+        update(file.data(), file.size());
+    }
+
+    // Finalized digest as 32 lowercase hex digits; the hash state is not modified
+    std::string hex() const {
+        uint64_t h1 = m_h1, h2 = m_h2;
+        uint64_t k1 = 0, k2 = 0;
+        for (std::size_t i = m_tail_size; i > 8; --i) k2 = k2 << 8 | m_tail[i - 1];
+        for (std::size_t i = std::min(m_tail_size, (std::size_t)8); i > 0; --i) k1 = k1 << 8 | m_tail[i - 1];
+        if (m_tail_size > 8) {
+            k2 *= C2; k2 = rotl(k2, 33); k2 *= C1; h2 ^= k2;
+        }
+        if (m_tail_size > 0) {
+            k1 *= C1; k1 = rotl(k1, 31); k1 *= C2; h1 ^= k1;
+        }
+        h1 ^= m_length;
+        h2 ^= m_length;
+        h1 += h2;
+        h2 += h1;
+        h1 = fmix(h1);
+        h2 = fmix(h2);
+        h1 += h2;
+        h2 += h1;
+        char text[33];
+        std::snprintf(text, sizeof(text), "%016llx%016llx", (unsigned long long)h1, (unsigned long long)h2);
+        return text;
+    }
+
+private:
+    static const uint64_t C1 = 0x87c37b91114253d5ULL;
+    static const uint64_t C2 = 0x4cf5ad432745937fULL;
+
+    uint64_t m_h1 = 0x9368e53c2f6af274ULL; // Fixed seed
+    uint64_t m_h2 = 0x586dcd208f7cd3fdULL;
+    uint64_t m_length = 0;
+    uint8_t m_tail[16];        // Bytes of the incomplete block
+    std::size_t m_tail_size = 0;
+
+    static uint64_t rotl(uint64_t x, int r) { return x << r | x >> (64 - r); }
+
+    static uint64_t fmix(uint64_t k) {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ULL;
+        k ^= k >> 33;
+        return k;
+    }
+
+    static uint64_t load64(const uint8_t* p) {
+        uint64_t value = 0;
+        for (int i = 7; i >= 0; --i) value = value << 8 | p[i];
+        return value;
+    }
+
+    void block(const uint8_t* p) {
+        uint64_t k1 = load64(p), k2 = load64(p + 8);
+        k1 *= C1; k1 = rotl(k1, 31); k1 *= C2; m_h1 ^= k1;
+        m_h1 = rotl(m_h1, 27); m_h1 += m_h2; m_h1 = m_h1 * 5 + 0x52dce729;
+        k2 *= C2; k2 = rotl(k2, 33); k2 *= C1; m_h2 ^= k2;
+        m_h2 = rotl(m_h2, 31); m_h2 += m_h1; m_h2 = m_h2 * 5 + 0x38495ab5;
+    }
+};
+
+// Counters of a result cache, for one run or accumulated over all runs
+struct ResultCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t bytes_saved = 0; // Output bytes served from the cache instead of being recomputed
+    uint64_t evictions = 0;
+};
+
+// On-disk cache of output files, addressed by a content hash of everything
+// that determines them.
+//
+// Each entry is one file <key>.oas in the cache directory. Entries are written
+// to a temporary file and renamed into place, so concurrent runs sharing the
+// directory never see a partial entry. A hit copies the entry to the requested
+// output and refreshes its modification time; after every store the least
+// recently used entries are deleted until the directory fits the size limit.
+// Accumulated counters live in a small text file next to the entries and are
+// updated under an exclusive lock.
+class ResultCache {
+public:
+    // Open (and create if needed) a cache directory. Throws std::runtime_error on failure.
+    ResultCache(const std::string& directory, uint64_t max_bytes) : m_directory(directory), m_max_bytes(max_bytes) {
+        if (mkdir(directory.c_str(), 0777) != 0 && errno != EEXIST) {
+            throw std::runtime_error("Unable to create cache directory " + directory + ": " + std::strerror(errno));
+        }
+        struct stat info;
+        if (stat(directory.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+            throw std::runtime_error("Cache path " + directory + " is not a directory");
+        }
+    }
+
+    // Copy the entry for a key to output_file. Returns false (a miss) if there is no entry.
+    bool fetch(const std::string& key, const std::string& output_file) {
+        const std::string entry = entryPath(key);
+        uint64_t bytes = 0;
+        if (access(entry.c_str(), R_OK) != 0 || !copyFile(entry, output_file, bytes)) {
+            ++m_stats.misses;
+            record(0, 1, 0, 0);
+            return false;
+        }
+        utimensat(AT_FDCWD, entry.c_str(), nullptr, 0); // Mark as recently used
+        ++m_stats.hits;
+        m_stats.bytes_saved += bytes;
+        record(1, 0, bytes, 0);
+        return true;
+    }
+
+    // Store output_file as the entry for a key and evict old entries. Returns false if it could not be stored.
+    bool store(const std::string& key, const std::string& output_file) {
+        std::string temp = m_directory + "/tmp_XXXXXX";
+        std::vector<char> path(temp.begin(), temp.end());
+        path.push_back('\0');
+        int fd = mkstemp(path.data());
+        if (fd < 0) return false;
+        fchmod(fd, 0644); // mkstemp creates private files; entries are shared
+        ::close(fd);
+        temp = path.data();
+        uint64_t bytes = 0;
+        if (!copyFile(output_file, temp, bytes) || std::rename(temp.c_str(), entryPath(key).c_str()) != 0) {
+            std::remove(temp.c_str());
+            return false;
+        }
+        evict(key);
+        return true;
+    }
+
+    // Counters of this run
+    const ResultCacheStats& stats() const { return m_stats; }
+
+    // Counters accumulated over all runs that used the directory
+    ResultCacheStats totalStats() const {
+        ResultCacheStats totals;
+        Lock lock(m_directory);
+        readTotals(totals);
+        return totals;
+    }
+
+    const std::string& directory() const { return m_directory; }
+
+private:
+    std::string m_directory;
+    uint64_t m_max_bytes;       // Size limit of all entries together
+    ResultCacheStats m_stats;
+
+    // Exclusive advisory lock on the directory's lock file
+    struct Lock {
+        int fd;
+        explicit Lock(const std::string& directory) : fd(::open((directory + "/lock").c_str(), O_RDWR | O_CREAT, 0666)) {
+            if (fd >= 0) flock(fd, LOCK_EX);
+        }
+        ~Lock() {
+            if (fd >= 0) ::close(fd);
+        }
+        Lock(const Lock&) = delete;
+        Lock& operator=(const Lock&) = delete;
+    };
+
+    std::string entryPath(const std::string& key) const { return m_directory + "/" + key + ".oas"; }
+    std::string statsPath() const { return m_directory + "/stats"; }
+
+    static bool copyFile(const std::string& from, const std::string& to, uint64_t& bytes) {
+        std::FILE* in = std::fopen(from.c_str(), "rb");
+        if (!in) return false;
+        std::FILE* out = std::fopen(to.c_str(), "wb");
+        if (!out) {
+            std::fclose(in);
+            return false;
+        }
+        std::vector<char> buffer(1 << 20);
+        bool ok = true;
+        bytes = 0;
+        for (;;) {
+            const std::size_t got = std::fread(buffer.data(), 1, buffer.size(), in);
+            if (got == 0) break;
+            if (std::fwrite(buffer.data(), 1, got, out) != got) {
+                ok = false;
+                break;
+            }
+            bytes += got;
+        }
+        if (std::ferror(in)) ok = false;
+        std::fclose(in);
+        if (std::fclose(out) != 0) ok = false;
+        return ok;
+    }
+
+    void readTotals(ResultCacheStats& totals) const {
+        std::FILE* file = std::fopen(statsPath().c_str(), "r");
+        if (!file) return;
+        unsigned long long hits = 0, misses = 0, saved = 0, evictions = 0;
+        if (std::fscanf(file, "hits %llu misses %llu bytes_saved %llu evictions %llu", &hits, &misses, &saved, &evictions) == 4) {
+            totals.hits = hits;
+            totals.misses = misses;
+            totals.bytes_saved = saved;
+            totals.evictions = evictions;
+        }
+        std::fclose(file);
+    }
+
+    // Add to the accumulated counters
+    void record(uint64_t hits, uint64_t misses, uint64_t bytes_saved, uint64_t evictions) {
+        Lock lock(m_directory);
+        ResultCacheStats totals;
+        readTotals(totals);
+        totals.hits += hits;
+        totals.misses += misses;
+        totals.bytes_saved += bytes_saved;
+        totals.evictions += evictions;
+        const std::string temp = statsPath() + ".tmp";
+        std::FILE* file = std::fopen(temp.c_str(), "w");
+        if (!file) return;
+        std::fprintf(file, "hits %llu\nmisses %llu\nbytes_saved %llu\nevictions %llu\n", (unsigned long long)totals.hits,
+                     (unsigned long long)totals.misses, (unsigned long long)totals.bytes_saved, (unsigned long long)totals.evictions);
+        if (std::fclose(file) == 0) std::rename(temp.c_str(), statsPath().c_str());
+    }
+
+    // Delete the least recently used entries until all entries fit the size limit.
+    // The entry just stored is only deleted if it alone exceeds the limit.
+    void evict(const std::string& keep) {
+        struct Entry {
+            std::string path;
+            uint64_t bytes;
+            int64_t used_ns;
+            bool keep;
+        };
+        std::vector<Entry> entries;
+        uint64_t total = 0;
+        DIR* dir = opendir(m_directory.c_str());
+        if (!dir) return;
+        while (struct dirent* item = readdir(dir)) {
+            const std::string name = item->d_name;
+            if (name.size() != 36 || name.compare(32, 4, ".oas") != 0) continue;
+            const std::string path = m_directory + "/" + name;
+            struct stat info;
+            if (stat(path.c_str(), &info) != 0) continue;
+            const int64_t used_ns = (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+            entries.push_back(Entry{path, (uint64_t)info.st_size, used_ns, name.compare(0, 32, keep) == 0});
+            total += (uint64_t)info.st_size;
+        }
+        closedir(dir);
+        if (total <= m_max_bytes) return;
+
+        std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+            if (a.keep != b.keep) return b.keep;
+            return a.used_ns < b.used_ns;
+        });
+        uint64_t evicted = 0;
+        for (const Entry& entry : entries) {
+            if (total <= m_max_bytes) break;
+            if (std::remove(entry.path.c_str()) != 0) continue; // Already evicted by a concurrent run
+            total -= entry.bytes;
+            ++evicted;
+        }
+        m_stats.evictions += evicted;
+        if (evicted > 0) record(0, 0, 0, evicted);
+    }
+};
+
+#endif // DFM_RESULT_CACHE_H
@@ -0,0 +1,132 @@
+#ifndef DFM_STATS_H
+#define DFM_STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <sys/resource.h>
+
+#include "dfm_trace.h"
+
+// Process-wide phase timers and counters for run reports.
+//
+// Phases are timed with ScopedTimer, which adds its wall time to a named
+// timer when it goes out of scope; a phase that is entered several times
+// accumulates seconds and calls. Counters are plain named sums. Both are
+// guarded by one mutex, so hot loops should count locally and add their
+// totals once per phase. A phase that runs on several threads at once adds
+// up the time of every thread, like CPU time. writeJson() emits everything
+// together with the total wall time and the peak resident set, in a flat
+// layout that job schedulers can ingest without a schema.
+class RunStats {
+public:
+    static RunStats& instance() {
+        static RunStats stats;
+        return stats;
+    }
+
+    void addTime(const std::string& phase, double seconds) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Timer& timer = m_timers[phase];
+        timer.seconds += seconds;
+        ++timer.calls;
+    }
+
+    // Name of what the run did, for the report
+    void setMode(const std::string& mode) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_mode = mode;
+    }
+
+    void add(const std::string& counter, uint64_t value = 1) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_counters[counter] += value;
+    }
+
+    // Keep the largest value seen, for gauges such as worker memory
+    void max(const std::string& counter, uint64_t value) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        uint64_t& current = m_counters[counter];
+        if (value > current) current = value;
+    }
+
+    uint64_t counter(const std::string& name) const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto found = m_counters.find(name);
+        return found == m_counters.end() ? 0 : found->second;
+    }
+
+    double wallSeconds() const { return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count(); }
+
+    // Peak resident set of this process in kB
+    static long peakRssKb() {
+        struct rusage usage;
+        return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+    }
+
+    // Write the report. Returns false if the file cannot be written.
+    bool writeJson(const std::string& filename, const std::string& tool, int exit_code) const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::ofstream out(filename);
+        out << "{\n  \"tool\": \"" << tool << "\",\n  \"mode\": \"" << m_mode << "\",\n  \"exit_code\": " << exit_code
+            << ",\n  \"wall_seconds\": " << wallSeconds() << ",\n  \"peak_rss_kb\": " << peakRssKb() << ",\n  \"phases\": {";
+        const char* separator = "\n";
+        for (const auto& timer : m_timers) {
+            out << separator << "    \"" << timer.first << "\": {\"seconds\": " << timer.second.seconds << ", \"calls\": " << timer.second.calls << "}";
+            separator = ",\n";
+        }
+        out << (m_timers.empty() ? "" : "\n  ") << "},\n  \"counters\": {";
+        separator = "\n";
+        for (const auto& counter : m_counters) {
+            out << separator << "    \"" << counter.first << "\": " << counter.second;
+            separator = ",\n";
+        }
+        out << (m_counters.empty() ? "" : "\n  ") << "}\n}\n";
+        return (bool)out;
+    }
+
+private:
+    struct Timer {
+        double seconds = 0.0;
+        uint64_t calls = 0;
+    };
+
+    RunStats() : m_start(std::chrono::steady_clock::now()) {}
+
+    mutable std::mutex m_mutex;
+    std::chrono::steady_clock::time_point m_start; // Process start, for the wall time
+    std::string m_mode;
+    std::map<std::string, Timer> m_timers;
+    std::map<std::string, uint64_t> m_counters;
+};
+
+// Adds the wall time of its scope to a RunStats phase; the phase also appears in the trace (DFM_TRACE)
+class ScopedTimer {
+public:
+    explicit ScopedTimer(const char* phase) : m_phase(phase), m_start(std::chrono::steady_clock::now()) {
+        if (Tracer::enabled()) Tracer::instance().begin(phase);
+    }
+
+    ~ScopedTimer() { stop(); }
+
+    // End the phase before the scope does; later calls do nothing
+    void stop() {
+        if (!m_phase) return;
+        if (Tracer::enabled()) Tracer::instance().end(m_phase);
+        RunStats::instance().addTime(m_phase, std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count());
+        m_phase = nullptr;
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    const char* m_phase; // Null once stopped
+    std::chrono::steady_clock::time_point m_start;
+};
+
+#endif // DFM_STATS_H
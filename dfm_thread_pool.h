@@ -0,0 +1,180 @@
+#ifndef DFM_THREAD_POOL_H
+#define DFM_THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "dfm_trace.h"
+
+// Work-stealing thread pool used by the parallel paths of the DFM tools.
+// Every worker owns a deque: it pops its own tasks LIFO (cache-friendly for
+// tasks spawned from inside a task) and steals FIFO from the other workers
+// when it runs dry, so uneven tiles do not leave cores idle.
+class ThreadPool {
+public:
+    // Create a pool with the given number of workers (at least one)
+    explicit ThreadPool(unsigned thread_count) {
+        if (thread_count == 0) thread_count = 1;
+        for (unsigned i = 0; i < thread_count; ++i) {
+            m_queues.emplace_back(new WorkerQueue());
+        }
+        for (unsigned i = 0; i < thread_count; ++i) {
+            m_workers.emplace_back(&ThreadPool::workerLoop, this, i);
+        }
+    }
+
+    // Finish all queued tasks, then join the workers
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_state_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (auto& worker : m_workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Number of worker threads
+    unsigned size() const { return (unsigned)m_workers.size(); }
+
+    // Queue a task. Tasks submitted from a worker go to that worker's own deque.
+    void submit(std::function<void()> task) {
+        unsigned index;
+        if (currentPool() == this) {
+            index = currentWorkerIndex();
+        } else {
+            index = m_next_queue.fetch_add(1, std::memory_order_relaxed) % size();
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_queues[index]->mutex);
+            m_queues[index]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_state_mutex);
+            ++m_queued;
+            ++m_pending;
+        }
+        m_wake.notify_one();
+    }
+
+    // Block until every submitted task has finished. Rethrows the first exception a task threw.
+    void waitIdle() {
+        std::unique_lock<std::mutex> lock(m_state_mutex);
+        m_idle.wait(lock, [this] { return m_pending == 0; });
+        if (m_error) {
+            std::exception_ptr error = m_error;
+            m_error = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkerQueue>> m_queues; // One deque per worker
+    std::vector<std::thread> m_workers;                 // Worker threads
+    std::atomic<unsigned> m_next_queue{0};              // Round-robin target for external submits
+
+    std::mutex m_state_mutex;           // Guards the counters below
+    std::condition_variable m_wake;     // Signalled when a task is queued or the pool stops
+    std::condition_variable m_idle;     // Signalled when m_pending drops to zero
+    std::size_t m_queued = 0;           // Tasks queued but not yet claimed by a worker
+    std::size_t m_pending = 0;          // Tasks submitted but not yet finished
+    bool m_stop = false;                // Set by the destructor
+    std::exception_ptr m_error;         // First exception thrown by a task
+
+    static ThreadPool*& currentPool() {
+        static thread_local ThreadPool* pool = nullptr;
+        return pool;
+    }
+
+    static unsigned& currentWorkerIndex() {
+        static thread_local unsigned index = 0;
+        return index;
+    }
+
+    // Pop from our own deque (back), otherwise steal from another worker (front)
+    bool popTask(unsigned index, std::function<void()>& task) {
+        {
+            WorkerQueue& own = *m_queues[index];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (unsigned offset = 1; offset < m_queues.size(); ++offset) {
+            WorkerQueue& victim = *m_queues[(index + offset) % m_queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(unsigned index) {
+        currentPool() = this;
+        currentWorkerIndex() = index;
+        if (Tracer::enabled()) Tracer::instance().setThreadName("pool worker");
+        for (;;) {
+            {
+                // Claim one queued task; it is guaranteed to sit in one of the deques
+                std::unique_lock<std::mutex> lock(m_state_mutex);
+                m_wake.wait(lock, [this] { return m_stop || m_queued > 0; });
+                if (m_queued == 0) return; // Stopping and nothing left to run
+                --m_queued;
+            }
+
+            std::function<void()> task;
+            while (!popTask(index, task)) {
+                std::this_thread::yield();
+            }
+
+            try {
+                task();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(m_state_mutex);
+                if (!m_error) m_error = std::current_exception();
+            }
+
+            std::lock_guard<std::mutex> lock(m_state_mutex);
+            if (--m_pending == 0) m_idle.notify_all();
+        }
+    }
+};
+
+// Run fn(i) for every i in [0, count) on the pool and wait for all of them.
+// With a single worker the loop runs inline on the calling thread.
+// Must not be called from inside a task of the same pool (waitIdle would wait on itself).
+template <typename Fn>
+void parallel_for(ThreadPool& pool, std::size_t count, Fn fn) {
+    if (pool.size() <= 1) {
+        for (std::size_t i = 0; i < count; ++i) fn(i);
+        return;
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        pool.submit([&fn, i] { fn(i); });
+    }
+    pool.waitIdle();
+}
+
+#endif // DFM_THREAD_POOL_H
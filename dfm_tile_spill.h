@@ -0,0 +1,197 @@
+#ifndef DFM_TILE_SPILL_H
+#define DFM_TILE_SPILL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "dfm_geometry.h"
+
+// Disk-backed spatial buckets for layers that do not fit in memory.
+//
+// Polygons are appended to a (layer, tile) bucket in a compact binary form
+// (vertex count, then 32-bit x/y pairs of the open outer ring). Buckets live
+// in memory until the buffered bytes exceed the buffer limit; then the largest
+// buffers are appended to one file per bucket in a private spill directory
+// until half of the limit is free. take() reads a bucket back as a layer and
+// deletes its file. The directory and any remaining files are removed by the
+// destructor.
+class TileSpillStore {
+public:
+    // Key of a tile; keys sort row-major in the order of the signed (row, column) pair
+    static uint64_t tileKey(int64_t column, int64_t row) {
+        return (uint64_t)((uint32_t)row ^ 0x80000000u) << 32 | ((uint32_t)column ^ 0x80000000u);
+    }
+
+    static void tilePosition(uint64_t key, int64_t& column, int64_t& row) {
+        column = (int32_t)((uint32_t)key ^ 0x80000000u);
+        row = (int32_t)((uint32_t)(key >> 32) ^ 0x80000000u);
+    }
+
+    // Create a spill directory below parent_dir. Throws std::runtime_error if that fails.
+    TileSpillStore(const std::string& parent_dir, std::size_t buffer_limit) : m_buffer_limit(buffer_limit) {
+        std::string pattern = (parent_dir.empty() ? std::string(".") : parent_dir) + "/dfm_spill_XXXXXX";
+        std::vector<char> path(pattern.begin(), pattern.end());
+        path.push_back('\0');
+        if (!mkdtemp(path.data())) throw std::runtime_error("cannot create a spill directory in " + parent_dir);
+        m_directory = path.data();
+    }
+
+    ~TileSpillStore() {
+        for (const auto& bucket : m_buckets) {
+            if (bucket.second.file_bytes > 0) std::remove(bucketPath(bucket.first).c_str());
+        }
+        rmdir(m_directory.c_str());
+    }
+
+    TileSpillStore(const TileSpillStore&) = delete;
+    TileSpillStore& operator=(const TileSpillStore&) = delete;
+
+    // Append the open outer ring of a polygon to a bucket
+    void add(std::size_t layer, uint64_t tile, const point_type* points, std::size_t count) {
+        Bucket& bucket = m_buckets[BucketKey(tile, layer)];
+        const std::size_t before = bucket.buffer.size();
+        putU32(bucket.buffer, (uint32_t)count);
+        for (std::size_t k = 0; k < count; ++k) {
+            putU32(bucket.buffer, (uint32_t)points[k].x());
+            putU32(bucket.buffer, (uint32_t)points[k].y());
+        }
+        ++bucket.polygons;
+        m_buffered += bucket.buffer.size() - before;
+        if (m_buffered > m_buffer_limit) spill();
+    }
+
+    // All tiles that hold polygons of any layer, in key order
+    std::vector<uint64_t> tiles() const {
+        std::vector<uint64_t> keys;
+        for (const auto& bucket : m_buckets) {
+            if (keys.empty() || keys.back() != bucket.first.first) keys.push_back(bucket.first.first);
+        }
+        return keys;
+    }
+
+    // Serialized size of a bucket (buffered and spilled)
+    uint64_t bytes(std::size_t layer, uint64_t tile) const {
+        auto found = m_buckets.find(BucketKey(tile, layer));
+        return found == m_buckets.end() ? 0 : found->second.file_bytes + found->second.buffer.size();
+    }
+
+    uint64_t polygons(std::size_t layer, uint64_t tile) const {
+        auto found = m_buckets.find(BucketKey(tile, layer));
+        return found == m_buckets.end() ? 0 : found->second.polygons;
+    }
+
+    // Read a bucket back and drop it from the store. Throws std::runtime_error on read errors.
+    layer_type take(std::size_t layer, uint64_t tile) {
+        layer_type polygons;
+        auto found = m_buckets.find(BucketKey(tile, layer));
+        if (found == m_buckets.end()) return polygons;
+        Bucket& bucket = found->second;
+        polygons.reserve(bucket.polygons);
+
+        std::string data;
+        if (bucket.file_bytes > 0) {
+            const std::string path = bucketPath(found->first);
+            data.resize(bucket.file_bytes);
+            std::FILE* file = std::fopen(path.c_str(), "rb");
+            bool ok = file && std::fread(&data[0], 1, data.size(), file) == data.size();
+            if (file) std::fclose(file);
+            std::remove(path.c_str());
+            if (!ok) throw std::runtime_error("cannot read spill file " + path);
+        }
+        data += bucket.buffer;
+        m_buffered -= bucket.buffer.size();
+        m_buckets.erase(found);
+
+        std::size_t pos = 0;
+        while (pos + 4 <= data.size()) {
+            const uint32_t count = getU32(data, pos);
+            if (pos + 8 * (std::size_t)count > data.size()) throw std::runtime_error("truncated spill data");
+            polygon_type poly;
+            poly.outer().reserve(count + 1);
+            for (uint32_t k = 0; k < count; ++k) {
+                const coord_type x = (coord_type)getU32(data, pos);
+                const coord_type y = (coord_type)getU32(data, pos);
+                poly.outer().push_back(point_type(x, y));
+            }
+            poly.outer().push_back(poly.outer().front());
+            polygons.push_back(std::move(poly));
+        }
+        return polygons;
+    }
+
+    // Bytes written to spill files so far
+    uint64_t spilledBytes() const { return m_spilled; }
+
+    const std::string& directory() const { return m_directory; }
+
+private:
+    typedef std::pair<uint64_t, std::size_t> BucketKey; // (tile, layer): the layers of a tile are adjacent
+
+    struct Bucket {
+        std::string buffer;       // Serialized polygons not yet on disk
+        uint64_t file_bytes = 0;  // Serialized polygons in the bucket's spill file
+        uint64_t polygons = 0;
+    };
+
+    std::string m_directory;
+    std::size_t m_buffer_limit;   // Buffered bytes that trigger a spill
+    std::size_t m_buffered = 0;   // Bytes currently buffered over all buckets
+    uint64_t m_spilled = 0;
+    std::map<BucketKey, Bucket> m_buckets;
+
+    static void putU32(std::string& out, uint32_t value) {
+        char bytes[4];
+        for (int i = 0; i < 4; ++i) bytes[i] = (char)(value >> (8 * i) & 0xff);
+        out.append(bytes, 4);
+    }
+
+    static uint32_t getU32(const std::string& data, std::size_t& pos) {
+        uint32_t value = 0;
+        for (int i = 0; i < 4; ++i) value |= (uint32_t)(uint8_t)data[pos + i] << (8 * i);
+        pos += 4;
+        return value;
+    }
+
+    std::string bucketPath(const BucketKey& key) const {
+        char name[64];
+        std::snprintf(name, sizeof(name), "/%zu_%016llx.bin", key.second, (unsigned long long)key.first);
+        return m_directory + name;
+    }
+
+    // Write the largest buffers to their files until half of the limit is free
+    void spill() {
+        std::vector<std::pair<std::size_t, std::map<BucketKey, Bucket>::iterator>> by_size;
+        for (auto it = m_buckets.begin(); it != m_buckets.end(); ++it) {
+            if (!it->second.buffer.empty()) by_size.push_back(std::make_pair(it->second.buffer.size(), it));
+        }
+        std::sort(by_size.begin(), by_size.end(), [](const std::pair<std::size_t, std::map<BucketKey, Bucket>::iterator>& a,
+                                                     const std::pair<std::size_t, std::map<BucketKey, Bucket>::iterator>& b) {
+            return a.first > b.first;
+        });
+        for (auto& entry : by_size) {
+            if (m_buffered <= m_buffer_limit / 2) break;
+            Bucket& bucket = entry.second->second;
+            const std::string path = bucketPath(entry.second->first);
+            std::FILE* file = std::fopen(path.c_str(), "ab");
+            bool ok = file && std::fwrite(bucket.buffer.data(), 1, bucket.buffer.size(), file) == bucket.buffer.size();
+            if (file && std::fclose(file) != 0) ok = false;
+            if (!ok) throw std::runtime_error("cannot write spill file " + path);
+            bucket.file_bytes += bucket.buffer.size();
+            m_spilled += bucket.buffer.size();
+            m_buffered -= bucket.buffer.size();
+            std::string().swap(bucket.buffer);
+        }
+    }
+};
+
+#endif // DFM_TILE_SPILL_H
@@ -0,0 +1,139 @@
+#ifndef DFM_TRACE_H
+#define DFM_TRACE_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+// Timeline tracing in the Chrome trace-event format (chrome://tracing, Perfetto).
+//
+// Tracing is switched on by setting DFM_TRACE to an output path; the file is
+// written when the process exits. Every thread appends begin/end events to its
+// own buffer, so recording takes no lock: a thread registers its buffer once,
+// on its first event. Event names must be string literals (or otherwise live
+// until exit), since only the pointer is stored. With DFM_TRACE unset a
+// TraceScope costs one check of a cached flag.
+class Tracer {
+public:
+    static bool enabled() {
+        static const bool on = !path().empty();
+        return on;
+    }
+
+    // Output file from DFM_TRACE, empty when tracing is off
+    static const std::string& path() {
+        static const std::string trace_path = [] {
+            const char* value = std::getenv("DFM_TRACE");
+            return std::string(value ? value : "");
+        }();
+        return trace_path;
+    }
+
+    static Tracer& instance() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    void begin(const char* name) { threadBuffer().events.push_back(Event{name, now(), 'B'}); }
+    void end(const char* name) { threadBuffer().events.push_back(Event{name, now(), 'E'}); }
+
+    // Label the calling thread in the timeline
+    void setThreadName(const char* name) { threadBuffer().name = name; }
+
+    // Write the events recorded so far. Only call while no other thread is recording.
+    bool write(const std::string& filename) const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::ofstream out(filename);
+        const long pid = (long)getpid();
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+        const char* separator = "\n";
+        char ts[32];
+        for (const auto& buffer : m_buffers) {
+            if (buffer->name) {
+                out << separator << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid << ", \"tid\": " << buffer->tid
+                    << ", \"args\": {\"name\": \"" << buffer->name << "\"}}";
+                separator = ",\n";
+            }
+            for (const Event& event : buffer->events) {
+                std::snprintf(ts, sizeof(ts), "%.3f", event.ns / 1000.0); // Microseconds
+                out << separator << "{\"name\": \"" << event.name << "\", \"ph\": \"" << event.phase << "\", \"ts\": " << ts
+                    << ", \"pid\": " << pid << ", \"tid\": " << buffer->tid << "}";
+                separator = ",\n";
+            }
+        }
+        out << "\n]}\n";
+        return (bool)out;
+    }
+
+    ~Tracer() {
+        if (!enabled()) return;
+        if (!write(path())) std::fprintf(stderr, "Warning: Could not write the trace to %s\n", path().c_str());
+    }
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+private:
+    struct Event {
+        const char* name;
+        int64_t ns;  // Since the tracer started
+        char phase;  // 'B' or 'E'
+    };
+
+    // Events of one thread; owned by the tracer so they outlive the thread
+    struct ThreadBuffer {
+        uint32_t tid = 0;
+        const char* name = nullptr;
+        std::vector<Event> events;
+    };
+
+    Tracer() : m_start(std::chrono::steady_clock::now()) {}
+
+    int64_t now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count();
+    }
+
+    ThreadBuffer& threadBuffer() {
+        static thread_local ThreadBuffer* buffer = nullptr;
+        if (!buffer) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_buffers.emplace_back(new ThreadBuffer());
+            buffer = m_buffers.back().get();
+            buffer->tid = (uint32_t)m_buffers.size();
+            buffer->events.reserve(4096);
+        }
+        return *buffer;
+    }
+
+    std::chrono::steady_clock::time_point m_start;
+    mutable std::mutex m_mutex;                          // Guards m_buffers (registration and the final write)
+    std::vector<std::unique_ptr<ThreadBuffer>> m_buffers;
+};
+
+// Records a begin event now and the matching end event when the scope ends
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) : m_name(Tracer::enabled() ? name : nullptr) {
+        if (m_name) Tracer::instance().begin(m_name);
+    }
+
+    ~TraceScope() {
+        if (m_name) Tracer::instance().end(m_name);
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* m_name; // Null when tracing is off
+};
+
+#endif // DFM_TRACE_H
@@ -0,0 +1,390 @@
+#ifndef DFM_WIDTH_SPACING_H
+#define DFM_WIDTH_SPACING_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <queue>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "dfm_geometry.h"
+#include "dfm_manhattan.h"
+#include "dfm_thread_pool.h"
+#include "dfm_trace.h"
+
+// Width and spacing measurements on the edges of a layer.
+//
+// Two edges form a violating pair when they are closer than the rule and
+// face each other: the line between their closest points leaves both edges
+// on their inner side (width; both edges of the same polygon) or on their
+// outer side (spacing; any two edges, including a notch of one polygon).
+// Distances are Euclidean, so corners that approach each other diagonally
+// are measured corner to corner. Edges that touch (distance 0), such as the
+// two edges at a vertex, are never reported; abutting shapes should be
+// merged first. The spacing rule may depend on the parallel run length of
+// the two edges, the length over which parallel edges face each other.
+//
+// Candidate pairs come from a sweep over the edges in order of their left
+// end, with an active set ordered by the lower end of each edge; edges leave
+// the set once they are out of reach of the sweep line. The layer is cut
+// into vertical stripes that are swept in parallel. A stripe also loads the
+// edges within reach to its left (the halo), but owns only the pairs whose
+// later edge starts inside it, so every pair is tested by exactly one stripe.
+// Coordinates must keep differences within 31 bits for the 64-bit cross products.
+
+enum class EdgeCheck {
+    Width,  // Interior distance between edges of one polygon
+    Spacing // Exterior distance between edges
+};
+
+// Spacing that applies from a parallel run length on; rows of a table are kept sorted by run length
+struct SpacingRule {
+    coord_type run_length; // Database units
+    coord_type spacing;    // Database units
+};
+
+struct EdgeCheckRules {
+    coord_type min_width = 0;         // 0 skips the width check
+    std::vector<SpacingRule> spacing; // Empty skips the spacing check
+
+    // Add a row to the spacing table
+    void addSpacing(coord_type run_length, coord_type spacing_value) {
+        spacing.push_back(SpacingRule{run_length, spacing_value});
+        std::sort(spacing.begin(), spacing.end(), [](const SpacingRule& a, const SpacingRule& b) { return a.run_length < b.run_length; });
+    }
+
+    // Spacing required for a parallel run length: the last row whose run length is reached
+    coord_type requiredSpacing(double run_length) const {
+        coord_type required = 0;
+        for (const SpacingRule& rule : spacing) {
+            if (run_length >= rule.run_length) required = rule.spacing;
+        }
+        return required;
+    }
+
+    // Largest distance any rule can flag
+    coord_type reach() const {
+        coord_type largest = min_width;
+        for (const SpacingRule& rule : spacing) largest = std::max(largest, rule.spacing);
+        return largest;
+    }
+};
+
+struct EdgeMarker {
+    EdgeCheck check;
+    double distance;                // Euclidean distance of the two edges in database units
+    double run_length;              // Parallel run length, 0 for edges that are not parallel
+    coord_type required;            // Rule value the distance falls short of
+    point_type edges[4];            // First edge, then second edge
+    std::array<double, 4> closest;  // Closest points (x, y, x, y), the lower point first
+    polygon_type shape;             // Marker between the two edges
+};
+
+struct EdgeCheckStats {
+    std::size_t edges = 0;          // Edges of the layer
+    std::size_t stripes = 0;        // Parallel sweep stripes
+    std::size_t halo_edges = 0;     // Edge copies loaded by a stripe as its halo
+    std::size_t candidate_pairs = 0; // Pairs within reach of each other that were measured
+    std::size_t duplicates = 0;     // Markers dropped because another pair met at the same closest points
+};
+
+class WidthSpacingChecker {
+public:
+    explicit WidthSpacingChecker(const EdgeCheckRules& rules) : m_rules(rules) {}
+
+    // All violating pairs, sorted by check and closest points. A corner that is too close to another corner is
+    // reported once, although up to four edge pairs meet there.
+    std::vector<EdgeMarker> check(const layer_type& layer, ThreadPool& pool, EdgeCheckStats* stats = nullptr) const {
+        EdgeCheckStats local_stats;
+        std::vector<EdgeMarker> markers;
+        const coord_type reach = m_rules.reach();
+        std::vector<Edge> edges = collectEdges(layer);
+        local_stats.edges = edges.size();
+        if (edges.empty() || reach <= 0) {
+            if (stats) *stats = local_stats;
+            return markers;
+        }
+
+        // Stripes no narrower than the reach, so the halo does not dominate a stripe
+        int64_t left = edges[0].xmin, right = edges[0].xmax;
+        for (const Edge& edge : edges) {
+            left = std::min<int64_t>(left, edge.xmin);
+            right = std::max<int64_t>(right, edge.xmax);
+        }
+        const int64_t span = right - left + 1;
+        const std::size_t stripes = (std::size_t)std::max<int64_t>(1, std::min<int64_t>((int64_t)pool.size() * 4, span / reach));
+        const int64_t width = (span + (int64_t)stripes - 1) / (int64_t)stripes;
+        auto stripe_of = [left, width, stripes](int64_t x) {
+            const int64_t s = (x - left) / width;
+            return (std::size_t)std::max<int64_t>(0, std::min<int64_t>((int64_t)stripes - 1, s));
+        };
+
+        // A stripe needs every edge that can pair with an edge starting inside it
+        std::vector<std::vector<std::size_t>> stripe_edges(stripes);
+        for (std::size_t i = 0; i < edges.size(); ++i) {
+            const std::size_t last = stripe_of((int64_t)edges[i].xmax + reach);
+            for (std::size_t s = stripe_of(edges[i].xmin); s <= last; ++s) stripe_edges[s].push_back(i);
+        }
+
+        std::vector<std::vector<EdgeMarker>> stripe_markers(stripes);
+        std::vector<std::size_t> stripe_candidates(stripes, 0);
+        parallel_for(pool, stripes, [&](std::size_t s) {
+            TraceScope trace("edge_sweep");
+            auto owned = [&](const Edge& edge) { return stripe_of(edge.xmin) == s; };
+            stripe_candidates[s] = sweep(edges, stripe_edges[s], owned, reach, stripe_markers[s]);
+        });
+
+        for (std::size_t s = 0; s < stripes; ++s) {
+            local_stats.halo_edges += stripe_edges[s].size();
+            local_stats.candidate_pairs += stripe_candidates[s];
+            markers.insert(markers.end(), std::make_move_iterator(stripe_markers[s].begin()), std::make_move_iterator(stripe_markers[s].end()));
+        }
+        local_stats.halo_edges -= edges.size();
+        local_stats.stripes = stripes;
+
+        auto key_less = [](const EdgeMarker& a, const EdgeMarker& b) {
+            return a.check != b.check ? a.check < b.check : a.closest < b.closest;
+        };
+        std::stable_sort(markers.begin(), markers.end(), key_less);
+        const std::size_t before = markers.size();
+        markers.erase(std::unique(markers.begin(), markers.end(),
+                                  [](const EdgeMarker& a, const EdgeMarker& b) { return a.check == b.check && a.closest == b.closest; }),
+                      markers.end());
+        local_stats.duplicates = before - markers.size();
+        if (stats) *stats = local_stats;
+        return markers;
+    }
+
+private:
+    struct Edge {
+        point_type p, q;          // Directed as in the ring
+        coord_type xmin, xmax, ymin, ymax;
+        uint32_t polygon;         // Index in the layer
+        bool inside_right;        // The polygon lies to the right of p -> q
+    };
+
+    EdgeCheckRules m_rules;
+
+    static std::vector<Edge> collectEdges(const layer_type& layer) {
+        std::vector<Edge> edges;
+        for (std::size_t i = 0; i < layer.size(); ++i) {
+            const polygon_type& poly = layer[i];
+            // Boost outer rings are clockwise, holes counter-clockwise: the interior is on the right
+            const bool inside_right = ring_area2(poly.outer()) <= 0;
+            auto add_ring = [&](const polygon_type::ring_type& ring) {
+                const std::size_t n = ring.size();
+                for (std::size_t k = 0; k < n; ++k) {
+                    const point_type& p = ring[k];
+                    const point_type& q = ring[(k + 1) % n];
+                    if (bg::equals(p, q)) continue; // Includes the closing point of a closed ring
+                    edges.push_back(Edge{p, q, std::min(p.x(), q.x()), std::max(p.x(), q.x()), std::min(p.y(), q.y()),
+                                         std::max(p.y(), q.y()), (uint32_t)i, inside_right});
+                }
+            };
+            add_ring(poly.outer());
+            for (const auto& inner : poly.inners()) add_ring(inner);
+        }
+        return edges;
+    }
+
+    // Sweep the edges of one stripe from left to right; returns the number of measured pairs
+    template <typename Owned>
+    std::size_t sweep(const std::vector<Edge>& edges, std::vector<std::size_t> order, Owned owned, coord_type reach,
+                      std::vector<EdgeMarker>& markers) const {
+        std::sort(order.begin(), order.end(), [&edges](std::size_t a, std::size_t b) {
+            return edges[a].xmin != edges[b].xmin ? edges[a].xmin < edges[b].xmin : a < b;
+        });
+        typedef std::multimap<coord_type, std::size_t> active_type; // Lower end -> edge
+        active_type active;
+        std::multiset<int64_t> heights;                             // Of the active edges, for the query range
+        typedef std::pair<coord_type, active_type::iterator> expiry;
+        auto later = [](const expiry& a, const expiry& b) { return a.first > b.first; };
+        std::priority_queue<expiry, std::vector<expiry>, decltype(later)> expiries(later); // Right ends, smallest first
+        std::size_t measured = 0;
+
+        for (std::size_t index : order) {
+            const Edge& edge = edges[index];
+            // Edges ending more than the reach left of this one cannot pair with it or any later edge
+            while (!expiries.empty() && (int64_t)expiries.top().first + reach <= edge.xmin) {
+                const active_type::iterator gone = expiries.top().second;
+                heights.erase(heights.find((int64_t)edges[gone->second].ymax - gone->first));
+                active.erase(gone);
+                expiries.pop();
+            }
+            if (owned(edge) && !active.empty()) {
+                const int64_t tallest = *heights.rbegin();
+                auto it = active.lower_bound((coord_type)std::max<int64_t>(std::numeric_limits<coord_type>::min(), (int64_t)edge.ymin - reach - tallest));
+                for (; it != active.end() && (int64_t)it->first < (int64_t)edge.ymax + reach; ++it) {
+                    const Edge& other = edges[it->second];
+                    if ((int64_t)other.ymax + reach <= edge.ymin) continue;
+                    ++measured;
+                    measure(other, edge, markers);
+                }
+            }
+            const active_type::iterator inserted = active.emplace(edge.ymin, index);
+            heights.insert((int64_t)edge.ymax - edge.ymin);
+            expiries.push(expiry(edge.xmax, inserted));
+        }
+        return measured;
+    }
+
+    // Outward normal of an edge (not normalized)
+    static void outwardNormal(const Edge& edge, double& nx, double& ny) {
+        const double dx = (double)edge.q.x() - edge.p.x(), dy = (double)edge.q.y() - edge.p.y();
+        // The right-hand normal of p -> q is (dy, -dx)
+        nx = edge.inside_right ? -dy : dy;
+        ny = edge.inside_right ? dx : -dx;
+    }
+
+    static bool segmentsIntersect(const Edge& a, const Edge& b) {
+        auto orientation = [](const point_type& o, const point_type& p, const point_type& q) {
+            const wide_coord_type cross = ((wide_coord_type)p.x() - o.x()) * ((wide_coord_type)q.y() - o.y()) -
+                                          ((wide_coord_type)p.y() - o.y()) * ((wide_coord_type)q.x() - o.x());
+            return cross > 0 ? 1 : cross < 0 ? -1 : 0;
+        };
+        const int o1 = orientation(a.p, a.q, b.p), o2 = orientation(a.p, a.q, b.q);
+        const int o3 = orientation(b.p, b.q, a.p), o4 = orientation(b.p, b.q, a.q);
+        if (o1 != o2 && o3 != o4) return true;
+        auto on_segment = [](const Edge& e, const point_type& pt) {
+            return pt.x() >= e.xmin && pt.x() <= e.xmax && pt.y() >= e.ymin && pt.y() <= e.ymax;
+        };
+        return (o1 == 0 && on_segment(a, b.p)) || (o2 == 0 && on_segment(a, b.q)) || (o3 == 0 && on_segment(b, a.p)) ||
+               (o4 == 0 && on_segment(b, a.q));
+    }
+
+    // Closest point of segment s to (x, y); returns the squared distance
+    static double closestOnEdge(const Edge& s, double x, double y, double& cx, double& cy) {
+        const double dx = (double)s.q.x() - s.p.x(), dy = (double)s.q.y() - s.p.y();
+        double t = ((x - s.p.x()) * dx + (y - s.p.y()) * dy) / (dx * dx + dy * dy);
+        t = std::min(1.0, std::max(0.0, t));
+        cx = s.p.x() + t * dx;
+        cy = s.p.y() + t * dy;
+        return (x - cx) * (x - cx) + (y - cy) * (y - cy);
+    }
+
+    // Check one candidate pair against the rules
+    void measure(const Edge& a, const Edge& b, std::vector<EdgeMarker>& markers) const {
+        const bool same_polygon = a.polygon == b.polygon;
+        if (!same_polygon && m_rules.spacing.empty()) return;
+        if (segmentsIntersect(a, b)) return; // Touching edges have no distance to measure
+
+        // Closest points: one of them is an endpoint when the segments do not cross
+        double best = -1.0, ax = 0, ay = 0, bx = 0, by = 0;
+        // Closest point of the other edge to an endpoint of a or b
+        auto consider = [&](const point_type& endpoint, const Edge& other, bool endpoint_on_a) {
+            double cx, cy;
+            const double d2 = closestOnEdge(other, endpoint.x(), endpoint.y(), cx, cy);
+            if (best >= 0.0 && d2 >= best) return;
+            best = d2;
+            if (endpoint_on_a) {
+                ax = endpoint.x(), ay = endpoint.y(), bx = cx, by = cy;
+            } else {
+                ax = cx, ay = cy, bx = endpoint.x(), by = endpoint.y();
+            }
+        };
+        consider(a.p, b, true);
+        consider(a.q, b, true);
+        consider(b.p, a, false);
+        consider(b.q, a, false);
+        const double distance = std::sqrt(best);
+
+        // Facing: the line between the closest points leaves a and enters b on the same side of both
+        double anx, any, bnx, bny;
+        outwardNormal(a, anx, any);
+        outwardNormal(b, bnx, bny);
+        const double vx = bx - ax, vy = by - ay;
+        const double tolerance = 1e-9 * distance;
+        const double a_side = (anx * vx + any * vy) / std::hypot(anx, any);
+        const double b_side = -(bnx * vx + bny * vy) / std::hypot(bnx, bny);
+        EdgeCheck check;
+        coord_type required;
+        const double run_length = parallelRunLength(a, b);
+        if (a_side > tolerance && b_side > tolerance) {
+            if (m_rules.spacing.empty()) return;
+            check = EdgeCheck::Spacing;
+            required = m_rules.requiredSpacing(run_length);
+        } else if (a_side < -tolerance && b_side < -tolerance && same_polygon) {
+            if (m_rules.min_width <= 0) return;
+            check = EdgeCheck::Width;
+            required = m_rules.min_width;
+        } else {
+            return;
+        }
+        if (!(distance < required)) return;
+
+        EdgeMarker marker;
+        marker.check = check;
+        marker.distance = distance;
+        marker.run_length = run_length;
+        marker.required = required;
+        marker.edges[0] = a.p;
+        marker.edges[1] = a.q;
+        marker.edges[2] = b.p;
+        marker.edges[3] = b.q;
+        if (std::make_pair(ax, ay) <= std::make_pair(bx, by)) {
+            marker.closest = {{ax, ay, bx, by}};
+        } else {
+            marker.closest = {{bx, by, ax, ay}};
+        }
+        marker.shape = markerShape(a, b, run_length, marker.closest);
+        markers.push_back(std::move(marker));
+    }
+
+    // Length over which two parallel edges face each other
+    static double parallelRunLength(const Edge& a, const Edge& b) {
+        const wide_coord_type adx = (wide_coord_type)a.q.x() - a.p.x(), ady = (wide_coord_type)a.q.y() - a.p.y();
+        const wide_coord_type bdx = (wide_coord_type)b.q.x() - b.p.x(), bdy = (wide_coord_type)b.q.y() - b.p.y();
+        if (adx * bdy - ady * bdx != 0) return 0.0;
+        double t0, t1;
+        projectOnto(a, b, t0, t1);
+        return std::max(0.0, std::min(std::hypot((double)adx, (double)ady), t1) - std::max(0.0, t0));
+    }
+
+    // Positions of b's endpoints along a, measured from a.p, smaller first
+    static void projectOnto(const Edge& a, const Edge& b, double& t0, double& t1) {
+        const double dx = (double)a.q.x() - a.p.x(), dy = (double)a.q.y() - a.p.y();
+        const double length = std::hypot(dx, dy);
+        const double tp = (((double)b.p.x() - a.p.x()) * dx + ((double)b.p.y() - a.p.y()) * dy) / length;
+        const double tq = (((double)b.q.x() - a.p.x()) * dx + ((double)b.q.y() - a.p.y()) * dy) / length;
+        t0 = std::min(tp, tq);
+        t1 = std::max(tp, tq);
+    }
+
+    // The quadrilateral between the facing parts of parallel edges, else the box between the closest points
+    static polygon_type markerShape(const Edge& a, const Edge& b, double run_length, const std::array<double, 4>& closest) {
+        auto point = [](double x, double y) { return point_type((coord_type)std::llround(x), (coord_type)std::llround(y)); };
+        polygon_type shape;
+        if (run_length > 0.0) {
+            double t0, t1;
+            projectOnto(a, b, t0, t1);
+            const double dx = (double)a.q.x() - a.p.x(), dy = (double)a.q.y() - a.p.y();
+            const double length = std::hypot(dx, dy);
+            const double lo = std::max(0.0, t0) / length, hi = std::min(length, t1) / length;
+            // b runs along a, so shifting the facing part of a by the offset between the lines gives the facing part of b
+            double fx, fy;
+            closestOnEdge(b, a.p.x() + lo * dx, a.p.y() + lo * dy, fx, fy);
+            const double ox = fx - (a.p.x() + lo * dx), oy = fy - (a.p.y() + lo * dy);
+            shape.outer() = {point(a.p.x() + lo * dx, a.p.y() + lo * dy), point(a.p.x() + hi * dx, a.p.y() + hi * dy),
+                             point(a.p.x() + hi * dx + ox, a.p.y() + hi * dy + oy), point(a.p.x() + lo * dx + ox, a.p.y() + lo * dy + oy)};
+        } else {
+            point_type low = point(std::min(closest[0], closest[2]), std::min(closest[1], closest[3]));
+            point_type high = point(std::max(closest[0], closest[2]), std::max(closest[1], closest[3]));
+            if (high.x() == low.x()) high.x(high.x() + 1); // Keep an area when the points line up
+            if (high.y() == low.y()) high.y(high.y() + 1);
+            shape.outer() = {low, point_type(low.x(), high.y()), high, point_type(high.x(), low.y())};
+        }
+        shape.outer().push_back(shape.outer().front());
+        bg::correct(shape);
+        return shape;
+    }
+};
+
+#endif // DFM_WIDTH_SPACING_H
@@ -20,6 +20,10 @@
 #include <gdstk/gdstk.hpp>
 
 #include "layoutwidget.h"
+#include "dfm_gdstk_adapter.h"
+#include "dfm_oasis_reader.h"
+#include "dfm_trace.h"
+#include <QElapsedTimer>
 #include <QFile>
 #include <QTextStream>
 #include <QDateTime>
@@ -30,6 +34,75 @@ QMutex logMutex;
 // Global QFile to keep it open
 QFile logFile;
 
+namespace bg = boost::geometry;
+typedef bg::model::box<gdstk::Vec2> gdstk_box_type;
+
+// Bounding box of a set of polygons, computed by Boost.Geometry directly on the gdstk point arrays
+static QRectF polygonsBoundingBox(const std::vector<gdstk::Polygon*>& polygons) {
+    gdstk_box_type envelope;
+    bg::assign_inverse(envelope);
+    for (const gdstk::Polygon* poly : polygons) {
+        if (poly && poly->point_array.count > 0) bg::expand(envelope, bg::return_envelope<gdstk_box_type>(*poly));
+    }
+    return QRectF(QPointF(envelope.min_corner().x, envelope.min_corner().y),
+                  QPointF(envelope.max_corner().x, envelope.max_corner().y));
+}
+
+// Sink that builds a gdstk::Library from OasisReader: one gdstk::Cell per OASIS cell holding
+// the cell's own polygons, in microns like gdstk::read_oas. Placements are not used by the viewer.
+class GdstkLibraryBuilder : public OasisSink {
+public:
+    explicit GdstkLibraryBuilder(gdstk::Library& library) : m_library(library) {}
+
+    void onStart(double db_unit) override {
+        m_scale = db_unit / 1e-6;
+        m_library.unit = 1e-6;
+        m_library.precision = db_unit;
+    }
+
+    bool wantsLayer(uint32_t, uint32_t) override { return true; }
+
+    void onCellName(uint64_t number, const std::string& name) override { m_cell_names[number] = name; }
+
+    void onCell(const OasisCellRef& ref) override {
+        m_current = (gdstk::Cell*)gdstk::allocate_clear(sizeof(gdstk::Cell));
+        if (ref.by_number) {
+            m_numbered_cells.push_back(std::make_pair(m_current, ref.number));
+        } else {
+            m_current->name = gdstk::copy_string(ref.name.c_str(), NULL);
+        }
+        m_library.cell_array.append(m_current);
+    }
+
+    void onPolygon(uint32_t layer, uint32_t datatype, const OasisPoint* points, std::size_t count) override {
+        if (!m_current) throw std::runtime_error("Malformed OASIS file: geometry outside of a cell");
+        if (count < 3) return; // A polygon needs at least 3 points
+        gdstk::Polygon* poly = (gdstk::Polygon*)gdstk::allocate_clear(sizeof(gdstk::Polygon));
+        poly->tag = gdstk::make_tag(layer, datatype);
+        poly->point_array.ensure_slots(count);
+        for (std::size_t k = 0; k < count; ++k) {
+            poly->point_array.append(gdstk::Vec2{points[k].x * m_scale, points[k].y * m_scale});
+        }
+        m_current->polygon_array.append(poly);
+    }
+
+    // Name the cells that were opened by reference number, once every CELLNAME record is known
+    void finish() {
+        for (const auto& cell : m_numbered_cells) {
+            auto name = m_cell_names.find(cell.second);
+            std::string cell_name = name != m_cell_names.end() ? name->second : "#" + std::to_string(cell.second);
+            cell.first->name = gdstk::copy_string(cell_name.c_str(), NULL);
+        }
+    }
+
+private:
+    gdstk::Library& m_library;
+    double m_scale = 1e-3;                                        // Microns per database unit
+    gdstk::Cell* m_current = nullptr;                             // Cell receiving the polygons
+    std::map<uint64_t, std::string> m_cell_names;                 // CELLNAME table
+    std::vector<std::pair<gdstk::Cell*, uint64_t>> m_numbered_cells; // Cells still waiting for their name
+};
+
 void myMessageOutput(QtMsgType type, const QMessageLogContext &context, const QString &msg) {
     QMutexLocker locker(&logMutex); // Lock for thread safety
     if (!logFile.isOpen()) { // Open file on first use, ensures it's not opened multiple times
@@ -271,23 +344,13 @@ void LayoutWidget::clearSelection() {
 QString LayoutWidget::getPolygonInfo(const gdstk::Polygon* poly) const {
     if (!poly) return "No polygon selected";
 
-    // Compute polygon properties
-    double area = 0.0;
-    QPointF centroid(0, 0);
+    // Compute polygon properties on the point array itself (see dfm_gdstk_adapter.h).
+    // gdstk polygons may be stored in either orientation, hence the absolute area.
     size_t point_count = poly->point_array.count;
-
-    // Compute area and centroid using shoelace formula
-    for (size_t i = 0; i < point_count; ++i) {
-        size_t j = (i + 1) % point_count;
-        double cross_prod = poly->point_array[i].x * poly->point_array[j].y - poly->point_array[j].x * poly->point_array[i].y;
-        area += cross_prod;
-        centroid.rx() += (poly->point_array[i].x + poly->point_array[j].x) * cross_prod;
-        centroid.ry() += (poly->point_array[i].y + poly->point_array[j].y) * cross_prod;
-    }
-
-    area = std::abs(area) / 2.0;
-    centroid.rx() /= (6.0 * area);
-    centroid.ry() /= (6.0 * area);
+    double area = std::abs(bg::area(*poly));
+    gdstk::Vec2 center = {};
+    if (point_count > 0) bg::centroid(*poly, center);
+    QPointF centroid(center.x, center.y);
 
     // Format polygon info
     return QString("Polygon Info:\n"
@@ -333,63 +396,61 @@ bool LayoutWidget::loadOasisFile(const QString& filename) {
     }
 
     gdstk::Library temp_lib;
-    gdstk::ErrorCode local_err_code = gdstk::ErrorCode::NoError;
+    memset(&temp_lib, 0, sizeof(gdstk::Library));
+    temp_lib.init("", 1e-6, 1e-9);
 
     try {
-        // Use read_oas with all parameters
-        temp_lib = gdstk::read_oas(filename_str.c_str(), 0.0, 0.0, &local_err_code);
-        qDebug() << "read_oas error code:" << static_cast<int>(local_err_code);
-
-        if (local_err_code != gdstk::ErrorCode::NoError) {
-            QString errorDetails = QString("Failed to read OASIS file: %1\nError code: %2").arg(filename).arg(static_cast<int>(local_err_code));
+        // Decode straight into the library; the file is memory-mapped unless that was switched off
+        GdstkLibraryBuilder builder(temp_lib);
+        OasisReader reader(builder);
+        reader.setInputMode(m_memory_mapped_input ? OasisInputMode::MemoryMapped : OasisInputMode::Buffered);
+        reader.setThreads((unsigned)std::max(1, QThread::idealThreadCount())); // Cells are decoded in parallel
+        QElapsedTimer read_timer;
+        read_timer.start();
+        try {
+            TraceScope trace("viewer_read");
+            reader.readFile(filename_str);
+            builder.finish();
+        } catch (const std::runtime_error& e) {
+            temp_lib.free_all();
+            QString errorDetails = QString("Failed to read OASIS file: %1\n%2").arg(filename).arg(e.what());
             QMessageBox::critical(this, "OASIS Load Error", errorDetails);
             return false;
         }
+        qDebug() << "Read" << filename << "in" << read_timer.elapsed() << "ms"
+                 << (reader.stats().memory_mapped ? "(memory-mapped)" : "(buffered)")
+                 << reader.stats().segments << "segments decoded in parallel";
 
-        // Free existing library
+        // Free the existing library and take over the new one; temp_lib's arrays now belong to m_gdstk_lib
         m_gdstk_lib.free_all();
-
-        // Manually copy library properties to avoid potential string copy issues
-        m_gdstk_lib.copy_from(temp_lib, true); // true for deep_copy
-        temp_lib.free_all(); // Fully free temp_lib after its data has been copied or is no longer needed
+        m_gdstk_lib = temp_lib;
         qDebug() << "OASIS file loaded successfully";
 
         m_polygons_to_draw.clear();
         m_layers.clear();
         
-        // Find bounding box to center the view
-        double min_x = std::numeric_limits<double>::max();
-        double min_y = std::numeric_limits<double>::max();
-        double max_x = std::numeric_limits<double>::lowest();
-        double max_y = std::numeric_limits<double>::lowest();
-
-        for (size_t i = 0; i < m_gdstk_lib.cell_array.count; ++i) {
-            const gdstk::Cell* cell = m_gdstk_lib.cell_array[i];
-            if (!cell) { // ADDED NULL CHECK FOR CELL
-                qWarning() << "Warning: Encountered null cell at index" << i << "in library" << (m_gdstk_lib.name ? m_gdstk_lib.name : "Unnamed Library");
-                continue; 
-            }
-
-            for (size_t j = 0; j < cell->polygon_array.count; ++j) {
-                gdstk::Polygon* poly = cell->polygon_array[j];
-                if (!poly) { // ADDED NULL CHECK FOR POLYGON
-                    qWarning() << "Warning: Encountered null polygon in cell" << (cell->name ? cell->name : "Unnamed Cell") << "at polygon index" << j;
-                    continue;
-                }
-                // Store polygons for drawing
-                m_polygons_to_draw.push_back(poly);
-                qDebug() << "Added polygon with" << poly->point_array.count << "points";
-
-                // Update bounding box
-                for (size_t k = 0; k < poly->point_array.count; ++k) {
-                    min_x = std::min(min_x, poly->point_array[k].x);
-                    min_y = std::min(min_y, poly->point_array[k].y);
-                    max_x = std::max(max_x, poly->point_array[k].x);
-                    max_y = std::max(max_y, poly->point_array[k].y);
+        {
+            TraceScope trace("viewer_collect_polygons");
+            for (size_t i = 0; i < m_gdstk_lib.cell_array.count; ++i) {
+                const gdstk::Cell* cell = m_gdstk_lib.cell_array[i];
+                if (!cell) { // ADDED NULL CHECK FOR CELL
+                    qWarning() << "Warning: Encountered null cell at index" << i << "in library" << (m_gdstk_lib.name ? m_gdstk_lib.name : "Unnamed Library");
+                    continue; 
                 }
 
-                // Collect layers
-                m_layers[gdstk::get_layer(poly->tag)].push_back(poly);
+                for (size_t j = 0; j < cell->polygon_array.count; ++j) {
+                    gdstk::Polygon* poly = cell->polygon_array[j];
+                    if (!poly) { // ADDED NULL CHECK FOR POLYGON
+                        qWarning() << "Warning: Encountered null polygon in cell" << (cell->name ? cell->name : "Unnamed Cell") << "at polygon index" << j;
+                        continue;
+                    }
+                    // Store polygons for drawing
+                    m_polygons_to_draw.push_back(poly);
+                    qDebug() << "Added polygon with" << poly->point_array.count << "points";
+
+                    // Collect layers
+                    m_layers[gdstk::get_layer(poly->tag)].push_back(poly);
+                }
             }
         }
         qDebug() << "Finished processing polygons loop.";
@@ -417,6 +478,11 @@ bool LayoutWidget::loadOasisFile(const QString& filename) {
     }
 }
 
+// Chooses between memory-mapped and buffered reads for the next loadOasisFile()
+void LayoutWidget::setMemoryMappedInput(bool enabled) {
+    m_memory_mapped_input = enabled;
+}
+
 // Resets the view to its default zoom and pan state, or fits to loaded polygons
 void LayoutWidget::resetView() {
     // Reset zoom and pan to default state
@@ -444,21 +510,7 @@ void LayoutWidget::zoomToFit() {
         return;
     }
 
-    double min_x = std::numeric_limits<double>::max();
-    double max_x = std::numeric_limits<double>::lowest();
-    double min_y = std::numeric_limits<double>::max();
-    double max_y = std::numeric_limits<double>::lowest();
-
-    for (const auto& poly : m_polygons_to_draw) {
-        for (size_t i = 0; i < poly->point_array.count; ++i) {
-            min_x = std::min(min_x, poly->point_array[i].x);
-            max_x = std::max(max_x, poly->point_array[i].x);
-            min_y = std::min(min_y, poly->point_array[i].y);
-            max_y = std::max(max_y, poly->point_array[i].y);
-        }
-    }
-
-    QRectF bounding_box(QPointF(min_x, min_y), QPointF(max_x, max_y));
+    QRectF bounding_box = polygonsBoundingBox(m_polygons_to_draw);
     QRectF widget_rect(0, 0, width(), height());
     qDebug().noquote() << QString("[zoomToFit] BoundingBox: (%1,%2)-(%3,%4) W:%5 H:%6")
                             .arg(bounding_box.left()).arg(bounding_box.top())
@@ -496,21 +548,7 @@ void LayoutWidget::zoomToSelection() {
     }
 
     // Compute bounding box of selected polygons
-    double min_x = std::numeric_limits<double>::max();
-    double max_x = std::numeric_limits<double>::lowest();
-    double min_y = std::numeric_limits<double>::max();
-    double max_y = std::numeric_limits<double>::lowest();
-
-    for (const auto& poly : m_selected_polygons) {
-        for (size_t i = 0; i < poly->point_array.count; ++i) {
-            min_x = std::min(min_x, poly->point_array[i].x);
-            max_x = std::max(max_x, poly->point_array[i].x);
-            min_y = std::min(min_y, poly->point_array[i].y);
-            max_y = std::max(max_y, poly->point_array[i].y);
-        }
-    }
-
-    QRectF bounding_box(QPointF(min_x, min_y), QPointF(max_x, max_y));
+    QRectF bounding_box = polygonsBoundingBox(m_selected_polygons);
 
     // Compute zoom to fit the selected polygons
     double zoom_width = width() / bounding_box.width();
@@ -710,6 +748,7 @@ QVector<int> LayoutWidget::getAvailableLayers() {
 // Stub implementations for missing Qt event handlers
 
 void LayoutWidget::paintEvent(QPaintEvent *event) {
+    TraceScope trace("viewer_paint");
     qDebug().noquote() << QString("[paintEvent] Called. Zoom: %1 Pan: (%2,%3) Widget: %4x%5 Polys: %6")
                             .arg(m_zoom_factor).arg(m_pan_offset.x()).arg(m_pan_offset.y())
                             .arg(width()).arg(height()).arg(m_polygons_to_draw.size());
@@ -871,6 +910,7 @@ void LayoutWidget::wheelEvent(QWheelEvent *event) {
 int main(int argc, char *argv[]) {
     qInstallMessageHandler(myMessageOutput); // Install before QApplication
     QApplication app(argc, argv);
+    if (Tracer::enabled()) Tracer::instance().setThreadName("gui"); // Loads and paints run on this thread
 
     QMainWindow mainWindow;
     LayoutWidget *layoutWidget = new LayoutWidget(&mainWindow);
@@ -901,6 +941,12 @@ int main(int argc, char *argv[]) {
     QAction *loadAction = new QAction("Load OASIS/GDS", &mainWindow);
     // TODO: Add icon: loadAction->setIcon(QIcon::fromTheme("document-open"));
     fileToolBar->addAction(loadAction);
+
+    QAction *mmapAction = new QAction("Memory-Mapped Reads", &mainWindow);
+    mmapAction->setCheckable(true);
+    mmapAction->setChecked(true);
+    fileToolBar->addAction(mmapAction);
+    QObject::connect(mmapAction, &QAction::toggled, layoutWidget, &LayoutWidget::setMemoryMappedInput);
     QObject::connect(loadAction, &QAction::triggered, [&mainWindow, layoutWidget]() { // Capture mainWindow for parent
         QString fileName = QFileDialog::getOpenFileName(&mainWindow, "Open Layout File", "", "OASIS Files (*.oas);;GDSII Files (*.gds);;All Files (*)");
         if (!fileName.isEmpty()) {
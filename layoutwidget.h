@@ -49,6 +49,8 @@ public:
 
     // Load an OASIS file into the viewer
     bool loadOasisFile(const QString& filename);
+    // Read files through a memory mapping (default) or a buffered window
+    void setMemoryMappedInput(bool enabled);
     // Reset the view to its default state (zoom, pan)
     void resetView();
     // Set the current interaction mode
@@ -127,6 +129,7 @@ private:
     std::map<int, std::vector<gdstk::Polygon*>> m_layers; // Map of layers and their polygons
     std::vector<gdstk::Polygon*> m_polygons_to_draw; // Vector of all polygons to draw
     QString m_current_file; // Path to the currently loaded file
+    bool m_memory_mapped_input = true; // Read OASIS files through a memory mapping
 
     // --- Grid ---
     bool m_show_grid = false;       // Flag indicating if the grid should be shown
@@ -0,0 +1,130 @@
+// Regression tests for the loaders and AND paths of dfm_pattern_capture.
+//
+// Every test writes a small OASIS layout, runs one loader or AND path on it and
+// checks the result. Failures are printed and the exit status is non-zero if
+// any check failed.
+
+#define DFM_CAPTURE_NO_MAIN
+#include "../dfm_pattern_capture.cpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const std::string& what) {
+    if (condition) return;
+    std::cerr << "FAILED: " << what << '\n';
+    ++failures;
+}
+
+void add_square(OasisWriter& writer, uint32_t layer, int64_t x, int64_t y, int64_t size) {
+    const OasisPoint square[] = {{x, y}, {x + size, y}, {x + size, y + size}, {x, y + size}};
+    writer.addPolygon(layer, 0, square, 4);
+}
+
+// TOP places cell SQUARES, which holds two squares on layer 1, twice
+void write_hierarchy_layout(const std::string& filename) {
+    OasisWriter writer(filename, 1e-9);
+    writer.beginCell("SQUARES");
+    add_square(writer, 1, 0, 0, 1000);
+    add_square(writer, 1, 2000, 0, 1000);
+    writer.beginCell("TOP");
+    writer.addPlacement("SQUARES", 0, 0);
+    writer.addPlacement("SQUARES", 0, 5000);
+    writer.close();
+}
+
+// Mask and input on the same layer of one file: both slots get every polygon
+void test_hierarchy_same_layer(const std::string& dir) {
+    const std::string filename = dir + "/dfm_capture_tests_hierarchy.oas";
+    write_hierarchy_layout(filename);
+    const std::pair<uint32_t, uint32_t> tag(1, 0);
+    LayoutHierarchy hierarchy = load_hierarchy_from_oasis(filename, {tag, tag});
+    const layer_type input = hierarchy.flatten(0);
+    const layer_type mask = hierarchy.flatten(1);
+    check(input.size() == 4, "hierarchy same layer: input slot has 4 polygons, got " + std::to_string(input.size()));
+    check(mask.size() == 4, "hierarchy same layer: mask slot has 4 polygons, got " + std::to_string(mask.size()));
+    std::remove(filename.c_str());
+}
+
+double total_area(const layer_type& layer) {
+    double area = 0.0;
+    for (const auto& poly : layer) area += bg::area(poly);
+    return area;
+}
+
+// Overlapping squares on layer 1, several of them across tile borders
+void write_flat_layout(const std::string& filename) {
+    OasisWriter writer(filename, 1e-9);
+    writer.beginCell("TOP");
+    for (int64_t k = 0; k < 8; ++k) {
+        add_square(writer, 1, k * 700, 0, 1000);
+        add_square(writer, 1, k * 900, 1500, 600);
+    }
+    writer.close();
+}
+
+// Mask and input on the same layer of one file: the out-of-core AND buckets
+// both and gives the same result as the in-memory AND
+void test_out_of_core_same_layer(const std::string& dir) {
+    const std::string filename = dir + "/dfm_capture_tests_flat.oas";
+    const std::string output = dir + "/dfm_capture_tests_flat_and.oas";
+    write_flat_layout(filename);
+    const layer_type layer = load_layer_from_oasis(filename, 1);
+    const double expected = total_area(layer_and(layer, layer));
+
+    TileOptions options;
+    options.tile_size = 1500;
+    options.memory_limit = 1 << 20;
+    options.spill_dir = dir;
+    OutOfCoreStats stats;
+    layer_and_out_of_core(LayerRequest{filename, 1, 0}, LayerRequest{filename, 1, 0}, output, 9, 0, options, OasisWriterOptions(), nullptr, &stats);
+    check(stats.mask_polygons == layer.size(), "out-of-core same layer: mask has " + std::to_string(layer.size()) + " polygons, got " +
+                                                   std::to_string(stats.mask_polygons));
+    check(stats.input_polygons == layer.size(), "out-of-core same layer: input has " + std::to_string(layer.size()) + " polygons, got " +
+                                                    std::to_string(stats.input_polygons));
+    const double area = total_area(load_layer_from_oasis(output, 9));
+    check(std::abs(area - expected) < 1e-6 * expected, "out-of-core same layer: result area " + std::to_string(area) + ", expected " +
+                                                           std::to_string(expected));
+    std::remove(filename.c_str());
+    std::remove(output.c_str());
+}
+
+// A 1 nm database unit is written as the whole number 1000 (real type 0), not as
+// the IEEE double 999.9999999999999 that 1e-6 / 1e-9 evaluates to
+void test_writer_start_unit(const std::string& dir) {
+    const std::string filename = dir + "/dfm_capture_tests_unit.oas";
+    write_flat_layout(filename);
+    std::ifstream file(filename, std::ios::binary);
+    std::string header(21, '\0');
+    file.read(&header[0], header.size());
+    // Magic (13 bytes), START record id, version string "1.0", then the unit
+    check(file && header.compare(18, 3, std::string("\x00\xe8\x07", 3)) == 0, "writer start unit: 1 nm is written as integer 1000");
+    std::remove(filename.c_str());
+}
+
+} // namespace
+
+int main() {
+    const char* tmpdir = std::getenv("TMPDIR");
+    const std::string dir = tmpdir && *tmpdir ? tmpdir : "/tmp";
+
+    try {
+        test_hierarchy_same_layer(dir);
+        test_out_of_core_same_layer(dir);
+        test_writer_start_unit(dir);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+
+    if (failures > 0) {
+        std::cerr << failures << " checks failed" << '\n';
+        return 1;
+    }
+    std::cout << "All checks passed" << '\n';
+    return 0;
+}
@@ -0,0 +1,17 @@
+# Regression tests for the loaders and AND paths of dfm_pattern_capture.
+# Build and run from the repository root:
+#   qmake -o tests/Makefile tests/dfm_capture_tests.pro && make -C tests
+#   ./tests/dfm_capture_tests
+
+TEMPLATE = app
+TARGET = dfm_capture_tests
+CONFIG += console c++14 release
+CONFIG -= qt app_bundle
+
+INCLUDEPATH += .. \
+               /usr/include # For zlib and Boost if system-installed
+
+SOURCES += dfm_capture_tests.cpp
+
+LIBS += -lz -pthread
+QMAKE_CXXFLAGS += -pthread